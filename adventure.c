@@ -46,10 +46,17 @@
 #include <time.h>
 
 #include "assert.h"
+#include "capture.h"
+#include "copy.h"
 #include "input.h"
 #include "modex.h"
 #include "photo.h"
+#include "quant.h"
+#include "replay.h"
+#include "stats.h"
+#include "store.h"
 #include "text.h"
+#include "trace.h"
 #include "world.h"
  
 /*
@@ -66,6 +73,22 @@ static int sanity_check (void);
 #define TICK_USEC      50000 /* tick length in microseconds          */
 #define STATUS_MSG_LEN 40    /* maximum length of status message     */
 #define MOTION_SPEED   2     /* pixels moved per command             */
+#define PRERENDER_LINES 8    /* lines pre-rendered per idle step     */
+
+/* timeline trace output file (only written when built with "make TRACE=1") */
+#define TRACE_FILE     "adventure-trace.json"
+
+/*
+ * Acquire a mutex, recording the time spent waiting for it as a span in
+ * the timeline trace (see trace.h).  Without tracing, this is simply
+ * pthread_mutex_lock.
+ */
+#define TRACED_LOCK(m, name)                                           \
+do {                                                                   \
+    TRACE_BEGIN (name);                                                \
+    (void)pthread_mutex_lock (m);                                      \
+    TRACE_END (name);                                                  \
+} while (0)
 
 /* outcome of the game */
 
@@ -75,6 +98,7 @@ typedef enum {GAME_WON, GAME_QUIT} game_condition_t;
 
 typedef struct {
 
+    session_t*   sess;       /* rooms, objects, and player's flags    */
     room_t*      where;      /* current room for player               */
     unsigned int map_x, map_y;   /* current upper left display pixel      */
     int          x_speed;        /* number of pixels of x motion per move */
@@ -138,6 +162,8 @@ static const typed_cmd_t cmd_list[] = {
 /* local functions--see function headers for details */
 
 static void cancel_status_thread (void* ignore);
+static void cleanup_input (void* ignore);
+static int32_t do_command (cmd_t cmd);
 static game_condition_t game_loop (void);
 static int32_t handle_typing (void);
 static void init_game (void);
@@ -145,19 +171,32 @@ static void move_photo_down (void);
 static void move_photo_left (void);
 static void move_photo_right (void);
 static void move_photo_up (void);
+static void plan_prerender (void);
+static int32_t prerender_step (int32_t n_lines);
 static void redraw_room (void);
 static void* status_thread (void* ignore);
 static int time_is_after (struct timeval* t1, struct timeval* t2);
+static int32_t use_prerendered (void);
 static void cancel_tux_thread (void* ignore);
 static void* tux_thread (void* ignore);
 extern cmd_t get_tux_command();
 
 static cmd_t cmd, tux_command;
+static uint32_t tux_tick;       /* tick at which tux_command was read */
 
 /* file-scope variables */
 
 static game_info_t game_info; /* game information */
 
+/*
+ * When replaying is set, commands come from a replay script (see replay.c)
+ * instead of the keyboard and Tux controller, the game loop does not wait
+ * for ticks, and drawing goes to a headless (memory) display.  The ticks
+ * variable counts passes through the game loop; scripts are timed by it.
+ */
+static int32_t replaying = 0;
+static uint32_t ticks = 0;
+
 /*
  * The variables below are used to keep track of the status message helper
  * thread, with Posix thread id recorded in status_thread_id.  
@@ -184,6 +223,25 @@ static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  cv = PTHREAD_COND_INITIALIZER;
 static int32_t enter_room;      /* player has changed rooms        */
 
+/*
+ * Rooms drawn ahead of time into the spare build buffers (see modex.h),
+ * one for each exit from the current room, so that walking through an
+ * exit needs no drawing.  The game loop draws a few lines at a time
+ * while waiting for a tick (and once per tick in a replay).  Each entry
+ * records the room's version (see room_version) when drawing started;
+ * if the room changes, drawing starts over, and a room is used on entry
+ * only if it is complete and still at that version.  Only the game loop
+ * thread uses these, while holding lock.
+ */
+typedef struct prerender_t prerender_t;
+struct prerender_t {
+    const room_t* room;     /* room drawn in spare buffer, or NULL */
+    uint32_t      version;  /* room's version when drawing started */
+    int32_t       lines;    /* lines drawn so far                  */
+};
+static prerender_t prerender[NUM_EXITS];
+static int32_t prerender_done;  /* nothing left to pre-render      */
+
 
 /*
  * cancel_status_thread
@@ -220,6 +278,75 @@ cancel_tux_thread (void* ignore) {
 }
 
 
+/*
+ * cleanup_input
+ *   DESCRIPTION: Shuts down the input device if it was started (it is
+ *                not used when replaying a script).  Used as a cleanup
+ *                method to ensure proper shutdown.
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: restores original terminal settings
+ */
+
+static void
+cleanup_input (void* ignore) {
+
+    if (!replaying) {
+        shutdown_input ();
+    }
+
+}
+
+
+/*
+ * do_command
+ *   DESCRIPTION: Carry out one command from the player.
+ *   INPUTS: cmd -- the command
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the player quits, 0 otherwise
+ *   SIDE EFFECTS: may move the view window, change rooms, and so forth;
+ *                 caller must hold lock
+ */
+
+static int32_t
+do_command (cmd_t cmd) {
+
+    uint64_t start; /* cycle count before typing (for stats.c) */
+
+    switch (cmd) {
+        case CMD_UP:    move_photo_down ();  break;
+        case CMD_RIGHT: move_photo_left ();  break;
+        case CMD_DOWN:  move_photo_up ();    break;
+        case CMD_LEFT:  move_photo_right (); break;
+        case CMD_MOVE_LEFT:  
+        enter_room = (TC_CHANGE_ROOM ==
+                  try_to_move_left (game_info.sess, &game_info.where));
+        break;
+        case CMD_ENTER:
+        enter_room = (TC_CHANGE_ROOM ==
+                  try_to_enter (game_info.sess, &game_info.where));
+        break;
+        case CMD_MOVE_RIGHT:
+        enter_room = (TC_CHANGE_ROOM ==
+                  try_to_move_right (game_info.sess, &game_info.where));
+        break;
+        case CMD_TYPED:
+        start = stat_cycles ();
+        if (handle_typing ()) {
+
+            enter_room = 1;
+
+        }
+        stat_add (STAT_TYPING, stat_cycles () - start);
+        break;
+        case CMD_QUIT: return 1;
+        default: break;
+    }
+    return 0;
+}
+
+
 /*
  * game_loop
  *   DESCRIPTION: Main event loop for the adventure game.
@@ -239,6 +366,9 @@ static game_condition_t game_loop () {
     struct timeval start_time, tick_time;
 
     struct timeval cur_time; /* current time (during tick)      */              /* command issued by input control */
+    cmd_t pushed;            /* command read from the Tux       */
+    int32_t missed;          /* ticks skipped to catch up       */
+    uint64_t start;          /* cycle count at room entry       */
 
     /* Record the starting time--assume success. */
 
@@ -254,6 +384,12 @@ static game_condition_t game_loop () {
     }
 
 
+    /* Let the Tux controller keep the elapsed time on its own display. */
+
+    if (!replaying) {
+        start_clock_on_tux (0);
+    }
+
     /* The player has just entered the first room. */
 
     enter_room = 1;
@@ -282,21 +418,52 @@ static game_condition_t game_loop () {
 
         /* Adjust colors and photo drawing for the current room photo. */
 
+        start = stat_cycles ();
+        TRACE_BEGIN ("prep_room");
         prep_room (game_info.where);
+        TRACE_END ("prep_room");
+
+        /* 
+         * Swap in the room if it was drawn ahead of time; otherwise
+         * draw the room.
+         */
+        TRACED_LOCK (&lock, "wait lock");
+        if (use_prerendered ()) {
+            stat_room_entry (1);
+        } else {
+            TRACE_BEGIN ("redraw_room");
+            redraw_room ();
+            TRACE_END ("redraw_room");
+            stat_room_entry (0);
+        }
+
+        /* Start drawing the rooms next to this one. */
+        plan_prerender ();
+        (void)pthread_mutex_unlock (&lock);
+        stat_add (STAT_ENTER_ROOM, stat_cycles () - start);
 
-        /* Draw the room (calls show. */
-        redraw_room ();
         /* Only draw once on entry. */
 
         enter_room = 0;
 
     }
 
+    /*
+     * The Tux thread draws into the build buffer while holding lock, so
+     * hold it while copying to the screen as well (with hardware scrolling,
+     * show_screen also consumes the list of lines drawn).
+     */
+    TRACED_LOCK (&lock, "wait lock");
+    TRACE_BEGIN ("show_screen");
     show_screen ();
+    TRACE_END ("show_screen");
+    (void)pthread_mutex_unlock (&lock);
+
+    TRACE_BEGIN ("status bar");
 
     // put a lock on status message before reading it
 
-    (void)pthread_mutex_lock (&msg_lock);
+    TRACED_LOCK (&msg_lock, "wait msg_lock");
 
  
 
@@ -316,7 +483,7 @@ static game_condition_t game_loop () {
 
         // put a lock on buffer and then show the room as well as the input
 
-        (void)pthread_mutex_lock (&buf_lock);
+        TRACED_LOCK (&buf_lock, "wait buf_lock");
 
         show_status_bar((char *) room_name(game_info.where), (char *) get_typed_command(), "\0");
 
@@ -324,14 +491,76 @@ static game_condition_t game_loop () {
 
     }
 
+    TRACE_END ("status bar");
+
  
 
+    /*
+     * A replay runs as fast as possible: no waiting for ticks, and no
+     * Tux controller.  Commands due at this tick come from the script,
+     * all of them in order (a recording may log both a Tux command and
+     * a keyboard command in one tick).
+     */
+
+    if (replaying) {
+
+        ticks++;
+        stats_tick (0);
+
+        /* Stand in for the idle time of a real tick. */
+        TRACED_LOCK (&lock, "wait lock");
+        TRACE_BEGIN ("prerender");
+        (void)prerender_step (PRERENDER_LINES);
+        TRACE_END ("prerender");
+        (void)pthread_mutex_unlock (&lock);
+
+        TRACE_BEGIN ("input");
+        cmd = replay_command (ticks);
+        TRACE_END ("input");
+
+        if (CMD_NONE == cmd && replay_done ()) {
+            return GAME_QUIT;
+        }
+
+        TRACED_LOCK (&lock, "wait lock");
+
+        TRACE_BEGIN ("command");
+        do {
+            if (do_command (cmd)) {
+                TRACE_END ("command");
+                pthread_mutex_unlock(&lock);
+                return GAME_QUIT;
+            }
+        } while (NULL != game_info.where && CMD_NONE != cmd &&
+                 CMD_NONE != (cmd = replay_command (ticks)));
+        TRACE_END ("command");
+
+        pthread_mutex_unlock(&lock);
+
+        if (NULL == game_info.where) {
+            return GAME_WON;
+        }
+
+        continue;
+    }
+
     /*
      * Wait for tick.  The tick defines the basic timing of our
      * event loop, and is the minimum amount of time between events.
+     * Spend the time drawing neighboring rooms, if any are not yet
+     * drawn (the last tick's commands may have changed them).
      */
 
+    TRACE_BEGIN ("wait for tick");
+    prerender_done = 0;
     do {
+        if (!prerender_done) {
+            TRACED_LOCK (&lock, "wait lock");
+            TRACE_BEGIN ("prerender");
+            prerender_done = !prerender_step (PRERENDER_LINES);
+            TRACE_END ("prerender");
+            (void)pthread_mutex_unlock (&lock);
+        }
 
         if (gettimeofday (&cur_time, NULL) != 0) {
 
@@ -342,6 +571,7 @@ static game_condition_t game_loop () {
         exit (3);
         }
     } while (!time_is_after (&cur_time, &tick_time));
+    TRACE_END ("wait for tick");
 
  
 
@@ -352,7 +582,9 @@ static game_condition_t game_loop () {
      * that we haven't missed.
      */
 
+    missed = -1;
     do {
+        missed++;
         if ((tick_time.tv_usec += TICK_USEC) > 1000000) {
         tick_time.tv_sec++;
         tick_time.tv_usec -= 1000000;
@@ -376,46 +608,38 @@ static game_condition_t game_loop () {
      * to be redrawn.
      */
 
-    tux_command = get_tux_command();
+    ticks++;
+    stats_tick (missed);
+
+    TRACE_BEGIN ("input");
+    pushed = get_tux_command();
+    TRACE_END ("input");
 
-    pthread_mutex_lock(&lock);
+    TRACED_LOCK (&lock, "wait lock");
 
-    if(tux_command != CMD_NONE){
+    if(pushed != CMD_NONE){
+        tux_command = pushed;
+        tux_tick = ticks;
         pthread_cond_signal(&cv);
     }
 
     pthread_mutex_unlock(&lock);
+    TRACE_BEGIN ("input");
     cmd = get_command ();
+    TRACE_END ("input");
 
-    pthread_mutex_lock(&lock);
-
-    switch (cmd) {
-        case CMD_UP:    move_photo_down ();  break;
-        case CMD_RIGHT: move_photo_left ();  break;
-        case CMD_DOWN:  move_photo_up ();    break;
-        case CMD_LEFT:  move_photo_right (); break;
-        case CMD_MOVE_LEFT:  
-        enter_room = (TC_CHANGE_ROOM ==
-                  try_to_move_left (&game_info.where));
-        break;
-        case CMD_ENTER:
-        enter_room = (TC_CHANGE_ROOM ==
-                  try_to_enter (&game_info.where));
-        break;
-        case CMD_MOVE_RIGHT:
-        enter_room = (TC_CHANGE_ROOM ==
-                  try_to_move_right (&game_info.where));
-        break;
-        case CMD_TYPED:
-        if (handle_typing ()) {
+    TRACED_LOCK (&lock, "wait lock");
 
-            enter_room = 1;
+    /* Recorded under the lock, so the script keeps the order of play. */
+    record_command (ticks, cmd, get_typed_command ());
 
-        }
-        break;
-        case CMD_QUIT: return GAME_QUIT;
-        default: break;
+    TRACE_BEGIN ("command");
+    if (do_command (cmd)) {
+        TRACE_END ("command");
+        pthread_mutex_unlock(&lock);
+        return GAME_QUIT;
     }
+    TRACE_END ("command");
     pthread_mutex_unlock(&lock);
     /* If player wins the game, their room becomes NULL. */
     if (NULL == game_info.where) {
@@ -491,39 +715,39 @@ handle_typing ()
 
         case TC_BUY:
 
-            result = typed_cmd_buy (&game_info.where, arg);
+            result = typed_cmd_buy (game_info.sess, &game_info.where, arg);
 
         break;
 
         case TC_CHARGE:
 
-            result = typed_cmd_charge (&game_info.where, arg);
+            result = typed_cmd_charge (game_info.sess, &game_info.where, arg);
 
         break;
 
         case TC_DO:
 
-            result = typed_cmd_do (&game_info.where, arg);
+            result = typed_cmd_do (game_info.sess, &game_info.where, arg);
 
         break;
 
         case TC_DRINK:
 
-            result = typed_cmd_drink (&game_info.where, arg);
+            result = typed_cmd_drink (game_info.sess, &game_info.where, arg);
 
         break;
 
         case TC_DROP:
 
-            result = typed_cmd_drop (&game_info.where, arg);
+            result = typed_cmd_drop (game_info.sess, &game_info.where, arg);
 
-        if (!player_has_board ()) {
+        if (!player_has_board (game_info.sess)) {
 
             game_info.x_speed = MOTION_SPEED;
 
         }
 
-        if (!player_has_jetpack ()) {
+        if (!player_has_jetpack (game_info.sess)) {
 
             game_info.y_speed = MOTION_SPEED;
 
@@ -533,27 +757,27 @@ handle_typing ()
 
         case TC_FIX:
 
-            result = typed_cmd_fix (&game_info.where, arg);
+            result = typed_cmd_fix (game_info.sess, &game_info.where, arg);
 
         break;
 
         case TC_FLASH:
 
-            result = typed_cmd_flash (&game_info.where, arg);
+            result = typed_cmd_flash (game_info.sess, &game_info.where, arg);
 
         break;
 
         case TC_GET:
 
-            result = typed_cmd_get (&game_info.where, arg);
+            result = typed_cmd_get (game_info.sess, &game_info.where, arg);
 
-        if (player_has_board ()) {
+        if (player_has_board (game_info.sess)) {
 
             game_info.x_speed = MOTION_SPEED * 3;
 
         }
 
-        if (player_has_jetpack ()) {
+        if (player_has_jetpack (game_info.sess)) {
 
             game_info.y_speed = MOTION_SPEED * 3;
 
@@ -562,32 +786,32 @@ handle_typing ()
         break;
 
         case TC_GO:
-            result = typed_cmd_go (&game_info.where, arg);
+            result = typed_cmd_go (game_info.sess, &game_info.where, arg);
 
         break;
 
         case TC_INSTALL:
-            result = typed_cmd_install (&game_info.where, arg);
+            result = typed_cmd_install (game_info.sess, &game_info.where, arg);
 
         break;
 
         case TC_INVENTORY:
-            result = typed_cmd_inventory (&game_info.where, arg);
+            result = typed_cmd_inventory (game_info.sess, &game_info.where, arg);
 
         break;
 
         case TC_SIGH:
-            result = typed_cmd_sigh (&game_info.where, arg);
+            result = typed_cmd_sigh (game_info.sess, &game_info.where, arg);
 
         break;
 
         case TC_USE:
-            result = typed_cmd_use (&game_info.where, arg);
+            result = typed_cmd_use (game_info.sess, &game_info.where, arg);
 
         break;
 
         case TC_WEAR:
-            result = typed_cmd_wear (&game_info.where, arg);
+            result = typed_cmd_wear (game_info.sess, &game_info.where, arg);
         break;
 
         default:
@@ -629,7 +853,7 @@ static void
 init_game ()
 
 {
-    game_info.where = start_in_room ();
+    game_info.where = start_in_room (game_info.sess);
     game_info.map_x = 0;
     game_info.map_y = 0;
     game_info.x_speed = MOTION_SPEED;
@@ -653,7 +877,6 @@ move_photo_down ()
 
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over rows to redraw.         */
 
     /* Calculate the number of pixels by which to move. */
 
@@ -662,9 +885,7 @@ move_photo_down ()
     game_info.map_y -= delta;
     set_view_window (game_info.map_x, game_info.map_y);
     /* Draw the newly exposed lines. */
-    for (idx = 0; delta > idx; idx++) {
-    (void)draw_horiz_line (idx);
-    }
+    (void)draw_horiz_lines (0, delta);
 }
 
 /*
@@ -685,7 +906,6 @@ move_photo_left ()
 {
     int32_t delta; /* Number of pixels by which to move. */
 
-    int32_t idx;   /* Index over columns to redraw.      */
     /* Calculate the number of pixels by which to move. */
     delta = room_photo_width (game_info.where) - SCROLL_X_DIM -game_info.map_x;
     delta = (game_info.x_speed > delta ? delta : game_info.x_speed);
@@ -694,9 +914,7 @@ move_photo_left ()
     game_info.map_x += delta;
     set_view_window (game_info.map_x, game_info.map_y);
     /* Draw the newly exposed lines. */
-    for (idx = 1; delta >= idx; idx++) {
-    (void)draw_vert_line (SCROLL_X_DIM - idx);
-    }
+    (void)draw_vert_lines (SCROLL_X_DIM - delta, delta);
 }
 
 
@@ -718,7 +936,6 @@ move_photo_right ()
 {
     int32_t delta; /* Number of pixels by which to move. */
 
-    int32_t idx;   /* Index over columns to redraw.      */
 
     /* Calculate the number of pixels by which to move. */
 
@@ -732,11 +949,7 @@ move_photo_right ()
 
     /* Draw the newly exposed lines. */
 
-    for (idx = 0; delta > idx; idx++) {
-
-    (void)draw_vert_line (idx);
-
-    }
+    (void)draw_vert_lines (0, delta);
 }
 
 
@@ -755,7 +968,6 @@ move_photo_up ()
 
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over rows to redraw.         */
 
     /* Calculate the number of pixels by which to move. */
 
@@ -771,15 +983,79 @@ move_photo_up ()
 
     /* Draw the newly exposed lines. */
 
-    for (idx = 1; delta >= idx; idx++) {
+    (void)draw_horiz_lines (SCROLL_Y_DIM - delta, delta);
 
-    (void)draw_horiz_line (SCROLL_Y_DIM - idx);
+}
+
+ 
+
+/*
+ * plan_prerender
+ *   DESCRIPTION: Choose the rooms to draw ahead of time: those through
+ *                the exits of the player's room (each drawn once).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: discards earlier pre-rendering; caller must hold lock
+ */
 
+static void
+plan_prerender ()
+{
+    int32_t k;    /* index over exits          */
+    int32_t j;    /* index over earlier exits  */
+    room_t* next; /* room through exit k       */
+
+    for (k = 0; NUM_EXITS > k; k++) {
+        next = room_exit (game_info.where, k);
+        for (j = 0; k > j && prerender[j].room != next; j++);
+        prerender[k].room = (game_info.where == next || k > j ? NULL : next);
+        prerender[k].lines = 0;
     }
+    prerender_done = 0;
+}
+
 
+/*
+ * prerender_step
+ *   DESCRIPTION: Draw a few more lines of the rooms chosen by
+ *                plan_prerender into the spare build buffers, starting
+ *                a room over if it has changed.
+ *   INPUTS: n_lines -- most lines to draw
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if any work was done, 0 if every room was already
+ *                 drawn and unchanged
+ *   SIDE EFFECTS: draws into the spare build buffers; caller must hold lock
+ */
+
+static int32_t
+prerender_step (int32_t n_lines)
+{
+    unsigned char buf[SCROLL_X_DIM]; /* image of one line          */
+    prerender_t*  p;                 /* room being drawn           */
+    int32_t       k;                 /* index over spare buffers   */
+    int32_t       worked = 0;        /* any lines drawn?           */
+
+    for (k = 0; NUM_EXITS > k && 0 < n_lines; k++) {
+        p = &prerender[k];
+        if (NULL == p->room) {
+            continue;
+        }
+        if (0 == p->lines || p->version != room_version (p->room)) {
+            p->version = room_version (p->room);
+            p->lines = 0;
+        } else if (SCROLL_Y_DIM == p->lines) {
+            continue;
+        }
+        for (; SCROLL_Y_DIM > p->lines && 0 < n_lines; p->lines++, n_lines--) {
+            fill_horiz_buffer (p->room, 0, p->lines, buf);
+            (void)draw_spare_line (k, p->lines, buf);
+        }
+        worked = 1;
+    }
+    return worked;
 }
 
- 
 
 /*
  * redraw_room
@@ -793,16 +1069,8 @@ move_photo_up ()
 static void
 redraw_room ()
 {
-    int32_t i; /* index over rows */
-
-
     /* Draw all lines in the scroll region. */
-
-    for (i = 0; i < SCROLL_Y_DIM; i++) {
-
-    (void)draw_horiz_line (i);
-
-    }
+    (void)draw_horiz_lines (0, SCROLL_Y_DIM);
 
 }
 
@@ -827,6 +1095,8 @@ status_thread (void* ignore)
 {
     struct timespec ts; /* absolute wake-up time */
 
+    TRACE_THREAD ("status_thread");
+
     while (1) {
 
     /*
@@ -835,7 +1105,7 @@ status_thread (void* ignore)
      * yields the lock, then reacquires the lock before returning.
      */
 
-    (void)pthread_mutex_lock (&msg_lock);
+    TRACED_LOCK (&msg_lock, "wait msg_lock");
     while ('\0' == status_msg[0]) {
         pthread_cond_wait (&msg_cv, &msg_lock);
     }
@@ -902,6 +1172,34 @@ time_is_after (struct timeval* t1, struct timeval* t2)
 }
 
  
+/*
+ * use_prerendered
+ *   DESCRIPTION: If the player's room was drawn ahead of time and has not
+ *                changed since, make its spare build buffer the build
+ *                buffer (with the view window at (0,0)).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the room was swapped in, 0 if it must be drawn
+ *   SIDE EFFECTS: may change the build buffer; caller must hold lock
+ */
+
+static int32_t
+use_prerendered ()
+{
+    int32_t k; /* index over spare buffers */
+
+    for (k = 0; NUM_EXITS > k; k++) {
+        if (game_info.where == prerender[k].room &&
+            SCROLL_Y_DIM == prerender[k].lines &&
+            room_version (game_info.where) == prerender[k].version) {
+            use_spare_build (k);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
 /*
  * show_status (interface function; declared in world.h)
  *   DESCRIPTION: Show a specific status message of up to STATUS_MSG_LEN
@@ -916,7 +1214,7 @@ show_status (const char* s)
 {
     /* msg_lock critical section starts here. */
 
-    (void)pthread_mutex_lock (&msg_lock);
+    TRACED_LOCK (&msg_lock, "wait msg_lock");
 
     /* Copy the new message under the protection of msg_lock. */
 
@@ -936,28 +1234,129 @@ show_status (const char* s)
 /*
  * main
  *   DESCRIPTION: Play the adventure game.
- *   INPUTS: none (command line arguments are ignored)
+ *   INPUTS: argc, argv -- "--replay <script>" plays the commands in a
+ *                         script as fast as possible without a display;
+ *                         "--record <script>" saves this session's
+ *                         commands in the same format; "--hwscroll"
+ *                         scrolls with the VGA start address instead of
+ *                         copying whole screens; "--latchcopy" copies
+ *                         the unchanged part of each screen within video
+ *                         memory; "--triple" flips among three screens
+ *                         on vertical retrace; "--pack <file>" reads
+ *                         photos and images from an asset pack; 
+ *                         "--quant <name>" chooses room palettes with
+ *                         another quantizer (see quant.h)
  *   OUTPUTS: none
  *   RETURN VALUE: 0 on success, 3 in panic situations
  */
 int
 
-main ()
+main (int argc, char* argv[])
 
 {
     game_condition_t game;  /* outcome of playing */
-    /* Randomize for more fun (remove for deterministic layout). */
+    const world_t* world;           /* photos shared by sessions     */
+    const char* replay_file = NULL; /* script to replay, if any     */
+    const char* record_file = NULL; /* script to record, if any     */
+    int hw_scroll = 0;              /* scroll with the VGA CRTC?     */
+    int latch = 0;                  /* copy pages with VGA latches?  */
+    int triple = 0;                 /* flip three pages on retrace?  */
+    const char* store_name = NULL;  /* shared asset store, if any    */
+    const char* pack_name = NULL;   /* asset pack, if any            */
+    const char* capture_dest = NULL; /* frame recorder sink, if any  */
+    unsigned int seed;              /* random seed for object layout */
+    struct timeval start, end;      /* replay timing                 */
+    double secs;                    /* replay duration in seconds    */
+    int i;                          /* index over arguments          */
+
+    for (i = 1; i < argc; i++) {
+        if (0 == strcmp (argv[i], "--replay") && i + 1 < argc) {
+            replay_file = argv[++i];
+        } else if (0 == strcmp (argv[i], "--record") && i + 1 < argc) {
+            record_file = argv[++i];
+        } else if (0 == strcmp (argv[i], "--hwscroll")) {
+            hw_scroll = 1;
+        } else if (0 == strcmp (argv[i], "--latchcopy")) {
+            latch = 1;
+        } else if (0 == strcmp (argv[i], "--triple")) {
+            triple = 1;
+        } else if (0 == strcmp (argv[i], "--shared-assets")) {
+            store_name = STORE_NAME;
+        } else if (0 == strcmp (argv[i], "--pack") && i + 1 < argc) {
+            pack_name = argv[++i];
+        } else if (0 == strcmp (argv[i], "--capture") && i + 1 < argc) {
+            capture_dest = argv[++i];
+        } else if (0 == strcmp (argv[i], "--copy") && i + 1 < argc) {
+            if (0 != copy_force (argv[++i])) {
+                fprintf (stderr, "unknown or unsupported copy strategy "
+                         "\"%s\"\n", argv[i]);
+                return 3;
+            }
+        } else if (0 == strcmp (argv[i], "--quant") && i + 1 < argc) {
+            if (0 != quant_force (argv[++i])) {
+                fprintf (stderr, "unknown quantizer \"%s\"\n", argv[i]);
+                return 3;
+            }
+        } else {
+            fprintf (stderr, "usage: %s [--replay script] [--record script] "
+                     "[--hwscroll | --latchcopy] [--triple] "
+                     "[--shared-assets] [--pack file] "
+                     "[--capture file|unix:path] "
+                     "[--copy auto|movsb|memcpy|sse2|avx2] "
+                     "[--quant octree|levels|median|fixed]\n",
+                     argv[0]);
+            return 3;
+        }
+    }
+
+    /*
+     * Randomize for more fun.  A replay uses the seed saved with the
+     * script so that objects land where they did in the recorded game.
+     */
+
+    seed = time (NULL);
+    if (NULL != replay_file) {
+        if (0 != replay_open (replay_file, &seed)) {
+            return 3;
+        }
+        replaying = 1;
+    }
+    srand (seed);
+
+    if (NULL != record_file && 0 != record_open (record_file, seed)) {
+        return 3;
+    }
+
+    /* Stream what the player sees, if asked (see capture.h). */
 
-    srand (time (NULL));
+    if (NULL != capture_dest && 0 != capture_open (capture_dest)) {
+        return 3;
+    }
 
     /* Provide some protection against fatal errors. */
 
     clean_on_signals ();
 
-    if (!build_world ()) {PANIC ("can't build world");}
+    /* Dump hot-path counters on SIGUSR1 (and on exit; see below). */
+
+    stats_init ();
+
+    /* Write the timeline trace on exit (if built with tracing). */
+
+    TRACE_THREAD ("main");
+    TRACE_START (TRACE_FILE);
+
+    TRACE_BEGIN ("build_world");
+    if (NULL == (world = load_world (store_name, pack_name)) ||
+        NULL == (game_info.sess = build_world (world, show_status))) {
+        PANIC ("can't build world");
+    }
+    TRACE_END ("build_world");
 
     init_game ();
-	init_tux();
+    if (!replaying) {
+        init_tux();
+    }
 
     /* Perform sanity checks. */
     if (0 != sanity_check ()) {
@@ -965,6 +1364,10 @@ main ()
     PANIC ("failed sanity checks");
     }
 
+    /* Dump the counters last, after text mode has been restored. */
+
+    push_cleanup (stats_dump_cleanup, NULL); {
+
     if (0 != pthread_create (&tux_thread_id, NULL, tux_thread, NULL)) {
         PANIC ("failed to create tux thread");
     }
@@ -979,23 +1382,38 @@ main ()
 
     push_cleanup (cancel_status_thread, NULL); {
 
-    /* Start mode X. */
-    if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer)) {
+    /* Start mode X (in memory only for a replay). */
+    if (replaying) {
+        set_headless_display ();
+    }
+    if (hw_scroll) {
+        set_hardware_scrolling ();
+    } else if (latch) {
+        set_latch_copy ();
+    }
+    if (triple) {
+        set_triple_buffering ();
+    }
+    if (0 != set_mode_X (fill_shown_horiz_buffer, fill_shown_vert_buffer)) {
         PANIC ("cannot initialize mode X");
     }
+    set_strip_fill (fill_shown_horiz_strip, fill_shown_vert_strip);
     push_cleanup ((cleanup_fn_t)clear_mode_X, NULL); {
 
     /* Initialize the keyboard and/or Tux controller. */
-    if (0 != init_input ()) {
+    if (!replaying && 0 != init_input ()) {
 
     PANIC ("cannot initialize input");
     }
-    push_cleanup ((cleanup_fn_t)shutdown_input, NULL); {
+    push_cleanup (cleanup_input, NULL); {
+    (void)gettimeofday (&start, NULL);
     game = game_loop ();
+    (void)gettimeofday (&end, NULL);
     } pop_cleanup (1);
     } pop_cleanup (1);
     } pop_cleanup (1);
     } pop_cleanup(1);
+    } pop_cleanup (1);
 
     /* Print a message about the outcome. */
 
@@ -1006,6 +1424,17 @@ main ()
     case GAME_QUIT: printf ("Quitter!\n"); break;
 
     }
+
+    /* Report replay throughput for benchmarking. */
+
+    if (replaying) {
+        secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+        printf ("replayed %u ticks in %.3f s (%.1f ticks/s)\n", ticks, secs,
+                (secs > 0 ? ticks / secs : 0.0));
+        replay_close ();
+    }
+    record_close ();
+    capture_close ();
     /* Return success. */
 
     return 0;
@@ -1035,6 +1464,13 @@ sanity_check ()
 
     ret_val = 0;
 
+    /* Each exit from a room needs its own spare build buffer. */
+
+    if (NUM_EXITS > NUM_SPARE_BUILDS) {
+        fputs ("Too few spare build buffers for room exits.\n", stderr);
+        ret_val = -1;
+    }
+
     /* Check typed command list. */
 
     (void)memset (cnt, 0, sizeof (cnt));
@@ -1085,18 +1521,28 @@ sanity_check ()
 #endif /* !defined(NDEBUG) */
 void* tux_thread(void* ignore){
 
+    int32_t ran; /* 1 if tux_command was carried out */
+
+    TRACE_THREAD ("tux_thread");
+
     while (1) {
 
         /*
         * wait for buttons
         */
 
-        (void)pthread_mutex_lock (&lock);
+        TRACED_LOCK (&lock, "wait lock");
 
         while (tux_command == CMD_NONE) {
             pthread_cond_wait (&cv, &lock);
         }
 
+        /*
+         * Carry out each Tux command once, as a replay does, and record
+         * only the commands that ran (not START, for instance).
+         */
+        TRACE_BEGIN ("tux command");
+        ran = 1;
         switch (tux_command) {
 
             case CMD_UP:    move_photo_down ();  break;
@@ -1105,18 +1551,22 @@ void* tux_thread(void* ignore){
             case CMD_LEFT:  move_photo_right (); break;
             case CMD_MOVE_LEFT:  
 
-            enter_room = (TC_CHANGE_ROOM ==try_to_move_left (&game_info.where));
+            enter_room = (TC_CHANGE_ROOM ==try_to_move_left (game_info.sess, &game_info.where));
             break;
             case CMD_ENTER:
-            enter_room = (TC_CHANGE_ROOM ==try_to_enter (&game_info.where));
+            enter_room = (TC_CHANGE_ROOM ==try_to_enter (game_info.sess, &game_info.where));
             break;
             case CMD_MOVE_RIGHT:
-                enter_room = (TC_CHANGE_ROOM ==try_to_move_right (&game_info.where));
+                enter_room = (TC_CHANGE_ROOM ==try_to_move_right (game_info.sess, &game_info.where));
                 break;
-            default: break;
+            default: ran = 0; break;
+        }
+        TRACE_END ("tux command");
+        if (ran) {
+            record_command (tux_tick, tux_command, NULL);
         }
+        tux_command = CMD_NONE;
         (void)pthread_mutex_unlock (&lock);
-        sched_yield();
     }
     /* This code never executes--the thread should always be cancelled. */
     return NULL;
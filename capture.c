@@ -0,0 +1,555 @@
+/*									tab:8
+ *
+ * capture.c - frame recorder that streams what the player sees (see
+ *             capture.h for the stream format)
+ *
+ * Filename:	    capture.c
+ * History:
+ *	1	Added a background frame recorder with keyframes on room
+ *		change and scroll-compensated row deltas in between.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "stats.h"
+
+
+/*
+ * Number of snapshot slots.  Encoding a frame takes well under a game
+ * loop tick, so a few slots absorb stalls in the sink.
+ */
+#define CAPTURE_SLOTS 8
+
+/* largest record payload: a keyframe with every row as one span */
+#define CAPTURE_OUT_SIZE (2 + 4 + CAPTURE_HEIGHT *			\
+			  (6 + CAPTURE_WIDTH + CAPTURE_WIDTH / 128 + 1))
+
+
+/* local functions--see function headers for details */
+static void* capture_thread (void* ignore);
+static int32_t encode_frame (const capture_snap_t* snap);
+static int32_t pack_bits (const unsigned char* src, int32_t n,
+			  unsigned char* dst);
+static unsigned char* put16 (unsigned char* p, uint32_t v);
+static unsigned char* put32 (unsigned char* p, uint32_t v);
+static int32_t write_record (int32_t type, uint32_t msec,
+			     const unsigned char* data, uint32_t len);
+
+
+/*
+ * file-scope variables
+ *
+ * The slots, palette, and counters below are protected by cap_lock.  The
+ * game thread fills a slot outside of the lock: slots from index
+ * (tail + count) on belong to the game thread, and the others to
+ * capture_thread.
+ */
+static volatile int32_t capturing = 0;	 /* recording (cleared on error) */
+static int32_t        opened = 0;	 /* capture_open succeeded       */
+static int            out_fd = -1;	 /* sink                         */
+static int32_t        out_is_socket;	 /* sink is a Unix socket        */
+static pthread_t      cap_thread_id;	 /* encoder and writer thread    */
+static pthread_mutex_t cap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cap_cv = PTHREAD_COND_INITIALIZER;
+static int32_t        cap_stop;		 /* asks capture_thread to exit  */
+static capture_snap_t* slot;		 /* CAPTURE_SLOTS snapshots      */
+static int32_t        tail;		 /* oldest queued slot           */
+static int32_t        count;		 /* number of queued slots       */
+static unsigned char  palette[256][3];	 /* current palette              */
+static int32_t        palette_dirty = 1; /* palette changed since frame  */
+static struct timespec start_time;	 /* time of capture_open         */
+static uint32_t       dropped;		 /* frames dropped (no free slot) */
+
+/* encoder state (capture_thread only) */
+static unsigned char  prev[CAPTURE_HEIGHT][CAPTURE_WIDTH]; /* last frame */
+static unsigned char  cur[CAPTURE_HEIGHT][CAPTURE_WIDTH];  /* this frame */
+static unsigned char  ref[CAPTURE_HEIGHT][CAPTURE_WIDTH];  /* delta base */
+static unsigned char* out_buf;		 /* record payload being built   */
+static int32_t        have_prev;	 /* prev holds a sent frame      */
+static int32_t        write_failed;	 /* sink is no longer usable     */
+static int32_t        prev_x, prev_y;	 /* view position of prev        */
+static int32_t        since_key;	 /* frames since last keyframe   */
+static uint32_t       n_frames;		 /* frames sent                  */
+static uint32_t       n_keys;		 /* keyframes sent               */
+static uint64_t       n_bytes;		 /* bytes written                */
+static uint64_t       enc_cycles;	 /* cycles spent encoding        */
+static uint64_t       max_enc_cycles;	 /* most cycles for one frame    */
+
+
+/*
+ * capture_open
+ *   DESCRIPTION: Open the sink, write the stream header, and start the
+ *                encoder thread.
+ *   INPUTS: dest -- file name, or "unix:PATH" for a listening viewer
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: creates a thread; prints an error message on failure
+ */
+int32_t
+capture_open (const char* dest)
+{
+    struct sockaddr_un addr;	/* viewer socket address */
+    unsigned char      hdr[14];	/* stream header         */
+    unsigned char*     p;	/* header write pointer  */
+
+    if (0 == strncmp (dest, "unix:", 5)) {
+	out_is_socket = 1;
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	if (sizeof (addr.sun_path) <= strlen (dest + 5)) {
+	    fprintf (stderr, "capture: socket path too long\n");
+	    return -1;
+	}
+	strcpy (addr.sun_path, dest + 5);
+	if (-1 == (out_fd = socket (AF_UNIX, SOCK_STREAM, 0)) ||
+	    -1 == connect (out_fd, (struct sockaddr*)&addr, sizeof (addr))) {
+	    perror (dest + 5);
+	    if (-1 != out_fd) {
+		(void)close (out_fd);
+	    }
+	    return -1;
+	}
+    } else {
+	out_is_socket = 0;
+	out_fd = open (dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (-1 == out_fd) {
+	    perror (dest);
+	    return -1;
+	}
+    }
+
+    if (NULL == (slot = malloc (CAPTURE_SLOTS * sizeof (*slot))) ||
+	NULL == (out_buf = malloc (CAPTURE_OUT_SIZE))) {
+	fputs ("capture: out of memory\n", stderr);
+	goto fail;
+    }
+
+    memcpy (hdr, CAPTURE_MAGIC, 8);
+    p = put16 (hdr + 8, CAPTURE_WIDTH);
+    p = put16 (p, CAPTURE_HEIGHT);
+    (void)put16 (p, CAPTURE_VIEW_HEIGHT);
+    if (0 != write_record (-1, 0, hdr, sizeof (hdr))) {
+	goto fail;
+    }
+    n_bytes = 0;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &start_time);
+    cap_stop = 0;
+    if (0 != pthread_create (&cap_thread_id, NULL, capture_thread, NULL)) {
+	fputs ("capture: cannot create thread\n", stderr);
+	goto fail;
+    }
+    opened = 1;
+    capturing = 1;
+    return 0;
+
+fail:
+    free (slot);
+    free (out_buf);
+    slot = NULL;
+    out_buf = NULL;
+    (void)close (out_fd);
+    out_fd = -1;
+    return -1;
+}
+
+
+/*
+ * capture_get_snap
+ *   DESCRIPTION: Get a free snapshot slot for the next frame.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the slot, or NULL if not recording or if no slot is
+ *                 free (the frame is then dropped)
+ *   SIDE EFFECTS: counts dropped frames
+ */
+capture_snap_t*
+capture_get_snap ()
+{
+    capture_snap_t* snap; /* free slot */
+
+    if (!capturing) {
+	return NULL;
+    }
+    (void)pthread_mutex_lock (&cap_lock);
+    if (CAPTURE_SLOTS == count) {
+	dropped++;
+	snap = NULL;
+    } else {
+	snap = &slot[(tail + count) % CAPTURE_SLOTS];
+    }
+    (void)pthread_mutex_unlock (&cap_lock);
+    return snap;
+}
+
+
+/*
+ * capture_put_snap
+ *   DESCRIPTION: Queue a filled-in snapshot for encoding.
+ *   INPUTS: snap -- slot returned by capture_get_snap, with the view
+ *                   position, view, and status bar filled in
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: wakes the encoder thread
+ */
+void
+capture_put_snap (capture_snap_t* snap)
+{
+    struct timespec now;	/* time of frame */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &now);
+    snap->msec = (now.tv_sec - start_time.tv_sec) * 1000 +
+		 (now.tv_nsec - start_time.tv_nsec) / 1000000;
+
+    (void)pthread_mutex_lock (&cap_lock);
+    snap->new_palette = palette_dirty;
+    if (palette_dirty) {
+	memcpy (snap->palette, palette, sizeof (palette));
+	palette_dirty = 0;
+    }
+    count++;
+    (void)pthread_cond_signal (&cap_cv);
+    (void)pthread_mutex_unlock (&cap_lock);
+}
+
+
+/*
+ * capture_palette
+ *   DESCRIPTION: Record a change to the palette.  The next frame will be
+ *                a keyframe preceded by the new palette.
+ *   INPUTS: first -- first color changed
+ *           n -- number of colors changed
+ *           rgb -- n 6-bit RGB triples
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+capture_palette (int32_t first, int32_t n, const unsigned char* rgb)
+{
+    (void)pthread_mutex_lock (&cap_lock);
+    memcpy (palette[first], rgb, n * 3);
+    palette_dirty = 1;
+    (void)pthread_mutex_unlock (&cap_lock);
+}
+
+
+/*
+ * capture_close
+ *   DESCRIPTION: Encode and write any queued frames, stop the encoder
+ *                thread, close the sink, and report frame counts and
+ *                encoding costs.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: prints a summary to stderr
+ */
+void
+capture_close ()
+{
+    if (!opened) {
+	return;
+    }
+    capturing = 0;
+    (void)pthread_mutex_lock (&cap_lock);
+    cap_stop = 1;
+    (void)pthread_cond_signal (&cap_cv);
+    (void)pthread_mutex_unlock (&cap_lock);
+    (void)pthread_join (cap_thread_id, NULL);
+    (void)close (out_fd);
+    out_fd = -1;
+    free (slot);
+    free (out_buf);
+    slot = NULL;
+    out_buf = NULL;
+    opened = 0;
+
+    fprintf (stderr, "capture: %u frames (%u keyframes, %u dropped), "
+	     "%llu bytes; %.0f bytes/frame, %.0f cycles/frame to encode "
+	     "(max %llu)\n", n_frames, n_keys, dropped,
+	     (unsigned long long)n_bytes,
+	     (0 == n_frames ? 0.0 : (double)n_bytes / n_frames),
+	     (0 == n_frames ? 0.0 : (double)enc_cycles / n_frames),
+	     (unsigned long long)max_enc_cycles);
+}
+
+
+/*
+ * capture_thread
+ *   DESCRIPTION: Encoder thread: encode and write queued snapshots in
+ *                order until capture_close asks it to stop.
+ *   INPUTS: ignore -- ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: writes to the sink; stops recording on a write error
+ */
+static void*
+capture_thread (void* ignore)
+{
+    capture_snap_t* snap; /* oldest queued snapshot */
+
+    while (1) {
+	(void)pthread_mutex_lock (&cap_lock);
+	while (0 == count && !cap_stop) {
+	    (void)pthread_cond_wait (&cap_cv, &cap_lock);
+	}
+	if (0 == count) {
+	    (void)pthread_mutex_unlock (&cap_lock);
+	    return NULL;
+	}
+	snap = &slot[tail];
+	(void)pthread_mutex_unlock (&cap_lock);
+
+	if (!write_failed && 0 != encode_frame (snap)) {
+	    write_failed = 1;
+	    capturing = 0;
+	}
+
+	(void)pthread_mutex_lock (&cap_lock);
+	tail = (tail + 1) % CAPTURE_SLOTS;
+	count--;
+	(void)pthread_mutex_unlock (&cap_lock);
+    }
+}
+
+
+/*
+ * encode_frame
+ *   DESCRIPTION: Encode one snapshot as a keyframe or a delta from the
+ *                previous frame, and write it (with a palette record if
+ *                the palette changed).
+ *   INPUTS: snap -- the snapshot
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a write error
+ *   SIDE EFFECTS: updates the encoder state and counters
+ */
+static int32_t
+encode_frame (const capture_snap_t* snap)
+{
+    uint64_t       start;	/* cycle count at entry          */
+    uint64_t       cycles;	/* cycles spent encoding         */
+    int32_t        key;		/* send a keyframe?              */
+    int32_t        dx, dy;	/* view motion since last frame  */
+    int32_t        x, y;	/* pixel coordinates             */
+    int32_t        sx, sy;	/* shifted coordinates in prev   */
+    int32_t        x0, x1;	/* first and last changed pixel  */
+    int32_t        col0;	/* build buffer column of x == 0 */
+    int32_t        n_spans;	/* spans in the record           */
+    unsigned char* p;		/* payload write pointer         */
+    unsigned char* n_at;	/* where the span count goes     */
+
+    start = stat_cycles ();
+
+    /* Put the planar snapshot into screen order. */
+    col0 = snap->view_x >> 2;
+    for (y = 0; CAPTURE_VIEW_HEIGHT > y; y++) {
+	for (x = 0; CAPTURE_WIDTH > x; x++) {
+	    cur[y][x] = snap->view[(snap->view_x + x) & 3]
+			[y * SCROLL_X_WIDTH + ((snap->view_x + x) >> 2) - col0];
+	}
+    }
+    for (y = 0; CAPTURE_HEIGHT - CAPTURE_VIEW_HEIGHT > y; y++) {
+	for (x = 0; CAPTURE_WIDTH > x; x++) {
+	    cur[CAPTURE_VIEW_HEIGHT + y][x] =
+		snap->bar[x & 3][y * SCROLL_X_WIDTH + (x >> 2)];
+	}
+    }
+
+    /* Choose the record type and the frame to which it is relative. */
+    key = (snap->new_palette || !have_prev ||
+	   CAPTURE_KEY_INTERVAL <= since_key);
+    p = out_buf;
+    if (key) {
+	memset (ref, 0, sizeof (ref));
+    } else {
+	/* Compensate for scrolling: shift the view part of prev. */
+	dx = snap->view_x - prev_x;
+	dy = snap->view_y - prev_y;
+	for (y = 0; CAPTURE_VIEW_HEIGHT > y; y++) {
+	    sy = y + dy;
+	    if (0 > sy || CAPTURE_VIEW_HEIGHT <= sy) {
+		memset (ref[y], 0, CAPTURE_WIDTH);
+		continue;
+	    }
+	    for (x = 0; CAPTURE_WIDTH > x; x++) {
+		sx = x + dx;
+		ref[y][x] = (0 <= sx && CAPTURE_WIDTH > sx ? prev[sy][sx] : 0);
+	    }
+	}
+	memcpy (ref[CAPTURE_VIEW_HEIGHT], prev[CAPTURE_VIEW_HEIGHT],
+		(CAPTURE_HEIGHT - CAPTURE_VIEW_HEIGHT) * CAPTURE_WIDTH);
+	p = put16 (p, (uint16_t)dx);
+	p = put16 (p, (uint16_t)dy);
+    }
+
+    /* Send the changed part of each row. */
+    n_at = p;
+    p += 2;
+    n_spans = 0;
+    for (y = 0; CAPTURE_HEIGHT > y; y++) {
+	for (x0 = 0; CAPTURE_WIDTH > x0 && cur[y][x0] == ref[y][x0]; x0++);
+	if (CAPTURE_WIDTH == x0) {
+	    continue;
+	}
+	for (x1 = CAPTURE_WIDTH - 1; cur[y][x1] == ref[y][x1]; x1--);
+	p = put16 (p, y);
+	p = put16 (p, x0);
+	p = put16 (p, x1 - x0 + 1);
+	p += pack_bits (&cur[y][x0], x1 - x0 + 1, p);
+	n_spans++;
+    }
+    (void)put16 (n_at, n_spans);
+
+    memcpy (prev, cur, sizeof (prev));
+    prev_x = snap->view_x;
+    prev_y = snap->view_y;
+    have_prev = 1;
+    since_key = (key ? 0 : since_key + 1);
+
+    cycles = stat_cycles () - start;
+    enc_cycles += cycles;
+    if (cycles > max_enc_cycles) {
+	max_enc_cycles = cycles;
+    }
+    n_frames++;
+    n_keys += key;
+
+    if (snap->new_palette &&
+	0 != write_record ('P', snap->msec, &snap->palette[0][0], 256 * 3)) {
+	return -1;
+    }
+    return write_record (key ? 'K' : 'D', snap->msec, out_buf, p - out_buf);
+}
+
+
+/*
+ * pack_bits
+ *   DESCRIPTION: Compress bytes with PackBits (see capture.h).
+ *   INPUTS: src -- bytes to compress
+ *           n -- number of bytes
+ *   OUTPUTS: dst -- compressed bytes (at most n + n / 128 + 1)
+ *   RETURN VALUE: number of bytes written to dst
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+pack_bits (const unsigned char* src, int32_t n, unsigned char* dst)
+{
+    int32_t i;		/* next byte to compress   */
+    int32_t j;		/* end of literal sequence */
+    int32_t run;	/* length of repeated run  */
+    int32_t len;	/* bytes written           */
+
+    len = 0;
+    for (i = 0; n > i; ) {
+	for (run = 1; n > i + run && 129 > run && src[i + run] == src[i];
+	     run++);
+	if (3 <= run) {
+	    dst[len++] = run + 126;
+	    dst[len++] = src[i];
+	    i += run;
+	    continue;
+	}
+
+	/* Literal bytes up to the next run of three (or 128 bytes). */
+	for (j = i; n > j && 128 > j - i; j++) {
+	    if (n > j + 2 && src[j] == src[j + 1] && src[j] == src[j + 2]) {
+		break;
+	    }
+	}
+	dst[len++] = j - i - 1;
+	memcpy (dst + len, src + i, j - i);
+	len += j - i;
+	i = j;
+    }
+    return len;
+}
+
+
+/*
+ * put16
+ *   DESCRIPTION: Store a 16-bit little-endian value.
+ *   INPUTS: p -- where to store it
+ *           v -- the value
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer just past the stored value
+ *   SIDE EFFECTS: none
+ */
+static unsigned char*
+put16 (unsigned char* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+
+/*
+ * put32
+ *   DESCRIPTION: Store a 32-bit little-endian value.
+ *   INPUTS: p -- where to store it
+ *           v -- the value
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer just past the stored value
+ *   SIDE EFFECTS: none
+ */
+static unsigned char*
+put32 (unsigned char* p, uint32_t v)
+{
+    return put16 (put16 (p, v), v >> 16);
+}
+
+
+/*
+ * write_record
+ *   DESCRIPTION: Write one record (or, with type -1, raw bytes) to the
+ *                sink.
+ *   INPUTS: type -- record type, or -1 for no record header
+ *           msec -- record time
+ *           data -- payload
+ *           len -- payload length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: writes to the sink; prints an error message on failure
+ */
+static int32_t
+write_record (int32_t type, uint32_t msec, const unsigned char* data,
+	      uint32_t len)
+{
+    unsigned char  hdr[9];	/* record header            */
+    const unsigned char* src;	/* next bytes to write      */
+    uint32_t       left;	/* bytes left in this piece */
+    ssize_t        done;	/* bytes written by a call  */
+    int32_t        piece;	/* header (0) or payload    */
+
+    hdr[0] = type;
+    (void)put32 (put32 (hdr + 1, msec), len);
+    for (piece = (-1 == type ? 1 : 0); 2 > piece; piece++) {
+	src = (0 == piece ? hdr : data);
+	left = (0 == piece ? sizeof (hdr) : len);
+	while (0 < left) {
+	    done = (out_is_socket ? send (out_fd, src, left, MSG_NOSIGNAL) :
+		    write (out_fd, src, left));
+	    if (0 > done) {
+		if (EINTR == errno) {
+		    continue;
+		}
+		perror ("capture");
+		return -1;
+	    }
+	    src += done;
+	    left -= done;
+	    n_bytes += done;
+	}
+    }
+    return 0;
+}
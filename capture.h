@@ -0,0 +1,100 @@
+/*									tab:8
+ *
+ * capture.h - header file for the frame recorder, which streams what
+ *             the player sees to a file or a local spectator
+ *
+ * Filename:	    capture.h
+ * History:
+ *	1	Added a background frame recorder with keyframes on room
+ *		change and scroll-compensated row deltas in between.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+#include "modex.h"
+
+
+/*
+ * The recorder captures the screen the player sees: the logical view
+ * window from the build buffer, the status bar below it, and the
+ * palette.  show_screen copies the raw planes into a free snapshot slot
+ * (a few memcpys), and a background thread does all of the encoding and
+ * writing, so game_loop never waits for the disk or a viewer.  If the
+ * writer falls behind and no slot is free, the frame is dropped; deltas
+ * are always taken from the last frame sent, so the stream stays valid.
+ *
+ * Stream format (multi-byte values little-endian, pixels are palette
+ * indices, colors are 6-bit VGA DAC values):
+ *
+ *     header:  "ADVCAP01", u16 width (320), u16 height (200),
+ *              u16 view height (182; the status bar is below the view)
+ *     records: u8 type, u32 milliseconds since start, u32 payload length,
+ *              then the payload
+ *
+ *     'P' palette:  256 x 3 bytes (sent before a keyframe when changed)
+ *     'K' keyframe: row spans (below) applied to a frame of zeros
+ *     'D' delta:    s16 dx, s16 dy, then row spans; the view part of the
+ *                   previous frame (not the status bar) is first shifted
+ *                   so that pixel (x,y) takes the value at (x+dx,y+dy),
+ *                   or 0 if that lies outside the view
+ *
+ *     row spans: u16 count, then for each span u16 y, u16 x, u16 length,
+ *                and the span's pixels coded with PackBits (a control
+ *                byte c < 128 is followed by c+1 literal bytes; c >= 128
+ *                repeats the next byte c-126 times)
+ *
+ * Keyframes are sent for the first frame, after every palette change
+ * (prep_room sets the palette, so every room change), and every
+ * CAPTURE_KEY_INTERVAL frames so that a spectator can join at any time.
+ */
+
+#define CAPTURE_MAGIC        "ADVCAP01"
+#define CAPTURE_WIDTH        SCROLL_X_DIM
+#define CAPTURE_VIEW_HEIGHT  SCROLL_Y_DIM
+#define CAPTURE_HEIGHT       (SCROLL_Y_DIM + 18)
+#define CAPTURE_KEY_INTERVAL 256
+
+/*
+ * Raw snapshot of one frame, filled in by show_screen.  Plane p of the
+ * view holds the build buffer bytes for logical columns with (x & 3) ==
+ * p, starting at logical address (view_x >> 2) + view_y * SCROLL_X_WIDTH,
+ * so view pixel (x,y) is in plane (view_x + x) & 3 at index
+ * y * SCROLL_X_WIDTH + ((view_x + x) >> 2) - (view_x >> 2).  The status
+ * bar planes are copies of status_buffer.
+ */
+typedef struct capture_snap_t capture_snap_t;
+struct capture_snap_t {
+    int32_t       view_x, view_y;	/* logical view window position */
+    unsigned char view[4][SCROLL_X_WIDTH * SCROLL_Y_DIM + 1];
+    unsigned char bar[4][STATUSBAR_PLANE_SIZE];
+    uint32_t      msec;			/* time since capture_open       */
+    int32_t       new_palette;		/* palette changed before frame  */
+    unsigned char palette[256][3];	/* palette (if new_palette)      */
+};
+
+/*
+ * Start recording to dest, which is a file name or "unix:PATH" for a
+ * viewer listening on a local stream socket.  Returns 0 on success, -1
+ * on failure.
+ */
+extern int32_t capture_open (const char* dest);
+
+/*
+ * Get a free snapshot slot for a frame, or NULL if not recording (or no
+ * slot is free).  Fill in the view and status bar, then pass it to
+ * capture_put_snap.
+ */
+extern capture_snap_t* capture_get_snap ();
+extern void capture_put_snap (capture_snap_t* snap);
+
+/* Record palette colors first to first + n - 1 (at any time). */
+extern void capture_palette (int32_t first, int32_t n,
+			     const unsigned char* rgb);
+
+/* Write out queued frames, stop recording, and report encoding costs. */
+extern void capture_close ();
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,299 @@
+/*									tab:8
+ *
+ * copy.c - bulk copy engine (see copy.h)
+ *
+ * Filename:	    copy.c
+ * History:
+ *	1	Added a copy engine that picks among string moves, memcpy,
+ *		and non-temporal SSE2/AVX2 stores by timing them at startup.
+ */
+
+#include <immintrin.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "copy.h"
+#include "stats.h"
+
+
+/*
+ * Number of timed copies per strategy.  The fastest copy counts, so
+ * that a timer interrupt or an emulator hiccup does not decide.
+ */
+#define COPY_TRIALS 8
+
+
+/* local functions--see function headers for details */
+static void copy_movsb (void* dst, const void* src, size_t n);
+static void copy_memcpy (void* dst, const void* src, size_t n);
+static void copy_sse2 (void* dst, const void* src, size_t n);
+static void copy_avx2 (void* dst, const void* src, size_t n);
+static int32_t supported (int32_t s);
+
+
+/* the strategies, in the order tried */
+typedef struct copy_strategy_t copy_strategy_t;
+struct copy_strategy_t {
+    const char* name;	/* name for copy_force and reports */
+    copy_fn_t   fn;	/* copy routine                    */
+};
+static const copy_strategy_t strategy[] = {
+    {"movsb", copy_movsb},
+    {"memcpy", copy_memcpy},
+    {"sse2", copy_sse2},
+    {"avx2", copy_avx2}
+};
+#define NUM_STRATEGIES ((int32_t)(sizeof (strategy) / sizeof (strategy[0])))
+
+
+/*
+ * file-scope variables
+ */
+copy_fn_t copy_bytes = copy_memcpy;
+static int32_t  forced = -1;		     /* forced strategy, or -1   */
+static int32_t  chosen = 1;		     /* strategy in copy_bytes   */
+static size_t   timed_len;		     /* bytes per timed copy     */
+static uint64_t best_cycles[NUM_STRATEGIES]; /* fastest copy (0: untimed) */
+
+
+/*
+ * copy_force
+ *   DESCRIPTION: Choose the strategy that the next copy_calibrate uses
+ *                instead of timing them.
+ *   INPUTS: name -- a strategy name (see copy.h), or "auto"
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the name is unknown or the
+ *                 strategy cannot run on this processor
+ *   SIDE EFFECTS: none
+ */
+int32_t
+copy_force (const char* name)
+{
+    int32_t s; /* index over strategies */
+
+    if (0 == strcmp (name, "auto")) {
+	forced = -1;
+	return 0;
+    }
+    for (s = 0; NUM_STRATEGIES > s; s++) {
+	if (0 == strcmp (name, strategy[s].name) && supported (s)) {
+	    forced = s;
+	    return 0;
+	}
+    }
+    return -1;
+}
+
+
+/*
+ * copy_calibrate
+ *   DESCRIPTION: Set copy_bytes to the forced strategy, or else to the
+ *                supported strategy that copies len bytes into dst in
+ *                the fewest cycles.
+ *   INPUTS: dst -- destination for timed copies (overwritten with zeros)
+ *           len -- bytes per timed copy
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes copy_bytes; writes zeros to dst
+ */
+void
+copy_calibrate (void* dst, size_t len)
+{
+    unsigned char* src;   /* zeros to copy                 */
+    int32_t        s;     /* index over strategies         */
+    int32_t        trial; /* index over timed copies       */
+    uint64_t       start; /* cycle count before one copy   */
+    uint64_t       cyc;   /* cycles for one copy           */
+
+    memset (best_cycles, 0, sizeof (best_cycles));
+    timed_len = len;
+    if (-1 != forced) {
+	chosen = forced;
+	copy_bytes = strategy[chosen].fn;
+	return;
+    }
+
+    /* Without a source buffer, keep the C library. */
+    if (NULL == (src = calloc (1, len))) {
+	chosen = 1;
+	copy_bytes = copy_memcpy;
+	return;
+    }
+    chosen = -1;
+    for (s = 0; NUM_STRATEGIES > s; s++) {
+	if (!supported (s)) {
+	    continue;
+	}
+	strategy[s].fn (dst, src, len);	/* warm up caches and TLB */
+	for (trial = 0; COPY_TRIALS > trial; trial++) {
+	    start = stat_cycles ();
+	    strategy[s].fn (dst, src, len);
+	    cyc = stat_cycles () - start;
+	    if (0 == best_cycles[s] || cyc < best_cycles[s]) {
+		best_cycles[s] = (0 == cyc ? 1 : cyc);
+	    }
+	}
+	if (-1 == chosen || best_cycles[s] < best_cycles[chosen]) {
+	    chosen = s;
+	}
+    }
+    free (src);
+    copy_bytes = strategy[chosen].fn;
+}
+
+
+/*
+ * copy_report
+ *   DESCRIPTION: Write the selected strategy and, if the strategies were
+ *                timed, the cycles each took.
+ *   INPUTS: out -- stream to write to
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to out
+ */
+void
+copy_report (FILE* out)
+{
+    int32_t s; /* index over strategies */
+
+    fprintf (out, "copy engine: %s (%s)", strategy[chosen].name,
+	     (-1 != forced ? "forced" : 0 != timed_len ? "fastest" :
+	      "default"));
+    if (-1 == forced && 0 != timed_len) {
+	fprintf (out, "; cycles per %lu bytes:", (unsigned long)timed_len);
+	for (s = 0; NUM_STRATEGIES > s; s++) {
+	    if (0 != best_cycles[s]) {
+		fprintf (out, " %s %llu", strategy[s].name,
+			 (unsigned long long)best_cycles[s]);
+	    } else {
+		fprintf (out, " %s n/a", strategy[s].name);
+	    }
+	}
+    }
+    fputc ('\n', out);
+}
+
+
+/*
+ * supported
+ *   DESCRIPTION: Check whether the processor can run a strategy.
+ *   INPUTS: s -- index of strategy
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if supported, 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+supported (int32_t s)
+{
+    if (copy_sse2 == strategy[s].fn) {
+	return (0 != __builtin_cpu_supports ("sse2"));
+    }
+    if (copy_avx2 == strategy[s].fn) {
+	return (0 != __builtin_cpu_supports ("avx2"));
+    }
+    return 1;
+}
+
+
+/*
+ * copy_movsb
+ *   DESCRIPTION: Copy bytes with an x86 string move.
+ *   INPUTS: dst -- destination
+ *           src -- source
+ *           n -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes n bytes at dst
+ */
+static void
+copy_movsb (void* dst, const void* src, size_t n)
+{
+    asm volatile (
+        "cld                                                 ;"
+       	"rep movsb    # copy ECX bytes from M[ESI] to M[EDI]  "
+      : "+S" (src), "+D" (dst), "+c" (n)
+      : /* no other inputs */
+      : "memory"
+    );
+}
+
+
+/*
+ * copy_memcpy
+ *   DESCRIPTION: Copy bytes with the C library.
+ *   INPUTS: dst -- destination
+ *           src -- source
+ *           n -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes n bytes at dst
+ */
+static void
+copy_memcpy (void* dst, const void* src, size_t n)
+{
+    (void)memcpy (dst, src, n);
+}
+
+
+/*
+ * copy_sse2
+ *   DESCRIPTION: Copy bytes with 16-byte non-temporal stores, which
+ *                write around the cache.  Bytes before the first 16-byte
+ *                boundary of dst and after the last are copied singly.
+ *   INPUTS: dst -- destination
+ *           src -- source (any alignment)
+ *           n -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes n bytes at dst
+ */
+__attribute__ ((target ("sse2"))) static void
+copy_sse2 (void* dst, const void* src, size_t n)
+{
+    unsigned char*       d = dst; /* destination pointer */
+    const unsigned char* s = src; /* source pointer      */
+
+    for (; 0 < n && 0 != ((uintptr_t)d & 15); n--) {
+	*d++ = *s++;
+    }
+    for (; 16 <= n; n -= 16, d += 16, s += 16) {
+	_mm_stream_si128 ((__m128i*)d, _mm_loadu_si128 ((const __m128i*)s));
+    }
+    _mm_sfence ();
+    for (; 0 < n; n--) {
+	*d++ = *s++;
+    }
+}
+
+
+/*
+ * copy_avx2
+ *   DESCRIPTION: Copy bytes with 32-byte non-temporal stores, which
+ *                write around the cache.  Bytes before the first 32-byte
+ *                boundary of dst and after the last are copied singly.
+ *   INPUTS: dst -- destination
+ *           src -- source (any alignment)
+ *           n -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes n bytes at dst
+ */
+__attribute__ ((target ("avx2"))) static void
+copy_avx2 (void* dst, const void* src, size_t n)
+{
+    unsigned char*       d = dst; /* destination pointer */
+    const unsigned char* s = src; /* source pointer      */
+
+    for (; 0 < n && 0 != ((uintptr_t)d & 31); n--) {
+	*d++ = *s++;
+    }
+    for (; 32 <= n; n -= 32, d += 32, s += 32) {
+	_mm256_stream_si256 ((__m256i*)d,
+			     _mm256_loadu_si256 ((const __m256i*)s));
+    }
+    _mm_sfence ();
+    _mm256_zeroupper ();
+    for (; 0 < n; n--) {
+	*d++ = *s++;
+    }
+}
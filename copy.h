@@ -0,0 +1,60 @@
+/*									tab:8
+ *
+ * copy.h - header file for the bulk copy engine used to move pixels
+ *          from the build buffer into video memory
+ *
+ * Filename:	    copy.h
+ * History:
+ *	1	Added a copy engine that picks among string moves, memcpy,
+ *		and non-temporal SSE2/AVX2 stores by timing them at startup.
+ */
+
+#ifndef COPY_H
+#define COPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/*
+ * Which way of copying bytes is fastest depends on where the game runs.
+ * A real VGA behind /dev/mem is uncached, and each access costs a bus
+ * cycle.  Under QEMU or KVM every write to the legacy VGA window may
+ * trap to the emulator, so fewer, wider stores win.  For a headless
+ * display the destination is ordinary memory.  copy_calibrate times
+ * each strategy the processor supports on the real destination and
+ * makes the fastest one copy_bytes.  Call copy_force first to skip the
+ * timing and use a given strategy instead.
+ *
+ * Strategies:
+ *     movsb   -- x86 REP MOVSB (the original code)
+ *     memcpy  -- the C library's memcpy
+ *     sse2    -- 16-byte non-temporal stores (MOVNTDQ)
+ *     avx2    -- 32-byte non-temporal stores (VMOVNTDQ)
+ */
+
+/* type of a copy routine (same arguments as memcpy, no overlap) */
+typedef void (*copy_fn_t) (void* dst, const void* src, size_t n);
+
+/* the selected copy routine (memcpy until copy_calibrate is called) */
+extern copy_fn_t copy_bytes;
+
+/*
+ * Use the named strategy (or "auto" to time them) at the next
+ * copy_calibrate.  Returns 0 on success, or -1 if the name is unknown
+ * or the processor cannot run that strategy.
+ */
+extern int32_t copy_force (const char* name);
+
+/*
+ * Select copy_bytes by timing copies of len bytes of zeros into dst,
+ * unless a strategy was forced.  The caller's memory at dst (len
+ * bytes) is overwritten with zeros.
+ */
+extern void copy_calibrate (void* dst, size_t len);
+
+/* Write the selected strategy and the timings behind the choice. */
+extern void copy_report (FILE* out);
+
+#endif /* COPY_H */
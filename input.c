@@ -72,6 +72,8 @@ int fd;//struct_tty
 
 int flag;//flag for seeing ABC values aren't spammed
 
+int tux_clock_running;//tux keeps the elapsed time itself (TUX_SET_CLOCK)
+
 
 /* 
  * init_input
@@ -139,6 +141,13 @@ reset_typed_command ()
     typing[0] = '\0';
 }
 
+void
+set_typed_command (const char* s)
+{
+    strncpy (typing, s, MAX_TYPED_LEN);
+    typing[MAX_TYPED_LEN] = '\0';
+}
+
 static int32_t
 valid_typing (char c)
 {
@@ -381,6 +390,13 @@ display_time_on_tux (int num_seconds)
 	int ans=0;
 	int i;
 	int arg = 0x04070000;//mask last LED and display decimal before seconds value
+
+	//the tux's own clock is already showing this; nothing to send
+	if(tux_clock_running)
+	{
+		return;
+	}
+
 	i=0;
 	if(mins>=10)
 	{
@@ -409,6 +425,25 @@ display_time_on_tux (int num_seconds)
 }
 
 
+/* 
+ * start_clock_on_tux
+ *   DESCRIPTION: Start the Tux controller's own clock counting up from
+ *                the given number of seconds.  The driver keeps it in
+ *                step across controller resets, so after this call
+ *                display_time_on_tux has nothing left to do.
+ *   INPUTS: num_seconds -- seconds already elapsed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none 
+ *   SIDE EFFECTS: changes state of controller's display; on failure
+ *                 (e.g., older driver) display_time_on_tux keeps
+ *                 updating the LEDs every tick
+ */
+void
+start_clock_on_tux (int num_seconds)
+{
+	tux_clock_running=(ioctl(fd,TUX_SET_CLOCK,num_seconds)==0);
+}
+
 #if (TEST_INPUT_DRIVER == 1)
 int
 main ()
@@ -439,6 +474,11 @@ main ()
 	arg = 0x040f9869;
 	ioctl(fd, TUX_SET_LED, arg);
 
+	struct tux_led_stats led_stats;
+	if (ioctl(fd, TUX_LED_STATS, &led_stats) == 0)
+		printf("LED updates: %lu sent, %lu coalesced, %lu dropped\n",
+		       led_stats.sent, led_stats.coalesced, led_stats.dropped);
+
 
     init_input ();
 
@@ -61,6 +61,9 @@ extern const char* get_typed_command ();
 /* Reset typed command. */
 extern void reset_typed_command ();
 
+/* Replace typed command (used when replaying a script). */
+extern void set_typed_command (const char* s);
+
 /* Shut down the input device. */
 extern void shutdown_input ();
 
@@ -70,6 +73,12 @@ extern void shutdown_input ();
  */
 extern void display_time_on_tux (int num_seconds);
 
+/*
+ * Let the Tux controller count the elapsed time itself, starting at
+ * num_seconds; display_time_on_tux then has nothing to send.
+ */
+extern void start_clock_on_tux (int num_seconds);
+
 extern void init_tux();//initialise tux
 
 #endif /* INPUT_H */
@@ -0,0 +1,689 @@
+/*									tab:8
+ *
+ * ioq.c - batched reads of asset files (see ioq.h)
+ *
+ * Filename:	    ioq.c
+ * History:
+ *	1	Added batched asset reads through io_uring, with a pread
+ *		fallback.
+ */
+
+/*
+ * The ring is driven with raw system calls rather than liburing, which
+ * the game does not otherwise need.  Each buffer is a slot; a read's
+ * user_data is its slot number.  Reads that come back short are
+ * resubmitted for the rest of the file.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ioq.h"
+#include "stats.h"
+#include "trace.h"
+
+
+/* user_data of a cancellation (no slot has this number) */
+#define CANCEL_DATA ((uint64_t)-1)
+
+
+/* a buffer, and the file being read into it */
+typedef struct ioq_slot_t ioq_slot_t;
+struct ioq_slot_t {
+    int32_t  idx;	/* file being read, or -1 if the slot is free */
+    int      fd;	/* the file                                   */
+    uint8_t* buf;	/* buffer                                     */
+    size_t   cap;	/* bytes in buffer                            */
+    size_t   len;	/* size of file                               */
+    size_t   got;	/* bytes read so far                          */
+    int64_t  mtime;	/* modification time of file                 */
+};
+
+/* state of one call to ioq_read_files */
+typedef struct ioq_run_t ioq_run_t;
+struct ioq_run_t {
+    const char* const* fname;	   /* files to read                   */
+    ioq_done_fn_t      done_fn;	   /* called with each file           */
+    void*              arg;	   /* first argument to done_fn       */
+    struct timespec    start;	   /* when the first file was opened  */
+    int64_t            first_usec; /* start to first decode, or -1    */
+    uint64_t           bytes;	   /* bytes read                      */
+    int32_t            by_pread;   /* files io_uring left to pread    */
+};
+
+/* an io_uring instance and its mapped rings */
+typedef struct uring_t uring_t;
+struct uring_t {
+    int                  fd;	     /* ring file descriptor          */
+    void*                sq_map;     /* submission ring mapping       */
+    size_t               sq_len;     /* ...its length                 */
+    void*                cq_map;     /* completion ring mapping       */
+    size_t               cq_len;     /* ...its length (0 if shared)   */
+    struct io_uring_sqe* sqe;	     /* submission entries            */
+    size_t               sqe_len;    /* ...their mapping's length     */
+    unsigned*            sq_head;    /* submission ring head          */
+    unsigned*            sq_tail;    /* submission ring tail          */
+    unsigned*            sq_mask;    /* submission ring index mask    */
+    unsigned*            sq_array;   /* submission ring (sqe indices) */
+    unsigned*            cq_head;    /* completion ring head          */
+    unsigned*            cq_tail;    /* completion ring tail          */
+    unsigned*            cq_mask;    /* completion ring index mask    */
+    struct io_uring_cqe* cqe;	     /* completion entries            */
+};
+
+
+/* local functions--see function headers for details */
+static int32_t uring_setup (uring_t* u, uint32_t entries);
+static void uring_teardown (uring_t* u);
+static void uring_read (uring_t* u, int32_t slot, const ioq_slot_t* s);
+static void uring_cancel (uring_t* u, int32_t slot);
+static void uring_queue (uring_t* u, const struct io_uring_sqe* e);
+static int32_t uring_unqueue (uring_t* u);
+static void uring_drain (uring_t* u, ioq_slot_t* slot, int32_t depth,
+			 int32_t in_flight);
+static int32_t read_with_uring (ioq_run_t* run, int32_t n,
+				ioq_slot_t* slot, int32_t depth);
+static int32_t read_with_pread (ioq_run_t* run, int32_t first, int32_t n,
+				ioq_slot_t* slot);
+static int32_t start_file (ioq_run_t* run, ioq_slot_t* s, int32_t idx);
+static int32_t pread_rest (ioq_slot_t* s);
+static int32_t finish_file (ioq_run_t* run, ioq_slot_t* s);
+static int64_t usec_since (const struct timespec* start);
+
+
+/*
+ * ioq_read_files
+ *   DESCRIPTION: Read files with up to depth reads in flight, passing
+ *                each to a callback as its read completes.
+ *   INPUTS: n -- number of files
+ *           fname -- file names
+ *           depth -- most reads in flight (and number of buffers)
+ *           done_fn -- called with each file's contents
+ *           arg -- first argument to done_fn
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: reads files; counts the reads (see stats.h)
+ */
+int32_t
+ioq_read_files (int32_t n, const char* const* fname, int32_t depth,
+		ioq_done_fn_t done_fn, void* arg)
+{
+    ioq_run_t   run;	 /* state of this call         */
+    ioq_slot_t* slot;	 /* buffers                    */
+    int32_t     uring;	 /* 1 if io_uring was used     */
+    int32_t     used;	 /* most reads in flight       */
+    int32_t     ret;	 /* return value               */
+    int32_t     i;	 /* index over slots           */
+
+    if (0 >= n) {
+	return 0;
+    }
+    TRACE_BEGIN ("ioq_read_files");
+    run.fname = fname;
+    run.done_fn = done_fn;
+    run.arg = arg;
+    run.first_usec = -1;
+    run.bytes = 0;
+    run.by_pread = 0;
+    (void)clock_gettime (CLOCK_MONOTONIC, &run.start);
+
+    depth = (n < depth ? n : depth);
+    depth = (1 > depth ? 1 : depth);
+    if (NULL == (slot = calloc (depth, sizeof (*slot)))) {
+	TRACE_END ("ioq_read_files");
+	return -1;
+    }
+    ret = 0;
+    for (i = 0; depth > i; i++) {
+	slot[i].idx = -1;
+	slot[i].fd = -1;
+	slot[i].cap = IOQ_BUF_BYTES;
+	if (NULL == (slot[i].buf = malloc (IOQ_BUF_BYTES))) {
+	    ret = -1;
+	}
+    }
+
+    /* Use io_uring if the kernel allows it, or else plain preads. */
+    uring = 0;
+    used = depth;
+    if (0 == ret) {
+	ret = read_with_uring (&run, n, slot, depth);
+	uring = (-2 != ret);
+	if (!uring) {
+	    used = 1;
+	    ret = read_with_pread (&run, 0, n, slot);
+	}
+    }
+    stat_asset_reads (uring, run.by_pread, used, n, run.bytes, 
+		      run.first_usec, usec_since (&run.start));
+
+    for (i = 0; depth > i; i++) {
+	if (-1 != slot[i].fd) {
+	    (void)close (slot[i].fd);
+	}
+	free (slot[i].buf);
+    }
+    free (slot);
+    TRACE_END ("ioq_read_files");
+    return ret;
+}
+
+
+/*
+ * read_with_uring
+ *   DESCRIPTION: Read the files through io_uring.  Each free slot is
+ *                given the next file and its read submitted; completed
+ *                files are handed to the callback, freeing their slots.
+ *                After a failure, reads already in flight are waited
+ *                for, since they write into the slots' buffers.  If the
+ *                ring itself fails, the files left are read with pread
+ *                (counted in run->by_pread).
+ *   INPUTS: run -- state of this call
+ *           n -- number of files
+ *           slot -- the buffers (all free)
+ *           depth -- number of slots
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure, or -2 if io_uring is
+ *                 not available (nothing was read)
+ *   SIDE EFFECTS: reads files; calls the callback
+ */
+static int32_t
+read_with_uring (ioq_run_t* run, int32_t n, ioq_slot_t* slot,
+		 int32_t depth)
+{
+    uring_t              u;	    /* the ring                       */
+    struct io_uring_cqe* c;	    /* a completion                   */
+    ioq_slot_t*          s;	    /* slot of a completion           */
+    unsigned             head;	    /* completion ring head           */
+    int32_t              next;	    /* next file to start             */
+    int32_t              in_flight; /* reads submitted, not completed */
+    int32_t              to_submit; /* reads queued, not submitted    */
+    int32_t              ok;	    /* 0 while nothing has failed     */
+    int32_t              i;	    /* index over slots               */
+    int32_t              res;	    /* result of a read               */
+
+    if (0 != uring_setup (&u, depth)) {
+	return -2;
+    }
+    next = 0;
+    in_flight = to_submit = 0;
+    ok = 0;
+    while (0 < in_flight || (0 == ok && n > next)) {
+
+	/* Give free slots the next files. */
+	for (i = 0; 0 == ok && depth > i && n > next; i++) {
+	    if (-1 != slot[i].idx) {
+		continue;
+	    }
+	    if (0 > (res = start_file (run, &slot[i], next++))) {
+		ok = -1;
+	    } else if (0 == res) {
+		uring_read (&u, i, &slot[i]);
+		in_flight++;
+		to_submit++;
+	    }
+	}
+	if (0 == in_flight) {
+	    continue;
+	}
+
+	/* Submit the new reads and wait for at least one to complete. */
+	if (0 > syscall (__NR_io_uring_enter, u.fd, to_submit, 1,
+			 IORING_ENTER_GETEVENTS, NULL, 0)) {
+	    if (EINTR == errno || EAGAIN == errno || EBUSY == errno) {
+		continue;
+	    }
+	    /* 
+	     * The ring is unusable.  Once the kernel is done with the 
+	     * buffers of the reads in flight, finish those files and the
+	     * rest by hand.
+	     */
+	    uring_drain (&u, slot, depth, in_flight);
+	    uring_teardown (&u);
+	    for (i = 0; depth > i; i++) {
+		if (-1 != slot[i].idx && 0 == ok) {
+		    (void)pread_rest (&slot[i]);
+		    ok = finish_file (run, &slot[i]);
+		    run->by_pread++;
+		}
+	    }
+	    if (0 != ok) {
+		return ok;
+	    }
+	    run->by_pread += n - next;
+	    return read_with_pread (run, next, n, slot);
+	}
+	to_submit = 0;
+
+	/* Handle the completions. */
+	head = *u.cq_head;
+	while (head != __atomic_load_n (u.cq_tail, __ATOMIC_ACQUIRE)) {
+	    c = &u.cqe[head & *u.cq_mask];
+	    s = &slot[c->user_data];
+	    res = c->res;
+	    head++;
+	    __atomic_store_n (u.cq_head, head, __ATOMIC_RELEASE);
+	    in_flight--;
+
+	    if (0 != ok) {
+		/* Draining after a failure. */
+		s->idx = -1;
+	    } else if (0 > res) {
+		/* The kernel refused the read; do it directly. */
+		(void)pread_rest (s);
+		ok = finish_file (run, s);
+		run->by_pread++;
+	    } else if (0 == res) {
+		/* The file is shorter than its size said. */
+		ok = finish_file (run, s);
+	    } else if (s->len > (s->got += res)) {
+		uring_read (&u, c->user_data, s);
+		in_flight++;
+		to_submit++;
+	    } else if (0 != finish_file (run, s)) {
+		ok = -1;
+	    }
+	}
+    }
+    uring_teardown (&u);
+    return ok;
+}
+
+
+/*
+ * read_with_pread
+ *   DESCRIPTION: Read files one after another with pread, into one
+ *                buffer.
+ *   INPUTS: run -- state of this call
+ *           first -- first file to read
+ *           n -- number of files (read those from first to n - 1)
+ *           slot -- the buffers (only the first is used)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: reads files; calls the callback
+ */
+static int32_t
+read_with_pread (ioq_run_t* run, int32_t first, int32_t n, ioq_slot_t* slot)
+{
+    int32_t i;   /* index over files     */
+    int32_t res; /* result of start_file */
+
+    for (i = first; n > i; i++) {
+	if (0 > (res = start_file (run, slot, i))) {
+	    return -1;
+	}
+	if (0 == res) {
+	    (void)pread_rest (slot);
+	    if (0 != finish_file (run, slot)) {
+		return -1;
+	    }
+	}
+    }
+    return 0;
+}
+
+
+/*
+ * start_file
+ *   DESCRIPTION: Open a file for reading into a free slot.  A file that
+ *                cannot be opened, is empty, or is too large to read
+ *                goes straight to the callback, without data.
+ *   INPUTS: run -- state of this call
+ *           s -- the slot
+ *           idx -- index of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the file should now be read into the slot, 1 if
+ *                 it was handed to the callback, or -1 on failure
+ *   SIDE EFFECTS: opens the file; may grow the slot's buffer
+ */
+static int32_t
+start_file (ioq_run_t* run, ioq_slot_t* s, int32_t idx)
+{
+    struct stat sb;  /* status of file */
+    uint8_t*    buf; /* larger buffer  */
+
+    s->idx = idx;
+    s->len = s->got = 0;
+    s->mtime = 0;
+    if (-1 == (s->fd = open (run->fname[idx], O_RDONLY)) ||
+	0 != fstat (s->fd, &sb)) {
+	return (0 == finish_file (run, s) ? 1 : -1);
+    }
+    s->len = sb.st_size;
+    s->mtime = sb.st_mtime;
+    if (0 == s->len || IOQ_MAX_FILE < s->len) {
+	return (0 == finish_file (run, s) ? 1 : -1);
+    }
+    if (s->cap < s->len) {
+	if (NULL == (buf = realloc (s->buf, s->len))) {
+	    return (0 == finish_file (run, s) ? 1 : -1);
+	}
+	s->buf = buf;
+	s->cap = s->len;
+    }
+    return 0;
+}
+
+
+/*
+ * pread_rest
+ *   DESCRIPTION: Read the rest of a slot's file with pread.
+ *   INPUTS: s -- the slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 if the file cannot be read whole
+ *   SIDE EFFECTS: reads the file
+ */
+static int32_t
+pread_rest (ioq_slot_t* s)
+{
+    ssize_t got; /* bytes read by one call */
+
+    while (s->len > s->got) {
+	got = pread (s->fd, s->buf + s->got, s->len - s->got, s->got);
+	if (0 > got && EINTR == errno) {
+	    continue;
+	}
+	if (0 >= got) {
+	    return -1;
+	}
+	s->got += got;
+    }
+    return 0;
+}
+
+
+/*
+ * finish_file
+ *   DESCRIPTION: Hand a slot's file to the callback and free the slot.
+ *                The callback gets no data unless the whole file was
+ *                read.
+ *   INPUTS: run -- state of this call
+ *           s -- the slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 if the callback fails
+ *   SIDE EFFECTS: calls the callback; closes the file
+ */
+static int32_t
+finish_file (ioq_run_t* run, ioq_slot_t* s)
+{
+    int32_t idx; /* index of the file */
+
+    if (-1 != s->fd) {
+	(void)close (s->fd);
+	s->fd = -1;
+    }
+    idx = s->idx;
+    s->idx = -1;
+    if (-1 == run->first_usec) {
+	run->first_usec = usec_since (&run->start);
+    }
+    run->bytes += s->got;
+    return run->done_fn (run->arg, idx,
+			 (s->got == s->len && 0 != s->len ? s->buf : NULL),
+			 s->len, s->mtime);
+}
+
+
+/*
+ * usec_since
+ *   DESCRIPTION: Measure the time since a start time.
+ *   INPUTS: start -- the start time (CLOCK_MONOTONIC)
+ *   OUTPUTS: none
+ *   RETURN VALUE: microseconds since start
+ *   SIDE EFFECTS: none
+ */
+static int64_t
+usec_since (const struct timespec* start)
+{
+    struct timespec now; /* current time */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &now);
+    return ((int64_t)(now.tv_sec - start->tv_sec) * 1000000 +
+	    (now.tv_nsec - start->tv_nsec) / 1000);
+}
+
+
+/*
+ * uring_setup
+ *   DESCRIPTION: Create an io_uring instance and map its rings.
+ *   INPUTS: entries -- most submissions at once
+ *   OUTPUTS: u -- the ring
+ *   RETURN VALUE: 0 on success, or -1 if io_uring is not available
+ *   SIDE EFFECTS: creates the ring (destroy it with uring_teardown)
+ */
+static int32_t
+uring_setup (uring_t* u, uint32_t entries)
+{
+    struct io_uring_params p;  /* ring parameters */
+    uint8_t*               sq; /* submission ring */
+    uint8_t*               cq; /* completion ring */
+
+    (void)memset (u, 0, sizeof (*u));
+    (void)memset (&p, 0, sizeof (p));
+    if (0 > (u->fd = syscall (__NR_io_uring_setup, entries, &p))) {
+	return -1;
+    }
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    if (0 != (p.features & IORING_FEAT_SINGLE_MMAP)) {
+	u->sq_len = (u->cq_len > u->sq_len ? u->cq_len : u->sq_len);
+	u->cq_len = 0;
+    }
+    u->sqe_len = p.sq_entries * sizeof (struct io_uring_sqe);
+    u->sq_map = mmap (NULL, u->sq_len, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    u->cq_map = (0 == u->cq_len ? u->sq_map :
+		 mmap (NULL, u->cq_len, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING));
+    u->sqe = mmap (NULL, u->sqe_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (MAP_FAILED == u->sq_map || MAP_FAILED == u->cq_map ||
+	MAP_FAILED == u->sqe) {
+	uring_teardown (u);
+	return -1;
+    }
+    sq = u->sq_map;
+    cq = u->cq_map;
+    u->sq_head = (unsigned*)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqe = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+
+/*
+ * uring_teardown
+ *   DESCRIPTION: Unmap an io_uring instance's rings and close it.  Safe
+ *                to call on a partly set up ring.
+ *   INPUTS: u -- the ring
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: destroys the ring
+ */
+static void
+uring_teardown (uring_t* u)
+{
+    if (NULL != u->sqe && MAP_FAILED != u->sqe) {
+	(void)munmap (u->sqe, u->sqe_len);
+    }
+    if (0 != u->cq_len && NULL != u->cq_map && MAP_FAILED != u->cq_map) {
+	(void)munmap (u->cq_map, u->cq_len);
+    }
+    if (NULL != u->sq_map && MAP_FAILED != u->sq_map) {
+	(void)munmap (u->sq_map, u->sq_len);
+    }
+    if (0 <= u->fd) {
+	(void)close (u->fd);
+    }
+}
+
+
+/*
+ * uring_read
+ *   DESCRIPTION: Queue a read of the rest of a slot's file.  The queue
+ *                never overflows, since there are no more reads than
+ *                slots, and the ring has an entry per slot.
+ *   INPUTS: u -- the ring
+ *           slot -- slot number (returned with the completion)
+ *           s -- the slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: adds a submission to the ring (io_uring_enter sends it)
+ */
+static void
+uring_read (uring_t* u, int32_t slot, const ioq_slot_t* s)
+{
+    struct io_uring_sqe e; /* submission entry */
+
+    (void)memset (&e, 0, sizeof (e));
+    e.opcode = IORING_OP_READ;
+    e.fd = s->fd;
+    e.addr = (uintptr_t)(s->buf + s->got);
+    e.len = s->len - s->got;
+    e.off = s->got;
+    e.user_data = slot;
+    uring_queue (u, &e);
+}
+
+
+/*
+ * uring_cancel
+ *   DESCRIPTION: Queue a cancellation of the read into a slot.  The 
+ *                ring has room as long as no reads are queued (see
+ *                uring_read).
+ *   INPUTS: u -- the ring
+ *           slot -- slot number of the read
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: adds a submission to the ring (io_uring_enter sends it)
+ */
+static void
+uring_cancel (uring_t* u, int32_t slot)
+{
+    struct io_uring_sqe e; /* submission entry */
+
+    (void)memset (&e, 0, sizeof (e));
+    e.opcode = IORING_OP_ASYNC_CANCEL;
+    e.fd = -1;
+    e.addr = slot;
+    e.user_data = CANCEL_DATA;
+    uring_queue (u, &e);
+}
+
+
+/*
+ * uring_queue
+ *   DESCRIPTION: Add a submission entry to the ring.
+ *   INPUTS: u -- the ring
+ *           e -- the entry
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: adds a submission to the ring (io_uring_enter sends it)
+ */
+static void
+uring_queue (uring_t* u, const struct io_uring_sqe* e)
+{
+    unsigned tail; /* submission tail   */
+    unsigned i;    /* index in the ring */
+
+    tail = *u->sq_tail;
+    i = tail & *u->sq_mask;
+    u->sqe[i] = *e;
+    u->sq_array[i] = i;
+    __atomic_store_n (u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * uring_unqueue
+ *   DESCRIPTION: Take back the submissions that the kernel has not 
+ *                picked up from the ring.
+ *   INPUTS: u -- the ring
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of submissions taken back
+ *   SIDE EFFECTS: empties the submission ring
+ */
+static int32_t
+uring_unqueue (uring_t* u)
+{
+    unsigned head; /* submission head */
+    int32_t  n;    /* entries taken   */
+
+    head = __atomic_load_n (u->sq_head, __ATOMIC_ACQUIRE);
+    n = (int32_t)(*u->sq_tail - head);
+    __atomic_store_n (u->sq_tail, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+
+/*
+ * uring_drain
+ *   DESCRIPTION: Wait until the kernel is done with the buffers of the
+ *                reads in flight, after io_uring_enter failed.  Reads 
+ *                the kernel never picked up are taken back; the others
+ *                are cancelled if the ring still takes submissions, and
+ *                are waited for either way.  Bytes brought in by reads
+ *                that completed are counted in their slots.
+ *   INPUTS: u -- the ring
+ *           slot -- the slots
+ *           depth -- number of slots
+ *           in_flight -- reads queued or submitted, not completed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may sleep until the reads complete
+ */
+static void
+uring_drain (uring_t* u, ioq_slot_t* slot, int32_t depth, int32_t in_flight)
+{
+    static const struct timespec nap = {0, 1000000}; /* poll interval */
+    struct io_uring_cqe* c;	/* a completion             */
+    unsigned             head;	/* completion ring head     */
+    int32_t              n;	/* cancellations queued     */
+    int32_t              i;	/* index over slots         */
+
+    /* Reads still in the submission ring were never started. */
+    in_flight -= uring_unqueue (u);
+
+    /* Ask for the rest to be cancelled (any left unsent are dropped). */
+    for (i = n = 0; depth > i; i++) {
+	if (-1 != slot[i].idx) {
+	    uring_cancel (u, i);
+	    n++;
+	}
+    }
+    (void)syscall (__NR_io_uring_enter, u->fd, n, 0, 0, NULL, 0);
+    (void)uring_unqueue (u);
+
+    /* Wait for the reads, polling the ring if waiting in it fails. */
+    while (0 < in_flight) {
+	head = *u->cq_head;
+	if (head == __atomic_load_n (u->cq_tail, __ATOMIC_ACQUIRE)) {
+	    if (0 > syscall (__NR_io_uring_enter, u->fd, 0, 1,
+			     IORING_ENTER_GETEVENTS, NULL, 0)) {
+		(void)nanosleep (&nap, NULL);
+	    }
+	    continue;
+	}
+	c = &u->cqe[head & *u->cq_mask];
+	if (CANCEL_DATA != c->user_data) {
+	    in_flight--;
+	    if (0 < c->res) {
+		slot[c->user_data].got += c->res;
+	    }
+	}
+	__atomic_store_n (u->cq_head, head + 1, __ATOMIC_RELEASE);
+    }
+}
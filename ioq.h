@@ -0,0 +1,64 @@
+/*									tab:8
+ *
+ * ioq.h - header file for batched reads of asset files
+ *
+ * Filename:	    ioq.h
+ * History:
+ *	1	Added batched asset reads through io_uring, with a pread
+ *		fallback.
+ */
+
+#ifndef IOQ_H
+#define IOQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * On a cold start, loading the world used to wait on one blocking read
+ * after another.  ioq_read_files instead keeps up to depth whole-file
+ * reads in flight through io_uring, each into one of depth buffers
+ * allocated up front (and grown if a file needs more), and hands each
+ * file to a callback as soon as its read completes.  Decoding one file
+ * therefore overlaps the reads of the next few.  Where io_uring is not
+ * available (older kernels, or a sandbox that forbids it), the files
+ * are read one at a time with pread; a read that io_uring rejects is
+ * also redone with pread.
+ *
+ * The method, depth, and time from the first open to the first decode
+ * are reported with the hot-path counters (see stats.h).
+ */
+
+/* reads in flight when loading the world */
+#define IOQ_DEPTH     8
+
+/* initial size of each read buffer */
+#define IOQ_BUF_BYTES (512 * 1024)
+
+/*
+ * Larger files (such as panoramas, which are streamed from a tile file)
+ * are not read; the callback is given NULL data and reads them itself.
+ */
+#define IOQ_MAX_FILE  (8 * 1024 * 1024)
+
+/*
+ * Called with the contents of file idx: len bytes at data (valid only
+ * during the call), and its modification time.  data is NULL if the
+ * file was not read whole (too large, missing, or a read failed); the
+ * callback may then read it by other means and report any error.
+ * Returns 0 to continue, or -1 to stop reading.
+ */
+typedef int32_t (*ioq_done_fn_t) (void* arg, int32_t idx, const void* data,
+				  size_t len, int64_t mtime);
+
+/*
+ * Read n files, keeping up to depth reads in flight, and pass each to
+ * done_fn (on the calling thread) as its read completes, in any order.
+ * Returns 0 on success, or -1 if memory runs out or done_fn fails.
+ */
+extern int32_t ioq_read_files (int32_t n, const char* const* fname,
+			       int32_t depth, ioq_done_fn_t done_fn,
+			       void* arg);
+
+#endif /* IOQ_H */
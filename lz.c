@@ -0,0 +1,217 @@
+/*									tab:8
+ *
+ * lz.c - small LZ77 byte codec (see lz.h for the block format)
+ *
+ * Filename:	    lz.c
+ * History:
+ *	1	Added an LZ4-style block codec for room photo tiles.
+ */
+
+#include <string.h>
+
+#include "lz.h"
+
+
+/* parameters defined for this file */
+#define LZ_HASH_BITS 12			/* match finder table size  */
+#define LZ_MAX_OFFSET 65535		/* farthest back reference  */
+
+
+/* local functions--see function headers for details */
+static uint8_t* put_length (uint8_t* out, size_t len);
+static uint8_t* put_sequence (uint8_t* out, const uint8_t* lit,
+			      size_t n_lit, size_t offset, size_t match);
+static uint32_t hash4 (const uint8_t* p);
+
+
+/*
+ * lz_compress
+ *   DESCRIPTION: Compress bytes greedily, finding earlier copies of each
+ *                four-byte string through a hash table of last positions.
+ *   INPUTS: src -- bytes to compress
+ *           n -- number of bytes
+ *   OUTPUTS: dst -- compressed block (up to LZ_BOUND (n) bytes)
+ *   RETURN VALUE: length of compressed block
+ *   SIDE EFFECTS: none
+ */
+size_t
+lz_compress (const uint8_t* src, size_t n, uint8_t* dst)
+{
+    uint32_t table[1 << LZ_HASH_BITS]; /* last position + 1 of each hash */
+    uint8_t* out = dst;		/* next output byte                */
+    size_t   i;			/* current input position          */
+    size_t   anchor;		/* first byte not yet emitted      */
+    size_t   cand;		/* earlier position with same hash */
+    size_t   m;			/* match length                    */
+    uint32_t h;			/* hash of bytes at i              */
+
+    memset (table, 0, sizeof (table));
+    i = anchor = 0;
+    while (n >= i + LZ_MIN_MATCH) {
+	h = hash4 (src + i);
+	cand = table[h];
+	table[h] = i + 1;
+	if (0 == cand-- || LZ_MAX_OFFSET < i - cand ||
+	    0 != memcmp (src + cand, src + i, LZ_MIN_MATCH)) {
+	    i++;
+	    continue;
+	}
+	for (m = LZ_MIN_MATCH; n > i + m && src[cand + m] == src[i + m]; m++);
+	out = put_sequence (out, src + anchor, i - anchor, i - cand, m);
+	i += m;
+	anchor = i;
+    }
+
+    /* The last sequence holds the remaining literals. */
+    return put_sequence (out, src + anchor, n - anchor, 0, 0) - dst;
+}
+
+
+/*
+ * lz_decompress
+ *   DESCRIPTION: Expand a compressed block, checking every length and
+ *                offset against the input and output sizes.
+ *   INPUTS: src -- compressed block
+ *           len -- length of block
+ *           n -- expected expanded length
+ *   OUTPUTS: dst -- n expanded bytes
+ *   RETURN VALUE: 0 on success, or -1 if the block is damaged
+ *   SIDE EFFECTS: none
+ */
+int32_t
+lz_decompress (const uint8_t* src, size_t len, uint8_t* dst, size_t n)
+{
+    const uint8_t* in = src;		/* next input byte        */
+    const uint8_t* end = src + len;	/* end of input           */
+    size_t         out = 0;		/* bytes written to dst   */
+    size_t         n_lit;		/* literal count          */
+    size_t         m;			/* match length           */
+    size_t         offset;		/* match offset           */
+    uint8_t        token;		/* sequence token         */
+    uint8_t        b;			/* length extension byte  */
+
+    while (end > in) {
+	token = *in++;
+
+	/* Copy the literals. */
+	n_lit = token >> 4;
+	if (15 == n_lit) {
+	    do {
+		if (end == in) {
+		    return -1;
+		}
+		n_lit += (b = *in++);
+	    } while (255 == b);
+	}
+	if ((size_t)(end - in) < n_lit || n - out < n_lit) {
+	    return -1;
+	}
+	memcpy (dst + out, in, n_lit);
+	in += n_lit;
+	out += n_lit;
+
+	/* A sequence without an offset ends the block. */
+	if (end == in) {
+	    return (n == out ? 0 : -1);
+	}
+
+	/* Copy the match, a byte at a time since it may overlap. */
+	if (2 > end - in) {
+	    return -1;
+	}
+	offset = in[0] | (in[1] << 8);
+	in += 2;
+	m = (token & 15) + LZ_MIN_MATCH;
+	if (15 + LZ_MIN_MATCH == m) {
+	    do {
+		if (end == in) {
+		    return -1;
+		}
+		m += (b = *in++);
+	    } while (255 == b);
+	}
+	if (0 == offset || out < offset || n - out < m) {
+	    return -1;
+	}
+	for (; 0 < m; m--, out++) {
+	    dst[out] = dst[out - offset];
+	}
+    }
+    return -1;
+}
+
+
+/*
+ * put_length
+ *   DESCRIPTION: Write the extension bytes of a token field of 15 or more.
+ *   INPUTS: out -- where to write
+ *           len -- field value minus 15
+ *   OUTPUTS: none
+ *   RETURN VALUE: next output byte
+ *   SIDE EFFECTS: writes to out
+ */
+static uint8_t*
+put_length (uint8_t* out, size_t len)
+{
+    for (; 255 <= len; len -= 255) {
+	*out++ = 255;
+    }
+    *out++ = len;
+    return out;
+}
+
+
+/*
+ * put_sequence
+ *   DESCRIPTION: Write one sequence of literals and a match (or, with a
+ *                match length of zero, the final literals of a block).
+ *   INPUTS: out -- where to write
+ *           lit -- literal bytes
+ *           n_lit -- number of literal bytes
+ *           offset -- match offset
+ *           match -- match length (0, or at least LZ_MIN_MATCH)
+ *   OUTPUTS: none
+ *   RETURN VALUE: next output byte
+ *   SIDE EFFECTS: writes to out
+ */
+static uint8_t*
+put_sequence (uint8_t* out, const uint8_t* lit, size_t n_lit, size_t offset,
+	      size_t match)
+{
+    uint8_t* token = out++;	/* token byte, filled in last */
+    size_t   m;			/* match length field         */
+
+    m = (0 == match ? 0 : match - LZ_MIN_MATCH);
+    *token = ((15 < n_lit ? 15 : n_lit) << 4) | (15 < m ? 15 : m);
+    if (15 <= n_lit) {
+	out = put_length (out, n_lit - 15);
+    }
+    memcpy (out, lit, n_lit);
+    out += n_lit;
+    if (0 != match) {
+	*out++ = offset & 0xFF;
+	*out++ = offset >> 8;
+	if (15 <= m) {
+	    out = put_length (out, m - 15);
+	}
+    }
+    return out;
+}
+
+
+/*
+ * hash4
+ *   DESCRIPTION: Hash four bytes for the match finder.
+ *   INPUTS: p -- the bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: hash value (LZ_HASH_BITS bits)
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+hash4 (const uint8_t* p)
+{
+    uint32_t v; /* the bytes as a word */
+
+    memcpy (&v, p, sizeof (v));
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
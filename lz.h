@@ -0,0 +1,47 @@
+/*									tab:8
+ *
+ * lz.h - header file for a small LZ77 byte codec used to keep pixel
+ *        data compressed in memory
+ *
+ * Filename:	    lz.h
+ * History:
+ *	1	Added an LZ4-style block codec for room photo tiles.
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * A compressed block is a series of sequences.  Each starts with a token
+ * byte: the high four bits give a count of literal bytes and the low
+ * four bits a match length minus LZ_MIN_MATCH.  A field of 15 continues
+ * in the following bytes, each added in, until one is not 255.  The
+ * literal bytes follow, then a 16-bit little-endian offset back into the
+ * output (at least 1), from which the match is copied (it may overlap
+ * the bytes being written).  The last sequence has literals only and
+ * ends the block.
+ *
+ * Decoding is a loop of copies with no tables, so tiles can be expanded
+ * on demand as the view moves.
+ */
+
+#define LZ_MIN_MATCH 4
+
+/* most bytes that compressing n bytes can produce */
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+/* Compress n bytes into dst (LZ_BOUND (n) bytes); returns the length. */
+extern size_t lz_compress (const uint8_t* src, size_t n, uint8_t* dst);
+
+/*
+ * Expand a block of len bytes into exactly n bytes at dst.  Returns 0 on
+ * success, or -1 if the block is damaged (dst is then undefined).
+ */
+extern int32_t lz_decompress (const uint8_t* src, size_t len, uint8_t* dst,
+			      size_t n);
+
+#endif /* LZ_H */
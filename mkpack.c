@@ -0,0 +1,183 @@
+/*									tab:8
+ *
+ * mkpack.c - utility program that packs room photos and object images
+ *            into one asset pack file for the adventure game
+ *
+ * Filename:	    mkpack.c
+ * History:
+ *	1	Added a single-file asset pack that is mapped at startup.
+ */
+
+
+/*
+ * Usage: mkpack <pack file> <file>...
+ *
+ * Each file is packed under the name given on the command line, which
+ * must be the name the game uses for it (such as "images/foo.photo"), 
+ * along with its size and modification time.  See photo_headers.h for
+ * the format.  The pack is written under a temporary name and renamed
+ * when complete.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "photo_headers.h"
+
+
+/* one file to pack */
+typedef struct item_t item_t;
+struct item_t {
+    const char* fname;	/* name of file (and name in pack) */
+    uint64_t    size;	/* size of file                    */
+    int64_t     mtime;	/* modification time of file       */
+};
+
+
+/*
+ * compare_items
+ *   DESCRIPTION: Order files by name for qsort, as the index requires.
+ *   INPUTS: a, b -- the items
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative, zero, or positive as for strcmp
+ *   SIDE EFFECTS: none
+ */
+static int
+compare_items (const void* a, const void* b)
+{
+    return strcmp (((const item_t*)a)->fname, ((const item_t*)b)->fname);
+}
+
+
+/*
+ * copy_file
+ *   DESCRIPTION: Append a file's contents to the pack, then pad the pack
+ *                to the next PACK_ALIGN boundary.
+ *   INPUTS: out -- the pack
+ *           it -- the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 on success, 0 on failure
+ *   SIDE EFFECTS: writes to out
+ */
+static int
+copy_file (FILE* out, const item_t* it)
+{
+    static const uint8_t zero[PACK_ALIGN]; /* padding       */
+    FILE*                in;		   /* the file      */
+    uint8_t*             data;		   /* its contents  */
+    size_t               pad;		   /* padding bytes */
+    int                  ok;
+
+    if (NULL == (in = fopen (it->fname, "rb"))) {
+	perror (it->fname);
+	return 0;
+    }
+    pad = (PACK_ALIGN - it->size % PACK_ALIGN) % PACK_ALIGN;
+    ok = (NULL != (data = malloc (it->size + 1)) &&
+	  it->size == fread (data, 1, it->size, in) &&
+	  it->size == fwrite (data, 1, it->size, out) &&
+	  pad == fwrite (zero, 1, pad, out));
+    if (!ok) {
+	fprintf (stderr, "%s: could not be packed\n", it->fname);
+    }
+    free (data);
+    (void)fclose (in);
+    return ok;
+}
+
+
+int
+main (int argc, char* argv[])
+{
+    FILE*         out;		/* the pack                   */
+    char*         tmp;		/* temporary name of the pack */
+    item_t*       item;		/* files to pack              */
+    pack_header_t hdr;		/* pack header                */
+    pack_entry_t  ent;		/* one index entry            */
+    struct stat   sb;		/* status of a file           */
+    uint64_t      pos;		/* start of next contents     */
+    uint32_t      name_off;	/* start of next name         */
+    int           n;		/* number of files            */
+    int           i;		/* index over files           */
+    int           ok;
+
+    if (3 > argc) {
+	fprintf (stderr, "usage: %s <pack file> <file>...\n", argv[0]);
+	return 2;
+    }
+    n = argc - 2;
+    if (NULL == (item = calloc (n, sizeof (*item))) ||
+	NULL == (tmp = malloc (strlen (argv[1]) + sizeof (".tmp")))) {
+	perror ("allocate index");
+	return 2;
+    }
+
+    /* Gather the files' sizes and times, and sort them by name. */
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, PACK_MAGIC, sizeof (hdr.magic));
+    hdr.n_entries = n;
+    for (i = 0; n > i; i++) {
+	if (0 != stat (argv[i + 2], &sb)) {
+	    perror (argv[i + 2]);
+	    return 2;
+	}
+	item[i].fname = argv[i + 2];
+	item[i].size = sb.st_size;
+	item[i].mtime = sb.st_mtime;
+	hdr.names_size += strlen (argv[i + 2]) + 1;
+    }
+    qsort (item, n, sizeof (*item), compare_items);
+    for (i = 1; n > i; i++) {
+	if (0 == strcmp (item[i - 1].fname, item[i].fname)) {
+	    fprintf (stderr, "%s is named twice.\n", item[i].fname);
+	    return 2;
+	}
+    }
+
+    /* Write the header, the index, the names, and the contents. */
+    sprintf (tmp, "%s.tmp", argv[1]);
+    if (NULL == (out = fopen (tmp, "wb"))) {
+	perror (tmp);
+	return 2;
+    }
+    ok = (1 == fwrite (&hdr, sizeof (hdr), 1, out));
+    pos = sizeof (hdr) + (uint64_t)n * sizeof (ent) + hdr.names_size;
+    pos = (pos + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+    name_off = 0;
+    for (i = 0; ok && n > i; i++) {
+	memset (&ent, 0, sizeof (ent));
+	ent.offset = pos;
+	ent.size = item[i].size;
+	ent.mtime = item[i].mtime;
+	ent.name_off = name_off;
+	ok = (1 == fwrite (&ent, sizeof (ent), 1, out));
+	pos += (item[i].size + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+	name_off += strlen (item[i].fname) + 1;
+    }
+    for (i = 0; ok && n > i; i++) {
+	ok = (1 == fwrite (item[i].fname, strlen (item[i].fname) + 1, 1, 
+			   out));
+    }
+    ok = (ok && 0 == fseek (out, (ftell (out) + PACK_ALIGN - 1) / 
+			    PACK_ALIGN * PACK_ALIGN, SEEK_SET));
+    for (i = 0; ok && n > i; i++) {
+	ok = copy_file (out, &item[i]);
+    }
+
+    /* Close the pack and give it its name. */
+    if (EOF == fclose (out) || !ok || 0 != rename (tmp, argv[1])) {
+	perror ("write pack file");
+	(void)unlink (tmp);
+	return 3;
+    }
+    printf ("%s: %d files, %llu bytes\n", argv[1], n, 
+	    (unsigned long long)pos);
+    free (item);
+    free (tmp);
+    return 0;
+}
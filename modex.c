@@ -41,41 +41,57 @@
  */
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/io.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 #include<stdint.h>
 #include<stdlib.h>
 
+#include "capture.h"
+#include "copy.h"
 #include "modex.h"
+#include "stats.h"
 #include "text.h"
 
 
 /* 
  * Calculate the image build buffer parameters.  SCROLL_SIZE is the space
- * needed for one plane of an image.  SCREEN_SIZE is the space needed for
- * all four planes.  The extra +1 supports logical view x coordinates that 
- * are not multiples of four.  In these cases, some plane addresses are 
- * shifted by 1 byte forward.  The planes are stored in the build buffer 
- * in reverse order to allow those planes that shift forward to do so 
- * without running into planes that aren't shifted.  For example, when 
- * the leftmost x pixel in the logical view is 3 mod 4, planes 2, 1, and 0 
- * are shifted forward, while plane 3 is not, so there is one unused byte 
- * between the image of plane 3 and that of plane 2.  BUILD_BUF_SIZE is
- * the size of the space allocated for building images.  We add 20000 bytes
- * to reduce the number of memory copies required during scrolling.
- * Strictly speaking (try it), no extra space is necessary, but the minimum 
- * means an extra 64kB memory copy with every scroll pixel.  Finally,
- * BUILD_BASE_INIT places initial (or transferred) logical view in the
- * middle of the available buffer area.
+ * needed for one plane of an image.  Each plane is kept in a ring of
+ * BUILD_RING_SIZE bytes (a power of two at least SCROLL_SIZE), and
+ * BUILD_BUF_SIZE is the space for all four rings.  See the comments on
+ * the build buffer below for the addressing.
  */
 #define SCROLL_SIZE     (SCROLL_X_WIDTH * SCROLL_Y_DIM)
-#define SCREEN_SIZE	(SCROLL_SIZE * 4 + 1)
-#define BUILD_BUF_SIZE  (SCREEN_SIZE + 20000) 
+#define BUILD_RING_SIZE 16384
+#define BUILD_RING_MASK (BUILD_RING_SIZE - 1)
+#define BUILD_BUF_SIZE  (BUILD_RING_SIZE * 4)
 #define STATUSBAR_PLANE_SIZE	((SCROLL_X_DIM * 18) / 4)
-#define BUILD_BASE_INIT ((BUILD_BUF_SIZE - SCREEN_SIZE) / 2)
+
+/*
+ * Hardware scrolling parameters.  The room image occupies the video memory
+ * from HW_SCROLL_BASE (just after the status bar) to the end of each
+ * plane, HW_SCROLL_SPAN bytes in all.  HW_DIRTY_MAX is the number of lines
+ * (of each direction) that can be drawn between calls to show_screen
+ * before we give up and copy the whole screen instead.
+ */
+#define HW_SCROLL_BASE  STATUSBAR_PLANE_SIZE
+#define HW_SCROLL_SPAN  (65536 - HW_SCROLL_BASE)
+#define HW_DIRTY_MAX    32
+
+/*
+ * Display pages.  Two pages (alternating with ^ 0x4000) are used normally;
+ * triple buffering adds a third.  Each page holds SCROLL_SIZE + 1 bytes per
+ * plane.  RETRACE_NSEC is the frame period of mode X (70 Hz), used to
+ * pace page flips on a headless display.
+ */
+#define NUM_PAGES       3
+#define PAGE_BASE       5760  /* 18*320 gives value of memory after status bar is finished */
+#define RETRACE_NSEC    14285714
 
 /* Mode X and general VGA parameters */
 #define VID_MEM_SIZE       131072
@@ -102,9 +118,10 @@ static unsigned char mode_X_attr[NUM_ATTR_REGS * 2] = {
     0x04, 0x04, 0x05, 0x05, 0x06, 0x06, 0x07, 0x07, 
     0x08, 0x08, 0x09, 0x09, 0x0A, 0x0A, 0x0B, 0x0B, 
     0x0C, 0x0C, 0x0D, 0x0D, 0x0E, 0x0E, 0x0F, 0x0F,
-    0x10, 0x41, 0x11, 0x00, 0x12, 0x0F, 0x13, 0x00,
+    0x10, 0x61, 0x11, 0x00, 0x12, 0x0F, 0x13, 0x00,
     0x14, 0x00, 0x15, 0x00
 };
+//Mode control changed from 0x41 to 0x61 so that pixel panning (used for hardware scrolling) stops at the line compare split, leaving the status bar in place
 static unsigned short mode_X_graphics[NUM_GRAPHICS_REGS] = {
     0x0000, 0x0001, 0x0002, 0x0003, 0x0004, 0x4005, 0x0506, 0x0F07,
     0xFF08
@@ -146,7 +163,29 @@ static void fill_palette_mode_x ();
 static void fill_palette_text ();
 static void write_font_data ();
 static void set_text_mode_3 (int clear_scr);
-static void copy_image (unsigned char* img, unsigned short scr_addr);
+#if !defined(TEXT_RESTORE_PROGRAM)
+static void put_horiz_line (unsigned char* base, int x, int y,
+			    unsigned char buf[SCROLL_X_DIM]);
+#endif
+static void copy_image (unsigned char* img, unsigned short scr_addr,
+			int len);
+static int copy_ring (unsigned char* ring, int idx, unsigned short scr_addr,
+		      int len);
+static void set_write_plane (int plane);
+static void set_pixel_panning (int pan);
+static int start_triple_buffering ();
+static void capture_view ();
+static void set_display_start (unsigned short addr, int pan);
+static int copy_view (int base);
+static int copy_dirty_lines (int base);
+static void latch_copy_image (unsigned short src_addr,
+			      unsigned short scr_addr, int len);
+static int show_screen_hw ();
+static void show_screen_latch ();
+static unsigned short next_page ();
+static void present_page (int pan);
+static void* present_thread (void* ignore);
+static int wait_for_retrace (int in_retrace);
 //extern void copypalletetoVGA(uint8_t pallette[192][3]);
 
 
@@ -159,15 +198,17 @@ static void copy_image (unsigned char* img, unsigned short scr_addr);
  * the number of video memory writes; unfortunately, these techniques
  * are slower in emulation...). 
  *
- * The size allows the four plane images to move within an area of
- * about twice the size necessary (to reduce the need to deal with
- * the boundary conditions by moving the data within the buffer).
+ * Each plane is a ring: logical pixel (x,y) is kept in ring 3 - (x & 3)
+ * at index ((x >> 2) + y * SCROLL_X_WIDTH) & BUILD_RING_MASK.  For any
+ * view window, the pixels of one plane have SCROLL_SIZE consecutive
+ * logical indices, so they never collide in the ring, and a pixel keeps
+ * its index as the view moves.  Changing the view therefore never moves
+ * data (only the newly exposed lines must be drawn), and each plane is
+ * copied to video memory in at most two pieces (split where the ring
+ * wraps).
  *
- * Plane 3 is first, followed by 2, 1, and 0.  The reverse ordering
- * is used because the logical address of 0 increases first; if plane
- * 0 were first, we would need a buffer byte to keep it from colliding
- * with plane 1 when plane 0 was offset by 1 from plane 1, i.e., when
- * displaying a one-pixel left shift.
+ * Plane 3 is first, followed by 2, 1, and 0, as in the original linear
+ * buffer, so the plane arithmetic matches the rest of the code.
  *
  * The memory fence (included when NDEBUG is not defined) allocates
  * the build buffer with extra space on each side.  The extra space
@@ -183,16 +224,94 @@ static void copy_image (unsigned char* img, unsigned short scr_addr);
 #endif
 #define MEM_FENCE_MAGIC 0xF3
 static unsigned char build[BUILD_BUF_SIZE + 2 * MEM_FENCE_WIDTH];
-static int img3_off;		    /* offset of upper left pixel   */
-static unsigned char* img3;	    /* pointer to upper left pixel  */
+static unsigned char* img3 = build + MEM_FENCE_WIDTH; /* plane 3 ring */
 static int show_x, show_y;          /* logical view coordinates     */
 
+/*
+ * Spare build buffers (see modex.h), laid out like the build buffer.
+ * use_spare_build exchanges pointers, so img3 may point into spare_build
+ * and spare[k] into build; the fence stays around the build array.
+ * Only the game draws into them.
+ */
+#if !defined(TEXT_RESTORE_PROGRAM)
+static unsigned char spare_build[NUM_SPARE_BUILDS][BUILD_BUF_SIZE];
+static unsigned char* spare[NUM_SPARE_BUILDS] = {
+    spare_build[0], spare_build[1], spare_build[2]
+};
+#endif
+
 /* displayed video memory variables */
 static unsigned char* mem_image;    /* pointer to start of video memory */
+static unsigned char* plane_image;  /* video memory for selected plane  */
 static unsigned short target_img;   /* offset of displayed screen image */
 static unsigned short statusbar_img;  /* offset of displayed status_bar image */
 unsigned char status_buffer[4][STATUSBAR_PLANE_SIZE]; //statusbar buffer that contains all mapping of pixels
 
+/*
+ * Headless display.  When set (by set_headless_display, before calling
+ * set_mode_X), "video memory" is four 64kB planes of ordinary memory and
+ * no VGA ports are touched, so the game can run without a display (for
+ * scripted replays and benchmarks).  The palette written by
+ * copypalletetoVGA is kept in headless_palette instead of the DAC.
+ */
+static int headless = 0;
+static unsigned char headless_palette[256][3];
+
+/*
+ * Hardware scrolling and latch copies.  Both keep the image in video memory
+ * with absolute planes: logical pixel (x,y) lives in video plane x & 3 at
+ * address base + (x >> 2) + y * SCROLL_X_WIDTH, and the pixel panning
+ * register supplies the last x & 3 of the view.  When a view is shown,
+ * only the rows and columns listed in dirty_row and dirty_col (logical
+ * coordinates, recorded by the drawing functions) are copied from the
+ * build buffer, unless screen_valid has been cleared.
+ *
+ * With hardware scrolling (set by set_hardware_scrolling, before calling
+ * set_mode_X), the room image stays in a single area of video memory,
+ * and moving the view changes only the CRTC start address and panning.
+ * The base is HW_SCROLL_BASE - hw_org; hw_org is chosen again (and the
+ * whole screen copied) whenever the view drifts out of the area.
+ *
+ * With latch copies (set_latch_copy), the two pages are kept, and the
+ * part of the displayed page that stays on the screen is copied into the
+ * other page within video memory using write mode 1, in which each byte
+ * read loads the latches of all four planes and each byte written stores
+ * them.  The base of each page is target_img minus the logical index of
+ * the upper left byte of its view (latch_first for the displayed page).
+ */
+static int hw_scroll = 0;		/* hardware scrolling enabled     */
+static int latch_copy = 0;		/* latch copies enabled           */
+static int screen_valid;		/* video memory holds last view   */
+static int hw_org;			/* logical index at HW_SCROLL_BASE */
+static int latch_first;			/* logical index of shown page    */
+static int dirty_row[HW_DIRTY_MAX];	/* rows drawn since show_screen   */
+static int dirty_col[HW_DIRTY_MAX];	/* columns drawn since show_screen */
+static int n_dirty_rows, n_dirty_cols;	/* number of entries in each      */
+
+/*
+ * Triple buffering.  When set (by set_triple_buffering, before calling
+ * set_mode_X), show_screen draws into one of three pages that is neither
+ * on the screen (shown_page) nor being flipped to (flip_page) nor waiting
+ * to be flipped to (pending_page), then queues it as pending_page and
+ * returns.  A helper thread, present_thread, writes the CRTC start address
+ * for the pending page and waits for vertical retrace, at which point the
+ * VGA has latched the new address and the page is shown.  If all three
+ * pages are busy, the pending page has not been flipped to yet, so it is
+ * dropped and drawn again; show_screen never waits for retrace.  All of
+ * the page variables are protected by present_lock.
+ */
+static int triple = 0;			/* triple buffering enabled       */
+static pthread_t present_thread_id;	/* thread that flips pages        */
+static pthread_mutex_t present_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t present_cv = PTHREAD_COND_INITIALIZER;
+static int present_stop;		/* asks present_thread to exit    */
+static int shown_page;			/* page on the screen             */
+static int flip_page;			/* page being flipped to, or -1   */
+static int pending_page;		/* page queued for a flip, or -1  */
+static int draw_page;			/* page most recently drawn       */
+static int pending_pan;			/* pixel panning for pending_page */
+static struct timespec pending_time;	/* when pending_page was queued   */
+
 
 /* 
  * functions provided by the caller to set_mode_X() and used to obtain  
@@ -202,6 +321,16 @@ unsigned char status_buffer[4][STATUSBAR_PLANE_SIZE]; //statusbar buffer that co
 static void (*horiz_line_fn) (int, int, unsigned char[SCROLL_X_DIM]);
 static void (*vert_line_fn) (int, int, unsigned char[SCROLL_Y_DIM]);
 
+/* 
+ * functions provided by the caller to set_strip_fill() and used to 
+ * obtain images of strips of lines (see draw_horiz_lines and
+ * draw_vert_lines); NULL to draw strips a line at a time
+ */
+#if !defined(TEXT_RESTORE_PROGRAM)
+static void (*horiz_strip_fn) (int, int, int, unsigned char*);
+static void (*vert_strip_fn) (int, int, int, unsigned char*);
+#endif
+
 /* 
  * macro used to target a specific video plane or planes when writing
  * to video memory in mode X; bits 8-11 in the mask_hi_bits enable writes
@@ -282,7 +411,8 @@ do {                                                                    \
  *   OUTPUTS: none
  *   RETURN VALUE: 0 on success, -1 on failure
  *   SIDE EFFECTS: initializes the logical view window; maps video memory
- *                 and obtains permission for VGA ports; clears video memory
+ *                 and obtains permission for VGA ports; clears video memory;
+ *                 selects the copy engine strategy (see copy.h)
  */   
 int
 set_mode_X (void (*horiz_fill_fn) (int, int, unsigned char[SCROLL_X_DIM]),
@@ -301,8 +431,8 @@ set_mode_X (void (*horiz_fill_fn) (int, int, unsigned char[SCROLL_X_DIM]),
 
     /* Initialize the logical view window to position (0,0). */
     show_x = show_y = 0;
-    img3_off = BUILD_BASE_INIT;
-    img3 = build + img3_off + MEM_FENCE_WIDTH;
+    screen_valid = 0;
+    n_dirty_rows = n_dirty_cols = 0;
 
     /* Set up the memory fence on the build buffer. */
     for (i = 0; i < MEM_FENCE_WIDTH; i++) {
@@ -312,12 +442,25 @@ set_mode_X (void (*horiz_fill_fn) (int, int, unsigned char[SCROLL_X_DIM]),
 
     /* One display page goes at the start of video memory. */
 
-    target_img = 5760; // 18*320 gives value of memory after status bar is finished
+    target_img = PAGE_BASE;
     statusbar_img=0; // starts at memory location 0.
+    shown_page = draw_page = 0;
+    flip_page = pending_page = -1;
+
+    /* A headless display only needs memory to draw into. */
+    if (headless) {
+	if ((mem_image = malloc (4 * MODE_X_MEM_SIZE)) == NULL)
+	    return -1;
+	plane_image = mem_image;
+	clear_screens ();
+	copy_calibrate (mem_image + target_img, SCROLL_SIZE);
+	return start_triple_buffering ();
+    }
 
     /* Map video memory and obtain permission for VGA port access. */
     if (open_memory_and_ports () == -1)
         return -1;
+    plane_image = mem_image;
 
     /* 
      * The code below was produced by recording a call to set mode 0013h
@@ -338,9 +481,33 @@ set_mode_X (void (*horiz_fill_fn) (int, int, unsigned char[SCROLL_X_DIM]),
     set_graphics_registers (mode_X_graphics);    /* graphics registers    */
     fill_palette_mode_x ();			 /* palette colors        */
     clear_screens ();				 /* zero video memory     */
+    copy_calibrate (mem_image + target_img, SCROLL_SIZE); /* copy engine */
     VGA_blank (0);			         /* unblank the screen    */
 
-    /* Return success. */
+    /* Start flipping pages on retrace if requested. */
+    return start_triple_buffering ();
+}
+
+
+/*
+ * start_triple_buffering
+ *   DESCRIPTION: Start the page-flipping thread if triple buffering was
+ *                requested (it is not used with hardware scrolling).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: creates a thread
+ */   
+static int
+start_triple_buffering ()
+{
+    if (!triple || hw_scroll)
+	return 0;
+    present_stop = 0;
+    if (0 != pthread_create (&present_thread_id, NULL, present_thread, NULL)) {
+	triple = 0;
+	return -1;
+    }
     return 0;
 }
 
@@ -358,12 +525,26 @@ void
 clear_mode_X ()
 {
     int i;   /* loop index for checking memory fence */
+
+    /* Stop flipping pages before leaving mode X. */
+    if (triple && !hw_scroll) {
+	(void)pthread_mutex_lock (&present_lock);
+	present_stop = 1;
+	(void)pthread_cond_signal (&present_cv);
+	(void)pthread_mutex_unlock (&present_lock);
+	(void)pthread_join (present_thread_id, NULL);
+    }
     
-    /* Put VGA into text mode, restore font data, and clear screens. */
-    set_text_mode_3 (1);
+    if (headless) {
+	/* Nothing to restore; just release the memory display. */
+	free (mem_image);
+    } else {
+	/* Put VGA into text mode, restore font data, and clear screens. */
+	set_text_mode_3 (1);
 
-    /* Unmap video memory. */
-    (void)munmap (mem_image, VID_MEM_SIZE);
+	/* Unmap video memory. */
+	(void)munmap (mem_image, VID_MEM_SIZE);
+    }
 
     /* Check validity of build buffer memory fence.  Report breakage. */
     for (i = 0; i < MEM_FENCE_WIDTH; i++) {
@@ -383,115 +564,24 @@ clear_mode_X ()
 
 /*
  * set_view_window
- *   DESCRIPTION: Set the logical view window, moving its location within
- *                the build buffer if necessary to keep all on-screen data
- *                in the build buffer.  If the location within the build
- *                buffer moves, this function copies all data from the old
- *                window that are within the new screen to the appropriate
- *                new location, so only data not previously on the screen 
- *                must be drawn before calling show_screen.
+ *   DESCRIPTION: Set the logical view window.  Pixels keep their places
+ *                in the build buffer rings as the window moves (see the
+ *                build buffer comments), so only data not previously on
+ *                the screen must be drawn before calling show_screen.
  *   INPUTS: (scr_x,scr_y) -- new upper left pixel of logical view window
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: may shift position of logical view window within build 
- *                 buffer
+ *   SIDE EFFECTS: changes the logical view window
  */   
 void
 set_view_window (int scr_x, int scr_y)
 {
-    int old_x, old_y;     /* old position of logical view window           */
-    int start_x, start_y; /* starting position for copying from old to new */ 
-    int end_x, end_y;     /* ending position for copying from old to new   */ 
-    int start_off;        /* offset of copy start relative to old build    */
-     		          /*    buffer start position                      */
-    int length;           /* amount of data to be copied                   */
-    int i;	          /* copy loop index                               */
-    unsigned char* start_addr;  /* starting memory address of copy     */
-    unsigned char* target_addr; /* destination memory address for copy */
-
-    /* Record the old position. */
-    old_x = show_x;
-    old_y = show_y;
-
-    /* Keep track of the new view window. */
+    uint64_t start = stat_cycles (); /* cycle count at entry (for stats.c) */
+
     show_x = scr_x;
     show_y = scr_y;
 
-    /*
-     * If the new view window fits within the boundaries of the build 
-     * buffer, we need move nothing around.
-    */
-    if (img3_off + (scr_x >> 2) + scr_y * SCROLL_X_WIDTH >= 0 &&
-        img3_off + 3 * SCROLL_SIZE +
-	    ((scr_x + SCROLL_X_DIM - 1) >> 2) + 
-	    (scr_y + SCROLL_Y_DIM - 1) * SCROLL_X_WIDTH < BUILD_BUF_SIZE)
-	return;
-
-    /*
-     * If the new screen does not overlap at all with the old screen, none
-     * of the old data need to be saved, and we can simply reposition the
-     * valid window of the build buffer in the middle of that buffer.
-     */
-    if (scr_x <= old_x - SCROLL_X_DIM || scr_x >= old_x + SCROLL_X_DIM ||
-	scr_y <= old_y - SCROLL_Y_DIM || scr_y >= old_y + SCROLL_Y_DIM) {
-	img3_off = BUILD_BASE_INIT - (scr_x >> 2) - scr_y * SCROLL_X_WIDTH;
-	img3 = build + img3_off + MEM_FENCE_WIDTH;
-	return;
-    }
-
-    /*
-     * Any still-visible portion of the old screen should be retained.
-     * Rather than clipping exactly, we copy all contiguous data between
-     * a clipped starting point to a clipped ending point (which may
-     * include non-visible data).
-     *
-     * The starting point is the maximum (x,y) coordinates between the
-     * new and old screens.  The ending point is the minimum (x,y)
-     * coordinates between the old and new screens (offset by the screen
-     * size).
-     */
-    if (scr_x > old_x) {
-        start_x = scr_x;
-	end_x = old_x;
-    } else {
-        start_x = old_x;
-	end_x = scr_x;
-    }
-    end_x += SCROLL_X_DIM - 1;
-    if (scr_y > old_y) {
-        start_y = scr_y;
-	end_y = old_y;
-    } else {
-        start_y = old_y;
-	end_y = scr_y;
-    }
-    end_y += SCROLL_Y_DIM - 1;
-
-    /* 
-     * We now calculate the starting and ending addresses for the copy
-     * as well as the new offsets for use with the build buffer.  The
-     * length to be copied is basically the ending offset minus the starting
-     * offset plus one (plus the three screens in between planes 3 and 0).
-     */
-    start_off = (start_x >> 2) + start_y * SCROLL_X_WIDTH;
-    start_addr = img3 + start_off;
-    length = (end_x >> 2) + end_y * SCROLL_X_WIDTH + 1 - start_off + 
-	     3 * SCROLL_SIZE;
-    img3_off = BUILD_BASE_INIT - (show_x >> 2) - show_y * SCROLL_X_WIDTH;
-    img3 = build + img3_off + MEM_FENCE_WIDTH;
-    target_addr = img3 + start_off;
-
-    /* 
-     * Copy the relevant portion of the screen from the old location to the
-     * new one.  The areas may overlap, so copy direction is important. 
-     * (You should be able to explain why!)
-     */
-    if (start_addr < target_addr)
-	for (i = length; i-- > 0; )
-	    target_addr[i] = start_addr[i];
-    else
-	for (i = 0; i < length; i++)
-	    target_addr[i] = start_addr[i];
+    stat_add (STAT_SET_VIEW, stat_cycles () - start);
 }
 
 
@@ -507,9 +597,30 @@ set_view_window (int scr_x, int scr_y)
 void
 show_screen ()
 {
-    unsigned char* addr;  /* source address for copy             */
+    unsigned char* ring;  /* build buffer ring for current plane */
     int p_off;            /* plane offset of first display plane */
     int i;		  /* loop index over video planes        */
+    int idx;              /* ring index of plane's first pixel   */
+    uint64_t start;       /* cycle count at entry (for stats.c)  */
+
+    /* Hand the frame to the recorder, if one is running. */
+    capture_view ();
+
+    start = stat_cycles ();
+
+    /* With hardware scrolling, only the exposed lines are copied. */
+    if (hw_scroll) {
+	stat_add_vram_bytes (show_screen_hw ());
+	stat_add (STAT_SHOW_SCREEN, stat_cycles () - start);
+	return;
+    }
+
+    /* With latch copies, most of the last page is copied within the VGA. */
+    if (latch_copy) {
+	show_screen_latch ();
+	stat_add (STAT_SHOW_SCREEN, stat_cycles () - start);
+	return;
+    }
 
     /* 
      * Calculate offset of build buffer plane to be mapped into plane 0 
@@ -517,25 +628,434 @@ show_screen ()
      */
     p_off = (3 - (show_x & 3));
 
-    /* Switch to the other target screen in video memory. */
-    target_img ^= 0x4000;
-
-    /* Calculate the source address. */
-    addr = img3 + (show_x >> 2) + show_y * SCROLL_X_WIDTH;
+    /* Switch to another target screen in video memory. */
+    target_img = next_page ();
 
-    /* Draw to each plane in the video memory. */
+    /* 
+     * Draw to each plane in the video memory, splitting the copy where
+     * the plane's ring wraps around.
+     */
     for (i = 0; i < 4; i++) {
-	SET_WRITE_MASK (1 << (i + 8));
-	copy_image (addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i), 
-	            target_img);
+	ring = img3 + ((p_off - i + 4) & 3) * BUILD_RING_SIZE;
+	idx = (show_x >> 2) + (p_off < i) + show_y * SCROLL_X_WIDTH;
+	set_write_plane (i);
+	(void)copy_ring (ring, idx, target_img, SCROLL_SIZE);
     }
+    stat_add_vram_bytes (4 * SCROLL_SIZE);
 
     /* 
      * Change the VGA registers to point the top left of the screen
      * to the video memory that we just filled.
      */
-    OUTW (0x03D4, (target_img & 0xFF00) | 0x0C);
-    OUTW (0x03D4, ((target_img & 0x00FF) << 8) | 0x0D);
+    present_page (0);
+
+    stat_add (STAT_SHOW_SCREEN, stat_cycles () - start);
+}
+
+
+/*
+ * capture_view
+ *   DESCRIPTION: Copy the logical view window from the build buffer and
+ *                the status bar into a frame recorder snapshot (see 
+ *                capture.h).  Encoding happens on the recorder's thread.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: queues a frame for the recorder, if one is running
+ */   
+static void
+capture_view ()
+{
+    capture_snap_t* snap; /* snapshot slot                       */
+    unsigned char* ring;  /* build buffer ring for current plane */
+    int p;                /* loop index over planes              */
+    int idx;              /* ring index of plane's first byte    */
+    int first;            /* bytes before the ring wraps around  */
+    int len;              /* bytes per plane                     */
+    uint64_t start;       /* cycle count at entry (for stats.c)  */
+
+    if (NULL == (snap = capture_get_snap ()))
+	return;
+
+    start = stat_cycles ();
+    snap->view_x = show_x;
+    snap->view_y = show_y;
+    len = sizeof (snap->view[0]);
+    for (p = 0; p < 4; p++) {
+	ring = img3 + (3 - p) * BUILD_RING_SIZE;
+	idx = ((show_x >> 2) + show_y * SCROLL_X_WIDTH) & BUILD_RING_MASK;
+	first = BUILD_RING_SIZE - idx;
+	if (first >= len) {
+	    memcpy (snap->view[p], ring + idx, len);
+	} else {
+	    memcpy (snap->view[p], ring + idx, first);
+	    memcpy (snap->view[p] + first, ring, len - first);
+	}
+    }
+    memcpy (snap->bar, status_buffer, sizeof (snap->bar));
+    capture_put_snap (snap);
+
+    stat_add (STAT_CAPTURE, stat_cycles () - start);
+}
+
+
+/*
+ * set_display_start
+ *   DESCRIPTION: Point the top left of the screen at a video memory
+ *                address and pixel offset.
+ *   INPUTS: addr -- CRTC start address
+ *           pan -- number of pixels (0 to 3) to pan left
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the displayed image (nothing when headless)
+ */   
+static void
+set_display_start (unsigned short addr, int pan)
+{
+    if (headless)
+	return;
+    OUTW (0x03D4, (addr & 0xFF00) | 0x0C);
+    OUTW (0x03D4, ((addr & 0x00FF) << 8) | 0x0D);
+    set_pixel_panning (pan);
+}
+
+
+/*
+ * copy_view
+ *   DESCRIPTION: Copy the whole logical view from the build buffer into
+ *                video memory with absolute planes (see hw_scroll).
+ *   INPUTS: base -- video memory address of logical index 0
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes written to video memory
+ *   SIDE EFFECTS: writes video memory
+ */   
+static int
+copy_view (int base)
+{
+    int q;   /* loop index over planes (x & 3) */
+    int idx; /* logical index of plane's first byte */
+
+    for (q = 0; q < 4; q++) {
+	idx = (show_x >> 2) + (q < (show_x & 3)) + show_y * SCROLL_X_WIDTH;
+	set_write_plane (q);
+	(void)copy_ring (img3 + (3 - q) * BUILD_RING_SIZE, idx, base + idx,
+			 SCROLL_SIZE);
+    }
+    return 4 * SCROLL_SIZE;
+}
+
+
+/*
+ * copy_dirty_lines
+ *   DESCRIPTION: Copy the rows and columns drawn since the last call that
+ *                are still in the logical view from the build buffer into
+ *                video memory with absolute planes (see hw_scroll).
+ *   INPUTS: base -- video memory address of logical index 0
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes written to video memory
+ *   SIDE EFFECTS: writes video memory; empties the dirty line lists
+ */   
+static int
+copy_dirty_lines (int base)
+{
+    unsigned char* ring; /* build buffer ring for current plane */
+    int q;               /* loop index over planes (x & 3)      */
+    int c0;              /* first visible column of plane q     */
+    int idx;             /* logical index of current byte       */
+    int k;               /* loop index over dirty lines         */
+    int i;               /* loop index over pixels in a column  */
+    int bytes = 0;       /* bytes written to video memory       */
+
+    for (q = 0; q < 4; q++) {
+	ring = img3 + (3 - q) * BUILD_RING_SIZE;
+	c0 = (show_x >> 2) + (q < (show_x & 3));
+	set_write_plane (q);
+
+	/* Copy each dirty row that is still on the screen. */
+	for (k = 0; k < n_dirty_rows; k++) {
+	    if (dirty_row[k] < show_y || dirty_row[k] >= show_y + SCROLL_Y_DIM)
+		continue;
+	    idx = c0 + dirty_row[k] * SCROLL_X_WIDTH;
+	    bytes += copy_ring (ring, idx, base + idx, SCROLL_X_WIDTH);
+	}
+
+	/* Copy each dirty column of this plane that is still on the screen. */
+	for (k = 0; k < n_dirty_cols; k++) {
+	    if ((dirty_col[k] & 3) != q || dirty_col[k] < show_x ||
+		dirty_col[k] >= show_x + SCROLL_X_DIM)
+		continue;
+	    idx = (dirty_col[k] >> 2) + show_y * SCROLL_X_WIDTH;
+	    for (i = 0; i < SCROLL_Y_DIM; i++) {
+		plane_image[base + idx] = ring[idx & BUILD_RING_MASK];
+		idx += SCROLL_X_WIDTH;
+	    }
+	    bytes += SCROLL_Y_DIM;
+	}
+    }
+    n_dirty_rows = n_dirty_cols = 0;
+    return bytes;
+}
+
+
+/*
+ * show_screen_hw
+ *   DESCRIPTION: Show the logical view window by hardware scrolling.
+ *                Copies the lines drawn since the last call (or the whole
+ *                screen, if the view has left the video memory area or
+ *                too many lines were drawn) into video memory, then points
+ *                the CRTC start address and pixel panning at the view.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes written to video memory
+ *   SIDE EFFECTS: writes video memory; changes the displayed image;
+ *                 empties the dirty line lists
+ */   
+static int
+show_screen_hw ()
+{
+    int first;  /* logical index of view's upper left byte */
+    int bytes;  /* bytes written to video memory           */
+
+    first = (show_x >> 2) + show_y * SCROLL_X_WIDTH;
+
+    /*
+     * If any plane of the view would fall outside the video memory area,
+     * center the area on the view and copy everything.  The plane that
+     * starts one byte after the others ends at first + SCROLL_SIZE.
+     */
+    if (first < hw_org || first + SCROLL_SIZE - hw_org >= HW_SCROLL_SPAN) {
+	hw_org = first - (HW_SCROLL_SPAN - SCROLL_SIZE - 1) / 2;
+	screen_valid = 0;
+    }
+
+    if (screen_valid) {
+	bytes = copy_dirty_lines (HW_SCROLL_BASE - hw_org);
+    } else {
+	bytes = copy_view (HW_SCROLL_BASE - hw_org);
+	n_dirty_rows = n_dirty_cols = 0;
+	screen_valid = 1;
+    }
+
+    /* Point the display at the view. */
+    set_display_start (HW_SCROLL_BASE + first - hw_org, show_x & 3);
+    return bytes;
+}
+
+
+/*
+ * show_screen_latch
+ *   DESCRIPTION: Show the logical view window on the other page, copying
+ *                the part of the displayed page that stays on the screen
+ *                within video memory and only the lines drawn since the
+ *                last call from the build buffer (or the whole screen, if
+ *                too many lines were drawn).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes video memory; changes the displayed image;
+ *                 empties the dirty line lists
+ */   
+static void
+show_screen_latch ()
+{
+    int first;       /* logical index of view's upper left byte     */
+    int delta;       /* change in first since the displayed page    */
+    int b0, b1;      /* range of new page bytes copied from old one */
+    unsigned short shown; /* address of the displayed page          */
+
+    first = (show_x >> 2) + show_y * SCROLL_X_WIDTH;
+    delta = first - latch_first;
+
+    /* Switch to another target screen in video memory. */
+    shown = target_img;
+    target_img = next_page ();
+
+    /*
+     * A page holds SCROLL_SIZE + 1 bytes (the plane that starts one byte
+     * after the others ends one byte later).  Byte b of the new page holds
+     * the same pixels as byte b + delta of the displayed page, as long as
+     * those were on the screen before; the rest are in the dirty lines.
+     * (With triple buffering, the last page may be drawn again.)
+     */
+    if (screen_valid && shown != target_img && delta > -(SCROLL_SIZE + 1) &&
+	delta < SCROLL_SIZE + 1) {
+	b0 = (delta < 0 ? -delta : 0);
+	b1 = (delta > 0 ? SCROLL_SIZE + 1 - delta : SCROLL_SIZE + 1);
+	latch_copy_image (shown + b0 + delta, target_img + b0, b1 - b0);
+	stat_add_latch_bytes (b1 - b0);
+	stat_add_vram_bytes (copy_dirty_lines (target_img - first));
+    } else {
+	stat_add_vram_bytes (copy_view (target_img - first));
+	n_dirty_rows = n_dirty_cols = 0;
+	screen_valid = 1;
+    }
+    latch_first = first;
+
+    /* Point the display at the new page. */
+    present_page (show_x & 3);
+}
+
+
+/*
+ * next_page
+ *   DESCRIPTION: Choose the display page to draw next.  Without triple
+ *                buffering, this is the page not on the screen.  With it,
+ *                this is a page that is neither shown nor being flipped
+ *                to nor queued, or else the queued page (which is then
+ *                dropped without being shown).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: video memory address of the page
+ *   SIDE EFFECTS: may drop a queued page
+ */   
+static unsigned short
+next_page ()
+{
+    int k; /* loop index over pages */
+
+    if (!triple)
+	return target_img ^ 0x4000;
+
+    (void)pthread_mutex_lock (&present_lock);
+    for (k = 0; k < NUM_PAGES; k++) {
+	if (k != shown_page && k != flip_page && k != pending_page)
+	    break;
+    }
+    if (k == NUM_PAGES) {
+	k = pending_page;
+	pending_page = -1;
+	stat_drop_frame ();
+    }
+    draw_page = k;
+    (void)pthread_mutex_unlock (&present_lock);
+    return PAGE_BASE + k * 0x4000;
+}
+
+
+/*
+ * present_page
+ *   DESCRIPTION: Show the page just drawn (target_img).  Without triple
+ *                buffering, the display is switched immediately; with it,
+ *                the page is queued for present_thread.
+ *   INPUTS: pan -- number of pixels (0 to 3) to pan left
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes (or queues a change to) the displayed image
+ */   
+static void
+present_page (int pan)
+{
+    if (!triple) {
+	set_display_start (target_img, pan);
+	return;
+    }
+    (void)pthread_mutex_lock (&present_lock);
+    pending_page = draw_page;
+    pending_pan = pan;
+    (void)clock_gettime (CLOCK_MONOTONIC, &pending_time);
+    (void)pthread_cond_signal (&present_cv);
+    (void)pthread_mutex_unlock (&present_lock);
+}
+
+
+/*
+ * present_thread
+ *   DESCRIPTION: Function executed by the page-flipping helper thread.
+ *                Waits for a page to be queued, writes its address into
+ *                the CRTC while the display is active, then waits for the
+ *                vertical retrace that latches it and sets pixel panning
+ *                during the retrace.  Records the time from queueing to
+ *                retrace as the present latency.
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: changes the displayed image
+ */   
+static void*
+present_thread (void* ignore)
+{
+    int page;              /* page being flipped to           */
+    int pan;               /* its pixel panning               */
+    struct timespec since; /* when the page was queued        */
+    struct timespec now;   /* time of the retrace             */
+    unsigned short addr;   /* CRTC start address for the page */
+
+    while (1) {
+	(void)pthread_mutex_lock (&present_lock);
+	while (-1 == pending_page && !present_stop)
+	    pthread_cond_wait (&present_cv, &present_lock);
+	if (present_stop) {
+	    (void)pthread_mutex_unlock (&present_lock);
+	    return NULL;
+	}
+	page = flip_page = pending_page;
+	pan = pending_pan;
+	since = pending_time;
+	pending_page = -1;
+	(void)pthread_mutex_unlock (&present_lock);
+
+	/*
+	 * The start address is latched at the start of vertical retrace,
+	 * so write it outside of retrace, then wait for the next one.
+	 */
+	addr = PAGE_BASE + page * 0x4000;
+	if (0 != wait_for_retrace (0))
+	    return NULL;
+	if (!headless) {
+	    OUTW (0x03D4, (addr & 0xFF00) | 0x0C);
+	    OUTW (0x03D4, ((addr & 0x00FF) << 8) | 0x0D);
+	}
+	if (0 != wait_for_retrace (1))
+	    return NULL;
+	if (!headless)
+	    set_pixel_panning (pan);
+	(void)clock_gettime (CLOCK_MONOTONIC, &now);
+
+	(void)pthread_mutex_lock (&present_lock);
+	shown_page = page;
+	flip_page = -1;
+	(void)pthread_mutex_unlock (&present_lock);
+
+	stat_present ((now.tv_sec - since.tv_sec) * 1000000 +
+		      (now.tv_nsec - since.tv_nsec) / 1000);
+    }
+}
+
+
+/*
+ * wait_for_retrace
+ *   DESCRIPTION: Wait until the VGA is (or is not) in vertical retrace,
+ *                according to input status register 1.  A headless
+ *                display has no retrace; waiting for one sleeps until the
+ *                next 70 Hz frame boundary instead.
+ *   INPUTS: in_retrace -- 1 to wait for retrace, 0 to wait for display
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if clear_mode_X asked us to stop
+ *   SIDE EFFECTS: resets the attribute controller's index/data flip-flop
+ */   
+static int
+wait_for_retrace (int in_retrace)
+{
+    struct timespec ts; /* next simulated retrace */
+    uint64_t ns;        /* current time in nanoseconds */
+
+    if (headless) {
+	if (in_retrace) {
+	    (void)clock_gettime (CLOCK_MONOTONIC, &ts);
+	    ns = (ts.tv_sec * 1000000000ULL + ts.tv_nsec) / RETRACE_NSEC;
+	    ns = (ns + 1) * RETRACE_NSEC;
+	    ts.tv_sec = ns / 1000000000ULL;
+	    ts.tv_nsec = ns % 1000000000ULL;
+	    (void)clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+	return (present_stop ? -1 : 0);
+    }
+    while (((inb (0x03DA) & 0x08) != 0) != in_retrace) {
+	if (present_stop)
+	    return -1;
+	sched_yield ();
+    }
+    return 0;
 }
 
 
@@ -550,6 +1070,12 @@ show_screen ()
 void 
 clear_screens ()
 {
+    /* A headless display keeps the four planes one after another. */
+    if (headless) {
+	memset (mem_image, 0, 4 * MODE_X_MEM_SIZE);
+	return;
+    }
+
     /* Write to all four planes at once. */ 
     SET_WRITE_MASK (0x0F00);
 
@@ -558,6 +1084,122 @@ clear_screens ()
 }
 
 
+/*
+ * set_headless_display
+ *   DESCRIPTION: Request that the next set_mode_X draw into ordinary
+ *                memory instead of the VGA.  No ports or /dev/mem are
+ *                needed, so the game can run without a display.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: all later drawing goes to the memory display
+ */   
+void
+set_headless_display ()
+{
+    headless = 1;
+}
+
+
+/*
+ * set_hardware_scrolling
+ *   DESCRIPTION: Request that the next set_mode_X scroll with the CRTC
+ *                start address and pixel panning, keeping the room image
+ *                in video memory and copying only newly exposed lines.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the behavior of show_screen
+ */   
+void
+set_hardware_scrolling ()
+{
+    hw_scroll = 1;
+}
+
+
+/*
+ * set_latch_copy
+ *   DESCRIPTION: Request that show_screen (after the next set_mode_X) copy
+ *                the part of the displayed page that stays on the screen
+ *                within video memory with VGA latches, rather than copying
+ *                the whole screen from the build buffer.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the behavior of show_screen
+ */   
+void
+set_latch_copy ()
+{
+    latch_copy = 1;
+}
+
+
+/*
+ * set_triple_buffering
+ *   DESCRIPTION: Request that the next set_mode_X use three display pages,
+ *                flipping to each on vertical retrace (see triple).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the behavior of show_screen
+ */   
+void
+set_triple_buffering ()
+{
+    triple = 1;
+}
+
+
+/*
+ * set_write_plane
+ *   DESCRIPTION: Select the video plane written by the following copies.
+ *   INPUTS: plane -- plane number (0 to 3)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets the VGA write mask, or for a headless display
+ *                 points plane_image at that plane's memory
+ */   
+static void
+set_write_plane (int plane)
+{
+    if (headless) {
+	plane_image = mem_image + plane * MODE_X_MEM_SIZE;
+	return;
+    }
+    SET_WRITE_MASK (1 << (plane + 8));
+}
+
+
+/*
+ * set_pixel_panning
+ *   DESCRIPTION: Shift the displayed image left by 0 to 3 pixels (the
+ *                part of the view's x coordinate below the CRTC start
+ *                address's four-pixel resolution).  The status bar is
+ *                not panned (see mode_X_attr).
+ *   INPUTS: pan -- number of pixels (0 to 3)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets the attribute controller's pixel panning register
+ */   
+static void
+set_pixel_panning (int pan)
+{
+    /* Reset attribute register to write index next rather than data. */
+    asm volatile (
+	"inb (%%dx),%%al"
+      : : "d" (0x03DA) : "eax", "memory");
+
+    /* 
+     * Select register 0x13 (keeping the display enabled with 0x20); in
+     * 256-color modes, panning counts half pixels.
+     */
+    OUTB (0x03C0, 0x33);
+    OUTB (0x03C0, pan * 2);
+}
+
+
 /* 
  * The functions inside the preprocessor block below rely on functions
  * in maze.c to generate graphical images of the maze.  These functions
@@ -585,31 +1227,42 @@ int
 draw_vert_line (int x)
 {
     unsigned char buf[SCROLL_Y_DIM]; /* buffer for graphical image of column */
-    unsigned char* addr;             /* address of first pixel in build    */
-   				     /*     buffer (without plane offset)  */
-    int p_off;                       /* offset of plane of first pixel     */
+    unsigned char* ring;             /* build buffer ring for the column   */
+    int idx;                         /* ring index of current pixel        */
     int i;			     /* loop index over pixels             */
+    uint64_t start;                  /* cycle count at entry (for stats.c) */
 
     /* Check whether requested line falls in the logical view window. */
     if (x < 0 || x >= SCROLL_X_DIM)
 	return -1;
 
+    start = stat_cycles ();
+
     /* Adjust x to the logical column value. */
     x += show_x;
 
     /* Get the image of the column. */
     (*vert_line_fn) (x, show_y, buf);
 
-    /* Calculate starting address in build buffer. */
-    addr = img3 + (x >> 2) + show_y * SCROLL_X_WIDTH;
-    /* Calculate plane offset of first pixel. */
-     p_off = (3 - (x & 3));
+    /* Find the column's ring and the index of its first pixel. */
+    ring = img3 + (3 - (x & 3)) * BUILD_RING_SIZE;
+    idx = (x >> 2) + show_y * SCROLL_X_WIDTH;
 
-    /* Copy image data into appropriate planes in build buffer. */
+    /* Copy image data into the ring, wrapping around as needed. */
     for (i = 0; i < SCROLL_Y_DIM; i++) {
-        addr[p_off * SCROLL_SIZE] = buf[i];
-        addr+=SCROLL_X_WIDTH;
-	}
+        ring[idx & BUILD_RING_MASK] = buf[i];
+        idx += SCROLL_X_WIDTH;
+    }
+
+    /* Remember the column for copying to video memory (see hw_scroll). */
+    if (hw_scroll || latch_copy) {
+	if (n_dirty_cols < HW_DIRTY_MAX)
+	    dirty_col[n_dirty_cols++] = x;
+	else
+	    screen_valid = 0;
+    }
+    stat_add (STAT_DRAW_VERT, stat_cycles () - start);
+
     /* Return success. */
     return 0;
 }
@@ -632,38 +1285,273 @@ int
 draw_horiz_line (int y)
 {
     unsigned char buf[SCROLL_X_DIM]; /* buffer for graphical image of row */
-    unsigned char* addr;             /* address of first pixel in build    */
-   				     /*     buffer (without plane offset)  */
-    int p_off;                       /* offset of plane of first pixel     */
-    int i;			     /* loop index over pixels             */
+    uint64_t start;                  /* cycle count at entry (for stats.c) */
 
     /* Check whether requested line falls in the logical view window. */
     if (y < 0 || y >= SCROLL_Y_DIM)
 	return -1;
 
+    start = stat_cycles ();
+
     /* Adjust y to the logical row value. */
     y += show_y;
 
     /* Get the image of the line. */
     (*horiz_line_fn) (show_x, y, buf);
 
-    /* Calculate starting address in build buffer. */
-    addr = img3 + (show_x >> 2) + y * SCROLL_X_WIDTH;
+    /* Copy image data into appropriate planes in build buffer. */
+    put_horiz_line (img3, show_x, y, buf);
+
+    /* Remember the row for copying to video memory (see hw_scroll). */
+    if (hw_scroll || latch_copy) {
+	if (n_dirty_rows < HW_DIRTY_MAX)
+	    dirty_row[n_dirty_rows++] = y;
+	else
+	    screen_valid = 0;
+    }
+    stat_add (STAT_DRAW_HORIZ, stat_cycles () - start);
+
+    /* Return success. */
+    return 0;
+}
+
+
+
+/*
+ * set_strip_fill
+ *   DESCRIPTION: Set the callbacks used by draw_horiz_lines and 
+ *                draw_vert_lines to obtain images of strips of lines
+ *                (see modex.h).
+ *   INPUTS: horiz_fill_fn -- fills rows y to y + n - 1, starting at 
+ *                            logical column x, or NULL
+ *           vert_fill_fn -- fills columns x to x + n - 1, starting at 
+ *                           logical row y, or NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the behavior of draw_horiz_lines and 
+ *                 draw_vert_lines
+ */   
+void
+set_strip_fill (void (*horiz_fill_fn) (int, int, int, unsigned char*),
+		void (*vert_fill_fn) (int, int, int, unsigned char*))
+{
+    horiz_strip_fn = horiz_fill_fn;
+    vert_strip_fn = vert_fill_fn;
+}
+
+
+/*
+ * draw_vert_lines
+ *   DESCRIPTION: Draw adjacent vertical map lines into the build buffer,
+ *                obtaining the image of up to MAX_STRIP_LINES of them 
+ *                with each call of the strip callback.
+ *   INPUTS: x0 -- the 0-based pixel column number of the first line 
+ *                 within the logical view window
+ *           n -- number of lines
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success.  If any of the lines is outside 
+ *                 of the valid SCROLL range, the function returns -1.
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+int
+draw_vert_lines (int x0, int n)
+{
+    unsigned char buf[MAX_STRIP_LINES * SCROLL_Y_DIM]; /* image of strip */
+    unsigned char* ring;	/* build buffer ring for a column         */
+    int x;			/* logical column of the strip's left side */
+    int w;			/* columns in the strip                   */
+    int col;			/* index over columns in the strip        */
+    int idx;			/* ring index of current pixel            */
+    int i;			/* loop index over rows                   */
+    uint64_t start;		/* cycle count at entry (for stats.c)     */
+
+    /* Check whether requested lines fall in the logical view window. */
+    if (x0 < 0 || n < 0 || x0 + n > SCROLL_X_DIM)
+	return -1;
+
+    if (vert_strip_fn == NULL) {
+	for (; n > 0; x0++, n--)
+	    (void)draw_vert_line (x0);
+	return 0;
+    }
+
+    for (; n > 0; x0 += w, n -= w) {
+	start = stat_cycles ();
+	w = (n < MAX_STRIP_LINES ? n : MAX_STRIP_LINES);
+
+	/* Adjust x to the logical column value and get the strip's image. */
+	x = x0 + show_x;
+	(*vert_strip_fn) (x, show_y, w, buf);
+
+	/* 
+	 * Copy each column into its ring, wrapping around as needed (see
+	 * draw_vert_line).
+	 */
+	for (col = 0; col < w; col++) {
+	    ring = img3 + (3 - ((x + col) & 3)) * BUILD_RING_SIZE;
+	    idx = ((x + col) >> 2) + show_y * SCROLL_X_WIDTH;
+	    for (i = 0; i < SCROLL_Y_DIM; i++) {
+		ring[idx & BUILD_RING_MASK] = buf[i * w + col];
+		idx += SCROLL_X_WIDTH;
+	    }
+
+	    /* Remember the column for copying to video memory. */
+	    if (hw_scroll || latch_copy) {
+		if (n_dirty_cols < HW_DIRTY_MAX)
+		    dirty_col[n_dirty_cols++] = x + col;
+		else
+		    screen_valid = 0;
+	    }
+	}
+	stat_add (STAT_DRAW_VERT, stat_cycles () - start);
+    }
+
+    /* Return success. */
+    return 0;
+}
+
+
+/*
+ * draw_horiz_lines
+ *   DESCRIPTION: Draw adjacent horizontal map lines into the build 
+ *                buffer, obtaining the image of up to MAX_STRIP_LINES of
+ *                them with each call of the strip callback.
+ *   INPUTS: y0 -- the 0-based pixel row number of the first line within
+ *                 the logical view window
+ *           n -- number of lines
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success.  If any of the lines is outside 
+ *                 of the valid SCROLL range, the function returns -1.
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+int
+draw_horiz_lines (int y0, int n)
+{
+    unsigned char buf[MAX_STRIP_LINES * SCROLL_X_DIM]; /* image of strip */
+    int y;			/* logical row of the strip's top         */
+    int h;			/* rows in the strip                      */
+    int row;			/* index over rows in the strip           */
+    uint64_t start;		/* cycle count at entry (for stats.c)     */
+
+    /* Check whether requested lines fall in the logical view window. */
+    if (y0 < 0 || n < 0 || y0 + n > SCROLL_Y_DIM)
+	return -1;
+
+    if (horiz_strip_fn == NULL) {
+	for (; n > 0; y0++, n--)
+	    (void)draw_horiz_line (y0);
+	return 0;
+    }
+
+    for (; n > 0; y0 += h, n -= h) {
+	start = stat_cycles ();
+	h = (n < MAX_STRIP_LINES ? n : MAX_STRIP_LINES);
+
+	/* Adjust y to the logical row value and get the strip's image. */
+	y = y0 + show_y;
+	(*horiz_strip_fn) (show_x, y, h, buf);
+
+	/* Copy each row into the build buffer, and remember it. */
+	for (row = 0; row < h; row++) {
+	    put_horiz_line (img3, show_x, y + row, buf + row * SCROLL_X_DIM);
+	    if (hw_scroll || latch_copy) {
+		if (n_dirty_rows < HW_DIRTY_MAX)
+		    dirty_row[n_dirty_rows++] = y + row;
+		else
+		    screen_valid = 0;
+	    }
+	}
+	stat_add (STAT_DRAW_HORIZ, stat_cycles () - start);
+    }
+
+    /* Return success. */
+    return 0;
+}
+
+
+/*
+ * draw_spare_line
+ *   DESCRIPTION: Draw a horizontal line into a spare build buffer, for a
+ *                logical view window at (0,0).
+ *   INPUTS: k -- spare build buffer (0 to NUM_SPARE_BUILDS - 1)
+ *           y -- the 0-based pixel row number of the line
+ *           buf -- image of the line
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success.  If k or y is out of range, the
+ *                 function returns -1.
+ *   SIDE EFFECTS: draws into the spare build buffer
+ */   
+int
+draw_spare_line (int k, int y, unsigned char buf[SCROLL_X_DIM])
+{
+    if (k < 0 || k >= NUM_SPARE_BUILDS || y < 0 || y >= SCROLL_Y_DIM)
+	return -1;
+    put_horiz_line (spare[k], 0, y, buf);
+    return 0;
+}
+
+
+/*
+ * use_spare_build
+ *   DESCRIPTION: Exchange a spare build buffer with the build buffer and
+ *                move the logical view window to (0,0), where the spare
+ *                was drawn.  The old build buffer becomes spare k.
+ *   INPUTS: k -- spare build buffer (0 to NUM_SPARE_BUILDS - 1)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the build buffer and the logical view window;
+ *                 the next show_screen copies the whole screen
+ */   
+void
+use_spare_build (int k)
+{
+    unsigned char* old = img3; /* build buffer being replaced */
+
+    if (k < 0 || k >= NUM_SPARE_BUILDS)
+	return;
+    img3 = spare[k];
+    spare[k] = old;
+    show_x = show_y = 0;
+
+    /* None of the screen in video memory can be reused. */
+    screen_valid = 0;
+    n_dirty_rows = n_dirty_cols = 0;
+}
+
+
+/*
+ * put_horiz_line
+ *   DESCRIPTION: Copy an image of a horizontal line into the planes of a
+ *                build buffer.
+ *   INPUTS: base -- plane 3 ring of the build buffer
+ *           (x,y) -- logical coordinates of the leftmost pixel
+ *           buf -- image of the line
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes into the build buffer
+ */   
+static void
+put_horiz_line (unsigned char* base, int x, int y,
+		unsigned char buf[SCROLL_X_DIM])
+{
+    int idx;   /* ring index of current pixel    */
+    int p_off; /* offset of plane of first pixel */
+    int i;     /* loop index over pixels         */
+
+    /* Calculate ring index of first pixel. */
+    idx = ((x >> 2) + y * SCROLL_X_WIDTH) & BUILD_RING_MASK;
 
     /* Calculate plane offset of first pixel. */
-    p_off = (3 - (show_x & 3));
+    p_off = (3 - (x & 3));
 
     /* Copy image data into appropriate planes in build buffer. */
     for (i = 0; i < SCROLL_X_DIM; i++) {
-        addr[p_off * SCROLL_SIZE] = buf[i];
+        base[p_off * BUILD_RING_SIZE + idx] = buf[i];
 	if (--p_off < 0) {
 	    p_off = 3;
-	    addr++;
+	    idx = (idx + 1) & BUILD_RING_MASK;
 	}
     }
-
-    /* Return success. */
-    return 0;
 }
 
 #endif /* !defined(TEXT_RESTORE_PROGRAM) */
@@ -878,6 +1766,9 @@ fill_palette_mode_x ()
 	{0x3F, 0x3F, 0x2A}, {0x3F, 0x3F, 0x3F}
     };
 
+    /* Tell the frame recorder (if any) about the colors. */
+    capture_palette (0, 64, &palette_RGB[0][0]);
+
     /* Start writing at color 0. */
     OUTB (0x03C8, 0x00);
 
@@ -898,11 +1789,22 @@ fill_palette_mode_x ()
 
 void copypalletetoVGA(uint8_t* pallette)
 {
-     /* Start writing at color 64. */
-    OUTB (0x03C8, 0x40);
+    uint64_t start = stat_cycles (); /* cycle count at entry (for stats.c) */
+
+    capture_palette (64, 192, pallette);
 
-    /* Write all 192 colors from array. */
-    REP_OUTSB (0x03C9, pallette, 192 * 3);
+    /* A headless display just remembers the colors. */
+    if (headless) {
+	memcpy (headless_palette[64], pallette, 192 * 3);
+    } else {
+	/* Start writing at color 64. */
+	OUTB (0x03C8, 0x40);
+
+	/* Write all 192 colors from array. */
+	REP_OUTSB (0x03C9, pallette, 192 * 3);
+    }
+
+    stat_add (STAT_PALETTE, stat_cycles () - start);
 }
 
 
@@ -1024,29 +1926,99 @@ set_text_mode_3 (int clear_scr)
  * copy_image
  *   DESCRIPTION: Copy one plane of a screen from the build buffer to the 
  *                video memory.
- *   INPUTS: img -- a pointer to a single screen plane in the build buffer
+ *   INPUTS: img -- a pointer to (part of) a screen plane in the build
+ *                  buffer
  *           scr_addr -- the destination offset in video memory
+ *           len -- number of bytes to copy (SCROLL_SIZE for a whole plane)
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: copies a plane from the build buffer to video memory
  */   
 static void
-copy_image (unsigned char* img, unsigned short scr_addr)
+copy_image (unsigned char* img, unsigned short scr_addr, int len)
+{
+    /* The copy engine picks the fastest way to write video memory. */
+    copy_bytes (plane_image + scr_addr, img, len);
+}
+
+
+/*
+ * copy_ring
+ *   DESCRIPTION: Copy consecutive logical bytes of one plane from a build
+ *                buffer ring to video memory, in two pieces if the ring
+ *                wraps around.
+ *   INPUTS: ring -- the plane's ring in the build buffer
+ *           idx -- logical index of the first byte (see build buffer)
+ *           scr_addr -- the destination offset in video memory
+ *           len -- number of bytes to copy (at most BUILD_RING_SIZE)
+ *   OUTPUTS: none
+ *   RETURN VALUE: len
+ *   SIDE EFFECTS: copies from the build buffer to video memory
+ */   
+static int
+copy_ring (unsigned char* ring, int idx, unsigned short scr_addr, int len)
 {
+    int first; /* bytes before the ring wraps around */
+
+    idx &= BUILD_RING_MASK;
+    first = BUILD_RING_SIZE - idx;
+    if (first >= len) {
+	copy_image (ring + idx, scr_addr, len);
+    } else {
+	copy_image (ring + idx, scr_addr, first);
+	copy_image (ring, scr_addr + first, len - first);
+    }
+    return len;
+}
+
+
+/*
+ * latch_copy_image
+ *   DESCRIPTION: Copy bytes of all four planes from one part of video
+ *                memory to another using write mode 1, in which the
+ *                latches loaded by each read are stored by each write.
+ *   INPUTS: src_addr -- the source offset in video memory
+ *           scr_addr -- the destination offset in video memory
+ *           len -- number of bytes (per plane) to copy
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: copies within video memory; leaves all planes enabled
+ *                 for writing
+ */   
+static void
+latch_copy_image (unsigned short src_addr, unsigned short scr_addr, int len)
+{
+    unsigned char* src = mem_image + src_addr; /* copy source      */
+    unsigned char* dst = mem_image + scr_addr; /* copy destination */
+    int q;                                     /* loop over planes */
+
+    /* A headless display has no latches; copy each plane instead. */
+    if (headless) {
+	for (q = 0; q < 4; q++)
+	    copy_bytes (dst + q * MODE_X_MEM_SIZE, src + q * MODE_X_MEM_SIZE,
+			len);
+	return;
+    }
+
     /* 
-     * memcpy is actually probably good enough here, and is usually
-     * implemented using ISA-specific features like those below,
-     * but the code here provides an example of x86 string moves
+     * Write all planes in write mode 1.  REP MOVSB reads and writes one
+     * byte at a time, so each write stores the four bytes just read.
+     * (Wider moves would store the latches of the last byte read, so
+     * this copy does not use the copy engine.)
      */
+    SET_WRITE_MASK (0x0F00);
+    OUTW (0x03CE, 0x4105);
     asm volatile (
         "cld                                                 ;"
-       	"movl $14560,%%ecx                                   ;" //change from 16000 to 14560 because screen size has changed.
        	"rep movsb    # copy ECX bytes from M[ESI] to M[EDI]  "
-      : /* no outputs */
-      : "S" (img), "D" (mem_image + scr_addr) 
-      : "eax", "ecx", "memory"
+      : "+S" (src), "+D" (dst), "+c" (len)
+      : /* no other inputs */
+      : "memory"
     );
+    OUTW (0x03CE, 0x4005);
 }
+
+
 /*
  * copy_status_bar
  *   DESCRIPTION: Copy one plane of a screen from the status_bar's build buffer to the 
@@ -1060,19 +2032,7 @@ copy_image (unsigned char* img, unsigned short scr_addr)
 static void
 copy_status_bar (unsigned char* img, unsigned short scr_addr)
 {
-    /* 
-     * memcpy is actually probably good enough here, and is usually
-     * implemented using ISA-specific features like those below,
-     * but the code here provides an example of x86 string moves
-     */
-    asm volatile (
-        "cld                                                 ;"
-       	"movl $1440,%%ecx                                   ;" 
-       	"rep movsb    # copy ECX bytes from M[ESI] to M[EDI]  "
-      : /* no outputs */
-      : "S" (img), "D" (mem_image + scr_addr) 
-      : "eax", "ecx", "memory"
-    );
+    copy_bytes (plane_image + scr_addr, img, STATUSBAR_PLANE_SIZE);
 }
 
 
@@ -1126,6 +2086,7 @@ show_status_bar (char room_name[],char typed_string[],char status_str[])
 
     int i;	/* loop index over each pixel in a plane         */ 
     int j;  /* loop index over video planes                  */
+    uint64_t start = stat_cycles (); /* cycle count at entry (for stats.c) */
 
     for(i=0;i<STATUSBAR_PLANE_SIZE;i++)
     {
@@ -1162,7 +2123,9 @@ show_status_bar (char room_name[],char typed_string[],char status_str[])
     /* Draw to each plane in the video memory. */
     for(i=0;i<4;i++)
     {
-        SET_WRITE_MASK (1 << (i+8)); // shift 1 by plane + 8
+        set_write_plane (i); // select plane i
 	    copy_status_bar(status_buffer[i],statusbar_img);
     }
+
+    stat_add (STAT_STATUS_BAR, stat_cycles () - start);
 }
@@ -115,6 +115,22 @@ extern unsigned char status_buffer[4][STATUSBAR_PLANE_SIZE]; //Status bar buffer
  * within a logical space defined by the program.  For example, if this
  * window shifts one pixel to the left, only the left border of the screen
  * is drawn.  Other data are left untouched in most cases.
+ *
+ * With hardware scrolling (set_hardware_scrolling), there is only one
+ * screen in video memory, inside a larger area that holds the room image
+ * around it.  Moving the view changes the CRTC start address and the
+ * pixel panning register, and show_screen copies only the lines drawn
+ * since the last call, unless the view has drifted out of the area.
+ *
+ * With latch copies (set_latch_copy), double-buffering is kept, but the
+ * part of the displayed screen that remains visible is copied to the new
+ * one inside video memory using the VGA latches, and only the newly drawn
+ * lines come from the build buffer.
+ *
+ * With triple buffering (set_triple_buffering), show_screen draws into a
+ * third page while a helper thread waits for vertical retrace to flip to
+ * the last page drawn, so the display neither tears nor makes the game
+ * wait.
  */
 
 /* configure VGA for mode X; initializes logical view to (0,0) */
@@ -123,6 +139,18 @@ extern int set_mode_X (void (*horiz_fill_fn)
 		       void (*vert_fill_fn) 
 		            (int, int, unsigned char[SCROLL_Y_DIM]));
 
+/* draw into system memory instead of the VGA (call before set_mode_X) */
+extern void set_headless_display ();
+
+/* scroll with the CRTC instead of copying pages (call before set_mode_X) */
+extern void set_hardware_scrolling ();
+
+/* copy unchanged screen data within video memory (call before set_mode_X) */
+extern void set_latch_copy ();
+
+/* flip among three pages on vertical retrace (call before set_mode_X) */
+extern void set_triple_buffering ();
+
 /* return to text mode */
 extern void clear_mode_X ();
 
@@ -141,6 +169,44 @@ extern int draw_horiz_line (int y);
 /* draw a vertical line at horizontal pixel x within the logical view window */
 extern int draw_vert_line (int x);
 
+/*
+ * A scroll step of several pixels exposes several adjacent lines.  The
+ * strip functions draw them together, each strip of up to 
+ * MAX_STRIP_LINES lines from one call of a strip callback, which fills
+ * its buffer in one pass over the room: rows y to y + n - 1 of 
+ * SCROLL_X_DIM pixels each (horizontal), or SCROLL_Y_DIM rows of the n 
+ * pixels from x to x + n - 1 (vertical), top row first.  Without strip
+ * callbacks, the lines are drawn one at a time.
+ */
+#define MAX_STRIP_LINES 8
+
+/* set callbacks for strips of lines (NULL for none; may be called anytime) */
+extern void set_strip_fill (void (*horiz_strip_fn) 
+				 (int, int, int, unsigned char*),
+			    void (*vert_strip_fn) 
+				 (int, int, int, unsigned char*));
+
+/* draw horizontal lines y0 to y0 + n - 1 within the logical view window */
+extern int draw_horiz_lines (int y0, int n);
+
+/* draw vertical lines x0 to x0 + n - 1 within the logical view window */
+extern int draw_vert_lines (int x0, int n);
+
+/*
+ * Spare build buffers hold screens drawn ahead of time (for example, the
+ * rooms next to the current one), each for a view window at (0,0).
+ * Drawing into a spare does not disturb the screen.  use_spare_build
+ * exchanges a spare with the build buffer, after which show_screen shows
+ * the spare's screen and the old build buffer is spare k.
+ */
+#define NUM_SPARE_BUILDS 3
+
+/* draw line y (an image of SCROLL_X_DIM pixels) into spare build buffer k */
+extern int draw_spare_line (int k, int y, unsigned char buf[SCROLL_X_DIM]);
+
+/* swap spare build buffer k in; sets logical view window to (0,0) */
+extern void use_spare_build (int k);
+
 extern void copypalletetoVGA(uint8_t* pallette);//copy pallette to Vga memory 
 
 #endif /* MODEX_H */
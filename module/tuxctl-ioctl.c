@@ -21,6 +21,7 @@
 #include <linux/kdev_t.h>
 #include <linux/tty.h>
 #include <linux/spinlock.h>
+#include <linux/jiffies.h>
 
 #include "tuxctl-ld.h"
 #include "tuxctl-ioctl.h"
@@ -32,6 +33,37 @@ extern unsigned char* mem_packet;
 extern unsigned char button[2];//global var with buttons
 int flag=1;//ack flag
 
+/*
+ * LED update cache.  The game asks for a new LED value far more often than
+ * the value changes, and the controller can only take one MTCP_LED_SET per
+ * MTCP_ACK.  Instead of dropping requests that arrive while an ACK is
+ * outstanding, we keep only the latest requested value (led_pending) and
+ * send it when the ACK arrives, and only if it differs from the value the
+ * device is already showing (led_shown).  All of these are shared between
+ * the ioctl path and tuxctl_handle_packet (interrupt context), so they are
+ * protected by led_lock.
+ */
+static spinlock_t led_lock = SPIN_LOCK_UNLOCKED;
+static unsigned long led_pending;	/* latest value requested by user   */
+static int led_pending_valid=0;		/* led_pending not yet sent          */
+static unsigned long led_shown;		/* value last sent to the device     */
+static int led_shown_valid=0;		/* led_shown reflects the device     */
+static struct tux_led_stats led_stats;	/* sent/coalesced/dropped counts    */
+
+/*
+ * Device clock state.  When clock_mode is set the LEDs show the tux's own
+ * clock (MTCP_LED_CLK) counting up from clock_start seconds, which were
+ * requested at jiffies value clock_base.  Both are kept so that the clock
+ * can be put back where it should be after an MTCP_RESET without any help
+ * from user space.  Protected by led_lock.
+ */
+static int clock_mode=0;
+static unsigned long clock_start;
+static unsigned long clock_base;
+
+static void led_flush(struct tty_struct* tty);
+static void clock_send(struct tty_struct* tty,unsigned long num_seconds);
+
 char hex_values[2][16]=
 {
 {0xE7,0x06,0xCB,0x8F,0x2E,0xAD,0xED,0x86,0xEF,0xAE,0xEE,0x6D,0xE1,0x4F,0xEB,0xE8},
@@ -52,6 +84,7 @@ void tuxctl_handle_packet (struct tty_struct* tty, unsigned char* packet)
 {
 	char init_buffer[3];
     unsigned a, b, c;
+    unsigned long flags;
 
     a = packet[0]; /* Avoid printk() sign extending the 8-bit */
     b = packet[1]; /* values when printing them. */
@@ -67,22 +100,37 @@ void tuxctl_handle_packet (struct tty_struct* tty, unsigned char* packet)
 
 	if(a==MTCP_ACK)
 	{
+		spin_lock_irqsave(&led_lock, flags);
 		flag=1;//allow additions to buffer
+		led_flush(tty);//send whatever was requested while we waited
+		spin_unlock_irqrestore(&led_lock, flags);
 		return;
 	}
 	if(a==MTCP_RESET)
 	{
-		int i;
-		for(i=0;i<6;i++)
-		{
-			tux_buffer[i]=tux_buffer_reset[i];
-		}
-		
 		init_buffer[0]=MTCP_BIOC_ON;
 		init_buffer[1]=MTCP_LED_USR;
 		init_buffer[2]= MTCP_DBG_OFF;
 		tuxctl_ldisc_put(tty,init_buffer, 3);
-		tuxctl_ldisc_put(tty,tux_buffer, 6);//fill buffer wuth previous buffer values 
+
+		//device display is blank now; resend the latest value we know of
+		spin_lock_irqsave(&led_lock, flags);
+		if(clock_mode)
+		{
+			//device clock restarted at 0:00; put it back to elapsed time
+			clock_send(tty,clock_start+(jiffies-clock_base)/HZ);
+			spin_unlock_irqrestore(&led_lock, flags);
+			return;
+		}
+		if(!led_pending_valid && led_shown_valid)
+		{
+			led_pending=led_shown;
+			led_pending_valid=1;
+		}
+		led_shown_valid=0;
+		flag=1;
+		led_flush(tty);
+		spin_unlock_irqrestore(&led_lock, flags);
 		return;
 	}
     //printk("packet : %x %x %x\n", a, b, c); */
@@ -113,11 +161,23 @@ int tuxinitialise(struct tty_struct* tty)
 {
 	int i=0;
 	char init_buffer[3];
-	for(i=0;i<8;i++)
+	unsigned long flags;
+	for(i=0;i<6;i++)
 	{
 		tux_buffer[i]=0;
 		tux_buffer_reset[i]=0;
 	}
+
+	//forget anything cached about the display; nothing is outstanding yet
+	spin_lock_irqsave(&led_lock, flags);
+	flag=1;
+	clock_mode=0;
+	led_pending_valid=0;
+	led_shown_valid=0;
+	led_stats.sent=0;
+	led_stats.coalesced=0;
+	led_stats.dropped=0;
+	spin_unlock_irqrestore(&led_lock, flags);
 	init_buffer[0]=MTCP_BIOC_ON;
 	init_buffer[1]=MTCP_LED_USR;
 	init_buffer[2]= MTCP_DBG_OFF;
@@ -177,14 +237,14 @@ int set_button(struct tty_struct* tty,unsigned long arg)
 }
 
 /* 
- * set_led_func 
- *   DESCRIPTION: updates tux buffer with set led opcode and required values to print LEDs according to argument
- *   INPUTS: struct tty_struct* tty, arg from user to display
- *   OUTPUTS: none
- *   RETURN VALUE: 0 
- *   SIDE EFFECTS: changes tux buffer
+ * led_encode 
+ *   DESCRIPTION: converts a TUX_SET_LED argument into the 6 byte MTCP_LED_SET packet
+ *   INPUTS: arg from user to display, packet to fill
+ *   OUTPUTS: packet -- MTCP_LED_SET opcode, LED mask and the four segment bytes
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
  */
-int set_led_func(struct tty_struct* tty,unsigned long arg)
+static void led_encode(unsigned long arg,char packet[6])
 {
 	
 	int first;
@@ -197,12 +257,6 @@ int set_led_func(struct tty_struct* tty,unsigned long arg)
 	char second_entry;
 	char third_entry;
 	char fourth_entry;
-	int i;
-
-	if(flag==0)
-	{
-		return 0;
-	}
 
 	first=arg & 0xF;
 	second=arg & 0xF0;
@@ -295,25 +349,211 @@ int set_led_func(struct tty_struct* tty,unsigned long arg)
 		}
 	}
 
-	tux_buffer[0]=MTCP_LED_SET;
-	tux_buffer[1]=0xF;
-	tux_buffer[2]=first_entry;
-	tux_buffer[3]=second_entry;
-	tux_buffer[4]=third_entry;
-	tux_buffer[5]=fourth_entry;
+	packet[0]=MTCP_LED_SET;
+	packet[1]=0xF;
+	packet[2]=first_entry;
+	packet[3]=second_entry;
+	packet[4]=third_entry;
+	packet[5]=fourth_entry;
+}
+
+/* 
+ * led_flush 
+ *   DESCRIPTION: sends the pending LED value to the tux if no ACK is outstanding
+ *                and the value differs from what the device already shows.
+ *                Must be called with led_lock held.
+ *   INPUTS: struct tty_struct* tty
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes tux buffer, clears flag and the pending value when a
+ *                 packet is sent
+ */
+static void led_flush(struct tty_struct* tty)
+{
+	int i;
+
+	if(flag==0 || led_pending_valid==0)
+	{
+		return;//wait for the ACK, or nothing to send
+	}
 
-	// printk("%d",first_entry);
-	// printk("%d",second_entry);
-	// printk("%d",third_entry);
-	// printk("%d",fourth_entry);
+	if(led_shown_valid && led_shown==led_pending)
+	{
+		led_pending_valid=0;
+		led_stats.dropped++;//device already shows this value
+		return;
+	}
 
+	led_encode(led_pending,tux_buffer);
 	for(i=0;i<6;i++)
 	{
 		tux_buffer_reset[i]=tux_buffer[i];//fill reset buffer with prev buffer values
 	}
 
-	tuxctl_ldisc_put(tty,tux_buffer,6);
-	flag=0;//don't allow additon to tux buffer
+	if(tuxctl_ldisc_put(tty,tux_buffer,6)!=0)
+	{
+		led_shown_valid=0;//partial packet; keep the value pending and
+		return;//resend it on the next ACK or set_led
+	}
+	led_pending_valid=0;
+	led_shown=led_pending;
+	led_shown_valid=1;
+	led_stats.sent++;
+	flag=0;//don't allow additon to tux buffer until ACK
+}
+
+/* 
+ * set_led_func 
+ *   DESCRIPTION: records the requested LED value; it is sent right away if the
+ *                tux is idle, otherwise it replaces any older pending value and
+ *                goes out when the outstanding MTCP_ACK arrives
+ *   INPUTS: struct tty_struct* tty, arg from user to display
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 
+ *   SIDE EFFECTS: changes tux buffer and LED cache
+ */
+int set_led_func(struct tty_struct* tty,unsigned long arg)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&led_lock, flags);
+	if(clock_mode)
+	{
+		//user values are only displayed in user mode; device forgot them
+		char usr_mode=MTCP_LED_USR;
+		tuxctl_ldisc_put(tty,&usr_mode,1);
+		clock_mode=0;
+		led_shown_valid=0;
+	}
+	if(led_pending_valid)
+	{
+		led_stats.coalesced++;//older request never reached the device
+	}
+	led_pending=arg;
+	led_pending_valid=1;
+	led_flush(tty);
+	spin_unlock_irqrestore(&led_lock, flags);
+
+	return 0;
+}
+
+/* 
+ * read_led_func 
+ *   DESCRIPTION: copies the latest requested LED value to the user
+ *   INPUTS: struct tty_struct* tty, arg -- user pointer to an unsigned long
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -EINVAL on bad pointer or if nothing was set yet
+ *   SIDE EFFECTS: none
+ */
+int read_led_func(struct tty_struct* tty,unsigned long arg)
+{
+	unsigned long flags;
+	unsigned long value;
+	int valid;
+
+	if(arg==0)
+	{
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&led_lock, flags);
+	valid=(led_pending_valid || led_shown_valid);
+	value=(led_pending_valid ? led_pending : led_shown);
+	spin_unlock_irqrestore(&led_lock, flags);
+
+	if(!valid || copy_to_user((unsigned long*)arg,&value,sizeof(value))>0)
+	{
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* 
+ * led_stats_func 
+ *   DESCRIPTION: copies the LED sent/coalesced/dropped counters to the user
+ *   INPUTS: struct tty_struct* tty, arg -- user pointer to struct tux_led_stats
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -EINVAL on bad pointer
+ *   SIDE EFFECTS: none
+ */
+int led_stats_func(struct tty_struct* tty,unsigned long arg)
+{
+	unsigned long flags;
+	struct tux_led_stats snapshot;
+
+	if(arg==0)
+	{
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&led_lock, flags);
+	snapshot=led_stats;
+	spin_unlock_irqrestore(&led_lock, flags);
+
+	if(copy_to_user((struct tux_led_stats*)arg,&snapshot,sizeof(snapshot))>0)
+	{
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* 
+ * clock_send 
+ *   DESCRIPTION: programs the tux clock to count up from the given time and
+ *                switches the LEDs to show it.  Must be called with led_lock held.
+ *   INPUTS: struct tty_struct* tty, num_seconds -- value to start counting from
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sends clock commands to the tux
+ */
+static void clock_send(struct tty_struct* tty,unsigned long num_seconds)
+{
+	char clock_buffer[10];
+	unsigned long mins=num_seconds/60;
+	unsigned long secs=num_seconds%60;
+
+	if(mins>99)
+	{
+		mins=99;//display only has room for 99:59
+		secs=59;
+	}
+
+	clock_buffer[0]=MTCP_CLK_STOP;
+	clock_buffer[1]=MTCP_CLK_SET;
+	clock_buffer[2]=mins;
+	clock_buffer[3]=secs;
+	clock_buffer[4]=MTCP_CLK_MAX;
+	clock_buffer[5]=99;
+	clock_buffer[6]=59;
+	clock_buffer[7]=MTCP_CLK_UP;
+	clock_buffer[8]=MTCP_LED_CLK;
+	clock_buffer[9]=MTCP_CLK_RUN;
+	tuxctl_ldisc_put(tty,clock_buffer,10);
+
+	//any user LED value is no longer on the display
+	led_shown_valid=0;
+	led_pending_valid=0;
+}
+
+/* 
+ * set_clock_func 
+ *   DESCRIPTION: starts the tux's own clock counting up from arg seconds, so
+ *                the display keeps time without any further ioctls
+ *   INPUTS: struct tty_struct* tty, arg -- elapsed seconds to start from
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 
+ *   SIDE EFFECTS: sends clock commands to the tux; leaves LED user mode
+ */
+int set_clock_func(struct tty_struct* tty,unsigned long arg)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&led_lock, flags);
+	clock_mode=1;
+	clock_start=arg;
+	clock_base=jiffies;
+	clock_send(tty,arg);
+	spin_unlock_irqrestore(&led_lock, flags);
 
 	return 0;
 }
@@ -336,7 +576,9 @@ tuxctl_ioctl (struct tty_struct* tty, struct file* file,
 					}
 	case TUX_LED_ACK:return -1;
 	case TUX_LED_REQUEST:return -1;
-	case TUX_READ_LED:return -1;
+	case TUX_READ_LED:return read_led_func(tty,arg);
+	case TUX_LED_STATS:return led_stats_func(tty,arg);
+	case TUX_SET_CLOCK:return set_clock_func(tty,arg);
 	default:
 	    return -EINVAL;
     }
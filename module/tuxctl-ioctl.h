@@ -9,6 +9,15 @@
 #define TUX_INIT _IO('E', 0x13)
 #define TUX_LED_REQUEST _IO('E', 0x14)
 #define TUX_LED_ACK _IO('E', 0x15)
+#define TUX_LED_STATS _IOR('E', 0x16, struct tux_led_stats)
+#define TUX_SET_CLOCK _IOR('E', 0x17, unsigned long)
+
+/* LED update counters returned by TUX_LED_STATS */
+struct tux_led_stats {
+	unsigned long sent;		/* MTCP_LED_SET packets put on the wire      */
+	unsigned long coalesced;	/* requests replaced before they were sent   */
+	unsigned long dropped;		/* requests the device already showed       */
+};
 
 char tux_buffer[6];
 char tux_buffer_reset[6]; 
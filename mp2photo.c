@@ -45,15 +45,87 @@
  * The output file format is 5:6:5 RGB stored in the same order as in the
  * BMP, i.e., rows from bottom to top, and from right to left within each
  * row.  The header simply gives the dimensions of the image.
+ *
+ * With -v2, room photos are written in the compressed version 2 format
+ * instead (see photo_headers.h).  The input may then also be a room 
+ * photo in the original format, to convert existing photos.  With 
+ * -bench, the program instead times reading the given original-format
+ * photos against reading and decoding them in the version 2 format.
+ * With -quant, it times choosing a palette for each photo and mapping
+ * its pixels with each quantizer (see quant.h), and reports the memory
+ * each uses and how far each result is from the photo.
+ *
+ * With -batch, the program converts many images at once on a pool of
+ * threads, given either a manifest file or a directory of BMP files.
+ * Outputs that are newer than their inputs are skipped.  Each line of a
+ * manifest names a BMP file and, optionally, its output file; outputs
+ * ending in ".obj" are object images, and others are room photos.
+ * Lines starting with '#' are ignored.  For a directory, each BMP file
+ * becomes an image of the kind the program writes by default (a room
+ * photo for mp2photo, an object image for mp2object) in the output
+ * directory, or next to the BMP file.
  */
 
 
+#include <dirent.h>
+#include <immintrin.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "photo_headers.h"
+#include "pixcodec.h"
+#include "quant.h"
+
+
+/* rows in each block of a version 2 photo */
+#define V2_ROWS_PER_BLOCK 16
+
+/* times each photo is read by -bench */
+#define BENCH_REPEATS 20
+
+/* times each photo is quantized by -quant */
+#define QUANT_REPEATS 10
+
+/* most quantizers compared by -quant */
+#define QUANT_MAX     8
+
+/* longest line in a -batch manifest */
+#define MAX_MANIFEST_LINE 4096
+
+
+/* converts one row of n BMP pixels (blue, green, red bytes) */
+typedef void (*row_fn_t) (const uint8_t* bgr, uint32_t n, void* out);
+
+/* one file to convert in -batch mode */
+typedef struct job_t job_t;
+struct job_t {
+    char* in_name;	/* BMP file (or original-format photo)   */
+    char* out_name;	/* output file                           */
+    int   object;	/* 1 for an object image, 0 for a photo  */
+};
+
+/* state shared by the -batch worker threads */
+typedef struct batch_t batch_t;
+struct batch_t {
+    job_t*          job;	/* files to convert                 */
+    int             n_jobs;	/* number of files                  */
+    int             max_jobs;	/* files with room allocated        */
+    int             next;	/* next job to claim                */
+    int             v2;		/* write photos in version 2 format */
+    int             force;	/* convert even if up to date       */
+    int             converted;	/* files written                    */
+    int             skipped;	/* files already up to date         */
+    int             failed;	/* files that could not be written  */
+    pthread_mutex_t lock;	/* protects next and the counts     */
+};
 
 
 #if !defined(WRITE_OBJECT_IMAGE)
@@ -87,7 +159,7 @@ bmp_header_check (const char* fname, FILE* in, bmp_header_t* h)
         fprintf (stderr, "%s does not appear to be a BMP file.\n", fname);
 	return 0;
     }
-    if (4096 < h->img_width || 4096 < h->img_height || 1 != h->planes || 
+    if (8192 < h->img_width || 4096 < h->img_height || 1 != h->planes || 
     	24 != h->bits_per_pixel || 0 != h->compression_type) {
         fprintf (stderr, "%s must be 24-bit-color on one plane with no "
 		 "compression.\n", fname);
@@ -127,86 +199,589 @@ read_bmp_image_data (FILE* in, const bmp_header_t* h)
     return img_data;
 }
 
+// Convert one row of n BMP pixels to 5:6:5 RGB words.
+static void
+row_565_c (const uint8_t* bgr, uint32_t n, void* out)
+{
+    uint16_t* px = out;
+    uint32_t  x;
+
+    for (x = 0; n > x; x++, bgr += 3) {
+	px[x] = ((bgr[2] >> 3) << 11) | ((bgr[1] >> 2) << 5) | (bgr[0] >> 3);
+    }
+}
+
+// Convert one row of n BMP pixels to 2:2:2 RGB bytes.  We map any bright 
+// yellow pixel to transparent; it's easy to be more specific by 
+// conditioning on the img data (24 bits) rather than the output image 
+// data (6 bits).
+static void
+row_222_c (const uint8_t* bgr, uint32_t n, void* out)
+{
+    uint8_t* px = out;
+    uint8_t  vga_color;
+    uint32_t x;
+
+    for (x = 0; n > x; x++, bgr += 3) {
+	vga_color = ((bgr[2] >> 6) << 4) | ((bgr[1] >> 6) << 2) | 
+		    (bgr[0] >> 6);
+	px[x] = (0x3C == vga_color ? OBJ_CLR_TRANSP : vga_color);
+    }
+}
+
+// Spread eight BMP pixels into two vectors of four 32-bit lanes, each
+// holding blue, green, and red in its low three bytes.  Reads 28 bytes.
+__attribute__ ((target ("ssse3"))) static inline void
+load_8_pixels (const uint8_t* bgr, __m128i* lo, __m128i* hi)
+{
+    const __m128i spread = _mm_setr_epi8 (0, 1, 2, -1, 3, 4, 5, -1, 
+					  6, 7, 8, -1, 9, 10, 11, -1);
+
+    *lo = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i*)bgr), spread);
+    *hi = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i*)(bgr + 12)),
+			    spread);
+}
+
+// Pack each lane of a vector of 32-bit lanes into 5:6:5 RGB.
+__attribute__ ((target ("ssse3"))) static inline __m128i
+lanes_to_565 (__m128i v)
+{
+    return _mm_or_si128 (
+	       _mm_or_si128 (
+		   _mm_and_si128 (_mm_srli_epi32 (v, 3), _mm_set1_epi32 (0x1F)),
+		   _mm_and_si128 (_mm_srli_epi32 (v, 5), 
+				  _mm_set1_epi32 (0x7E0))),
+	       _mm_and_si128 (_mm_srli_epi32 (v, 8), _mm_set1_epi32 (0xF800)));
+}
+
+// Pack each lane of a vector of 32-bit lanes into 2:2:2 RGB, with bright 
+// yellow mapped to transparent.
+__attribute__ ((target ("ssse3"))) static inline __m128i
+lanes_to_222 (__m128i v)
+{
+    __m128i c;
+    __m128i yellow;
+
+    c = _mm_or_si128 (
+	    _mm_or_si128 (
+		_mm_and_si128 (_mm_srli_epi32 (v, 6), _mm_set1_epi32 (0x03)),
+		_mm_and_si128 (_mm_srli_epi32 (v, 12), _mm_set1_epi32 (0x0C))),
+	    _mm_and_si128 (_mm_srli_epi32 (v, 18), _mm_set1_epi32 (0x30)));
+    yellow = _mm_cmpeq_epi32 (c, _mm_set1_epi32 (0x3C));
+    return _mm_or_si128 (_mm_andnot_si128 (yellow, c),
+			 _mm_and_si128 (yellow, 
+					_mm_set1_epi32 (OBJ_CLR_TRANSP)));
+}
+
+// Convert one row of n BMP pixels to 5:6:5 RGB words, eight at a time.
+// The vector loop stops while 28 bytes remain readable; the C version
+// does the rest.
+__attribute__ ((target ("ssse3"))) static void
+row_565_ssse3 (const uint8_t* bgr, uint32_t n, void* out)
+{
+    uint16_t* px = out;
+    uint32_t  x;
+    __m128i   lo;
+    __m128i   hi;
+
+    for (x = 0; n >= x + 10; x += 8) {
+	load_8_pixels (bgr + 3 * x, &lo, &hi);
+	// Sign-extend the low halves so that the saturating pack keeps them.
+	lo = _mm_srai_epi32 (_mm_slli_epi32 (lanes_to_565 (lo), 16), 16);
+	hi = _mm_srai_epi32 (_mm_slli_epi32 (lanes_to_565 (hi), 16), 16);
+	_mm_storeu_si128 ((__m128i*)(px + x), _mm_packs_epi32 (lo, hi));
+    }
+    row_565_c (bgr + 3 * x, n - x, px + x);
+}
+
+// Convert one row of n BMP pixels to 2:2:2 RGB bytes, eight at a time.
+__attribute__ ((target ("ssse3"))) static void
+row_222_ssse3 (const uint8_t* bgr, uint32_t n, void* out)
+{
+    uint8_t* px = out;
+    uint32_t x;
+    __m128i  lo;
+    __m128i  hi;
+    __m128i  words;
+
+    for (x = 0; n >= x + 10; x += 8) {
+	load_8_pixels (bgr + 3 * x, &lo, &hi);
+	words = _mm_packs_epi32 (lanes_to_222 (lo), lanes_to_222 (hi));
+	_mm_storel_epi64 ((__m128i*)(px + x), _mm_packus_epi16 (words, words));
+    }
+    row_222_c (bgr + 3 * x, n - x, px + x);
+}
+
+/* row converters; select_kernels picks vector ones if the CPU has them */
+static row_fn_t row_565 = row_565_c;
+static row_fn_t row_222 = row_222_c;
+
+// Use the vector row converters if the processor supports them.  Return
+// the name of the kernels chosen.
+static const char*
+select_kernels ()
+{
+    if (__builtin_cpu_supports ("ssse3")) {
+	row_565 = row_565_ssse3;
+	row_222 = row_222_ssse3;
+	return "ssse3";
+    }
+    return "c";
+}
+
+// Convert BMP image data to 5:6:5 RGB words or 2:2:2 RGB bytes, in the 
+// order of the BMP.  Return pointer to dynamically allocated pixels, or 
+// NULL on failure.
+static void*
+convert_image (const bmp_header_t* h, const uint8_t* img, int object)
+{
+    uint8_t* px;
+    size_t   size = (object ? sizeof (uint8_t) : sizeof (uint16_t));
+    uint32_t row_width;
+    uint32_t y;
+
+    if (NULL == (px = malloc ((size_t)h->img_width * h->img_height * 
+			      size))) {
+        perror ("allocate pixels");
+	return NULL;
+    }
+    row_width = bmp_row_width (h);
+    for (y = 0; h->img_height > y; y++) {
+	(object ? row_222 : row_565) (img + (size_t)row_width * y, 
+				      h->img_width, 
+				      px + (size_t)h->img_width * size * y);
+    }
+    return px;
+}
+
 // Write header and data as either 5:6:5 RGB words (little endian) or
 // 2:2:2 RGB bytes, row by row, to the output file.  Return 1 on success, 
 // 0 on failure.
 static int
-write_output_file (FILE* out, const bmp_header_t* h, const uint8_t* img)
+write_output_file (FILE* out, const bmp_header_t* h, const uint8_t* img,
+		   int object)
 {
     photo_header_t photo_header;
-    uint32_t       row_width;
-    uint16_t	   x;
-    uint16_t	   y;
+    void*          px;
+    size_t         n;
+    int            ok;
 
-    // Write header to output file.
+    // Convert the whole image, then write it with the header.
+    if (NULL == (px = convert_image (h, img, object))) {
+	return 0;
+    }
     photo_header.width = h->img_width;
     photo_header.height = h->img_height;
-    if (1 != fwrite (&photo_header, sizeof (photo_header), 1, out)) {
-        perror ("write header to output file");
+    n = (size_t)h->img_width * h->img_height;
+    ok = (1 == fwrite (&photo_header, sizeof (photo_header), 1, out) &&
+	  n == fwrite (px, (object ? sizeof (uint8_t) : sizeof (uint16_t)),
+		       n, out));
+    if (!ok) {
+        perror ("write output file");
+    }
+    free (px);
+    return ok;
+}
+
+// Read the header and pixels of a room photo in the original format.
+// Return pointer to dynamically allocated pixels, or NULL on failure.
+static uint16_t*
+read_raw_photo (const char* fname, FILE* in, photo_header_t* hdr)
+{
+    uint16_t* px;
+    size_t    n;
+
+    if (1 != fread (hdr, sizeof (*hdr), 1, in) ||
+        0 == memcmp (hdr, PHOTO_V2_MAGIC, sizeof (*hdr))) {
+        fprintf (stderr, "%s is not a BMP file or an original-format "
+		 "room photo.\n", fname);
+	return NULL;
+    }
+    n = (size_t)hdr->width * hdr->height;
+    if (NULL == (px = malloc (n * sizeof (*px))) ||
+        n != fread (px, sizeof (*px), n, in)) {
+        fprintf (stderr, "%s is too short for its header.\n", fname);
+	free (px);
+	return NULL;
+    }
+    return px;
+}
+
+// Write a room photo in version 2 format: header, block offset table,
+// and coded blocks of rows.  Return 1 on success, 0 on failure.
+static int
+write_v2_file (FILE* out, uint16_t width, uint16_t height, 
+	       const uint16_t* px)
+{
+    photo_v2_header_t hdr;
+    uint32_t*         off;
+    uint8_t*          packed;
+    uint32_t          n_blocks;
+    uint32_t          b;
+    uint32_t          rows;
+    size_t            len;
+    int               ok;
+
+    memcpy (hdr.magic, PHOTO_V2_MAGIC, sizeof (hdr.magic));
+    hdr.version = PHOTO_V2_VERSION;
+    hdr.rows_per_block = V2_ROWS_PER_BLOCK;
+    hdr.width = width;
+    hdr.height = height;
+    n_blocks = (height + V2_ROWS_PER_BLOCK - 1) / V2_ROWS_PER_BLOCK;
+    off = malloc ((n_blocks + 1) * sizeof (*off));
+    packed = malloc (PIX_BOUND ((size_t)width * V2_ROWS_PER_BLOCK));
+    if (NULL == off || NULL == packed) {
+        perror ("allocate blocks");
+	free (off);
+	free (packed);
 	return 0;
     }
 
-    // Write image data to output file.
-    row_width = bmp_row_width (h);
-    for (y = 0; h->img_height > y; y++) {
-	for (x = 0; h->img_width > x; x++) {
-#if (1 == WRITE_OBJECT_IMAGE)
-	    uint8_t vga_color;
- 	    vga_color = ((img[row_width * y + 3 * x + 2] >> 6) << 4) | 
- 	    		((img[row_width * y + 3 * x + 1] >> 6) << 2) | 
- 			(img[row_width * y + 3 * x] >> 6);
-	    /* 
-	     * We map any bright yellow pixel to transparent; it's easy to
-	     * be more specific by conditioning on the img data (24 bits)
-	     * rather than the output image data (6 bits).
-	     */
-	    if (0x3C == vga_color) {
- 	        vga_color = OBJ_CLR_TRANSP;
- 	    }
-#else /* (1 != WRITE_OBJECT_IMAGE) */
-	    uint16_t vga_color;
-	    vga_color = ((img[row_width * y + 3 * x + 2] >> 3) << 11) | 
-	    		((img[row_width * y + 3 * x + 1] >> 2) << 5) | 
-			(img[row_width * y + 3 * x] >> 3);
-#endif /* WRITE_OBJECT_IMAGE */
-	    if (1 != fwrite (&vga_color, sizeof (vga_color), 1, out)) {
-	        perror ("write data to output file");
-		return 0;
-	    }
+    // Write the header and room for the offsets (zeroed until filled in
+    // below), then the blocks.
+    memset (off, 0, (n_blocks + 1) * sizeof (*off));
+    ok = (1 == fwrite (&hdr, sizeof (hdr), 1, out) &&
+	  n_blocks + 1 == fwrite (off, sizeof (*off), n_blocks + 1, out));
+    off[0] = 0;
+    for (b = 0; ok && n_blocks > b; b++) {
+	rows = height - b * V2_ROWS_PER_BLOCK;
+	rows = (V2_ROWS_PER_BLOCK < rows ? V2_ROWS_PER_BLOCK : rows);
+	len = pix_encode (px + (size_t)width * V2_ROWS_PER_BLOCK * b,
+			  (size_t)width * rows, packed);
+	off[b + 1] = off[b] + len;
+	ok = (len == fwrite (packed, 1, len, out));
+    }
+
+    // Go back and fill in the offsets.
+    ok = (ok && 0 == fseek (out, sizeof (hdr), SEEK_SET) &&
+	  n_blocks + 1 == fwrite (off, sizeof (*off), n_blocks + 1, out));
+    if (!ok) {
+        perror ("write version 2 output file");
+    }
+    free (off);
+    free (packed);
+    return ok;
+}
+
+// Get a monotonic time in seconds.
+static double
+now_sec ()
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Time reading an original-format room photo a row at a time (as the
+// game did), against reading and decoding it a block at a time from a
+// version 2 copy in a temporary file.  Both files are read from the
+// page cache, so this measures the CPU cost of each path.  Add the 
+// pixels and times to the totals.  Return 1 on success, 0 on failure.
+static int
+bench_photo (const char* fname, double* t_raw, double* t_v2, 
+	     double* pixels, double* raw_bytes, double* v2_bytes)
+{
+    FILE*             in;
+    FILE*             v2;
+    photo_header_t    hdr;
+    photo_v2_header_t v2_hdr;
+    uint16_t*         px;
+    uint16_t*         rows;
+    uint8_t*          packed;
+    uint32_t*         off;
+    uint32_t          n_blocks;
+    uint32_t          b;
+    uint32_t          y;
+    uint32_t          n;
+    long              v2_size;
+    double            start;
+    double            raw_time;
+    double            v2_time;
+    int               rep;
+    int               ok;
+
+    if (NULL == (in = fopen (fname, "rb"))) {
+        perror (fname);
+	return 0;
+    }
+    px = read_raw_photo (fname, in, &hdr);
+    fclose (in);
+    if (NULL == px || NULL == (v2 = tmpfile ())) {
+	free (px);
+	return 0;
+    }
+    ok = write_v2_file (v2, hdr.width, hdr.height, px);
+    free (px);
+    v2_size = (0 == fseek (v2, 0, SEEK_END) ? ftell (v2) : -1);
+    ok = (ok && 0 < v2_size);
+    n_blocks = (hdr.height + V2_ROWS_PER_BLOCK - 1) / V2_ROWS_PER_BLOCK;
+    rows = malloc ((size_t)hdr.width * V2_ROWS_PER_BLOCK * sizeof (*rows));
+    packed = malloc (PIX_BOUND ((size_t)hdr.width * V2_ROWS_PER_BLOCK));
+    off = malloc ((n_blocks + 1) * sizeof (*off));
+    ok = (ok && NULL != rows && NULL != packed && NULL != off);
+
+    // Original format: one fread per row.
+    start = now_sec ();
+    for (rep = 0; ok && BENCH_REPEATS > rep; rep++) {
+	if (NULL == (in = fopen (fname, "rb"))) {
+	    ok = 0;
+	    break;
+	}
+	ok = (1 == fread (&hdr, sizeof (hdr), 1, in));
+	for (y = 0; ok && hdr.height > y; y++) {
+	    ok = (hdr.width == fread (rows, sizeof (*rows), hdr.width, in));
+	}
+	fclose (in);
+    }
+    raw_time = now_sec () - start;
+
+    // Version 2: one fread and one decode per block of rows.
+    start = now_sec ();
+    for (rep = 0; ok && BENCH_REPEATS > rep; rep++) {
+	rewind (v2);
+	ok = (1 == fread (&v2_hdr, sizeof (v2_hdr), 1, v2) &&
+	      n_blocks + 1 == fread (off, sizeof (*off), n_blocks + 1, v2));
+	for (b = 0; ok && n_blocks > b; b++) {
+	    n = hdr.height - b * V2_ROWS_PER_BLOCK;
+	    n = hdr.width * (V2_ROWS_PER_BLOCK < n ? V2_ROWS_PER_BLOCK : n);
+	    ok = (off[b + 1] - off[b] == 
+		  fread (packed, 1, off[b + 1] - off[b], v2) &&
+		  0 == pix_decode (packed, off[b + 1] - off[b], rows, n));
 	}
     }
+    v2_time = now_sec () - start;
+
+    if (ok) {
+	n = hdr.width * hdr.height;
+	printf ("%-28s %4ux%-4u %5.2f  %8.1f %8.1f\n", fname, hdr.width,
+		hdr.height, (double)v2_size / (sizeof (hdr) + 2.0 * n),
+		BENCH_REPEATS * n / raw_time / 1e6, 
+		BENCH_REPEATS * n / v2_time / 1e6);
+	*t_raw += raw_time;
+	*t_v2 += v2_time;
+	*pixels += (double)BENCH_REPEATS * n;
+	*raw_bytes += sizeof (hdr) + 2.0 * n;
+	*v2_bytes += v2_size;
+    } else {
+        fprintf (stderr, "%s: benchmark failed\n", fname);
+    }
+    fclose (v2);
+    free (rows);
+    free (packed);
+    free (off);
+    return ok;
+}
+
+// Run the -bench mode over the given photos.  Return 0 on success.
+static int
+bench_main (int n_files, char* files[])
+{
+    double t_raw = 0;
+    double t_v2 = 0;
+    double pixels = 0;
+    double raw_bytes = 0;
+    double v2_bytes = 0;
+    int    i;
+    int    ok = 1;
+
+    printf ("%-28s %9s %5s  %8s %8s\n", "photo", "size", "ratio", 
+	    "raw Mp/s", "v2 Mp/s");
+    for (i = 0; n_files > i; i++) {
+	ok = bench_photo (files[i], &t_raw, &t_v2, &pixels, &raw_bytes, 
+			  &v2_bytes) && ok;
+    }
+    if (0 < pixels) {
+	printf ("%-28s %9s %5.2f  %8.1f %8.1f\n", "total", "", 
+		v2_bytes / raw_bytes, pixels / t_raw / 1e6, 
+		pixels / t_v2 / 1e6);
+    }
+    return (ok ? 0 : 3);
+}
+
+// Add the squared error of a quantized photo against its 5:6:5 pixels
+// (in 6-bit VGA components, as the palette holds them) to *sq_err.
+static void
+quant_error (const uint16_t* px, size_t n, uint8_t palette[][3],
+	     const uint8_t map[OCTREE_COLORS], double* sq_err)
+{
+    const uint8_t* c;
+    size_t         i;
+    int            dr;
+    int            dg;
+    int            db;
+
+    for (i = 0; n > i; i++) {
+	c = palette[map[px[i]]];
+	dr = ((px[i] >> 11) << 1) - c[0];
+	dg = ((px[i] >> 5) & 0x3F) - c[1];
+	db = ((px[i] & 0x1F) << 1) - c[2];
+	*sq_err += dr * dr + dg * dg + db * db;
+    }
+}
 
+// Quantize one photo QUANT_REPEATS times with the selected quantizer,
+// as read_photo does: histogram (if used), palette, then a map lookup
+// per pixel.  Add the time and squared error to the totals, and keep
+// the largest scratch memory.  Return 1 on success, 0 on failure.
+static int
+quant_photo (const uint16_t* px, size_t n, uint8_t* img, double* t, 
+	     double* sq_err, size_t* scratch)
+{
+    static uint32_t hist[OCTREE_COLORS];
+    static uint8_t  map[OCTREE_COLORS];
+    uint8_t         palette[QUANT_ENTRIES][3];
+    double          start;
+    size_t          i;
+    int             rep;
+
+    start = now_sec ();
+    for (rep = 0; QUANT_REPEATS > rep; rep++) {
+	memset (hist, 0, sizeof (hist));
+	for (i = 0; quant_uses_histogram () && n > i; i++) {
+	    hist[px[i]]++;
+	}
+	if (0 != quant_palette (hist, palette, map)) {
+	    return 0;
+	}
+	for (i = 0; n > i; i++) {
+	    img[i] = 64 + map[px[i]];
+	}
+    }
+    *t += now_sec () - start;
+    *scratch = (quant_scratch () > *scratch ? quant_scratch () : *scratch);
+    quant_error (px, n, palette, map, sq_err);
     return 1;
 }
 
-int
-main (int argc, char* argv[])
+// Convert a mean squared error in 6-bit components to PSNR in dB.
+static double
+psnr (double mse)
 {
-    FILE*        in;
-    FILE*        out;
-    bmp_header_t bmp_header;
-    uint8_t*     img_data;
-    int32_t      written;
+    return (0 == mse ? 99.0 : 10 * log10 (63.0 * 63.0 / mse));
+}
 
-    // Check syntax of invocation.
-    if (3 != argc) {
-    	fprintf (stderr, "usage: %s <BMP file name> <output file>\n", argv[0]);
-	return 2;
+// Run the -quant mode over the given photos: one line per photo with
+// each quantizer's PSNR, then each quantizer's mean time per photo, 
+// peak scratch memory, mean squared error, and PSNR over all pixels.
+// Return 0 on success.
+static int
+quant_main (int n_files, char* files[])
+{
+    FILE*          in;
+    photo_header_t hdr;
+    uint16_t*      px;
+    uint8_t*       img;
+    size_t         n;
+    double         t[QUANT_MAX];
+    double         err[QUANT_MAX];
+    double         sum_err[QUANT_MAX];
+    size_t         scratch[QUANT_MAX];
+    double         pixels = 0;
+    int            n_quant;
+    int            n_done = 0;
+    int            i;
+    int            k;
+    int            ok = 1;
+
+    printf ("%-28s %9s ", "photo (PSNR dB)", "size");
+    for (n_quant = 0; QUANT_MAX > n_quant && NULL != quant_name (n_quant); 
+	 n_quant++) {
+	t[n_quant] = sum_err[n_quant] = 0;
+	scratch[n_quant] = 0;
+	printf (" %7s", quant_name (n_quant));
+    }
+    printf ("\n");
+    for (i = 0; n_files > i; i++) {
+	if (NULL == (in = fopen (files[i], "rb"))) {
+	    perror (files[i]);
+	    ok = 0;
+	    continue;
+	}
+	px = read_raw_photo (files[i], in, &hdr);
+	fclose (in);
+	n = (size_t)hdr.width * hdr.height;
+	if (NULL == px || NULL == (img = malloc (n))) {
+	    free (px);
+	    ok = 0;
+	    continue;
+	}
+	printf ("%-28s %4ux%-4u ", files[i], hdr.width, hdr.height);
+	for (k = 0; n_quant > k; k++) {
+	    err[k] = 0;
+	    if (0 != quant_force (quant_name (k)) ||
+		!quant_photo (px, n, img, &t[k], &err[k], &scratch[k])) {
+		fprintf (stderr, "%s: %s failed\n", files[i], quant_name (k));
+		ok = 0;
+	    }
+	    sum_err[k] += err[k];
+	    printf (" %7.2f", psnr (err[k] / n));
+	}
+	printf ("\n");
+	pixels += n;
+	n_done++;
+	free (img);
+	free (px);
     }
+    if (0 < pixels) {
+	printf ("\n%-8s %10s %12s %8s %8s\n", "quant", "ms/photo", 
+		"scratch KB", "MSE", "PSNR dB");
+	for (k = 0; n_quant > k; k++) {
+	    printf ("%-8s %10.2f %12.1f %8.3f %8.2f\n", quant_name (k),
+		    1e3 * t[k] / QUANT_REPEATS / n_done, scratch[k] / 1024.0,
+		    sum_err[k] / pixels, psnr (sum_err[k] / pixels));
+	}
+    }
+    return (ok ? 0 : 3);
+}
+
+// Convert one BMP file to a room photo or object image.  For a version 2
+// room photo, the input may also be an original-format room photo.
+// Return 0 on success, 2 if the input cannot be used, or 3 if the 
+// output cannot be written.
+static int
+convert_file (const char* in_name, const char* out_name, int object, int v2)
+{
+    FILE*          in;
+    FILE*          out;
+    bmp_header_t   bmp_header;
+    photo_header_t photo_header;
+    uint8_t*       img_data;
+    uint16_t*      px;
+    int32_t        written;
+    char           magic[2];
 
     // Try to open the two files.
-    if (NULL == (in = fopen (argv[1], "r+b"))) {
-        perror ("open BMP file");
+    if (NULL == (in = fopen (in_name, "rb"))) {
+        perror (in_name);
 	return 2;
     }
-    if (NULL == (out = fopen (argv[2], "w+b"))) {
+    if (NULL == (out = fopen (out_name, "w+b"))) {
 	fclose (in);
-        perror ("open output file");
+        perror (out_name);
 	return 2;
     }
 
+    // For -v2, convert an original-format photo if given one.
+    if (v2 && (1 != fread (magic, sizeof (magic), 1, in) ||
+	       0 != memcmp (magic, BMP_MAGIC, sizeof (magic)))) {
+	rewind (in);
+	px = read_raw_photo (in_name, in, &photo_header);
+	(void)fclose (in);
+	written = (NULL != px && 
+		   write_v2_file (out, photo_header.width, 
+				  photo_header.height, px));
+	if (EOF == fclose (out)) {
+	    perror ("close output file");
+	    written = 0;
+	}
+	free (px);
+	return (written ? 0 : 3);
+    }
+    rewind (in);
+
     // Check validity of input file, then read image data from input file.
-    if (!bmp_header_check (argv[1], in, &bmp_header) ||
+    if (!bmp_header_check (in_name, in, &bmp_header) ||
 	NULL == (img_data = read_bmp_image_data (in, &bmp_header))) {
 	fclose (in);
 	fclose (out);
@@ -217,7 +792,14 @@ main (int argc, char* argv[])
     (void)fclose (in);
 
     // Try to write, then close, the output file.
-    written = write_output_file (out, &bmp_header, img_data);
+    if (v2) {
+	written = (NULL != (px = convert_image (&bmp_header, img_data, 0)) &&
+		   write_v2_file (out, bmp_header.img_width, 
+				  bmp_header.img_height, px));
+	free (px);
+    } else {
+	written = write_output_file (out, &bmp_header, img_data, object);
+    }
     if (EOF == fclose (out)) {
 	perror ("close output file");
         written = 0;
@@ -230,3 +812,328 @@ main (int argc, char* argv[])
     return (written ? 0 : 3);
 }
 
+// Check whether a file name ends with a suffix, ignoring case.
+static int
+has_suffix (const char* name, const char* suffix)
+{
+    size_t len = strlen (name);
+    size_t s_len = strlen (suffix);
+
+    return (len >= s_len && 0 == strcasecmp (name + len - s_len, suffix));
+}
+
+// Check whether a file starts with the version 2 photo magic.
+static int
+is_v2_file (const char* fname)
+{
+    FILE* in;
+    char  magic[sizeof (PHOTO_V2_MAGIC) - 1];
+    int   v2;
+
+    if (NULL == (in = fopen (fname, "rb"))) {
+        return 0;
+    }
+    v2 = (1 == fread (magic, sizeof (magic), 1, in) &&
+	  0 == memcmp (magic, PHOTO_V2_MAGIC, sizeof (magic)));
+    fclose (in);
+    return v2;
+}
+
+// Check whether an output file is at least as new as its input and, for
+// a room photo, already in the format asked for (version 2 or not).
+static int
+up_to_date (const char* in_name, const char* out_name, int photo, int v2)
+{
+    struct stat in_st;
+    struct stat out_st;
+
+    if (0 != stat (in_name, &in_st) || 0 != stat (out_name, &out_st)) {
+        return 0;
+    }
+    if (photo && v2 != is_v2_file (out_name)) {
+        return 0;
+    }
+    return (out_st.st_mtim.tv_sec > in_st.st_mtim.tv_sec ||
+	    (out_st.st_mtim.tv_sec == in_st.st_mtim.tv_sec &&
+	     out_st.st_mtim.tv_nsec >= in_st.st_mtim.tv_nsec));
+}
+
+// Add a file to convert.  Without an output name, the output is named 
+// after the input, with ".bmp" replaced, in out_dir or else next to the
+// input.  Return 1 on success, 0 on failure.
+static int
+add_job (batch_t* b, const char* in_name, const char* out_name, 
+	 const char* out_dir)
+{
+    job_t*      job;
+    const char* base;
+    size_t      len;
+    int         object;
+    int         max;
+
+    if (b->max_jobs == b->n_jobs) {
+	max = (0 == b->max_jobs ? 16 : 2 * b->max_jobs);
+	if (NULL == (job = realloc (b->job, max * sizeof (*job)))) {
+	    perror ("allocate jobs");
+	    return 0;
+	}
+	b->job = job;
+	b->max_jobs = max;
+    }
+    job = &b->job[b->n_jobs];
+    if (NULL != out_name) {
+	object = (has_suffix (out_name, ".obj") ? 1 : 
+		  has_suffix (out_name, ".photo") ? 0 : WRITE_OBJECT_IMAGE);
+	job->out_name = strdup (out_name);
+    } else {
+	object = WRITE_OBJECT_IMAGE;
+	base = in_name;
+	if (NULL != out_dir && NULL != strrchr (in_name, '/')) {
+	    base = strrchr (in_name, '/') + 1;
+	}
+	len = strlen (base) - (has_suffix (base, ".bmp") ? 4 : 0);
+	if (NULL != (job->out_name = malloc ((NULL != out_dir ? 
+					      strlen (out_dir) + 1 : 0) + 
+					     len + 7))) {
+	    sprintf (job->out_name, "%s%s%.*s%s", 
+		     (NULL != out_dir ? out_dir : ""), 
+		     (NULL != out_dir ? "/" : ""), (int)len, base, 
+		     (object ? ".obj" : ".photo"));
+	}
+    }
+    job->in_name = strdup (in_name);
+    job->object = object;
+    if (NULL == job->in_name || NULL == job->out_name) {
+        perror ("allocate jobs");
+	free (job->in_name);
+	free (job->out_name);
+	return 0;
+    }
+    b->n_jobs++;
+    return 1;
+}
+
+// Add each line of a manifest file to the jobs.  Return 1 on success, 
+// 0 on failure.
+static int
+read_manifest (batch_t* b, const char* fname, const char* out_dir)
+{
+    FILE* in;
+    char  line[MAX_MANIFEST_LINE];
+    char* in_name;
+    char* out_name;
+    int   ok = 1;
+
+    if (NULL == (in = fopen (fname, "r"))) {
+        perror (fname);
+	return 0;
+    }
+    while (ok && NULL != fgets (line, sizeof (line), in)) {
+	if (NULL == (in_name = strtok (line, " \t\r\n")) || '#' == *in_name) {
+	    continue;
+	}
+	out_name = strtok (NULL, " \t\r\n");
+	ok = add_job (b, in_name, out_name, out_dir);
+    }
+    fclose (in);
+    return ok;
+}
+
+// Add each BMP file in a directory to the jobs.  Return 1 on success, 
+// 0 on failure.
+static int
+read_directory (batch_t* b, const char* dname, const char* out_dir)
+{
+    DIR*           dir;
+    struct dirent* ent;
+    char*          path;
+    int            ok = 1;
+
+    if (NULL == (dir = opendir (dname))) {
+        perror (dname);
+	return 0;
+    }
+    while (ok && NULL != (ent = readdir (dir))) {
+	if (!has_suffix (ent->d_name, ".bmp")) {
+	    continue;
+	}
+	if (NULL == (path = malloc (strlen (dname) + strlen (ent->d_name) + 
+				    2))) {
+	    perror ("allocate jobs");
+	    ok = 0;
+	    break;
+	}
+	sprintf (path, "%s/%s", dname, ent->d_name);
+	ok = add_job (b, path, NULL, (NULL != out_dir ? out_dir : dname));
+	free (path);
+    }
+    closedir (dir);
+    return ok;
+}
+
+// Claim and convert jobs until none remain.  Each output is written to
+// a temporary file and renamed into place, so an interrupted conversion
+// never leaves a partial file that looks up to date.
+static void*
+batch_worker (void* arg)
+{
+    batch_t* b = arg;
+    job_t*   job;
+    char*    tmp_name;
+    int      status;
+
+    while (1) {
+	pthread_mutex_lock (&b->lock);
+	job = (b->n_jobs > b->next ? &b->job[b->next++] : NULL);
+	pthread_mutex_unlock (&b->lock);
+	if (NULL == job) {
+	    return NULL;
+	}
+	if (!b->force && up_to_date (job->in_name, job->out_name, 
+				     !job->object, b->v2)) {
+	    status = -1;
+	} else if (NULL == (tmp_name = malloc (strlen (job->out_name) + 5))) {
+	    perror ("allocate file name");
+	    status = 3;
+	} else {
+	    sprintf (tmp_name, "%s.tmp", job->out_name);
+	    status = convert_file (job->in_name, tmp_name, job->object, 
+				   b->v2 && !job->object);
+	    if (0 == status && 0 != rename (tmp_name, job->out_name)) {
+		perror (job->out_name);
+		status = 3;
+	    }
+	    if (0 != status) {
+		(void)remove (tmp_name);
+		fprintf (stderr, "%s: conversion failed\n", job->in_name);
+	    }
+	    free (tmp_name);
+	}
+	pthread_mutex_lock (&b->lock);
+	if (-1 == status) {
+	    b->skipped++;
+	} else if (0 == status) {
+	    b->converted++;
+	} else {
+	    b->failed++;
+	}
+	pthread_mutex_unlock (&b->lock);
+    }
+}
+
+// Run the -batch mode: [-j threads] [-f] [-v2] <manifest or directory> 
+// [output directory].  Return 0 on success.
+static int
+batch_main (int argc, char* argv[])
+{
+    batch_t     b;
+    struct stat st;
+    pthread_t*  thread;
+    const char* kernels;
+    const char* out_dir;
+    double      start;
+    long        n_threads;
+    long        n_started;
+    long        i;
+    int         ok;
+
+    memset (&b, 0, sizeof (b));
+    n_threads = sysconf (_SC_NPROCESSORS_ONLN);
+    for (; 0 < argc && '-' == argv[0][0]; argc--, argv++) {
+	if (1 < argc && 0 == strcmp (argv[0], "-j")) {
+	    n_threads = atol (argv[1]);
+	    argc--;
+	    argv++;
+	} else if (0 == strcmp (argv[0], "-f")) {
+	    b.force = 1;
+	} else if (0 == strcmp (argv[0], "-v2")) {
+	    b.v2 = 1;
+	} else {
+	    break;
+	}
+    }
+    if (1 > argc || 2 < argc || 0 != stat (argv[0], &st)) {
+        fprintf (stderr, "-batch needs [-j <threads>] [-f] [-v2] "
+		 "<manifest or directory> [output directory]\n");
+	return 2;
+    }
+    out_dir = (2 == argc ? argv[1] : NULL);
+    ok = (S_ISDIR (st.st_mode) ? read_directory (&b, argv[0], out_dir) :
+	  read_manifest (&b, argv[0], out_dir));
+    if (!ok) {
+	return 2;
+    }
+
+    // Run the pool; this thread is one of the workers.
+    kernels = select_kernels ();
+    n_threads = (b.n_jobs < n_threads ? b.n_jobs : n_threads);
+    n_threads = (1 > n_threads ? 1 : n_threads);
+    pthread_mutex_init (&b.lock, NULL);
+    start = now_sec ();
+    n_started = 0;
+    if (NULL != (thread = malloc (n_threads * sizeof (*thread)))) {
+	while (n_threads - 1 > n_started &&
+	       0 == pthread_create (&thread[n_started], NULL, batch_worker, 
+				    &b)) {
+	    n_started++;
+	}
+    }
+    (void)batch_worker (&b);
+    for (i = 0; n_started > i; i++) {
+	pthread_join (thread[i], NULL);
+    }
+    printf ("%d converted, %d up to date, %d failed in %.2f s "
+	    "(%ld threads, %s kernels)\n", b.converted, b.skipped, b.failed,
+	    now_sec () - start, n_started + 1, kernels);
+    pthread_mutex_destroy (&b.lock);
+    free (thread);
+    for (i = 0; b.n_jobs > i; i++) {
+	free (b.job[i].in_name);
+	free (b.job[i].out_name);
+    }
+    free (b.job);
+    return (0 == b.failed ? 0 : 3);
+}
+
+int
+main (int argc, char* argv[])
+{
+    int32_t v2 = 0;
+
+    // Check syntax of invocation.
+    if (2 < argc && 0 == strcmp (argv[1], "-bench") && 
+        !WRITE_OBJECT_IMAGE) {
+	return bench_main (argc - 2, argv + 2);
+    }
+    if (2 < argc && 0 == strcmp (argv[1], "-quant") && 
+        !WRITE_OBJECT_IMAGE) {
+	return quant_main (argc - 2, argv + 2);
+    }
+    if (2 < argc && 0 == strcmp (argv[1], "-batch")) {
+	return batch_main (argc - 2, argv + 2);
+    }
+    if (4 == argc && 0 == strcmp (argv[1], "-v2") && !WRITE_OBJECT_IMAGE) {
+	v2 = 1;
+	argv++;
+	argc--;
+    }
+    if (3 != argc) {
+	if (WRITE_OBJECT_IMAGE) {
+	    fprintf (stderr, "usage: %s <BMP file name> <output file>\n"
+		     "       %s -batch [-j <threads>] [-f] "
+		     "<manifest or directory> [output directory]\n", 
+		     argv[0], argv[0]);
+	} else {
+	    fprintf (stderr, "usage: %s [-v2] <BMP file name> <output file>\n"
+		     "       %s -v2 <.photo file> <output file>\n"
+		     "       %s -batch [-j <threads>] [-f] [-v2] "
+		     "<manifest or directory> [output directory]\n"
+		     "       %s -bench <.photo file>...\n"
+		     "       %s -quant <.photo file>...\n", argv[0], argv[0],
+		     argv[0], argv[0], argv[0]);
+	}
+	return 2;
+    }
+    (void)select_kernels ();
+    return convert_file (argv[1], argv[2], WRITE_OBJECT_IMAGE, v2);
+}
@@ -0,0 +1,578 @@
+/*									tab:8
+ *
+ * octree.c - octree color quantization of room photos (see octree.h)
+ *
+ * Filename:	    octree.c
+ * History:
+ *	1	Moved palette selection out of read_photo into an octree
+ *		with arena-allocated nodes.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "octree.h"
+
+
+/* a node of the tree */
+struct octree_node_t {
+    uint32_t count;	/* pixels in this subtree             */
+    uint32_t red;	/* sum of 5-bit red over those pixels */
+    uint32_t green;	/* ...6-bit green                     */
+    uint32_t blue;	/* ...5-bit blue                      */
+    uint16_t child[8];	/* arena index of each child, or 0    */
+    uint16_t parent;	/* arena index of parent (root: 0)    */
+    uint8_t  level;	/* 0 for the root                     */
+    uint8_t  leaf;	/* 1 if children are ignored          */
+    uint8_t  index;	/* palette entry of a leaf            */
+};
+
+/* level 4 node of the original scheme (see octree_levels) */
+typedef struct levels_node_t levels_node_t;
+struct levels_node_t {
+    int count;		/* pixels in node                   */
+    int red;		/* sum of low bit of red            */
+    int green;		/* sum of low two bits of green     */
+    int blue;		/* sum of low bit of blue           */
+    int index;		/* node index (before sorting)      */
+};
+
+
+/* local functions--see function headers for details */
+static int32_t heap_less (const octree_t* t, uint16_t a, uint16_t b);
+static void heap_push (octree_t* t, int32_t* n, uint16_t id);
+static uint16_t heap_pop (octree_t* t, int32_t* n);
+static int32_t all_leaves (const octree_t* t, const octree_node_t* nd);
+static int32_t number_leaves (octree_t* t, uint16_t id,
+			      uint8_t palette[][3], int32_t n);
+static int levels_compare (const void* a, const void* b);
+static void levels_palette (levels_node_t* sorted, uint8_t palette[192][3]);
+
+
+/*
+ * octree_arena_bytes
+ *   DESCRIPTION: Find the memory held by a tree of a given depth: enough
+ *                nodes for every node at every level, and a heap entry
+ *                for each.
+ *   INPUTS: depth -- levels below the root
+ *   OUTPUTS: none
+ *   RETURN VALUE: size in bytes
+ *   SIDE EFFECTS: none
+ */
+size_t
+octree_arena_bytes (int32_t depth)
+{
+    size_t  nodes; /* nodes in a full tree  */
+    size_t  level; /* nodes at one level    */
+    int32_t l;	   /* index over levels     */
+
+    for (nodes = 0, level = 1, l = 0; depth >= l; l++, level *= 8) {
+	nodes += level;
+    }
+    return nodes * (sizeof (octree_node_t) + sizeof (uint16_t));
+}
+
+
+/*
+ * octree_init
+ *   DESCRIPTION: Allocate the arena for a tree.
+ *   INPUTS: depth -- levels below the root (1 to OCTREE_MAX_DEPTH)
+ *           max_leaves -- leaf budget (1 to OCTREE_MAX_LEAVES)
+ *   OUTPUTS: t -- the tree
+ *   RETURN VALUE: 0 on success, or -1 on bad settings or if memory
+ *                 runs out
+ *   SIDE EFFECTS: dynamically allocates the arena (free with octree_free)
+ */
+int32_t
+octree_init (octree_t* t, int32_t depth, int32_t max_leaves)
+{
+    size_t nodes; /* nodes in a full tree */
+
+    if (1 > depth || OCTREE_MAX_DEPTH < depth ||
+	1 > max_leaves || OCTREE_MAX_LEAVES < max_leaves) {
+	return -1;
+    }
+    nodes = octree_arena_bytes (depth) /
+	    (sizeof (octree_node_t) + sizeof (uint16_t));
+    t->node = malloc (nodes * sizeof (t->node[0]));
+    t->heap = malloc (nodes * sizeof (t->heap[0]));
+    if (NULL == t->node || NULL == t->heap) {
+	free (t->node);
+	free (t->heap);
+	return -1;
+    }
+    t->cap = nodes;
+    t->used = 0;
+    t->depth = depth;
+    t->max_leaves = max_leaves;
+    t->leaves = 0;
+    return 0;
+}
+
+
+/*
+ * octree_free
+ *   DESCRIPTION: Free a tree's arena.
+ *   INPUTS: t -- the tree
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees memory
+ */
+void
+octree_free (octree_t* t)
+{
+    free (t->node);
+    free (t->heap);
+    t->node = NULL;
+    t->heap = NULL;
+}
+
+
+/*
+ * octree_build
+ *   DESCRIPTION: Reset the arena and add each color in a histogram to
+ *                the tree, adding its count and component sums to every
+ *                node on its path.  Each node's children are chosen by
+ *                one bit each of red, green, and blue, from the top bits
+ *                down.
+ *   INPUTS: t -- the tree
+ *           hist -- pixel count for each 5:6:5 value
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: replaces the tree's contents
+ */
+void
+octree_build (octree_t* t, const uint32_t hist[OCTREE_COLORS])
+{
+    octree_node_t* nd;	  /* node on a color's path       */
+    uint32_t       c;	  /* 5:6:5 pixel value            */
+    uint32_t       n;	  /* pixels of that value         */
+    uint32_t       r;	  /* 5-bit red                    */
+    uint32_t       g;	  /* 6-bit green                  */
+    uint32_t       b;	  /* 5-bit blue                   */
+    int32_t        l;	  /* level of nd                  */
+    int32_t        k;	  /* child index at that level    */
+    uint16_t       id;	  /* arena index of nd            */
+    uint16_t       kid;	  /* arena index of child         */
+
+    (void)memset (&t->node[0], 0, sizeof (t->node[0]));
+    t->used = 1;
+    t->leaves = 0;
+    for (c = 0; OCTREE_COLORS > c; c++) {
+	if (0 == (n = hist[c])) {
+	    continue;
+	}
+	r = c >> 11;
+	g = (c >> 5) & 0x3F;
+	b = c & 0x1F;
+	for (id = 0, l = 0; ; l++) {
+	    nd = &t->node[id];
+	    nd->count += n;
+	    nd->red += r * n;
+	    nd->green += g * n;
+	    nd->blue += b * n;
+	    if (t->depth == l) {
+		break;
+	    }
+	    k = (((r >> (4 - l)) & 1) << 2) | (((g >> (5 - l)) & 1) << 1) |
+		((b >> (4 - l)) & 1);
+	    if (0 == (kid = nd->child[k])) {
+		kid = nd->child[k] = t->used++;
+		(void)memset (&t->node[kid], 0, sizeof (t->node[kid]));
+		t->node[kid].parent = id;
+		t->node[kid].level = l + 1;
+		t->node[kid].leaf = (t->depth == l + 1);
+		t->leaves += t->node[kid].leaf;
+	    }
+	    id = kid;
+	}
+    }
+    t->node[0].leaf = (0 == t->leaves);
+}
+
+
+/*
+ * octree_reduce
+ *   DESCRIPTION: Fold nodes whose children are all leaves into leaves,
+ *                always the one with the fewest pixels (ties go to the
+ *                earlier node), until no more leaves than the budget
+ *                remain.  Then number the leaves in tree order and set
+ *                each one's palette entry to the average of its pixels.
+ *   INPUTS: t -- the tree (after octree_build)
+ *   OUTPUTS: palette -- one entry per leaf (6-bit components)
+ *   RETURN VALUE: number of palette entries
+ *   SIDE EFFECTS: changes the tree
+ */
+int32_t
+octree_reduce (octree_t* t, uint8_t palette[][3])
+{
+    octree_node_t* nd;	/* node being folded            */
+    int32_t        n;	/* nodes in heap                */
+    int32_t        kids; /* children of nd              */
+    int32_t        i;	/* index over nodes or children */
+    uint16_t       id;	/* arena index of nd            */
+
+    /* At first, only the nodes just above the leaves can be folded. */
+    n = 0;
+    for (i = 1; t->used > i; i++) {
+	if (t->depth - 1 == t->node[i].level) {
+	    heap_push (t, &n, i);
+	}
+    }
+    if (1 == t->depth && 0 != t->leaves) {
+	heap_push (t, &n, 0);
+    }
+
+    while (t->max_leaves < t->leaves && 0 < n) {
+	nd = &t->node[id = heap_pop (t, &n)];
+	for (kids = 0, i = 0; 8 > i; i++) {
+	    kids += (0 != nd->child[i]);
+	}
+	nd->leaf = 1;
+	t->leaves -= kids - 1;
+	if (0 != id && all_leaves (t, &t->node[nd->parent])) {
+	    heap_push (t, &n, nd->parent);
+	}
+    }
+    return (0 == t->leaves ? 0 : number_leaves (t, 0, palette, 0));
+}
+
+
+/*
+ * octree_map
+ *   DESCRIPTION: Find the palette entry for a pixel value by walking
+ *                down the tree to its leaf.  The value need not have
+ *                been in the histogram; it then maps to the leaf reached
+ *                by its path, or to the most populous child where the
+ *                path runs out.
+ *   INPUTS: t -- the tree (after octree_reduce)
+ *           pixel -- 5:6:5 pixel value
+ *   OUTPUTS: none
+ *   RETURN VALUE: palette entry
+ *   SIDE EFFECTS: none
+ */
+uint8_t
+octree_map (const octree_t* t, uint16_t pixel)
+{
+    const octree_node_t* nd;	/* node on the pixel's path */
+    uint32_t             r;	/* 5-bit red                */
+    uint32_t             g;	/* 6-bit green              */
+    uint32_t             b;	/* 5-bit blue               */
+    uint32_t             most;	/* pixels in best child     */
+    int32_t              l;	/* level of nd              */
+    int32_t              k;	/* child index              */
+    int32_t              i;	/* index over children      */
+
+    r = pixel >> 11;
+    g = (pixel >> 5) & 0x3F;
+    b = pixel & 0x1F;
+    for (nd = &t->node[0], l = 0; !nd->leaf; l++) {
+	k = (((r >> (4 - l)) & 1) << 2) | (((g >> (5 - l)) & 1) << 1) |
+	    ((b >> (4 - l)) & 1);
+	if (0 == nd->child[k]) {
+	    for (most = 0, i = 0; 8 > i; i++) {
+		if (0 != nd->child[i] &&
+		    most < t->node[nd->child[i]].count) {
+		    most = t->node[nd->child[i]].count;
+		    k = i;
+		}
+	    }
+	}
+	nd = &t->node[nd->child[k]];
+    }
+    return nd->index;
+}
+
+
+/*
+ * heap_less
+ *   DESCRIPTION: Order two nodes for folding: fewer pixels first, then
+ *                lower arena index.
+ *   INPUTS: t -- the tree
+ *           a, b -- arena indices of nodes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if a comes before b, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+heap_less (const octree_t* t, uint16_t a, uint16_t b)
+{
+    return (t->node[a].count < t->node[b].count ||
+	    (t->node[a].count == t->node[b].count && a < b));
+}
+
+
+/*
+ * heap_push
+ *   DESCRIPTION: Add a node to the heap of nodes that can be folded.
+ *   INPUTS: t -- the tree
+ *           n -- nodes in heap
+ *           id -- arena index of node
+ *   OUTPUTS: n -- one more
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the heap
+ */
+static void
+heap_push (octree_t* t, int32_t* n, uint16_t id)
+{
+    int32_t i; /* position of id   */
+    int32_t p; /* parent position  */
+
+    for (i = (*n)++; 0 < i && heap_less (t, id, t->heap[p = (i - 1) / 2]);
+	 i = p) {
+	t->heap[i] = t->heap[p];
+    }
+    t->heap[i] = id;
+}
+
+
+/*
+ * heap_pop
+ *   DESCRIPTION: Take the first node from the heap of nodes that can be
+ *                folded.
+ *   INPUTS: t -- the tree
+ *           n -- nodes in heap (at least one)
+ *   OUTPUTS: n -- one fewer
+ *   RETURN VALUE: arena index of the node
+ *   SIDE EFFECTS: changes the heap
+ */
+static uint16_t
+heap_pop (octree_t* t, int32_t* n)
+{
+    uint16_t top;  /* node taken          */
+    uint16_t last; /* node moved down     */
+    int32_t  i;	   /* position of last    */
+    int32_t  c;	   /* child position      */
+
+    top = t->heap[0];
+    last = t->heap[--*n];
+    for (i = 0; *n > (c = 2 * i + 1); i = c) {
+	if (*n > c + 1 && heap_less (t, t->heap[c + 1], t->heap[c])) {
+	    c++;
+	}
+	if (!heap_less (t, t->heap[c], last)) {
+	    break;
+	}
+	t->heap[i] = t->heap[c];
+    }
+    t->heap[i] = last;
+    return top;
+}
+
+
+/*
+ * all_leaves
+ *   DESCRIPTION: Check whether all of a node's children are leaves.
+ *   INPUTS: t -- the tree
+ *           nd -- the node (not a leaf)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if so, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+all_leaves (const octree_t* t, const octree_node_t* nd)
+{
+    int32_t i; /* index over children */
+
+    for (i = 0; 8 > i; i++) {
+	if (0 != nd->child[i] && !t->node[nd->child[i]].leaf) {
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+
+/*
+ * number_leaves
+ *   DESCRIPTION: Number the leaves under a node in tree order and fill
+ *                in their palette entries, rounding each average.
+ *   INPUTS: t -- the tree
+ *           id -- arena index of node
+ *           n -- next palette entry
+ *   OUTPUTS: palette -- entries for the leaves
+ *   RETURN VALUE: next palette entry after these leaves
+ *   SIDE EFFECTS: sets the leaves' indices
+ */
+static int32_t
+number_leaves (octree_t* t, uint16_t id, uint8_t palette[][3], int32_t n)
+{
+    octree_node_t* nd = &t->node[id]; /* the node          */
+    uint64_t       half;		  /* for rounding      */
+    int32_t        i;		  /* index over children */
+
+    if (!nd->leaf) {
+	for (i = 0; 8 > i; i++) {
+	    if (0 != nd->child[i]) {
+		n = number_leaves (t, nd->child[i], palette, n);
+	    }
+	}
+	return n;
+    }
+    half = nd->count / 2;
+    nd->index = n;
+    palette[n][0] = (2 * (uint64_t)nd->red + half) / nd->count;
+    palette[n][1] = (nd->green + half) / nd->count;
+    palette[n][2] = (2 * (uint64_t)nd->blue + half) / nd->count;
+    return n + 1;
+}
+
+
+/*
+ * octree_levels
+ *   DESCRIPTION: Choose a palette with the original scheme: count pixels
+ *                in the 4096 level 4 nodes (four bits of each component),
+ *                give the 128 most used nodes the first 128 entries, and
+ *                give each of the 64 level 2 nodes the average of the
+ *                rest of its pixels.  The results match those of the
+ *                code this replaced in read_photo.
+ *   INPUTS: hist -- pixel count for each 5:6:5 value
+ *   OUTPUTS: palette -- 192 entries (6-bit components)
+ *            map -- palette entry for each pixel value in hist
+ *   RETURN VALUE: 0 on success, or -1 if memory runs out
+ *   SIDE EFFECTS: none
+ */
+int32_t
+octree_levels (const uint32_t hist[OCTREE_COLORS], uint8_t palette[192][3],
+	       uint8_t map[OCTREE_COLORS])
+{
+    levels_node_t* node;   /* level 4 nodes in index order   */
+    levels_node_t* sorted; /* the same, sorted by count      */
+    uint8_t*       entry;  /* palette entry of each node     */
+    uint32_t       c;	   /* 5:6:5 pixel value              */
+    int32_t        i;	   /* index over nodes               */
+    int            least;  /* count of the 129th most used   */
+
+    if (NULL == (node = malloc (OCTREE_LEVELS_BYTES))) {
+	return -1;
+    }
+    sorted = node + 4096;
+    entry = (uint8_t*)(sorted + 4096);
+
+    /* Count pixels and the low bits of their components in each node. */
+    for (i = 0; 4096 > i; i++) {
+	node[i].count = node[i].red = node[i].green = node[i].blue = 0;
+	node[i].index = i;
+    }
+    for (c = 0; OCTREE_COLORS > c; c++) {
+	if (0 != hist[c]) {
+	    i = ((c >> 12) << 8) | (((c >> 7) & 0xF) << 4) | ((c >> 1) & 0xF);
+	    node[i].count += hist[c];
+	    node[i].red += ((c >> 11) & 1) * hist[c];
+	    node[i].green += ((c >> 5) & 3) * hist[c];
+	    node[i].blue += (c & 1) * hist[c];
+	}
+    }
+    (void)memcpy (sorted, node, 4096 * sizeof (*node));
+    qsort (sorted, 4096, sizeof (*sorted), levels_compare);
+    levels_palette (sorted, palette);
+
+    /*
+     * A node with more pixels than the 129th most used is one of the
+     * first 128 entries; any other maps to its level 2 node.
+     */
+    least = sorted[4095 - 128].count;
+    for (i = 0; 4096 > i; i++) {
+	entry[i] = 128 + (((i >> 10) << 4) | (((i >> 6) & 3) << 2) |
+			  ((i >> 2) & 3));
+    }
+    for (i = 0; 128 > i; i++) {
+	if (sorted[4095 - i].count > least) {
+	    entry[sorted[4095 - i].index] = i;
+	}
+    }
+    for (c = 0; OCTREE_COLORS > c; c++) {
+	if (0 != hist[c]) {
+	    map[c] = entry[((c >> 12) << 8) | (((c >> 7) & 0xF) << 4) |
+			   ((c >> 1) & 0xF)];
+	}
+    }
+    free (node);
+    return 0;
+}
+
+
+/*
+ * levels_compare
+ *   DESCRIPTION: Compare level 4 nodes by pixel count (for qsort).
+ *   INPUTS: a, b -- the nodes
+ *   OUTPUTS: none
+ *   RETURN VALUE: difference of counts
+ *   SIDE EFFECTS: none
+ */
+static int
+levels_compare (const void* a, const void* b)
+{
+    return ((const levels_node_t*)a)->count - ((const levels_node_t*)b)->count;
+}
+
+
+/*
+ * levels_palette
+ *   DESCRIPTION: Fill in the palette for octree_levels: the 128 most used
+ *                level 4 nodes, then averages of the rest at level 2.
+ *   INPUTS: sorted -- level 4 nodes sorted by count
+ *   OUTPUTS: palette -- 192 entries
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+levels_palette (levels_node_t* sorted, uint8_t palette[192][3])
+{
+    levels_node_t level_2[64]; /* sums of bits below level 2 */
+    int           i;	       /* index over nodes           */
+
+    for (i = 0; 128 > i; i++) {
+	int count = sorted[4095 - i].count / 2;
+	int val = sorted[4095 - i].index;
+	int red = (val >> 8) << 1;
+	int green = (val >> 4 & 0xF) << 2;
+	int blue = (val & 0xF) << 1;
+
+	if (sorted[4095 - i].red >= count) {
+	    red++;
+	}
+	if (0 != count) {
+	    green += sorted[4095 - i].green / (2 * count);
+	}
+	if (sorted[4095 - i].blue >= count) {
+	    blue++;
+	}
+	palette[i][0] = red << 1;
+	palette[i][1] = green;
+	palette[i][2] = blue << 1;
+    }
+
+    /* Add the other level 4 nodes into their level 2 nodes. */
+    (void)memset (level_2, 0, sizeof (level_2));
+    for (i = 128; 4096 > i; i++) {
+	int ind1 = sorted[4095 - i].index;
+	int ind2 = ((ind1 >> 10) << 4) | (((ind1 >> 6) & 3) << 2) |
+		   ((ind1 >> 2) & 3);
+	int red = (ind1 >> 7) & 0x06;
+	int green = (ind1 >> 2) & 0x0C;
+	int blue = (ind1 & 0x03) << 1;
+	int count = sorted[4095 - i].count;
+
+	level_2[ind2].red += red * count + sorted[4095 - i].red;
+	level_2[ind2].green += green * count + sorted[4095 - i].green;
+	level_2[ind2].blue += blue * count + sorted[4095 - i].blue;
+	level_2[ind2].count += count;
+    }
+
+    /* Each level 2 entry is its top bits plus the average of the rest. */
+    for (i = 0; 64 > i; i++) {
+	int count = level_2[i].count;
+
+	if (0 == count) {
+	    palette[128 + i][0] = palette[128 + i][1] = palette[128 + i][2] = 0;
+	} else {
+	    palette[128 + i][0] = ((i >> 4) << 4) +
+				  ((level_2[i].red / count) << 1);
+	    palette[128 + i][1] = (((i >> 2) & 3) << 4) +
+				  level_2[i].green / count;
+	    palette[128 + i][2] = ((i & 3) << 4) +
+				  ((level_2[i].blue / count) << 1);
+	}
+    }
+}
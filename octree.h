@@ -0,0 +1,100 @@
+/*									tab:8
+ *
+ * octree.h - header file for octree color quantization of room photos
+ *
+ * Filename:	    octree.h
+ * History:
+ *	1	Moved palette selection out of read_photo into an octree
+ *		with arena-allocated nodes.
+ */
+
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * A room photo is quantized from a histogram of its 5:6:5 pixels, which
+ * takes one pass over the photo and lets every later step work on the
+ * distinct colors alone.  octree_build puts each color of the histogram
+ * into a tree that splits on one more bit of red, green, and blue at
+ * each level, keeping the pixel count and component sums at every node.
+ * octree_reduce then folds the node with the fewest pixels whose
+ * children are all leaves into a leaf, again and again, until no more
+ * than the leaf budget remain, and gives each leaf a palette entry (the
+ * average of its pixels).  octree_map finds a color's leaf.
+ *
+ * Nodes come from an arena allocated once by octree_init and reset by
+ * each octree_build, so quantizing a photo allocates no memory.
+ *
+ * octree_levels is the original scheme from read_photo, kept for
+ * comparison (see "mp2photo -quant"): the 128 most used level 4 nodes,
+ * then one color for each of the 64 level 2 nodes.
+ */
+
+/* number of 5:6:5 pixel values (histogram and map size) */
+#define OCTREE_COLORS     65536
+
+/* deepest tree (five bits of each component; green keeps six in sums) */
+#define OCTREE_MAX_DEPTH  5
+
+/* most leaves (palette entries) a tree may keep */
+#define OCTREE_MAX_LEAVES 256
+
+/* settings for room photos: depth, and leaves for VGA colors 64-255 */
+#define OCTREE_DEPTH      5
+#define OCTREE_LEAVES     192
+
+/* a tree, with its node arena */
+typedef struct octree_node_t octree_node_t;
+typedef struct octree_t octree_t;
+struct octree_t {
+    octree_node_t* node;       /* arena (node 0 is the root)      */
+    uint16_t*      heap;       /* reducible nodes, fewest first   */
+    int32_t        cap;        /* nodes in arena                  */
+    int32_t        used;       /* nodes allocated since the build */
+    int32_t        depth;      /* levels below the root           */
+    int32_t        max_leaves; /* leaf budget                     */
+    int32_t        leaves;     /* leaves in the tree              */
+};
+
+/*
+ * Allocate the arena for a tree of the given depth (1 to
+ * OCTREE_MAX_DEPTH) and leaf budget (1 to OCTREE_MAX_LEAVES).  Returns 0
+ * on success, or -1 on bad settings or if memory runs out.
+ */
+extern int32_t octree_init (octree_t* t, int32_t depth, int32_t max_leaves);
+
+/* Free a tree's arena. */
+extern void octree_free (octree_t* t);
+
+/* Reset the arena and add the colors in hist (counts by pixel value). */
+extern void octree_build (octree_t* t, const uint32_t hist[OCTREE_COLORS]);
+
+/*
+ * Fold the tree down to its leaf budget and fill in one palette entry
+ * (6-bit VGA components) per leaf.  Returns the number of entries.
+ */
+extern int32_t octree_reduce (octree_t* t, uint8_t palette[][3]);
+
+/* Find the palette entry for a pixel value (after octree_reduce). */
+extern uint8_t octree_map (const octree_t* t, uint16_t pixel);
+
+/* bytes of memory held by a tree of the given depth */
+extern size_t octree_arena_bytes (int32_t depth);
+
+/* bytes of memory octree_levels allocates while it runs */
+#define OCTREE_LEVELS_BYTES (4096 * (2 * 5 * sizeof (int) + 1))
+
+/*
+ * Choose 192 palette entries with the original scheme, and set map[c]
+ * to the entry for each pixel value c present in hist.  Returns 0 on
+ * success, or -1 if memory runs out.
+ */
+extern int32_t octree_levels (const uint32_t hist[OCTREE_COLORS],
+			      uint8_t palette[192][3],
+			      uint8_t map[OCTREE_COLORS]);
+
+#endif /* OCTREE_H */
@@ -0,0 +1,183 @@
+/*									tab:8
+ *
+ * pack.c - reading assets from a mapped asset pack (see pack.h)
+ *
+ * Filename:	    pack.c
+ * History:
+ *	1	Added a single-file asset pack that is mapped at startup.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pack.h"
+#include "photo_headers.h"
+#include "trace.h"
+
+
+/* an opened pack */
+struct pack_t {
+    const uint8_t*       base;	/* read-only mapping of pack file */
+    size_t               size;	/* bytes mapped                   */
+    const pack_header_t* hdr;	/* pack header                    */
+    const pack_entry_t*  ent;	/* index table                    */
+    const char*          names;	/* names of packed files          */
+};
+
+
+/* local functions--see function headers for details */
+static int32_t check_index (const pack_t* pk);
+
+
+/*
+ * pack_open
+ *   DESCRIPTION: Map an asset pack read-only and check its index.  The
+ *                kernel is asked to read the whole file ahead, since
+ *                loading the world touches every asset in it.
+ *   INPUTS: fname -- pack file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the pack, or NULL if it is missing or damaged
+ *   SIDE EFFECTS: maps the file (unmap it with pack_close)
+ */
+pack_t*
+pack_open (const char* fname)
+{
+    int         fd;	/* pack file descriptor */
+    struct stat sb;	/* pack file size       */
+    void*       map;	/* pack mapping         */
+    pack_t*     pk;	/* the pack             */
+
+    TRACE_BEGIN ("pack_open");
+    if (-1 == (fd = open (fname, O_RDONLY))) {
+	TRACE_END ("pack_open");
+	return NULL;
+    }
+    if (0 != fstat (fd, &sb) || sizeof (pack_header_t) > (size_t)sb.st_size ||
+	MAP_FAILED == (map = mmap (NULL, sb.st_size, PROT_READ, MAP_PRIVATE,
+				   fd, 0))) {
+	(void)close (fd);
+	TRACE_END ("pack_open");
+	return NULL;
+    }
+    (void)close (fd);
+    (void)madvise (map, sb.st_size, MADV_WILLNEED);
+    if (NULL == (pk = malloc (sizeof (*pk)))) {
+	(void)munmap (map, sb.st_size);
+	TRACE_END ("pack_open");
+	return NULL;
+    }
+    pk->base = map;
+    pk->size = sb.st_size;
+    pk->hdr = map;
+    pk->ent = (const pack_entry_t*)(pk->hdr + 1);
+    pk->names = (const char*)(pk->ent + pk->hdr->n_entries);
+    if (0 != check_index (pk)) {
+	pack_close (pk);
+	pk = NULL;
+    }
+    TRACE_END ("pack_open");
+    return pk;
+}
+
+
+/*
+ * check_index
+ *   DESCRIPTION: Check that a pack's header and index describe names and
+ *                contents that lie within the file, so that pack_find
+ *                need not check again.
+ *   INPUTS: pk -- the pack (with all fields set)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the pack is sound, or -1 if it is damaged
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+check_index (const pack_t* pk)
+{
+    const pack_entry_t* e;	/* index entry          */
+    uint64_t            head;	/* bytes before names   */
+    uint32_t            i;	/* index over entries   */
+
+    if (0 != memcmp (pk->hdr->magic, PACK_MAGIC, sizeof (pk->hdr->magic))) {
+	return -1;
+    }
+    head = sizeof (*pk->hdr) + (uint64_t)pk->hdr->n_entries * sizeof (*e);
+    if (head > pk->size || pk->hdr->names_size > pk->size - head ||
+	(0 != pk->hdr->names_size && 
+	 '\0' != pk->names[pk->hdr->names_size - 1])) {
+	return -1;
+    }
+    for (i = 0; pk->hdr->n_entries > i; i++) {
+	e = &pk->ent[i];
+	if (e->name_off >= pk->hdr->names_size || e->offset > pk->size ||
+	    e->size > pk->size - e->offset ||
+	    (0 < i && 0 <= strcmp (pk->names + e[-1].name_off, 
+				   pk->names + e->name_off))) {
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+
+/*
+ * pack_find
+ *   DESCRIPTION: Look up a packed file by name (a binary search of the
+ *                sorted index).
+ *   INPUTS: pk -- the pack
+ *           fname -- name the file was packed under
+ *   OUTPUTS: len -- size of the file
+ *            mtime -- modification time of the file when packed
+ *   RETURN VALUE: pointer to the file's contents in the mapping, or NULL
+ *                 if it is not in the pack
+ *   SIDE EFFECTS: none
+ */
+const void*
+pack_find (const pack_t* pk, const char* fname, size_t* len, 
+	   int64_t* mtime)
+{
+    const pack_entry_t* e;	/* index entry              */
+    uint32_t            lo;	/* first entry still in play */
+    uint32_t            hi;	/* entry past those in play  */
+    uint32_t            mid;	/* entry compared            */
+    int                 cmp;	/* result of comparison      */
+
+    lo = 0;
+    hi = pk->hdr->n_entries;
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	e = &pk->ent[mid];
+	if (0 == (cmp = strcmp (fname, pk->names + e->name_off))) {
+	    *len = e->size;
+	    *mtime = e->mtime;
+	    return pk->base + e->offset;
+	}
+	if (0 > cmp) {
+	    hi = mid;
+	} else {
+	    lo = mid + 1;
+	}
+    }
+    return NULL;
+}
+
+
+/*
+ * pack_close
+ *   DESCRIPTION: Unmap a pack.  Views from pack_find become invalid.
+ *   INPUTS: pk -- the pack (may be NULL)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: unmaps the file; frees memory
+ */
+void
+pack_close (pack_t* pk)
+{
+    if (NULL != pk) {
+	(void)munmap ((void*)pk->base, pk->size);
+	free (pk);
+    }
+}
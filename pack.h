@@ -0,0 +1,50 @@
+/*									tab:8
+ *
+ * pack.h - header file for reading assets from a mapped asset pack
+ *
+ * Filename:	    pack.h
+ * History:
+ *	1	Added a single-file asset pack that is mapped at startup.
+ */
+
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * Loading the world reads dozens of room photos and object images, each
+ * with its own open, reads, and close, and each a separate miss in the
+ * page cache on a cold start.  mkpack copies them all into one file
+ * (see photo_headers.h for the format), which pack_open maps with one
+ * mmap and asks the kernel to read ahead in full.  pack_find then gives
+ * the contents of a packed file by name, for read_photo_view and 
+ * read_obj_image_view.  Files missing from the pack are read from disk
+ * as before, and so is a loose file modified after its copy was packed
+ * (with a warning to rebuild the pack), so edited assets are never 
+ * shadowed by a stale pack.
+ */
+
+/* default pack file name (see "make assets.pack") */
+#define PACK_NAME "assets.pack"
+
+/* an opened pack */
+typedef struct pack_t pack_t;
+
+/* Map a pack read-only.  Returns NULL if it is missing or damaged. */
+extern pack_t* pack_open (const char* fname);
+
+/*
+ * Look up a packed file by the name it was packed under.  Returns its
+ * contents (valid until pack_close) and sets *len and *mtime to its size
+ * and modification time, or returns NULL if it is not in the pack.
+ */
+extern const void* pack_find (const pack_t* pk, const char* fname, 
+			      size_t* len, int64_t* mtime);
+
+/* Unmap a pack. */
+extern void pack_close (pack_t* pk);
+
+#endif /* PACK_H */
@@ -36,29 +36,164 @@
  */
 
 
+#include <fcntl.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "assert.h"
+#include "lz.h"
 #include "modex.h"
 #include "photo.h"
 #include "photo_headers.h"
+#include "pixcodec.h"
+#include "quant.h"
+#include "stats.h"
+#include "trace.h"
 #include "world.h"
 
 
+/* 
+ * Room photo pixels are kept in square tiles of TILE_DIM x TILE_DIM
+ * pixels, each compressed on its own with lz_compress.  Tiles at the
+ * right and bottom edges are padded with zeros to full size.  Only the
+ * tiles under the lines being drawn are expanded, into a small cache
+ * shared by all photos, so the memory for decoded pixels is fixed by
+ * the size of the view rather than by the photos.  A scrolling view
+ * touches at most 6 x 4 tiles, so the cache holds two views' worth.
+ *
+ * Tiles are numbered from the bottom row of tiles up, left to right
+ * within a row, which is the order in which a .photo file holds them.
+ */
+#define TILE_SHIFT       6
+#define TILE_DIM         (1 << TILE_SHIFT)
+#define TILE_CACHE_SLOTS 48
+
+/* 
+ * Panoramas (photos larger than MAX_PHOTO_WIDTH x MAX_PHOTO_HEIGHT) are
+ * quantized once into a tile file next to the .photo file, named by
+ * adding TILE_FILE_SUFFIX.  Later runs read only its header and tile
+ * offsets, and tiles are read from the file as the view reaches them.
+ * The file is rebuilt whenever the .photo file's size or modification
+ * time no longer match those recorded in it.
+ */
+#define TILE_FILE_MAGIC  0x33454C54	/* "TLE3" */
+#define TILE_FILE_SUFFIX ".tiles"
+
+/* 
+ * Large photos are counted and mapped into the palette on several 
+ * threads, each taking a share of the rows: one thread per 
+ * QUANT_THREAD_PIXELS pixels, up to the number of processors and 
+ * QUANT_MAX_THREADS.  Each thread counts into a histogram of its own,
+ * and the histograms are then summed, so the palette and pixels are the
+ * same as with one thread.  A panorama is read QUANT_MAX_THREADS bands
+ * of tiles (or fewer) at a time.
+ */
+#define QUANT_MAX_THREADS   16
+#define QUANT_THREAD_PIXELS (256 * 1024)
+
+
 /* types local to this file (declared in types.h) */
 
 /* 
  * A room photo.  Note that you must write the code that selects the
  * optimized palette colors and fills in the pixel data using them as 
  * well as the code that sets up the VGA to make use of these colors.
- * Pixel data are stored as one-byte values starting from the upper
- * left and traversing the top row before returning to the left of
- * the second row, and so forth.  No padding should be used.
+ * Pixel data are one-byte values in tiles (see TILE_DIM), in rows
+ * from the top left.  The compressed tiles are in memory, or, for a
+ * panorama, in a tile file.
  */
 struct photo_t {
-    photo_header_t hdr;			/* defines height and width */
-    uint8_t        palette[192][3];     /* optimized palette colors */
-    uint8_t*       img;                 /* pixel data               */
+    photo_header_t  hdr;		/* defines height and width      */
+    uint8_t         palette[192][3];	/* optimized palette colors      */
+    uint32_t        serial;		/* names photo in the tile cache */
+    const uint32_t* tile_off;		/* tile starts in data, plus end */
+    const uint8_t*  tile_data;		/* compressed tiles, or NULL     */
+    int             fd;			/* tile file (if tile_data NULL) */
+    off_t           data_pos;		/* start of tiles in tile file   */
+};
+
+/* 
+ * Start of a panorama's tile file.  The tile offsets (one per tile, 
+ * plus the end of the last) follow, and then the compressed tiles.
+ */
+typedef struct tile_file_header_t tile_file_header_t;
+struct tile_file_header_t {
+    uint32_t       magic;		/* TILE_FILE_MAGIC              */
+    photo_header_t hdr;			/* height and width of photo    */
+    uint64_t       src_size;		/* size of the .photo file      */
+    int64_t        src_mtime;		/* its modification time        */
+    uint32_t       quant;		/* quantizer (quant_current)    */
+    uint8_t        palette[192][3];	/* palette chosen for the photo */
+};
+
+/* 
+ * A reader for the pixel rows of a .photo file in either format, in the
+ * order stored (bottom to top).  A version 2 file is decoded a block of 
+ * rows at a time.  The file may instead be a view of its contents in 
+ * memory (such as an asset pack entry), which is read in place.
+ */
+typedef struct photo_src_t photo_src_t;
+struct photo_src_t {
+    FILE*          in;		   /* the .photo file, or NULL for a view */
+    const uint8_t* mem;		   /* contents of the file, for a view    */
+    size_t         mem_len;	   /* bytes in the view                   */
+    size_t         mem_pos;	   /* next byte to read from the view     */
+    uint16_t       width;	   /* pixels per row                      */
+    uint16_t       height;	   /* rows in photo                       */
+    int32_t        rows_per_block; /* rows per block (0 for raw files)    */
+    uint32_t*      block_off;	   /* block offsets, plus end             */
+    long           data_pos;	   /* start of pixels or blocks in file   */
+    uint8_t*       packed;	   /* one coded block                     */
+    uint16_t*      rows;	   /* decoded rows (one for raw files)    */
+    int32_t        block;	   /* next block to decode                */
+    int32_t        row;		   /* next row to return from rows        */
+    int32_t        n_rows;	   /* rows held in rows                   */
+};
+
+/* 
+ * A share of the work of counting a photo's pixels, mapping them into
+ * the palette, or summing the histograms counted by each thread.
+ */
+typedef struct quant_job_t quant_job_t;
+struct quant_job_t {
+    void            (*run) (quant_job_t* job); /* does the work          */
+    const uint16_t* px;		/* pixel rows, bottom row first           */
+    uint8_t*        out;	/* mapped rows, top row first             */
+    uint32_t*       hist;	/* histogram to count or sum into         */
+    const uint32_t* part;	/* histograms to add to hist              */
+    int32_t         n_part;	/* number of histograms at part           */
+    int32_t         width;	/* pixels per row                         */
+    int32_t         rows;	/* rows at px and out                     */
+    int32_t         first;	/* first row (or pixel value) of share    */
+    int32_t         last;	/* one past last row (or value) of share  */
+    pthread_t       thread;	/* thread doing the share                 */
+    int32_t         started;	/* 1 if thread was created                */
+};
+
+/* a decoded tile in the tile cache */
+typedef struct tile_slot_t tile_slot_t;
+struct tile_slot_t {
+    uint32_t serial;			/* photo (0 for an empty slot) */
+    uint32_t tile;			/* tile index within photo     */
+    uint32_t last_use;			/* tile_clock at last use      */
+    uint8_t  pix[TILE_DIM * TILE_DIM];	/* decoded pixels              */
+};
+
+/* 
+ * The room on the screen, composited (photo and objects) once, so that
+ * the lines drawn while scrolling are plain copies.  Pixels are in rows
+ * from the top left, as in a photo.  See build_bg and room_changed.
+ */
+typedef struct bg_cache_t bg_cache_t;
+struct bg_cache_t {
+    const room_t*  room;	/* room cached, or NULL                 */
+    const photo_t* view;	/* its photo when cached                */
+    uint32_t       version;	/* its version (see room_version) then  */
+    int32_t        ok;		/* 1 if pix holds the room              */
+    uint8_t*       pix;		/* width x height composited pixels     */
+    size_t         size;	/* bytes allocated at pix               */
 };
 
 /* 
@@ -79,87 +214,99 @@ struct image_t {
 /* file-scope variables */
 
 /* 
- * The room currently shown on the screen.  This value is not known to 
- * the mode X code, but is needed when filling buffers in callbacks from 
- * that code (fill_horiz_buffer/fill_vert_buffer).  The value is set 
- * by calling prep_room.
+ * The tile cache.  The lock is held while a line of photo pixels is
+ * copied out, so that game sessions on different threads can share it.
  */
-
-
-/*Octree struct that mantains running sum of least significant bits of r,g,b count of pixels and index before sort*/
-typedef struct {
-    int count;
-    int red;
-    int green;
-    int blue;
-    int index;
-}octree_t;
-
-octree_t octree_level_4[4096];//level 4 with 4096 different nodes
-octree_t octree_level_2[64];//level 2 with 64 different nodes
-
+static tile_slot_t     tile_cache[TILE_CACHE_SLOTS];
+static uint32_t        tile_clock;	/* counts tile cache lookups */
+static uint32_t        next_serial = 1;	/* serial for the next photo */
+static uint8_t         tile_io[LZ_BOUND (TILE_DIM * TILE_DIM)]; /* tile read */
+static pthread_mutex_t tile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Scratch for choosing a photo's palette (see quant.h): a histogram of
+ * its pixel values, and the VGA color chosen for each value.  Reading 
+ * photos is not thread-safe, so one set serves every photo.
+ */
+static uint32_t quant_hist[OCTREE_COLORS];
+static uint8_t  quant_map[OCTREE_COLORS];
 
 /* 
- * comparator
- *   DESCRIPTION: compare values in a struct by frequency
- *   INPUTS: void pointers to be compared
- *   OUTPUTS: none
- *   RETURN VALUE: difference of two values
- *   SIDE EFFECTS: assists qsort to sort the octree array
+ * The background cache for the room on the screen.  It is built by 
+ * prep_room, patched by room_changed when an object moves, and rebuilt
+ * when the room's version shows any other change (such as a photo swap).
+ * Panoramas are not cached (they may be too large), so their lines are
+ * composited as they are drawn.  The lock covers the cache, cur_room
+ * (below), and changes from game sessions on other threads.
  */
-int comparator(const void* a,const void*b)
-{
-    octree_t* anew = (octree_t*) a;
-    octree_t* bnew = (octree_t*) b;
-	/*Returns if a>b*/
-    return anew->count - bnew->count;
-}
+static bg_cache_t      bg;
+static pthread_mutex_t bg_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* 
- * pixelintooctree
- *   DESCRIPTION: puts pixel into a level 4 octree node or finds pixel in index according to mode.
- *   INPUTS: value of pixel and mode (a=0 is put in octree mode , a=1 means find index mode)
- *   OUTPUTS: none
- *   RETURN VALUE: index of pixel in octree_level_4 array
- *   SIDE EFFECTS: added values to global octree_level_4 array
+ * The room currently shown on the screen.  This value is not known to 
+ * the mode X code, but is needed when filling buffers in callbacks from 
+ * that code (fill_shown_horiz_buffer/fill_shown_vert_buffer).  The value 
+ * is set by calling prep_room.  It is the one piece of display state not
+ * kept in a session: the VGA is a single device per process, and its
+ * callbacks take no context, so only one session can show rooms.  Other
+ * sessions draw through fill_horiz_buffer and friends, which take the
+ * room.  It is read and written only with bg_lock held.
  */
-int pixelintooctree(u_int16_t num,int a)
-{
-    int index;
-    int red_val=(num>>11);//find least sig bit of red
-
-    index=(red_val>>1);
-    red_val=(red_val & 0x0001);
-
-    int green_val=(num>>5);
-    green_val=green_val & (0x003F);
-
-    index=(index<<4);
-    index+=(green_val>>2);
-
-    green_val=(green_val & 0x0003);//find least 2 sig bit of green
-
-    int blue_val=num & (0x001F);
+static const room_t* cur_room = NULL;
 
-    index=(index<<4);
-    index+=(blue_val>>1);
 
-    blue_val=(blue_val & 0x01);//find least sig bit of blue
+/* local functions--see function headers for details */
+static const uint8_t* get_tile (const photo_t* p, int tx, int ty);
+static void fill_photo_row (const photo_t* p, int x, int y, int n,
+			    unsigned char* buf);
+static void fill_photo_col (const photo_t* p, int x, int y, int n,
+			    unsigned char* buf);
+static void fill_photo_rect (const photo_t* p, int x, int y, int w, int h,
+			     unsigned char* buf, int stride);
+static void fill_room_rect (const room_t* r, int x, int y, int w, int h,
+			    unsigned char* buf, int stride);
+static int32_t copy_bg (int x, int y, int w, int h, unsigned char* buf,
+			stat_id_t id, const room_t** shown);
+static void build_bg (const room_t* r);
+static int32_t compress_tiles (photo_t* p, const uint8_t* img);
+static size_t pack_tile (const photo_t* p, const uint8_t* rows, int32_t tx,
+			 int32_t h, uint8_t* dst);
+static photo_t* decode_photo (const char* fname, photo_src_t* src,
+			      const struct stat* photo_st);
+static int32_t stream_photo (photo_t* p, photo_src_t* src, uint8_t* img);
+static int32_t split_photo (photo_t* p, photo_src_t* src, int32_t n_threads,
+			    uint8_t* img);
+static photo_t* read_panorama (const char* fname, photo_src_t* src,
+			       photo_t* p, const struct stat* photo_st);
+static int32_t open_tile_file (photo_t* p, const char* name, 
+			       const struct stat* photo_st);
+static int32_t build_tile_file (photo_t* p, photo_src_t* src, 
+				const char* name, const struct stat* photo_st);
+static int32_t src_open (photo_src_t* src, FILE* in, const void* mem,
+			 size_t mem_len);
+static int32_t src_read (photo_src_t* src, void* dst, size_t len);
+static const void* src_view (photo_src_t* src, size_t len);
+static int32_t src_rewind (photo_src_t* src);
+static const uint16_t* src_row (photo_src_t* src);
+static void src_close (photo_src_t* src);
+static int32_t read_rows (photo_src_t* src, uint16_t* px, int32_t rows);
+static int32_t quant_threads (int32_t pixels);
+static uint32_t* alloc_hists (int32_t* n_threads);
+static void count_pixels (const uint16_t* px, int32_t width, int32_t rows,
+			  int32_t n_threads, uint32_t* part);
+static void sum_hists (int32_t n_threads, const uint32_t* part);
+static void map_pixels (const uint16_t* px, int32_t width, int32_t rows,
+			int32_t n_threads, uint8_t* out);
+static void run_jobs (quant_job_t* job, int32_t n, int32_t total);
+static void* run_job (void* arg);
+static void count_job (quant_job_t* job);
+static void sum_job (quant_job_t* job);
+static void map_job (quant_job_t* job);
+static int32_t choose_palette (photo_t* p);
+static void assign_serial (photo_t* p);
+static int32_t photo_tiles (const photo_t* p);
 
-	//push pixel into octree
-	if(a==0)
-	{
-		octree_level_4[index].count++;
-    	octree_level_4[index].red+=red_val;
-    	octree_level_4[index].blue+=blue_val;
-    	octree_level_4[index].green+=green_val;
-    	octree_level_4[index].index=index;
-		return -1;
-	}
-	else return index;
 
-}
-static const room_t* cur_room = NULL;
 //extern void copypalletetoVGA(uint8_t palette[192][3]); 
 //extern map_frequency(uint8_t* image ,int size);
 
@@ -174,13 +321,15 @@ static const room_t* cur_room = NULL;
  *                Note that this routine draws both the room photo and
  *                the objects in the room.
  *
- *   INPUTS: (x,y) -- leftmost pixel of line to be drawn 
+ *   INPUTS: r -- the room
+ *           (x,y) -- leftmost pixel of line to be drawn 
  *   OUTPUTS: buf -- buffer holding image data for the line
  *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
 void
-fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
+fill_horiz_buffer (const room_t* r, int x, int y, 
+		  unsigned char buf[SCROLL_X_DIM])
 {
     int            idx;   /* loop index over pixels in the line          */ 
     object_t*      obj;   /* loop index over objects in the current room */
@@ -191,18 +340,18 @@ fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
     int32_t        obj_x; /* object x position                           */
     int32_t        obj_y; /* object y position                           */
     const image_t* img;   /* object image                                */
+    uint64_t       start; /* cycle count at entry (for stats.c)          */
 
-    /* Get pointer to current photo of current room. */
-    view = room_photo (cur_room);
+    start = stat_cycles ();
 
-    /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_X_DIM; idx++) {
-        buf[idx] = (0 <= x + idx && view->hdr.width > x + idx ?
-		    view->img[view->hdr.width * y + x + idx] : 0);
-    }
+    /* Get pointer to current photo of the room. */
+    view = room_photo (r);
 
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
+    /* Copy the photo's pixels for the line. */
+    fill_photo_row (view, x, y, SCROLL_X_DIM, buf);
+
+    /* Loop over objects in the room. */
+    for (obj = room_contents_iterate (r); NULL != obj;
     	 obj = obj_next (obj)) {
 	obj_x = obj_get_x (obj);
 	obj_y = obj_get_y (obj);
@@ -239,6 +388,8 @@ fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 	    }
 	}
     }
+
+    stat_add (STAT_FILL_HORIZ, stat_cycles () - start);
 }
 
 
@@ -252,13 +403,15 @@ fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
  *                Note that this routine draws both the room photo and
  *                the objects in the room.
  *
- *   INPUTS: (x,y) -- top pixel of line to be drawn 
+ *   INPUTS: r -- the room
+ *           (x,y) -- top pixel of line to be drawn 
  *   OUTPUTS: buf -- buffer holding image data for the line
  *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
 void
-fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
+fill_vert_buffer (const room_t* r, int x, int y, 
+		 unsigned char buf[SCROLL_Y_DIM])
 {
     int            idx;   /* loop index over pixels in the line          */ 
     object_t*      obj;   /* loop index over objects in the current room */
@@ -269,18 +422,18 @@ fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
     int32_t        obj_x; /* object x position                           */
     int32_t        obj_y; /* object y position                           */
     const image_t* img;   /* object image                                */
+    uint64_t       start; /* cycle count at entry (for stats.c)          */
 
-    /* Get pointer to current photo of current room. */
-    view = room_photo (cur_room);
+    start = stat_cycles ();
 
-    /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_Y_DIM; idx++) {
-        buf[idx] = (0 <= y + idx && view->hdr.height > y + idx ?
-		    view->img[view->hdr.width * (y + idx) + x] : 0);
-    }
+    /* Get pointer to current photo of the room. */
+    view = room_photo (r);
 
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
+    /* Copy the photo's pixels for the line. */
+    fill_photo_col (view, x, y, SCROLL_Y_DIM, buf);
+
+    /* Loop over objects in the room. */
+    for (obj = room_contents_iterate (r); NULL != obj;
     	 obj = obj_next (obj)) {
 	obj_x = obj_get_x (obj);
 	obj_y = obj_get_y (obj);
@@ -317,6 +470,564 @@ fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
 	    }
 	}
     }
+
+    stat_add (STAT_FILL_VERT, stat_cycles () - start);
+}
+
+
+/* 
+ * fill_horiz_strip
+ *   DESCRIPTION: Given the (x,y) map pixel coordinate of the leftmost 
+ *                pixel of the top line of a strip of adjacent horizontal
+ *                lines, produce an image of the strip: the room photo
+ *                and objects, as for fill_horiz_buffer.
+ *   INPUTS: r -- the room
+ *           (x,y) -- leftmost pixel of top line
+ *           n -- number of lines
+ *   OUTPUTS: buf -- n rows of SCROLL_X_DIM pixels, top row first
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_horiz_strip (const room_t* r, int x, int y, int n, unsigned char* buf)
+{
+    uint64_t start; /* cycle count at entry (for stats.c) */
+
+    start = stat_cycles ();
+    fill_room_rect (r, x, y, SCROLL_X_DIM, n, buf, SCROLL_X_DIM);
+    stat_add (STAT_FILL_HSTRIP, stat_cycles () - start);
+}
+
+
+/* 
+ * fill_vert_strip
+ *   DESCRIPTION: Given the (x,y) map pixel coordinate of the top pixel 
+ *                of the leftmost line of a strip of adjacent vertical 
+ *                lines, produce an image of the strip: the room photo
+ *                and objects, as for fill_vert_buffer.
+ *   INPUTS: r -- the room
+ *           (x,y) -- top pixel of leftmost line
+ *           n -- number of lines
+ *   OUTPUTS: buf -- SCROLL_Y_DIM rows of n pixels, top row first
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_vert_strip (const room_t* r, int x, int y, int n, unsigned char* buf)
+{
+    uint64_t start; /* cycle count at entry (for stats.c) */
+
+    start = stat_cycles ();
+    fill_room_rect (r, x, y, n, SCROLL_Y_DIM, buf, n);
+    stat_add (STAT_FILL_VSTRIP, stat_cycles () - start);
+}
+
+
+/* 
+ * fill_room_rect
+ *   DESCRIPTION: Produce an image of a rectangle of a room: the photo,
+ *                then each object over it (in list order), skipping 
+ *                transparent pixels.  The object list is walked once.
+ *   INPUTS: r -- the room
+ *           (x,y) -- upper left pixel of rectangle
+ *           w -- width of rectangle
+ *           h -- height of rectangle
+ *           stride -- bytes from one row to the next in buf
+ *   OUTPUTS: buf -- h rows of w pixels, top row first
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may replace slots in the tile cache
+ */
+static void
+fill_room_rect (const room_t* r, int x, int y, int w, int h, 
+		unsigned char* buf, int stride)
+{
+    object_t*      obj;   /* loop index over objects in the room  */
+    const image_t* img;   /* object image                         */
+    const uint8_t* src;   /* row of object image pixels           */
+    unsigned char* dst;   /* row of rectangle pixels              */
+    int32_t        obj_x; /* object x position                    */
+    int32_t        obj_y; /* object y position                    */
+    int32_t        x0;    /* left of overlap with object          */
+    int32_t        x1;    /* one past right of overlap            */
+    int32_t        y0;    /* top of overlap with object           */
+    int32_t        y1;    /* one past bottom of overlap           */
+    int32_t        row;   /* index over rows of overlap           */
+    int32_t        i;     /* index over pixels in a row           */
+
+    fill_photo_rect (room_photo (r), x, y, w, h, buf, stride);
+
+    for (obj = room_contents_iterate (r); NULL != obj;
+    	 obj = obj_next (obj)) {
+	obj_x = obj_get_x (obj);
+	obj_y = obj_get_y (obj);
+	img = obj_image (obj);
+
+	/* Find the part of the object in the rectangle, if any. */
+	x0 = (x > obj_x ? x : obj_x);
+	x1 = (x + w < obj_x + img->hdr.width ? 
+	      x + w : obj_x + img->hdr.width);
+	y0 = (y > obj_y ? y : obj_y);
+	y1 = (y + h < obj_y + img->hdr.height ? 
+	      y + h : obj_y + img->hdr.height);
+	if (x0 >= x1 || y0 >= y1) {
+	    continue;
+	}
+
+	/* Copy the object's pixels, a row at a time. */
+	for (row = y0; y1 > row; row++) {
+	    src = img->img + (row - obj_y) * img->hdr.width + (x0 - obj_x);
+	    dst = buf + (row - y) * stride + (x0 - x);
+	    for (i = 0; x1 - x0 > i; i++) {
+
+		/* Don't copy transparent pixels. */
+		if (OBJ_CLR_TRANSP != src[i]) {
+		    dst[i] = src[i];
+		}
+	    }
+	}
+    }
+}
+
+
+/* 
+ * get_tile
+ *   DESCRIPTION: Find a tile of a room photo in the tile cache, expanding
+ *                it into the least recently used slot if it is not
+ *                there.  A damaged tile (possible only for a photo
+ *                imported from shared memory or read from a tile file)
+ *                reads as zeros.
+ *   INPUTS: p -- room photo
+ *           (tx,ty) -- column and row of tile
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the tile's TILE_DIM x TILE_DIM pixels, 
+ *                 valid until the next call
+ *   SIDE EFFECTS: may replace a slot in the tile cache; caller must
+ *                 hold tile_lock
+ */
+static const uint8_t*
+get_tile (const photo_t* p, int tx, int ty)
+{
+    uint32_t     tile;	 /* index of tile in photo          */
+    int32_t      i;	 /* index over cache slots          */
+    tile_slot_t* slot;	 /* current cache slot              */
+    tile_slot_t* victim; /* least recently used slot so far */
+    uint64_t     start;	 /* cycle count before expanding    */
+    uint32_t     len;	 /* compressed size of tile         */
+    const uint8_t* src;	 /* compressed tile, or NULL        */
+
+    tile = (((p->hdr.height + TILE_DIM - 1) >> TILE_SHIFT) - 1 - ty) *
+	   ((p->hdr.width + TILE_DIM - 1) >> TILE_SHIFT) + tx;
+    tile_clock++;
+    victim = &tile_cache[0];
+    for (i = 0; TILE_CACHE_SLOTS > i; i++) {
+	slot = &tile_cache[i];
+	if (p->serial == slot->serial && tile == slot->tile) {
+	    slot->last_use = tile_clock;
+	    return slot->pix;
+	}
+	if (tile_clock - slot->last_use > tile_clock - victim->last_use) {
+	    victim = slot;
+	}
+    }
+
+    start = stat_cycles ();
+    len = p->tile_off[tile + 1] - p->tile_off[tile];
+    if (NULL != p->tile_data) {
+	src = p->tile_data + p->tile_off[tile];
+    } else if (sizeof (tile_io) >= len &&
+	       (ssize_t)len == pread (p->fd, tile_io, len, 
+				      p->data_pos + p->tile_off[tile])) {
+	src = tile_io;
+    } else {
+	src = NULL;
+    }
+    if (NULL == src || 
+	0 != lz_decompress (src, len, victim->pix, sizeof (victim->pix))) {
+	(void)memset (victim->pix, 0, sizeof (victim->pix));
+    }
+    victim->serial = p->serial;
+    victim->tile = tile;
+    victim->last_use = tile_clock;
+    stat_add (STAT_LOAD_TILE, stat_cycles () - start);
+    return victim->pix;
+}
+
+
+/* 
+ * fill_photo_row
+ *   DESCRIPTION: Copy part of a row of room photo pixels, a tile at a 
+ *                time.  Pixels outside of the photo are 0.
+ *   INPUTS: p -- room photo
+ *           (x,y) -- leftmost pixel to copy
+ *           n -- number of pixels
+ *   OUTPUTS: buf -- the n pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may replace slots in the tile cache
+ */
+static void
+fill_photo_row (const photo_t* p, int x, int y, int n, unsigned char* buf)
+{
+    int            idx;	 /* index of next pixel in buf          */
+    int            px;	 /* photo column of pixel idx           */
+    int            len;	 /* pixels copied from the current tile */
+    const uint8_t* tile; /* current tile                        */
+
+    if (0 > y || p->hdr.height <= y) {
+	(void)memset (buf, 0, n);
+	return;
+    }
+    (void)pthread_mutex_lock (&tile_lock);
+    for (idx = 0; n > idx; idx += len) {
+	px = x + idx;
+	if (0 > px || p->hdr.width <= px) {
+	    buf[idx] = 0;
+	    len = 1;
+	    continue;
+	}
+	tile = get_tile (p, px >> TILE_SHIFT, y >> TILE_SHIFT);
+	len = TILE_DIM - (px & (TILE_DIM - 1));
+	if (n - idx < len) {
+	    len = n - idx;
+	}
+	if (p->hdr.width - px < len) {
+	    len = p->hdr.width - px;
+	}
+	(void)memcpy (buf + idx, tile + ((y & (TILE_DIM - 1)) << TILE_SHIFT) +
+		      (px & (TILE_DIM - 1)), len);
+    }
+    (void)pthread_mutex_unlock (&tile_lock);
+}
+
+
+/* 
+ * fill_photo_col
+ *   DESCRIPTION: Copy part of a column of room photo pixels, a tile at a
+ *                time.  Pixels outside of the photo are 0.
+ *   INPUTS: p -- room photo
+ *           (x,y) -- top pixel to copy
+ *           n -- number of pixels
+ *   OUTPUTS: buf -- the n pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may replace slots in the tile cache
+ */
+static void
+fill_photo_col (const photo_t* p, int x, int y, int n, unsigned char* buf)
+{
+    int            idx;	 /* index of next pixel in buf          */
+    int            py;	 /* photo row of pixel idx              */
+    int            len;	 /* pixels copied from the current tile */
+    int            i;	 /* index over pixels from the tile     */
+    const uint8_t* tile; /* current tile                        */
+
+    if (0 > x || p->hdr.width <= x) {
+	(void)memset (buf, 0, n);
+	return;
+    }
+    (void)pthread_mutex_lock (&tile_lock);
+    for (idx = 0; n > idx; idx += len) {
+	py = y + idx;
+	if (0 > py || p->hdr.height <= py) {
+	    buf[idx] = 0;
+	    len = 1;
+	    continue;
+	}
+	tile = get_tile (p, x >> TILE_SHIFT, py >> TILE_SHIFT);
+	len = TILE_DIM - (py & (TILE_DIM - 1));
+	if (n - idx < len) {
+	    len = n - idx;
+	}
+	if (p->hdr.height - py < len) {
+	    len = p->hdr.height - py;
+	}
+	tile += ((py & (TILE_DIM - 1)) << TILE_SHIFT) + (x & (TILE_DIM - 1));
+	for (i = 0; len > i; i++) {
+	    buf[idx + i] = tile[i << TILE_SHIFT];
+	}
+    }
+    (void)pthread_mutex_unlock (&tile_lock);
+}
+
+
+/* 
+ * fill_photo_rect
+ *   DESCRIPTION: Copy a rectangle of room photo pixels, a tile at a
+ *                time, so that each tile is found once.  Pixels outside
+ *                of the photo are 0.
+ *   INPUTS: p -- room photo
+ *           (x,y) -- upper left pixel to copy
+ *           w -- width of rectangle
+ *           h -- height of rectangle
+ *           stride -- bytes from one row to the next in buf
+ *   OUTPUTS: buf -- h rows of w pixels, top row first
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may replace slots in the tile cache
+ */
+static void
+fill_photo_rect (const photo_t* p, int x, int y, int w, int h, 
+		 unsigned char* buf, int stride)
+{
+    int            row;	 /* index of next row in buf             */
+    int            col;	 /* index of next column in buf          */
+    int            rows; /* rows copied from the current tiles   */
+    int            cols; /* columns copied from the current tile */
+    int            px;	 /* photo column of column col           */
+    int            py;	 /* photo row of row row                 */
+    int            i;	 /* index over rows from the tile        */
+    const uint8_t* tile; /* current tile                         */
+
+    if (0 > x || 0 > y || p->hdr.width < x + w || p->hdr.height < y + h) {
+	for (row = 0; h > row; row++) {
+	    (void)memset (buf + row * stride, 0, w);
+	}
+    }
+    (void)pthread_mutex_lock (&tile_lock);
+    for (row = 0; h > row; row += rows) {
+	py = y + row;
+	if (0 > py) {
+	    rows = -py;
+	    continue;
+	}
+	if (p->hdr.height <= py) {
+	    break;
+	}
+	rows = TILE_DIM - (py & (TILE_DIM - 1));
+	if (h - row < rows) {
+	    rows = h - row;
+	}
+	if (p->hdr.height - py < rows) {
+	    rows = p->hdr.height - py;
+	}
+	for (col = 0; w > col; col += cols) {
+	    px = x + col;
+	    if (0 > px) {
+		cols = -px;
+		continue;
+	    }
+	    if (p->hdr.width <= px) {
+		break;
+	    }
+	    cols = TILE_DIM - (px & (TILE_DIM - 1));
+	    if (w - col < cols) {
+		cols = w - col;
+	    }
+	    if (p->hdr.width - px < cols) {
+		cols = p->hdr.width - px;
+	    }
+	    tile = get_tile (p, px >> TILE_SHIFT, py >> TILE_SHIFT) +
+		   ((py & (TILE_DIM - 1)) << TILE_SHIFT) + 
+		   (px & (TILE_DIM - 1));
+	    for (i = 0; rows > i; i++) {
+		(void)memcpy (buf + (row + i) * stride + col, 
+			      tile + (i << TILE_SHIFT), cols);
+	    }
+	}
+    }
+    (void)pthread_mutex_unlock (&tile_lock);
+}
+
+
+/* 
+ * fill_shown_horiz_buffer
+ *   DESCRIPTION: Mode X callback: fill a buffer with a horizontal line of 
+ *                the room on the screen (see fill_horiz_buffer).  The
+ *                pixels come from the background cache if it holds the
+ *                room.
+ *   INPUTS: (x,y) -- leftmost pixel of line to be drawn 
+ *   OUTPUTS: buf -- buffer holding image data for the line
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_shown_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
+{
+    const room_t* r; /* room on the screen */
+
+    if (0 != copy_bg (x, y, SCROLL_X_DIM, 1, buf, STAT_FILL_HORIZ, &r) &&
+	NULL != r) {
+	fill_horiz_buffer (r, x, y, buf);
+    }
+}
+
+
+/* 
+ * fill_shown_vert_buffer
+ *   DESCRIPTION: Mode X callback: fill a buffer with a vertical line of 
+ *                the room on the screen (see fill_vert_buffer).  The
+ *                pixels come from the background cache if it holds the
+ *                room.
+ *   INPUTS: (x,y) -- top pixel of line to be drawn 
+ *   OUTPUTS: buf -- buffer holding image data for the line
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_shown_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
+{
+    const room_t* r; /* room on the screen */
+
+    if (0 != copy_bg (x, y, 1, SCROLL_Y_DIM, buf, STAT_FILL_VERT, &r) &&
+	NULL != r) {
+	fill_vert_buffer (r, x, y, buf);
+    }
+}
+
+
+/* 
+ * fill_shown_horiz_strip
+ *   DESCRIPTION: Mode X callback: fill a buffer with a strip of 
+ *                horizontal lines of the room on the screen (see 
+ *                fill_horiz_strip).  The pixels come from the
+ *                background cache if it holds the room.
+ *   INPUTS: (x,y) -- leftmost pixel of top line
+ *           n -- number of lines
+ *   OUTPUTS: buf -- n rows of SCROLL_X_DIM pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_shown_horiz_strip (int x, int y, int n, unsigned char* buf)
+{
+    const room_t* r; /* room on the screen */
+
+    if (0 != copy_bg (x, y, SCROLL_X_DIM, n, buf, STAT_FILL_HSTRIP, &r) &&
+	NULL != r) {
+	fill_horiz_strip (r, x, y, n, buf);
+    }
+}
+
+
+/* 
+ * fill_shown_vert_strip
+ *   DESCRIPTION: Mode X callback: fill a buffer with a strip of vertical
+ *                lines of the room on the screen (see fill_vert_strip).
+ *                The pixels come from the background cache if it holds
+ *                the room.
+ *   INPUTS: (x,y) -- top pixel of leftmost line
+ *           n -- number of lines
+ *   OUTPUTS: buf -- SCROLL_Y_DIM rows of n pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_shown_vert_strip (int x, int y, int n, unsigned char* buf)
+{
+    const room_t* r; /* room on the screen */
+
+    if (0 != copy_bg (x, y, n, SCROLL_Y_DIM, buf, STAT_FILL_VSTRIP, &r) &&
+	NULL != r) {
+	fill_vert_strip (r, x, y, n, buf);
+    }
+}
+
+
+/* 
+ * copy_bg
+ *   DESCRIPTION: Copy a rectangle of the room on the screen from the 
+ *                background cache, first building the cache again if
+ *                the room has changed since it was built.  Pixels outside
+ *                of the photo are 0.
+ *   INPUTS: (x,y) -- upper left pixel to copy
+ *           w -- width of rectangle
+ *           h -- height of rectangle
+ *           id -- counter for the time taken (see stats.h)
+ *   OUTPUTS: buf -- h rows of w pixels, top row first
+ *            shown -- the room on the screen (cur_room), or NULL
+ *   RETURN VALUE: 0 on success, or -1 if the cache cannot hold the room
+ *                 (the caller must then composite the pixels of *shown
+ *                 itself, if it is not NULL)
+ *   SIDE EFFECTS: may rebuild the background cache
+ */
+static int32_t
+copy_bg (int x, int y, int w, int h, unsigned char* buf, stat_id_t id,
+	 const room_t** shown)
+{
+    const uint8_t* src;   /* first cached pixel of a row      */
+    int32_t        width; /* pixels per cached row            */
+    int32_t        c0;	  /* first column of buf in the photo */
+    int32_t        c1;	  /* one past the last such column    */
+    int32_t        r0;	  /* first row of buf in the photo    */
+    int32_t        r1;	  /* one past the last such row       */
+    int32_t        row;	  /* index over rows of buf           */
+    uint64_t       start; /* cycle count at entry (for stats.c) */
+
+    start = stat_cycles ();
+    (void)pthread_mutex_lock (&bg_lock);
+    *shown = cur_room;
+    if (NULL == cur_room) {
+	(void)pthread_mutex_unlock (&bg_lock);
+	return -1;
+    }
+    if (cur_room != bg.room || room_photo (cur_room) != bg.view ||
+	room_version (cur_room) != bg.version) {
+	build_bg (cur_room);
+    }
+    if (!bg.ok) {
+	(void)pthread_mutex_unlock (&bg_lock);
+	return -1;
+    }
+
+    /* Clip the rectangle to the photo. */
+    width = bg.view->hdr.width;
+    c0 = (0 > x ? -x : 0);
+    c1 = (width - x < w ? width - x : w);
+    r0 = (0 > y ? -y : 0);
+    r1 = (bg.view->hdr.height - y < h ? bg.view->hdr.height - y : h);
+    if (0 != c0 || w != c1 || 0 != r0 || h != r1) {
+	(void)memset (buf, 0, w * h);
+    }
+
+    /* Copy the rows. */
+    for (row = r0; r1 > row && c0 < c1; row++) {
+	src = bg.pix + (size_t)(y + row) * width + x;
+	if (1 == w) {
+	    buf[row] = src[0];
+	} else {
+	    (void)memcpy (buf + row * w + c0, src + c0, c1 - c0);
+	}
+    }
+    (void)pthread_mutex_unlock (&bg_lock);
+    stat_add (id, stat_cycles () - start);
+    return 0;
+}
+
+
+/* 
+ * build_bg
+ *   DESCRIPTION: Composite a room (photo and objects) into the background
+ *                cache, unless its photo is a panorama.
+ *   INPUTS: r -- the room
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills the background cache, growing it if needed; 
+ *                 caller must hold bg_lock
+ */
+static void
+build_bg (const room_t* r)
+{
+    const photo_t* view; /* room photo                   */
+    size_t         size; /* bytes of composited pixels   */
+    uint8_t*       pix;	 /* grown cache                  */
+
+    view = room_photo (r);
+    bg.room = r;
+    bg.view = view;
+    bg.version = room_version (r);
+    bg.ok = 0;
+    if (MAX_PHOTO_WIDTH < view->hdr.width || 
+	MAX_PHOTO_HEIGHT < view->hdr.height) {
+	return;
+    }
+    size = (size_t)view->hdr.width * view->hdr.height;
+    if (bg.size < size) {
+	if (NULL == (pix = realloc (bg.pix, size))) {
+	    return;
+	}
+	bg.pix = pix;
+	bg.size = size;
+    }
+    fill_room_rect (r, 0, 0, view->hdr.width, view->hdr.height, bg.pix,
+		    view->hdr.width);
+    bg.ok = 1;
 }
 
 
@@ -397,83 +1108,147 @@ prep_room (const room_t* r)
 	
 	copypalletetoVGA((uint8_t*) view->palette);//Add created palette to vga palette
 
-    /* Record the current room. */
+    /* 
+     * Record the current room, and composite it into the background
+     * cache before any of its lines are drawn.
+     */
+    (void)pthread_mutex_lock (&bg_lock);
     cur_room = r;
+    build_bg (r);
+    (void)pthread_mutex_unlock (&bg_lock);
 }
 
 
 /* 
- * read_obj_image
- *   DESCRIPTION: Read size and pixel data in 2:2:2 RGB format from a
- *                photo file and create an image structure from it.
- *   INPUTS: fname -- file name for input
+ * room_changed
+ *   DESCRIPTION: Note that an object was put into or taken out of a room
+ *                (which also advanced the room's version).  If the room
+ *                is in the background cache and was up to date, only 
+ *                the object's rectangle is composited again; otherwise
+ *                the cache is left to be rebuilt when next used.
+ *   INPUTS: r -- the room
+ *           (x,y) -- upper left pixel of the object
+ *           w -- width of the object image
+ *           h -- height of the object image
  *   OUTPUTS: none
- *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
- *                 on failure
- *   SIDE EFFECTS: dynamically allocates memory for the image
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may patch the background cache
  */
-image_t*
-read_obj_image (const char* fname)
+void
+room_changed (const room_t* r, int x, int y, int w, int h)
 {
-    FILE*    in;		/* input file               */
-    image_t* img = NULL;	/* image structure          */
-    uint16_t x;			/* index over image columns */
-    uint16_t y;			/* index over image rows    */
-    uint8_t  pixel;		/* one pixel from the file  */
+    const photo_t* view; /* room photo */
 
-    /* 
-     * Open the file, allocate the structure, read the header, do some
-     * sanity checks on it, and allocate space to hold the image pixels.
-     * If anything fails, clean up as necessary and return NULL.
-     */
-    if (NULL == (in = fopen (fname, "r+b")) ||
-	NULL == (img = malloc (sizeof (*img))) ||
-	NULL != (img->img = NULL) || /* false clause for initialization */
-	1 != fread (&img->hdr, sizeof (img->hdr), 1, in) ||
-	MAX_OBJECT_WIDTH < img->hdr.width ||
-	MAX_OBJECT_HEIGHT < img->hdr.height ||
-	NULL == (img->img = malloc 
-		 (img->hdr.width * img->hdr.height * sizeof (img->img[0])))) {
-	if (NULL != img) {
-	    if (NULL != img->img) {
-	        free (img->img);
-	    }
-	    free (img);
+    (void)pthread_mutex_lock (&bg_lock);
+    if (r == bg.room && bg.ok && room_photo (r) == bg.view &&
+	room_version (r) == bg.version + 1) {
+	view = bg.view;
+
+	/* Clip the object to the photo. */
+	if (0 > x) {
+	    w += x;
+	    x = 0;
+	}
+	if (0 > y) {
+	    h += y;
+	    y = 0;
+	}
+	if (view->hdr.width - x < w) {
+	    w = view->hdr.width - x;
 	}
-	if (NULL != in) {
-	    (void)fclose (in);
+	if (view->hdr.height - y < h) {
+	    h = view->hdr.height - y;
 	}
+	if (0 < w && 0 < h) {
+	    fill_room_rect (r, x, y, w, h, 
+			    bg.pix + (size_t)y * view->hdr.width + x,
+			    view->hdr.width);
+	}
+	bg.version = room_version (r);
+    }
+    (void)pthread_mutex_unlock (&bg_lock);
+}
+
+
+/* 
+ * read_obj_image
+ *   DESCRIPTION: Read size and pixel data in 2:2:2 RGB format from a
+ *                photo file and create an image structure from it.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the image
+ */
+image_t*
+read_obj_image (const char* fname)
+{
+    FILE*       in;		/* input file            */
+    struct stat st;		/* status of input file  */
+    uint8_t*    data = NULL;	/* contents of the file  */
+    image_t*    img = NULL;	/* image structure       */
+
+    /* Object images are small, so read the whole file at once. */
+    if (NULL != (in = fopen (fname, "r+b")) &&
+	0 == fstat (fileno (in), &st) && 0 < st.st_size &&
+	NULL != (data = malloc (st.st_size)) &&
+	1 == fread (data, st.st_size, 1, in)) {
+	img = read_obj_image_view (data, st.st_size);
+    }
+    free (data);
+    if (NULL != in) {
+	(void)fclose (in);
+    }
+    return img;
+}
+
+
+/* 
+ * read_obj_image_view
+ *   DESCRIPTION: Create an image structure from the contents of an 
+ *                object image file held in memory.
+ *   INPUTS: data -- contents of the file
+ *           len -- number of bytes at data
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated image on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the image
+ */
+image_t*
+read_obj_image_view (const void* data, size_t len)
+{
+    const uint8_t* pix;		/* pixel rows in file order */
+    image_t*       img;		/* image structure          */
+    uint16_t       y;		/* index over image rows    */
+
+    /* 
+     * Allocate the structure, copy the header, do some sanity checks on 
+     * it, and allocate space to hold the image pixels.  If anything 
+     * fails, clean up as necessary and return NULL.
+     */
+    if (sizeof (img->hdr) > len || NULL == (img = malloc (sizeof (*img)))) {
+	return NULL;
+    }
+    (void)memcpy (&img->hdr, data, sizeof (img->hdr));
+    pix = (const uint8_t*)data + sizeof (img->hdr);
+    if (MAX_OBJECT_WIDTH < img->hdr.width ||
+	MAX_OBJECT_HEIGHT < img->hdr.height ||
+	len - sizeof (img->hdr) < 
+	    (size_t)img->hdr.width * img->hdr.height ||
+	NULL == (img->img = malloc 
+		 (img->hdr.width * img->hdr.height * sizeof (img->img[0])))) {
+	free (img);
 	return NULL;
     }
 
     /* 
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
+     * Copy rows from bottom to top.  Note that the file is stored in 
+     * this order, whereas in memory we store the data in the reverse
      * order (top to bottom).
      */
-    for (y = img->hdr.height; y-- > 0; ) {
-
-	/* Loop over columns from left to right. */
-	for (x = 0; img->hdr.width > x; x++) {
-
-	    /* 
-	     * Try to read one 8-bit pixel.  On failure, clean up and 
-	     * return NULL.
-	     */
-	    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-		free (img->img);
-		free (img);
-	        (void)fclose (in);
-		return NULL;
-	    }
-
-	    /* Store the pixel in the image data. */
-	    img->img[img->hdr.width * y + x] = pixel;
-	}
+    for (y = img->hdr.height; y-- > 0; pix += img->hdr.width) {
+	(void)memcpy (img->img + img->hdr.width * y, pix, img->hdr.width);
     }
-
-    /* All done.  Return success. */
-    (void)fclose (in);
     return img;
 }
 
@@ -495,342 +1270,1383 @@ read_obj_image (const char* fname)
 photo_t*
 read_photo (const char* fname)
 {
-    FILE*    in;	/* input file               */
-    photo_t* p = NULL;	/* photo structure          */
-    uint16_t x;		/* index over image columns */
-    uint16_t y;		/* index over image rows    */
-    uint16_t pixel;	/* one pixel from the file  */
-	int i;
+    FILE*       in;		/* input file            */
+    struct stat st;		/* status of input file  */
+    photo_src_t src;		/* reader for pixel rows */
+    photo_t*    p = NULL;	/* photo structure       */
+
+    TRACE_BEGIN ("read_photo");
+    (void)memset (&src, 0, sizeof (src));
+    if (NULL != (in = fopen (fname, "r+b")) &&
+	0 == fstat (fileno (in), &st) &&
+	0 == src_open (&src, in, NULL, 0)) {
+	p = decode_photo (fname, &src, &st);
+    }
+    src_close (&src);
+    if (NULL != in) {
+	(void)fclose (in);
+    }
+    TRACE_END ("read_photo");
+    return p;
+}
+
+
+/* 
+ * read_photo_view
+ *   DESCRIPTION: Create a photo structure from the contents of a .photo
+ *                file held in memory, as read_photo does from the file.
+ *   INPUTS: fname -- name of the file (a panorama's tile file is kept 
+ *                    next to it)
+ *           data -- contents of the file
+ *           len -- number of bytes at data
+ *           mtime -- modification time of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo
+ */
+photo_t*
+read_photo_view (const char* fname, const void* data, size_t len, 
+		 int64_t mtime)
+{
+    struct stat st;		/* stands in for status of file */
+    photo_src_t src;		/* reader for pixel rows        */
+    photo_t*    p = NULL;	/* photo structure              */
+
+    TRACE_BEGIN ("read_photo");
+    (void)memset (&st, 0, sizeof (st));
+    st.st_size = len;
+    st.st_mtime = mtime;
+    if (0 == src_open (&src, NULL, data, len)) {
+	p = decode_photo (fname, &src, &st);
+    }
+    src_close (&src);
+    TRACE_END ("read_photo");
+    return p;
+}
+
+
+/* 
+ * decode_photo
+ *   DESCRIPTION: Choose an optimized palette for a room photo and map
+ *                its pixels into the palette colors, or, for a 
+ *                panorama, find or build its tile file.
+ *   INPUTS: fname -- name of .photo file
+ *           src -- reader for the .photo file, opened
+ *           photo_st -- status of the .photo file
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo
+ */
+static photo_t*
+decode_photo (const char* fname, photo_src_t* src, 
+	      const struct stat* photo_st)
+{
+    photo_t*        p = NULL;	/* photo structure          */
+    uint8_t*        img = NULL;	/* pixel data before tiling */
+    int32_t         n_threads;	/* threads for the pixels   */
+    int32_t         ret;	/* 0 if pixels were mapped  */
 
     /* 
-     * Open the file, allocate the structure, read the header, do some
-     * sanity checks on it, and allocate space to hold the photo pixels.
-     * If anything fails, clean up as necessary and return NULL.
+     * Allocate the structure, do some sanity checks on the header, and 
+     * allocate space to hold the photo pixels.  If anything fails, 
+     * clean up as necessary and return NULL.
      */
-    if (NULL == (in = fopen (fname, "r+b")) ||
-	NULL == (p = malloc (sizeof (*p))) ||
-	NULL != (p->img = NULL) || /* false clause for initialization */
-	1 != fread (&p->hdr, sizeof (p->hdr), 1, in) ||
-	MAX_PHOTO_WIDTH < p->hdr.width ||
-	MAX_PHOTO_HEIGHT < p->hdr.height ||
-	NULL == (p->img = malloc 
-		 (p->hdr.width * p->hdr.height * sizeof (p->img[0])))) {
-	if (NULL != p) {
-	    if (NULL != p->img) {
-	        free (p->img);
-	    }
-	    free (p);
-	}
-	if (NULL != in) {
-	    (void)fclose (in);
-	}
+    if (MAX_PANORAMA_WIDTH < src->width ||
+	MAX_PANORAMA_HEIGHT < src->height ||
+	NULL == (p = malloc (sizeof (*p)))) {
 	return NULL;
     }
+    p->hdr.width = src->width;
+    p->hdr.height = src->height;
 
-	//initialise global octree arrays to 0
-	for(i=0;i<4096;i++)
-	{
-		octree_level_4[i].index=i;
-		octree_level_4[i].red=0;
-		octree_level_4[i].green=0;
-		octree_level_4[i].blue=0;
-		octree_level_4[i].count=0;
-	}
-	for(i=0;i<192;i++)
-	{
-		p->palette[i][0]=0;
-		p->palette[i][1]=0;
-		p->palette[i][2]=0;
-	}
+    /* Panoramas are streamed from a tile file instead. */
+    if (MAX_PHOTO_WIDTH < p->hdr.width || MAX_PHOTO_HEIGHT < p->hdr.height) {
+	return read_panorama (fname, src, p, photo_st);
+    }
+    if (NULL == (img = malloc 
+		 (p->hdr.width * p->hdr.height * sizeof (img[0])))) {
+	free (p);
+	return NULL;
+    }
+
+    /* 
+     * One thread reads the rows as it counts and maps them; splitting
+     * the work across threads needs all of the rows in memory first.
+     */
+    n_threads = quant_threads (p->hdr.width * p->hdr.height);
+    if (1 < n_threads) {
+	ret = split_photo (p, src, n_threads, img);
+    } else {
+	ret = stream_photo (p, src, img);
+    }
+    if (0 != ret) {
+	free (img);
+	free (p);
+	return NULL;
+    }
+
+    /* Keep only the compressed tiles. */
+    if (-1 == compress_tiles (p, img)) {
+	free (img);
+	free (p);
+	return NULL;
+    }
+    free (img);
+
+    /* All done.  Return success. */
+    return p;
+}
+
+
+/* 
+ * stream_photo
+ *   DESCRIPTION: Count the pixels of a room photo as they are read, 
+ *                choose its palette, then read the pixels again and map
+ *                them into the palette colors.  A quantizer that needs
+ *                no counts reads the pixels only once.
+ *   INPUTS: p -- the photo, with its header filled in
+ *           src -- reader for the .photo file, at its first row
+ *   OUTPUTS: img -- the photo pixels, top to bottom
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: fills in the photo's palette; advances the reader
+ */
+static int32_t
+stream_photo (photo_t* p, photo_src_t* src, uint8_t* img)
+{
+    const uint16_t* row;	/* one row of pixels        */
+    uint16_t        x;		/* index over image columns */
+    uint16_t        y;		/* index over image rows    */
+    int32_t         counted;	/* 1 if pixels were counted */
+
+    TRACE_BEGIN ("read_photo histogram");
+    (void)memset (quant_hist, 0, sizeof (quant_hist));
+    counted = quant_uses_histogram ();
 
     /* 
      * Loop over rows from bottom to top.  Note that the file is stored
      * in this order, whereas in memory we store the data in the reverse
-     * order (top to bottom).
+     * order (top to bottom).  The first pass counts colors; the second
+     * maps each pixel to the palette chosen from the counts.  A 
+     * quantizer that needs no counts skips the first pass.
      */
-    for (y = p->hdr.height; y-- > 0; ) {
+    for (y = (counted ? p->hdr.height : 0); y-- > 0; ) {
+	if (NULL == (row = src_row (src))) {
+	    TRACE_END ("read_photo histogram");
+	    return -1;
+	}
+	for (x = 0; p->hdr.width > x; x++) {
+	    quant_hist[row[x]]++;
+	}
+    }
+    TRACE_END ("read_photo histogram");
+    TRACE_BEGIN ("read_photo palette");
+    if (0 != choose_palette (p)) {
+	TRACE_END ("read_photo palette");
+	return -1;
+    }
+    TRACE_END ("read_photo palette");
+    TRACE_BEGIN ("read_photo map");
 
-	/* Loop over columns from left to right. */
+    /* Read the rows (again), mapping pixels into the palette. */
+    for (y = p->hdr.height; y-- > 0; ) {
+	if ((counted && p->hdr.height - 1 == y && 0 != src_rewind (src)) ||
+	    NULL == (row = src_row (src))) {
+	    TRACE_END ("read_photo map");
+	    return -1;
+	}
 	for (x = 0; p->hdr.width > x; x++) {
+	    img[p->hdr.width * y + x] = quant_map[row[x]];
+	}
+    }
+    TRACE_END ("read_photo map");
+    return 0;
+}
 
-	    /* 
-	     * Try to read one 16-bit pixel.  On failure, clean up and 
-	     * return NULL.
-	     */
-	    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-		free (p->img);
-		free (p);
-	        (void)fclose (in);
-		return NULL;
 
-	    }
+/* 
+ * split_photo
+ *   DESCRIPTION: Read all of the pixels of a room photo once, then count
+ *                them, choose its palette, and map them into the palette
+ *                colors, splitting the counting and mapping across 
+ *                threads.
+ *   INPUTS: p -- the photo, with its header filled in
+ *           src -- reader for the .photo file, at its first row
+ *           n_threads -- number of threads wanted
+ *   OUTPUTS: img -- the photo pixels, top to bottom
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: fills in the photo's palette; advances the reader
+ */
+static int32_t
+split_photo (photo_t* p, photo_src_t* src, int32_t n_threads, 
+	     uint8_t* img)
+{
+    uint16_t* px;   /* pixels as stored in file */
+    uint32_t* part; /* histograms of threads    */
 
-		//add pixel to octree
-		pixelintooctree(pixel,0);
-	    /* 
-	     * 16-bit pixel is coded as 5:6:5 RGB (5 bits red, 6 bits green,
-	     * and 6 bits blue).  We change to 2:2:2, which we've set for the
-	     * game objects.  You need to use the other 192 palette colors
-	     * to specialize the appearance of each photo.
-	     *
-	     * In this code, you need to calculate the p->palette values,
-	     * which encode 6-bit RGB as arrays of three uint8_t's.  When
-	     * the game puts up a photo, you should then change the palette 
-	     * to match the colors needed for that photo.
-	     */
-	    p->img[p->hdr.width * y + x] = (((pixel >> 14) << 4) |
-					    (((pixel >> 9) & 0x3) << 2) |
-					    ((pixel >> 3) & 0x3));
-	}
-    }
-
-	//unsorted octree array for map like efficiency
-	octree_t map_help[4096];
-	for(i=0;i<4096;i++)
-	{
-		map_help[i]=octree_level_4[i];
-	}
-
-	//sort array based on count
-	qsort(octree_level_4,4096,sizeof(octree_t),comparator);
-
-	for(i=0;i<128;i++)
-	{
-		int count=octree_level_4[4095-i].count;
-		count=count/2;
-		int val=octree_level_4[4095-i].index;
-		int red=(val>>8);
-		red=(red<<1);
-		if(octree_level_4[4095-i].red >=count)
-		{
-			red++;
-		}
-		//red=red/count;
-		int green=(val>>4);
-		green=green & 0xF;
-		green=(green<<2);
-		if(count !=0)
-		{
-			green=green + (octree_level_4[4095-i].green/(2*count));
-		}
-		//green=green/count
+    if (NULL == (px = malloc 
+		 (p->hdr.width * p->hdr.height * sizeof (px[0])))) {
+	return -1;
+    }
 
-		int blue=val & 0xF;
-		blue=(blue<<1);
-		if(octree_level_4[4095-i].blue >=count)
-		{
-			blue++;
-		}
-		//blue=blue/count;
-
-		p->palette[i][0]=(red<<1);//push red values in palette according to calculated average
-		p->palette[i][1]=green;//push green values in palette according to calculated average
-		p->palette[i][2]=(blue<<1);//push blue values in palette according to calculated average
-	}
-
-	//initialise level_2 octree array to 0
-	for(i=0;i<64;i++)
-	{
-		octree_level_2[i].index=i;
-		octree_level_2[i].red=0;
-		octree_level_2[i].green=0;
-		octree_level_2[i].blue=0;
-		octree_level_2[i].count=0;
-	}
-
-	//fill level_2 array using level_4 sorted array
-	for(i=128;i<4096;i++)
-	{
-		int temp;
-		int ind2;
-		int ind1=octree_level_4[4095-i].index;
-
-		ind2=(ind1>>10);
-		ind2=(ind2<<2);
-		temp=(ind1>>6);
-		temp=temp&0x03;
-		ind2+=temp;
-		ind2=(ind2<<2);
-		temp=(ind1>>2);
-		temp=temp&0x03;
-		ind2+=temp;
-
-		if(octree_level_2[ind2].count==0x0)
-		{
-			int red=(ind1>>7);
-			red=red & 0x06;
-			int green=(ind1>>2);
-			green=green & 0x0C;
-			int blue= ind1 & 0x03;
-			blue=(blue<<1);
-
-			int count=octree_level_4[4095-i].count;
-
-			if(count!=0)
-			{
-				blue*=count;
-				green*=count;
-				red*=count;
-			}
-			
-			//update pixel into octree level_2 which is in the lower 3969 level4 values
-			octree_level_2[ind2].red=red+octree_level_4[4095-i].red;
-			octree_level_2[ind2].green=green+octree_level_4[4095-i].green;
-			octree_level_2[ind2].blue=blue+octree_level_4[4095-i].blue;
-			octree_level_2[ind2].count=octree_level_4[4095-i].count;
-		}
-		else
-		{
-			int red=(ind1>>7);
-			red=red & 0x06;
-			int green=(ind1>>2);
-			green=green & 0x0C;
-			int blue= ind1 & 0x03;
-			blue=(blue<<1);
-
-			int count=octree_level_4[4095-i].count;
-			blue*=count;
-			green*=count;
-			red*=count;
-			
-
-			red=red+octree_level_4[4095-i].red;
-			green=green+octree_level_4[4095-i].green;
-			blue=blue+octree_level_4[4095-i].blue;
-
-			//update pixel into octree level_2 which is in the lower 3969 level4 values
-			octree_level_2[ind2].red=red+octree_level_2[ind2].red;
-			octree_level_2[ind2].green=green+octree_level_2[ind2].green;
-			octree_level_2[ind2].blue=blue+octree_level_2[ind2].blue;
-			octree_level_2[ind2].count+=octree_level_4[4095-i].count;
-		}
+    /* 
+     * Read the rows once, from bottom to top (see stream_photo).  The
+     * pixels are then counted (if the quantizer needs the counts) and 
+     * mapped into the palette chosen from the counts.
+     */
+    TRACE_BEGIN ("read_photo histogram");
+    if (0 != read_rows (src, px, p->hdr.height)) {
+	free (px);
+	TRACE_END ("read_photo histogram");
+	return -1;
+    }
+    (void)memset (quant_hist, 0, sizeof (quant_hist));
+    if (quant_uses_histogram ()) {
+	part = alloc_hists (&n_threads);
+	count_pixels (px, p->hdr.width, p->hdr.height, n_threads, part);
+	sum_hists (n_threads, part);
+	free (part);
+    }
+    TRACE_END ("read_photo histogram");
+    TRACE_BEGIN ("read_photo palette");
+    if (0 != choose_palette (p)) {
+	free (px);
+	TRACE_END ("read_photo palette");
+	return -1;
+    }
+    TRACE_END ("read_photo palette");
+    TRACE_BEGIN ("read_photo map");
+    map_pixels (px, p->hdr.width, p->hdr.height, n_threads, img);
+    free (px);
+    TRACE_END ("read_photo map");
+    return 0;
+}
+
+
+/* 
+ * src_open
+ *   DESCRIPTION: Start reading the rows of a .photo file, which may be
+ *                in the original raw format or in version 2 (see 
+ *                photo_headers.h).
+ *   INPUTS: in -- the .photo file, positioned at its start, or NULL to
+ *                 read from a view of its contents
+ *           mem -- contents of the file (if in is NULL)
+ *           mem_len -- number of bytes at mem
+ *   OUTPUTS: src -- the reader, with the photo's height and width
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: reads the file header; dynamically allocates buffers
+ *                 (free them with src_close)
+ */
+static int32_t
+src_open (photo_src_t* src, FILE* in, const void* mem, size_t mem_len)
+{
+    photo_header_t    hdr;	/* original header         */
+    photo_v2_header_t v2;	/* version 2 header        */
+    size_t            n;	/* number of block offsets */
+    int32_t           i;	/* index over blocks       */
+
+    (void)memset (src, 0, sizeof (*src));
+    src->in = in;
+    src->mem = mem;
+    src->mem_len = mem_len;
+    if (0 != src_read (src, &hdr, sizeof (hdr))) {
+	return -1;
+    }
+
+    /* An original file: rows of raw pixels follow the header. */
+    if (0 != memcmp (&hdr, PHOTO_V2_MAGIC, sizeof (v2.magic))) {
+	src->width = hdr.width;
+	src->height = hdr.height;
+	src->data_pos = sizeof (hdr);
+	src->rows = malloc (src->width * sizeof (src->rows[0]));
+	return (NULL == src->rows ? -1 : 0);
+    }
+
+    /* A version 2 file: read the rest of the header and the offsets. */
+    (void)memcpy (&v2, &hdr, sizeof (hdr));
+    if (0 != src_read (src, (uint8_t*)&v2 + sizeof (hdr), 
+		       sizeof (v2) - sizeof (hdr)) ||
+	PHOTO_V2_VERSION != v2.version || 0 == v2.rows_per_block) {
+	return -1;
+    }
+    src->width = v2.width;
+    src->height = v2.height;
+    src->rows_per_block = v2.rows_per_block;
+    n = (src->height + src->rows_per_block - 1) / src->rows_per_block + 1;
+    src->data_pos = sizeof (v2) + n * sizeof (src->block_off[0]);
+    if (NULL == (src->block_off = malloc (n * sizeof (src->block_off[0]))) ||
+	0 != src_read (src, src->block_off, n * sizeof (src->block_off[0])) ||
+	(NULL != in &&
+	 NULL == (src->packed = malloc (PIX_BOUND ((size_t)src->width * 
+						   src->rows_per_block)))) ||
+	NULL == (src->rows = malloc ((size_t)src->width * 
+				     src->rows_per_block * 
+				     sizeof (src->rows[0]))) ||
+	0 != src->block_off[0]) {
+	return -1;
+    }
+    for (i = 0; n - 1 > i; i++) {
+	if (src->block_off[i] > src->block_off[i + 1] ||
+	    PIX_BOUND ((size_t)src->width * src->rows_per_block) <
+		src->block_off[i + 1] - src->block_off[i]) {
+	    return -1;
 	}
+    }
+    return 0;
+}
 
-	//fill level_2 palette using averages in level2 nodes
-	for(i=0;i<64;i++)
-	{
-		int red_ind=(i>>4);
-		int green_ind=0;
-		int blue_ind=0;
-		int red=octree_level_2[i].red;
-		int count=octree_level_2[i].count;
-		
-		if(count == 0 )
-		{
-			red_ind=0;
-			green_ind=0;
-			blue_ind=0;
 
-		}
-		else
-		{
-			red=red/count;
-			red_ind=red_ind<<4;
-			red=red<<1;
-			red_ind=red_ind+red;
-
-			green_ind=(i>>2);
-			green_ind= green_ind & 0x03;
-			int green=octree_level_2[i].green;
-			green=green/count;
-			green_ind=green_ind<<4;
-			green_ind=green_ind+green;
-
-			blue_ind=(i & 0x03);
-			int blue=octree_level_2[i].blue;
-			blue=blue/count;
-			blue_ind=blue_ind<<4;
-			blue=blue<<1;
-			blue_ind=blue_ind+blue;
+/* 
+ * src_read
+ *   DESCRIPTION: Copy the next bytes of a .photo file.
+ *   INPUTS: src -- the reader
+ *           len -- number of bytes
+ *   OUTPUTS: dst -- the bytes
+ *   RETURN VALUE: 0 on success, or -1 if the file is too short
+ *   SIDE EFFECTS: reads the file
+ */
+static int32_t
+src_read (photo_src_t* src, void* dst, size_t len)
+{
+    if (NULL != src->in) {
+	return (len == fread (dst, 1, len, src->in) ? 0 : -1);
+    }
+    if (src->mem_len - src->mem_pos < len) {
+	return -1;
+    }
+    (void)memcpy (dst, src->mem + src->mem_pos, len);
+    src->mem_pos += len;
+    return 0;
+}
 
-		}
-		
-		//fill level 2 palette of last 64 values
-		p->palette[128+i][0]=red_ind;
-		p->palette[128+i][1]=green_ind;
-		p->palette[128+i][2]=blue_ind;
+
+/* 
+ * src_view
+ *   DESCRIPTION: Get the next bytes of a view in place, without copying.
+ *   INPUTS: src -- the reader (a view)
+ *           len -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the bytes, or NULL if the view is too short
+ *   SIDE EFFECTS: advances past the bytes
+ */
+static const void*
+src_view (photo_src_t* src, size_t len)
+{
+    const uint8_t* data; /* the bytes */
+
+    if (src->mem_len - src->mem_pos < len) {
+	return NULL;
+    }
+    data = src->mem + src->mem_pos;
+    src->mem_pos += len;
+    return data;
+}
+
+
+/* 
+ * src_rewind
+ *   DESCRIPTION: Go back to the first row of a .photo file.
+ *   INPUTS: src -- the reader
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: seeks in the file
+ */
+static int32_t
+src_rewind (photo_src_t* src)
+{
+    src->block = 0;
+    src->row = src->n_rows = 0;
+    if (NULL == src->in) {
+	src->mem_pos = src->data_pos;
+	return 0;
+    }
+    return (0 == fseek (src->in, src->data_pos, SEEK_SET) ? 0 : -1);
+}
+
+
+/* 
+ * src_row
+ *   DESCRIPTION: Read the next row of pixels from a .photo file, 
+ *                decoding a new block of rows when needed.  Blocks are
+ *                read in order, so the file is never sought within.
+ *                Raw rows in a view are returned in place.
+ *   INPUTS: src -- the reader
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the row's pixels (valid until the next 
+ *                 call), or NULL on failure
+ *   SIDE EFFECTS: reads the file
+ */
+static const uint16_t*
+src_row (photo_src_t* src)
+{
+    const uint8_t* coded; /* coded block          */
+    size_t         len;	  /* bytes in coded block */
+
+    if (0 == src->rows_per_block) {
+	len = src->width * sizeof (src->rows[0]);
+	if (NULL == src->in && 
+	    0 == ((uintptr_t)(src->mem + src->mem_pos) & 
+		  (sizeof (src->rows[0]) - 1))) {
+	    return src_view (src, len);
+	}
+	return (0 == src_read (src, src->rows, len) ? src->rows : NULL);
+    }
+    if (src->row == src->n_rows) {
+	if (src->height <= src->block * src->rows_per_block) {
+	    return NULL;
 	}
+	src->n_rows = src->height - src->block * src->rows_per_block;
+	src->n_rows = (src->rows_per_block < src->n_rows ? 
+		       src->rows_per_block : src->n_rows);
+	len = src->block_off[src->block + 1] - src->block_off[src->block];
+	coded = (NULL == src->in ? src_view (src, len) :
+		 0 == src_read (src, src->packed, len) ? src->packed : NULL);
+	if (NULL == coded ||
+	    0 != pix_decode (coded, len, src->rows, 
+			     (size_t)src->width * src->n_rows)) {
+	    src->n_rows = 0;
+	    return NULL;
+	}
+	src->block++;
+	src->row = 0;
+    }
+    return src->rows + src->width * src->row++;
+}
 
-	// p->palette[1][0]=0x00;
-	// p->palette[1][1]=0x00;
-	// p->palette[1][2]=0x00;
 
-	//reset file pointer to start of file
-	fseek(in,0,SEEK_SET);
-	
-	for (y = p->hdr.height; y-- > 0; ) {
+/* 
+ * src_close
+ *   DESCRIPTION: Free the buffers of a .photo reader (the file itself
+ *                is left open).  Safe to call after a failed src_open.
+ *   INPUTS: src -- the reader
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees memory
+ */
+static void
+src_close (photo_src_t* src)
+{
+    free (src->block_off);
+    free (src->packed);
+    free (src->rows);
+    src->block_off = NULL;
+    src->packed = NULL;
+    src->rows = NULL;
+}
 
-	/* Loop over columns from left to right. */
-	for (x = 0; p->hdr.width > x; x++) {
 
-	    /* 
-	     * Try to read one 16-bit pixel.  On failure, clean up and 
-	     * return NULL.
-	     */
-	    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-		free (p->img);
-		free (p);
-	        (void)fclose (in);
-		return NULL;
-	    }
+/* 
+ * compress_tiles
+ *   DESCRIPTION: Cut a room photo's pixels into tiles and compress each
+ *                one, setting the photo's tile fields.
+ *   INPUTS: p -- room photo (with header filled in)
+ *           img -- pixel data in rows from the top left, no padding
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if memory runs out
+ *   SIDE EFFECTS: dynamically allocates one block for the tiles
+ */
+static int32_t
+compress_tiles (photo_t* p, const uint8_t* img)
+{
+    int32_t   tiles_x;	/* tiles across photo               */
+    int32_t   tiles_y;	/* tiles down photo                 */
+    int32_t   n_tiles;	/* tiles in photo                   */
+    int32_t   tx;	/* index over tile columns          */
+    int32_t   ty;	/* index over tile rows             */
+    int32_t   h;	/* pixels of tile inside photo (y)  */
+    int32_t   t;	/* index of tile                    */
+    size_t    used;	/* compressed bytes so far          */
+    size_t    head;	/* bytes of offsets before the data */
+    uint32_t* block;	/* offsets followed by data         */
+    uint32_t* shrunk;	/* block trimmed to its used size   */
+
+    tiles_x = (p->hdr.width + TILE_DIM - 1) >> TILE_SHIFT;
+    tiles_y = (p->hdr.height + TILE_DIM - 1) >> TILE_SHIFT;
+    n_tiles = tiles_x * tiles_y;
+    head = (n_tiles + 1) * sizeof (block[0]);
+    if (NULL == (block = malloc (head + n_tiles * 
+				 LZ_BOUND (TILE_DIM * TILE_DIM)))) {
+	return -1;
+    }
+    used = 0;
+    for (t = 0, ty = tiles_y; ty-- > 0; ) {
+	h = p->hdr.height - (ty << TILE_SHIFT);
+	h = (TILE_DIM < h ? TILE_DIM : h);
+	for (tx = 0; tiles_x > tx; tx++, t++) {
+	    block[t] = used;
+	    used += pack_tile (p, img + p->hdr.width * (ty << TILE_SHIFT), 
+			       tx, h, (uint8_t*)block + head + used);
+	}
+    }
+    block[n_tiles] = used;
 
-		//find index of pixel to check if it is level4 top 128 nodes
-		int index = pixelintooctree(pixel,1);
-
-		//Lowest count of level4 that is in top 128 for comparison
-		int count= octree_level_4[4095-128].count;
-
-		
-
-		//p->img[p->hdr.width * y + x]=64+1;
-	    /* 
-	     * 16-bit pixel is coded as 5:6:5 RGB (5 bits red, 6 bits green,
-	     * and 6 bits blue).  We change to 2:2:2, which we've set for the
-	     * game objects.  You need to use the other 192 palette colors
-	     * to specialize the appearance of each photo.
-	     *
-	     * In this code, you need to calculate the p->palette values,
-	     * which encode 6-bit RGB as arrays of three uint8_t's.  When
-	     * the game puts up a photo, you should then change the palette 
-	     * to match the colors needed for that photo.
-	     */
-	    //p->img[p->hdr.width * y + x] = (((pixel >> 14) << 4) |
-					    // (((pixel >> 9) & 0x3) << 2) |
-					    // ((pixel >> 3) & 0x3));
-		if(map_help[index].count>count)
-		{
-			for(i=0;i<128;i++)
-			{
-				if(octree_level_4[4095-i].index==index)
-				{
-					//map pixel to level_4 corresponding value
-					p->img[p->hdr.width * y + x -2]=64+i;
-					break;
-				}
-			}
-		}
-		else
-		{
-			int red=(pixel>>14);
-			red=(red<<4);
+    /* Give back the room left for incompressible tiles. */
+    if (NULL != (shrunk = realloc (block, head + used))) {
+	block = shrunk;
+    }
+    p->tile_off = block;
+    p->tile_data = (uint8_t*)block + head;
+    p->fd = -1;
+    assign_serial (p);
+    stat_photo_bytes ((uint32_t)p->hdr.width * p->hdr.height, head + used);
+    return 0;
+}
+
+
+/* 
+ * pack_tile
+ *   DESCRIPTION: Compress one tile from a band of rows of photo pixels,
+ *                padding it with zeros to TILE_DIM x TILE_DIM.
+ *   INPUTS: p -- room photo (for its width)
+ *           rows -- pixels of the band, starting at the top of the tile
+ *           tx -- column of tile
+ *           h -- number of rows of the tile inside the photo
+ *   OUTPUTS: dst -- compressed tile (at most LZ_BOUND (TILE_DIM * 
+ *                   TILE_DIM) bytes)
+ *   RETURN VALUE: compressed size of tile
+ *   SIDE EFFECTS: none
+ */
+static size_t
+pack_tile (const photo_t* p, const uint8_t* rows, int32_t tx, int32_t h,
+	   uint8_t* dst)
+{
+    uint8_t tile[TILE_DIM * TILE_DIM]; /* tile before compression    */
+    int32_t w;			       /* pixels of tile inside photo */
+    int32_t y;			       /* index over rows of tile     */
+
+    w = p->hdr.width - (tx << TILE_SHIFT);
+    w = (TILE_DIM < w ? TILE_DIM : w);
+    (void)memset (tile, 0, sizeof (tile));
+    for (y = 0; h > y; y++) {
+	(void)memcpy (tile + (y << TILE_SHIFT), 
+		      rows + p->hdr.width * y + (tx << TILE_SHIFT), w);
+    }
+    return lz_compress (tile, sizeof (tile), dst);
+}
+
+
+/* 
+ * read_panorama
+ *   DESCRIPTION: Finish reading a panorama: use its tile file if that is
+ *                up to date, and otherwise quantize the photo into a new
+ *                tile file.  If no tile file can be written next to the
+ *                photo, an unnamed temporary file is used for this run.
+ *   INPUTS: fname -- name of .photo file
+ *           src -- reader for the .photo file, with header read
+ *           p -- photo with header read from the file
+ *           photo_st -- status of the .photo file
+ *   OUTPUTS: none
+ *   RETURN VALUE: p on success, or NULL on failure
+ *   SIDE EFFECTS: frees p on failure; may write the tile file
+ */
+static photo_t*
+read_panorama (const char* fname, photo_src_t* src, photo_t* p,
+	       const struct stat* photo_st)
+{
+    char*   name; /* name of the tile file */
+    int32_t ok;   /* 0 once p is set up    */
+
+    TRACE_BEGIN ("read_panorama");
+    ok = -1;
+    if (NULL != (name = malloc (strlen (fname) + 
+				sizeof (TILE_FILE_SUFFIX ".tmp")))) {
+	(void)strcpy (name, fname);
+	(void)strcat (name, TILE_FILE_SUFFIX);
+	if (0 == (ok = open_tile_file (p, name, photo_st))) {
+	    stat_photo_bytes ((uint32_t)p->hdr.width * p->hdr.height, 
+			      (photo_tiles (p) + 1) * sizeof (p->tile_off[0]));
+	} else {
+	    ok = build_tile_file (p, src, name, photo_st);
+	}
+	free (name);
+    }
+    if (0 != ok) {
+	free (p);
+	p = NULL;
+    } else {
+	assign_serial (p);
+    }
+    TRACE_END ("read_panorama");
+    return p;
+}
+
+
+/* 
+ * open_tile_file
+ *   DESCRIPTION: Set up a panorama from its tile file, reading only the
+ *                palette and tile offsets, if the file exists and 
+ *                matches the .photo file.
+ *   INPUTS: p -- photo with header read from the .photo file
+ *           name -- name of tile file
+ *           photo_st -- status of the .photo file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 if the tile file is missing, out
+ *                 of date, or damaged
+ *   SIDE EFFECTS: on success, sets p's palette and tile fields, leaving
+ *                 the tile file open
+ */
+static int32_t
+open_tile_file (photo_t* p, const char* name, const struct stat* photo_st)
+{
+    tile_file_header_t fh;	/* header of tile file      */
+    struct stat        st;	/* status of tile file      */
+    uint32_t*          off;	/* tile offsets             */
+    size_t             head;	/* bytes before tile data   */
+    int32_t            n;	/* number of tiles          */
+    int32_t            i;	/* index over tiles         */
+    int                fd;	/* tile file                */
+
+    if (-1 == (fd = open (name, O_RDONLY))) {
+	return -1;
+    }
+    n = photo_tiles (p);
+    head = sizeof (fh) + (n + 1) * sizeof (off[0]);
+    off = NULL;
+    if (sizeof (fh) != pread (fd, &fh, sizeof (fh), 0) ||
+	TILE_FILE_MAGIC != fh.magic || 
+	p->hdr.width != fh.hdr.width || p->hdr.height != fh.hdr.height ||
+	(uint64_t)photo_st->st_size != fh.src_size || 
+	(int64_t)photo_st->st_mtime != fh.src_mtime ||
+	(uint32_t)quant_current () != fh.quant ||
+	NULL == (off = malloc ((n + 1) * sizeof (off[0]))) ||
+	(ssize_t)((n + 1) * sizeof (off[0])) != 
+	    pread (fd, off, (n + 1) * sizeof (off[0]), sizeof (fh)) ||
+	0 != fstat (fd, &st) || 0 != off[0] ||
+	(uint64_t)st.st_size != head + off[n]) {
+	free (off);
+	(void)close (fd);
+	return -1;
+    }
+    for (i = 0; n > i; i++) {
+	if (off[i] > off[i + 1] || 
+	    LZ_BOUND (TILE_DIM * TILE_DIM) < off[i + 1] - off[i]) {
+	    free (off);
+	    (void)close (fd);
+	    return -1;
+	}
+    }
+    (void)memcpy (p->palette, fh.palette, sizeof (p->palette));
+    p->tile_off = off;
+    p->tile_data = NULL;
+    p->fd = fd;
+    p->data_pos = head;
+    return 0;
+}
 
-			int green=(pixel>>9);
-			green=green & 0x03;
-			green=(green<<2);
 
-			int blue=(pixel>>3);
-			blue=blue & 0x03;
+/* 
+ * build_tile_file
+ *   DESCRIPTION: Quantize a panorama into a new tile file.  Pixels are
+ *                read a row at a time and mapped into a band of 
+ *                TILE_DIM rows, which is compressed into tiles and 
+ *                written out as soon as it is full, so memory use 
+ *                depends only on the photo's width.  The file is 
+ *                written under a temporary name and renamed when done.
+ *   INPUTS: p -- photo with header read from the .photo file
+ *           src -- reader for the .photo file
+ *           name -- name of tile file
+ *           photo_st -- status of the .photo file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: sets p's palette and tile fields, leaving the tile
+ *                 file open; writes the tile file
+ */
+static int32_t
+build_tile_file (photo_t* p, photo_src_t* src, const char* name, 
+		 const struct stat* photo_st)
+{
+    tile_file_header_t fh;	/* header of tile file          */
+    char*              tmp;	/* temporary name of tile file  */
+    FILE*              anon;	/* unnamed file, if name fails  */
+    uint16_t*          px;	/* some rows of .photo pixels   */
+    uint8_t*           band;	/* the same rows, mapped        */
+    uint32_t*          part;	/* histograms of threads        */
+    uint8_t            packed[LZ_BOUND (TILE_DIM * TILE_DIM)]; /* a tile */
+    uint32_t*          off;	/* tile offsets                 */
+    size_t             head;	/* bytes before tile data       */
+    size_t             used;	/* compressed bytes so far      */
+    size_t             len;	/* compressed size of a tile    */
+    int32_t            tiles_x;	/* tiles across photo           */
+    int32_t            n;	/* number of tiles              */
+    int32_t            t;	/* index of next tile           */
+    int32_t            tx;	/* index over tile columns      */
+    int32_t            y;	/* rows not yet read            */
+    int32_t            lo;	/* first row of bands read      */
+    int32_t            by;	/* first row of a band          */
+    int32_t            n_threads; /* threads for the pixels     */
+    int32_t            chunk;	/* most rows read at once       */
+    int32_t            k;	/* rows counted at once         */
+    int32_t            ok;	/* 0 while nothing has failed   */
+    int32_t            counted;	/* 1 if pixels were counted     */
+    int                fd;	/* tile file                    */
+
+    TRACE_BEGIN ("build_tile_file");
+    tiles_x = (p->hdr.width + TILE_DIM - 1) >> TILE_SHIFT;
+    n = photo_tiles (p);
+    head = sizeof (fh) + (n + 1) * sizeof (off[0]);
+    n_threads = quant_threads (p->hdr.width * p->hdr.height);
+    part = alloc_hists (&n_threads);
+    chunk = n_threads * TILE_DIM;
+    px = malloc (p->hdr.width * chunk * sizeof (px[0]));
+    band = malloc (p->hdr.width * chunk);
+    off = malloc ((n + 1) * sizeof (off[0]));
+    tmp = malloc (strlen (name) + sizeof (".tmp"));
+    fd = -1;
+    if (NULL != tmp) {
+	(void)strcpy (tmp, name);
+	(void)strcat (tmp, ".tmp");
+	if (-1 == (fd = open (tmp, O_RDWR | O_CREAT | O_TRUNC, 0644))) {
+	    free (tmp);
+	    tmp = NULL;
+	}
+    }
+    if (-1 == fd && NULL != (anon = tmpfile ())) {
+	fd = dup (fileno (anon));
+	(void)fclose (anon);
+    }
+    ok = (NULL == px || NULL == band || NULL == off || -1 == fd ? -1 : 0);
 
-			int index= red+blue+green;
+    /* 
+     * Build the palette from a first pass over the pixels (if needed),
+     * counting chunk rows at a time.
+     */
+    (void)memset (quant_hist, 0, sizeof (quant_hist));
+    counted = quant_uses_histogram ();
+    for (y = (counted ? p->hdr.height : 0); 0 == ok && 0 < y; y -= k) {
+	k = (chunk < y ? chunk : y);
+	if (0 != read_rows (src, px, k)) {
+	    ok = -1;
+	    break;
+	}
+	count_pixels (px, p->hdr.width, k, n_threads, part);
+    }
+    if (0 == ok) {
+	sum_hists (n_threads, part);
+	ok = choose_palette (p);
+    }
 
-			//map pixel to level_2 corresponding value
-			p->img[p->hdr.width * y + x -2]=index+192;
+    /* 
+     * Map the pixels in a second pass, up to n_threads whole bands of 
+     * tiles at a time.  The file holds rows from bottom to top, so the
+     * bands are packed from the last one read, and the tiles are written
+     * in the order in which they are numbered.
+     */
+    if (0 == ok && counted && 0 != src_rewind (src)) {
+	ok = -1;
+    }
+    used = 0;
+    t = 0;
+    for (y = p->hdr.height; 0 == ok && 0 < y; y = lo) {
+	lo = ((y - 1) & ~(TILE_DIM - 1)) - (n_threads - 1) * TILE_DIM;
+	if (0 > lo) {
+	    lo = 0;
+	}
+	if (0 != read_rows (src, px, y - lo)) {
+	    ok = -1;
+	    break;
+	}
+	map_pixels (px, p->hdr.width, y - lo, n_threads, band);
+	for (by = (y - 1) & ~(TILE_DIM - 1); 0 == ok && lo <= by; 
+	     by -= TILE_DIM) {
+	    for (tx = 0; tiles_x > tx; tx++, t++) {
+		len = pack_tile (p, band + (by - lo) * p->hdr.width, tx, 
+				 (p->hdr.height - by < TILE_DIM ?
+				  p->hdr.height - by : TILE_DIM), packed);
+		off[t] = used;
+		if ((ssize_t)len != pwrite (fd, packed, len, head + used)) {
+		    ok = -1;
+		    break;
 		}
+		used += len;
+	    }
+	}
+    }
+
+    /* Write the header and offsets, then give the file its name. */
+    if (0 == ok) {
+	off[n] = used;
+	(void)memset (&fh, 0, sizeof (fh));
+	fh.magic = TILE_FILE_MAGIC;
+	fh.hdr = p->hdr;
+	fh.src_size = photo_st->st_size;
+	fh.src_mtime = photo_st->st_mtime;
+	fh.quant = quant_current ();
+	(void)memcpy (fh.palette, p->palette, sizeof (fh.palette));
+	if (sizeof (fh) != pwrite (fd, &fh, sizeof (fh), 0) ||
+	    (ssize_t)((n + 1) * sizeof (off[0])) != 
+		pwrite (fd, off, (n + 1) * sizeof (off[0]), sizeof (fh))) {
+	    ok = -1;
+	}
+    }
+    if (0 == ok && NULL != tmp) {
+	(void)rename (tmp, name);
+    } else if (NULL != tmp) {
+	(void)unlink (tmp);
+    }
+    free (tmp);
+    free (part);
+    free (px);
+    free (band);
+    if (0 != ok) {
+	free (off);
+	if (-1 != fd) {
+	    (void)close (fd);
+	}
+	TRACE_END ("build_tile_file");
+	return -1;
+    }
+    p->tile_off = off;
+    p->tile_data = NULL;
+    p->fd = fd;
+    p->data_pos = head;
+    stat_photo_bytes ((uint32_t)p->hdr.width * p->hdr.height, 
+		      (n + 1) * sizeof (off[0]));
+    TRACE_END ("build_tile_file");
+    return 0;
+}
+
+
+/* 
+ * read_rows
+ *   DESCRIPTION: Read the next rows of a .photo file into memory.
+ *   INPUTS: src -- reader for the .photo file
+ *           rows -- number of rows to read
+ *   OUTPUTS: px -- the rows, in the order read (bottom to top)
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: advances the reader
+ */
+static int32_t
+read_rows (photo_src_t* src, uint16_t* px, int32_t rows)
+{
+    const uint16_t* row; /* one row of pixels    */
+    int32_t         r;   /* index over rows read */
+
+    for (r = 0; rows > r; r++) {
+	if (NULL == (row = src_row (src))) {
+	    return -1;
+	}
+	(void)memcpy (px + (size_t)r * src->width, row, 
+		      src->width * sizeof (px[0]));
+    }
+    return 0;
 }
+
+
+/* 
+ * quant_threads
+ *   DESCRIPTION: Decide how many threads should count and map the pixels
+ *                of a photo (see QUANT_THREAD_PIXELS).
+ *   INPUTS: pixels -- number of pixels in the photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of threads (at least one)
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+quant_threads (int32_t pixels)
+{
+    long    cpus; /* processors online */
+    int32_t n;    /* number of threads */
+
+    n = pixels / QUANT_THREAD_PIXELS;
+    cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    if (cpus < n) {
+	n = cpus;
     }
-    /* All done.  Return success. */
-    (void)fclose (in);
+    if (QUANT_MAX_THREADS < n) {
+	n = QUANT_MAX_THREADS;
+    }
+    return (1 > n ? 1 : n);
+}
+
+
+/* 
+ * alloc_hists
+ *   DESCRIPTION: Allocate (zeroed) histograms for all threads but the
+ *                first, which counts into quant_hist.  If memory runs 
+ *                out, one thread does the counting.
+ *   INPUTS: n_threads -- number of threads wanted
+ *   OUTPUTS: n_threads -- number of threads to use
+ *   RETURN VALUE: n_threads - 1 histograms of OCTREE_COLORS counts, one
+ *                 after another, or NULL if there are none
+ *   SIDE EFFECTS: dynamically allocates memory (free it with free)
+ */
+static uint32_t*
+alloc_hists (int32_t* n_threads)
+{
+    uint32_t* part; /* the histograms */
+
+    if (1 >= *n_threads) {
+	return NULL;
+    }
+    if (NULL == (part = calloc ((size_t)(*n_threads - 1) * OCTREE_COLORS,
+				sizeof (part[0])))) {
+	*n_threads = 1;
+    }
+    return part;
+}
+
+
+/* 
+ * count_pixels
+ *   DESCRIPTION: Count the pixel values in some rows of a photo, with
+ *                each thread taking a share of the rows.
+ *   INPUTS: px -- the rows
+ *           width -- pixels per row
+ *           rows -- number of rows
+ *           n_threads -- number of threads
+ *           part -- histograms for threads after the first (from 
+ *                   alloc_hists)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: adds to quant_hist and the histograms at part
+ */
+static void
+count_pixels (const uint16_t* px, int32_t width, int32_t rows,
+	      int32_t n_threads, uint32_t* part)
+{
+    quant_job_t job[QUANT_MAX_THREADS]; /* shares of the work */
+    int32_t     i;			/* index over threads */
+
+    for (i = 0; n_threads > i; i++) {
+	(void)memset (&job[i], 0, sizeof (job[i]));
+	job[i].run = count_job;
+	job[i].px = px;
+	job[i].hist = (0 == i ? quant_hist : 
+		       part + (size_t)(i - 1) * OCTREE_COLORS);
+	job[i].width = width;
+	job[i].rows = rows;
+    }
+    run_jobs (job, n_threads, rows);
+}
+
+
+/* 
+ * sum_hists
+ *   DESCRIPTION: Add the histograms counted by threads after the first
+ *                into quant_hist, with each thread taking a share of the
+ *                pixel values.
+ *   INPUTS: n_threads -- number of threads
+ *           part -- histograms for threads after the first
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: adds to quant_hist
+ */
+static void
+sum_hists (int32_t n_threads, const uint32_t* part)
+{
+    quant_job_t job[QUANT_MAX_THREADS]; /* shares of the work */
+    int32_t     i;			/* index over threads */
+
+    for (i = 0; n_threads > i; i++) {
+	(void)memset (&job[i], 0, sizeof (job[i]));
+	job[i].run = sum_job;
+	job[i].hist = quant_hist;
+	job[i].part = part;
+	job[i].n_part = n_threads - 1;
+    }
+    if (1 < n_threads) {
+	run_jobs (job, n_threads, OCTREE_COLORS);
+    }
+}
+
+
+/* 
+ * map_pixels
+ *   DESCRIPTION: Map the pixels in some rows of a photo into the palette
+ *                (quant_map), with each thread taking a share of the 
+ *                rows.
+ *   INPUTS: px -- the rows, bottom row first
+ *           width -- pixels per row
+ *           rows -- number of rows
+ *           n_threads -- number of threads
+ *   OUTPUTS: out -- the mapped rows, top row first
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+map_pixels (const uint16_t* px, int32_t width, int32_t rows,
+	    int32_t n_threads, uint8_t* out)
+{
+    quant_job_t job[QUANT_MAX_THREADS]; /* shares of the work */
+    int32_t     i;			/* index over threads */
+
+    for (i = 0; n_threads > i; i++) {
+	(void)memset (&job[i], 0, sizeof (job[i]));
+	job[i].run = map_job;
+	job[i].px = px;
+	job[i].out = out;
+	job[i].width = width;
+	job[i].rows = rows;
+    }
+    run_jobs (job, n_threads, rows);
+}
+
+
+/* 
+ * run_jobs
+ *   DESCRIPTION: Split total rows (or pixel values) evenly among jobs, 
+ *                and run them, the first on the calling thread and each
+ *                of the others on a new thread.  A job whose thread 
+ *                cannot be created runs on the calling thread instead.
+ *   INPUTS: job -- the jobs
+ *           n -- number of jobs
+ *           total -- number of rows (or values) to split
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: runs the jobs; returns once all are done
+ */
+static void
+run_jobs (quant_job_t* job, int32_t n, int32_t total)
+{
+    int32_t i; /* index over jobs */
+
+    for (i = 0; n > i; i++) {
+	job[i].first = (int32_t)((int64_t)total * i / n);
+	job[i].last = (int32_t)((int64_t)total * (i + 1) / n);
+	job[i].started = (0 < i && job[i].first < job[i].last &&
+			  0 == pthread_create (&job[i].thread, NULL, 
+					       run_job, &job[i]));
+    }
+    for (i = 0; n > i; i++) {
+	if (job[i].started) {
+	    (void)pthread_join (job[i].thread, NULL);
+	} else {
+	    job[i].run (&job[i]);
+	}
+    }
+}
+
+
+/* 
+ * run_job
+ *   DESCRIPTION: Thread body for a job started by run_jobs.
+ *   INPUTS: arg -- the job
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: runs the job
+ */
+static void*
+run_job (void* arg)
+{
+    quant_job_t* job = arg; /* the job */
+
+    job->run (job);
+    return NULL;
+}
+
+
+/* 
+ * count_job
+ *   DESCRIPTION: Count the pixel values in a job's share of the rows.
+ *   INPUTS: job -- the job
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: adds to the job's histogram
+ */
+static void
+count_job (quant_job_t* job)
+{
+    const uint16_t* row;		/* one row of pixels        */
+    uint32_t*       hist = job->hist;	/* histogram to count into  */
+    int32_t         r;			/* index over rows          */
+    int32_t         x;			/* index over image columns */
+
+    for (r = job->first; job->last > r; r++) {
+	row = job->px + (size_t)r * job->width;
+	for (x = 0; job->width > x; x++) {
+	    hist[row[x]]++;
+	}
+    }
+}
+
+
+/* 
+ * sum_job
+ *   DESCRIPTION: Add a job's share of the pixel values from the other 
+ *                histograms into its histogram.
+ *   INPUTS: job -- the job
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: adds to the job's histogram
+ */
+static void
+sum_job (quant_job_t* job)
+{
+    int32_t  c; /* 5:6:5 pixel value      */
+    int32_t  j; /* index over histograms  */
+    uint32_t n; /* pixels with the value  */
+
+    for (c = job->first; job->last > c; c++) {
+	n = job->hist[c];
+	for (j = 0; job->n_part > j; j++) {
+	    n += job->part[(size_t)j * OCTREE_COLORS + c];
+	}
+	job->hist[c] = n;
+    }
+}
+
+
+/* 
+ * map_job
+ *   DESCRIPTION: Map a job's share of the rows into the palette.  Rows
+ *                are counted from the top, so row r of out comes from 
+ *                row (rows - 1 - r) of px.
+ *   INPUTS: job -- the job
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the job's share of out
+ */
+static void
+map_job (quant_job_t* job)
+{
+    const uint16_t* row; /* one row of pixels        */
+    uint8_t*        dst; /* the row, mapped          */
+    int32_t         r;	 /* index over rows          */
+    int32_t         x;	 /* index over image columns */
+
+    for (r = job->first; job->last > r; r++) {
+	row = job->px + (size_t)(job->rows - 1 - r) * job->width;
+	dst = job->out + (size_t)r * job->width;
+	for (x = 0; job->width > x; x++) {
+	    dst[x] = quant_map[row[x]];
+	}
+    }
+}
+
+
+/* 
+ * choose_palette
+ *   DESCRIPTION: Choose a photo's palette with the selected quantizer
+ *                (see quant.h) from the histogram of its pixels in 
+ *                quant_hist, and the VGA color for each pixel value.
+ *   INPUTS: p -- room photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 if memory runs out
+ *   SIDE EFFECTS: sets p's palette and quant_map
+ */
+static int32_t
+choose_palette (photo_t* p)
+{
+    uint32_t c; /* 5:6:5 pixel value */
+
+    if (0 != quant_palette (quant_hist, p->palette, quant_map)) {
+	return -1;
+    }
+
+    /* 
+     * Palette entries are VGA colors 64 to 255.  (Values not in the 
+     * photo are never looked up, so their map entries do not matter.)
+     */
+    for (c = 0; OCTREE_COLORS > c; c++) {
+	quant_map[c] += 64;
+    }
+    return 0;
+}
+
+
+/* 
+ * assign_serial
+ *   DESCRIPTION: Give a room photo the serial number that identifies its
+ *                tiles in the tile cache.
+ *   INPUTS: p -- room photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes next_serial
+ */
+static void
+assign_serial (photo_t* p)
+{
+    (void)pthread_mutex_lock (&tile_lock);
+    p->serial = next_serial++;
+    (void)pthread_mutex_unlock (&tile_lock);
+}
+
+
+
+/* 
+ * photo_export_size
+ *   DESCRIPTION: Get the number of bytes needed to export a room photo
+ *                (header, palette, tile offsets, and compressed tiles)
+ *                with photo_export.
+ *   INPUTS: p -- room photo pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: size of exported photo in bytes
+ *   SIDE EFFECTS: none
+ */
+size_t
+photo_export_size (const photo_t* p)
+{
+    return sizeof (p->hdr) + sizeof (p->palette) + 
+	   (photo_tiles (p) + 1) * sizeof (p->tile_off[0]) + 
+	   p->tile_off[photo_tiles (p)];
+}
+
+
+/* 
+ * photo_export
+ *   DESCRIPTION: Copy a room photo into a flat block of memory that does
+ *                not contain pointers, such as a shared memory segment.
+ *   INPUTS: p -- room photo pointer
+ *   OUTPUTS: dst -- photo_export_size (p) bytes of exported photo
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+photo_export (const photo_t* p, void* dst)
+{
+    uint8_t* out = dst;	/* next byte to write */
+
+    (void)memcpy (out, &p->hdr, sizeof (p->hdr));
+    out += sizeof (p->hdr);
+    (void)memcpy (out, p->palette, sizeof (p->palette));
+    out += sizeof (p->palette);
+    (void)memcpy (out, p->tile_off, 
+		  (photo_tiles (p) + 1) * sizeof (p->tile_off[0]));
+    out += (photo_tiles (p) + 1) * sizeof (p->tile_off[0]);
+    if (NULL != p->tile_data) {
+	(void)memcpy (out, p->tile_data, p->tile_off[photo_tiles (p)]);
+    } else if ((ssize_t)p->tile_off[photo_tiles (p)] != 
+	       pread (p->fd, out, p->tile_off[photo_tiles (p)], p->data_pos)) {
+	/* Unreadable tiles are exported as zeros, which read as damaged. */
+	(void)memset (out, 0, p->tile_off[photo_tiles (p)]);
+    }
+}
+
+
+/* 
+ * photo_import
+ *   DESCRIPTION: Create a room photo from one exported by photo_export.
+ *                The tiles are not copied: the photo refers to them
+ *                in place, so src must stay mapped for as long as the
+ *                photo is used, and the photo must be treated as 
+ *                read-only.  src must be aligned to four bytes.
+ *   INPUTS: src -- exported photo
+ *           len -- number of bytes available at src
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL 
+ *                 if the data are inconsistent or memory runs out
+ *   SIDE EFFECTS: dynamically allocates memory for the photo (but not 
+ *                 for its pixels)
+ */
+photo_t*
+photo_import (const void* src, size_t len)
+{
+    const uint8_t* in = src;	/* next byte to read        */
+    photo_t*       p;		/* the new photo            */
+    size_t         head;	/* bytes before tile data   */
+    int32_t        i;		/* index over tile offsets  */
+
+    if (sizeof (p->hdr) + sizeof (p->palette) > len ||
+	NULL == (p = malloc (sizeof (*p)))) {
+	return NULL;
+    }
+    (void)memcpy (&p->hdr, in, sizeof (p->hdr));
+    in += sizeof (p->hdr);
+    (void)memcpy (p->palette, in, sizeof (p->palette));
+    in += sizeof (p->palette);
+    p->tile_off = (const uint32_t*)in;
+    head = sizeof (p->hdr) + sizeof (p->palette) +
+	   (photo_tiles (p) + 1) * sizeof (p->tile_off[0]);
+    if (MAX_PANORAMA_WIDTH < p->hdr.width || 
+	MAX_PANORAMA_HEIGHT < p->hdr.height || 
+	0 != ((uintptr_t)in & 3) || head > len || 0 != p->tile_off[0] ||
+	len - head != p->tile_off[photo_tiles (p)]) {
+	free (p);
+	return NULL;
+    }
+    for (i = 0; photo_tiles (p) > i; i++) {
+	if (p->tile_off[i] > p->tile_off[i + 1]) {
+	    free (p);
+	    return NULL;
+	}
+    }
+    p->tile_data = (const uint8_t*)src + head;
+    p->fd = -1;
+    assign_serial (p);
     return p;
 }
 
 
+/* 
+ * photo_tiles
+ *   DESCRIPTION: Get the number of tiles in a room photo.
+ *   INPUTS: p -- room photo pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of tiles
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+photo_tiles (const photo_t* p)
+{
+    return ((p->hdr.width + TILE_DIM - 1) >> TILE_SHIFT) *
+	   ((p->hdr.height + TILE_DIM - 1) >> TILE_SHIFT);
+}
+
+
+/* 
+ * image_export_size
+ *   DESCRIPTION: Get the number of bytes needed to export an object image
+ *                (header and pixel data) with image_export.
+ *   INPUTS: im -- object image pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: size of exported image in bytes
+ *   SIDE EFFECTS: none
+ */
+size_t
+image_export_size (const image_t* im)
+{
+    return sizeof (im->hdr) + (size_t)im->hdr.width * im->hdr.height;
+}
+
+
+/* 
+ * image_export
+ *   DESCRIPTION: Copy an object image into a flat block of memory that 
+ *                does not contain pointers.
+ *   INPUTS: im -- object image pointer
+ *   OUTPUTS: dst -- image_export_size (im) bytes of exported image
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+image_export (const image_t* im, void* dst)
+{
+    uint8_t* out = dst;	/* next byte to write */
+
+    (void)memcpy (out, &im->hdr, sizeof (im->hdr));
+    out += sizeof (im->hdr);
+    (void)memcpy (out, im->img, (size_t)im->hdr.width * im->hdr.height);
+}
+
+
+/* 
+ * image_import
+ *   DESCRIPTION: Create an object image from one exported by image_export.
+ *                As with photo_import, the pixel data are used in place.
+ *   INPUTS: src -- exported image
+ *           len -- number of bytes available at src
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated image on success, or NULL 
+ *                 if the data are inconsistent or memory runs out
+ *   SIDE EFFECTS: dynamically allocates memory for the image (but not 
+ *                 for its pixels)
+ */
+image_t*
+image_import (const void* src, size_t len)
+{
+    image_t* im;	/* the new image */
+
+    if (sizeof (im->hdr) > len || NULL == (im = malloc (sizeof (*im)))) {
+	return NULL;
+    }
+    (void)memcpy (&im->hdr, src, sizeof (im->hdr));
+    if (MAX_OBJECT_WIDTH < im->hdr.width || 
+	MAX_OBJECT_HEIGHT < im->hdr.height ||
+	image_export_size (im) != len) {
+	free (im);
+	return NULL;
+    }
+    im->img = (uint8_t*)src + sizeof (im->hdr);
+    return im;
+}
@@ -38,6 +38,7 @@
 #define PHOTO_H
 
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "types.h"
@@ -46,18 +47,53 @@
 #include "world.h"
 
 
-/* limits on allowed size of room photos and object images */
-#define MAX_PHOTO_WIDTH   1024
-#define MAX_PHOTO_HEIGHT  1024
-#define MAX_OBJECT_WIDTH  160
-#define MAX_OBJECT_HEIGHT 100
+/* 
+ * limits on allowed size of room photos and object images; photos larger
+ * than MAX_PHOTO_WIDTH x MAX_PHOTO_HEIGHT are panoramas, which are 
+ * streamed from a tile file rather than held in memory
+ */
+#define MAX_PHOTO_WIDTH     1024
+#define MAX_PHOTO_HEIGHT    1024
+#define MAX_PANORAMA_WIDTH  8192
+#define MAX_PANORAMA_HEIGHT 2048
+#define MAX_OBJECT_WIDTH    160
+#define MAX_OBJECT_HEIGHT   100
+
+
+/* 
+ * Fill a buffer with the pixels for a horizontal line of a room.  These
+ * only read the room and its photos, so game sessions on different 
+ * threads may call them at the same time.
+ */
+extern void fill_horiz_buffer (const room_t* r, int x, int y, 
+			       unsigned char buf[SCROLL_X_DIM]);
 
+/* Fill a buffer with the pixels for a vertical line of a room. */
+extern void fill_vert_buffer (const room_t* r, int x, int y, 
+			      unsigned char buf[SCROLL_Y_DIM]);
 
-/* Fill a buffer with the pixels for a horizontal line of current room. */
-extern void fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM]);
+/* 
+ * Fill a buffer with the pixels for n adjacent lines of a room, in one
+ * pass over the photo and objects: n rows of SCROLL_X_DIM pixels, or
+ * SCROLL_Y_DIM rows of n pixels (see draw_horiz_lines and 
+ * draw_vert_lines in modex.h).
+ */
+extern void fill_horiz_strip (const room_t* r, int x, int y, int n,
+			      unsigned char* buf);
+extern void fill_vert_strip (const room_t* r, int x, int y, int n,
+			     unsigned char* buf);
 
-/* Fill a buffer with the pixels for a vertical line of current room. */
-extern void fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM]);
+/* 
+ * Mode X callbacks: fill a buffer with the pixels for a line (or a strip
+ * of lines) of the room on the screen (the room last passed to
+ * prep_room).
+ */
+extern void fill_shown_horiz_buffer (int x, int y, 
+				     unsigned char buf[SCROLL_X_DIM]);
+extern void fill_shown_vert_buffer (int x, int y, 
+				    unsigned char buf[SCROLL_Y_DIM]);
+extern void fill_shown_horiz_strip (int x, int y, int n, unsigned char* buf);
+extern void fill_shown_vert_strip (int x, int y, int n, unsigned char* buf);
 
 /* Get height of object image in pixels. */
 extern uint32_t image_height (const image_t* im);
@@ -72,17 +108,47 @@ extern uint32_t photo_height (const photo_t* p);
 extern uint32_t photo_width (const photo_t* p);
 
 /* 
- * Prepare room for display (record pointer for use by callbacks, set up
- * VGA palette, etc.). 
+ * Prepare room for display (record pointer for use by the mode X 
+ * callbacks, set up VGA palette, composite the room into the background
+ * cache, etc.). 
  */
 extern void prep_room (const room_t* r);
 
+/* 
+ * Note that an object at (x,y), w by h pixels, was put into or taken out
+ * of a room, so that the background cache can be patched.
+ */
+extern void room_changed (const room_t* r, int x, int y, int w, int h);
+
+/* 
+ * Copy a photo or image into a flat block of memory (for the shared asset 
+ * store), and create one that uses such a block in place.  Imported 
+ * pixel data must not be modified.
+ */
+extern size_t photo_export_size (const photo_t* p);
+extern void photo_export (const photo_t* p, void* dst);
+extern photo_t* photo_import (const void* src, size_t len);
+extern size_t image_export_size (const image_t* im);
+extern void image_export (const image_t* im, void* dst);
+extern image_t* image_import (const void* src, size_t len);
+
 /* Read object image from a file into a dynamically allocated structure. */
 extern image_t* read_obj_image (const char* fname);
 
 /* Read room photo from a file into a dynamically allocated structure. */
 extern photo_t* read_photo (const char* fname);
 
+/* 
+ * Create an object image or room photo from the contents of its file
+ * held in memory (such as an entry in an asset pack; see pack.h).  The
+ * memory is not used after these return.  A room photo also needs the
+ * name and modification time of its file, which identify a panorama's 
+ * tile file.
+ */
+extern image_t* read_obj_image_view (const void* data, size_t len);
+extern photo_t* read_photo_view (const char* fname, const void* data, 
+				 size_t len, int64_t mtime);
+
 /* 
  * N.B.  I'm aware that Valgrind and similar tools will report the fact that
  * I chose not to bother freeing image data before terminating the program.
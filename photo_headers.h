@@ -81,5 +81,52 @@ struct photo_header_t {
     uint16_t height;	/* image height in pixels */
 };
 
+/*
+ * Version 2 room photo file header.  A version 2 file starts with 
+ * PHOTO_V2_MAGIC, which read as a photo_header_t gives a width larger 
+ * than any photo, so the two formats cannot be confused.  The header 
+ * is followed by a table of one offset per block of rows, plus the end 
+ * of the last block (uint32_t each, counted from the end of the table), 
+ * and then the blocks.  Each block holds rows_per_block rows (fewer in
+ * the last block) in the same order as the original format, coded with
+ * pix_encode (see pixcodec.h).
+ */
+#define PHOTO_V2_MAGIC   "PHO2"
+#define PHOTO_V2_VERSION 2
+typedef struct photo_v2_header_t photo_v2_header_t;
+struct photo_v2_header_t {
+    char     magic[4];		/* PHOTO_V2_MAGIC (no terminator)  */
+    uint16_t version;		/* PHOTO_V2_VERSION                */
+    uint16_t rows_per_block;	/* rows in each block              */
+    uint16_t width;		/* image width in pixels           */
+    uint16_t height;		/* image height in pixels          */
+};
+
+/*
+ * Asset pack file, written by mkpack.  A pack holds the contents of many
+ * room photo and object image files, so that the game can map a single
+ * file at startup rather than open each one.  The header is followed by
+ * n_entries index entries sorted by name (in strcmp order), then the 
+ * names (names_size bytes; each NUL-terminated), and then the contents
+ * of the files, each starting on a PACK_ALIGN boundary.  Each entry 
+ * keeps the size and modification time of the file that was packed.
+ */
+#define PACK_MAGIC "ADVPACK1"
+#define PACK_ALIGN 64
+typedef struct pack_header_t pack_header_t;
+struct pack_header_t {
+    char     magic[8];		/* PACK_MAGIC (no terminator)      */
+    uint32_t n_entries;		/* number of index entries         */
+    uint32_t names_size;	/* bytes of names after the index  */
+};
+typedef struct pack_entry_t pack_entry_t;
+struct pack_entry_t {
+    uint64_t offset;		/* start of contents in pack       */
+    uint64_t size;		/* length of contents (file size)  */
+    int64_t  mtime;		/* modification time of file       */
+    uint32_t name_off;		/* start of name within the names  */
+    uint32_t pad;
+};
+
 #endif /* PHOTO_HEADERS_H */
 
@@ -0,0 +1,157 @@
+/*									tab:8
+ *
+ * pixcodec.c - 5:6:5 pixel block codec (see pixcodec.h for the format)
+ *
+ * Filename:	    pixcodec.c
+ * History:
+ *	1	Added a delta/run/index codec for compressed .photo files.
+ */
+
+#include <string.h>
+
+#include "pixcodec.h"
+
+
+/* parameters defined for this file */
+#define PIX_OP_INDEX 0x00		/* color table slot         */
+#define PIX_OP_DIFF  0x40		/* small change per channel */
+#define PIX_OP_LUMA  0x80		/* change keyed to green    */
+#define PIX_OP_RUN   0xC0		/* repeats of last pixel    */
+#define PIX_OP_PIXEL 0xFE		/* literal pixel            */
+#define PIX_MAX_RUN  62
+
+
+/*
+ * pix_encode
+ *   DESCRIPTION: Code a block of pixels.
+ *   INPUTS: px -- the pixels (5:6:5 RGB)
+ *           n -- number of pixels
+ *   OUTPUTS: dst -- coded block (up to PIX_BOUND (n) bytes)
+ *   RETURN VALUE: length of coded block
+ *   SIDE EFFECTS: none
+ */
+size_t
+pix_encode (const uint16_t* px, size_t n, uint8_t* dst)
+{
+    uint16_t table[64];	/* recent colors                 */
+    uint16_t prev = 0;	/* previous pixel                */
+    uint16_t c;		/* current pixel                 */
+    size_t   i;		/* index over pixels             */
+    size_t   len = 0;	/* bytes written                 */
+    int32_t  run = 0;	/* repeats of prev not yet coded */
+    int32_t  dr;	/* change in red                 */
+    int32_t  dg;	/* change in green               */
+    int32_t  db;	/* change in blue                */
+
+    (void)memset (table, 0, sizeof (table));
+    for (i = 0; n > i; i++) {
+	c = px[i];
+	if (prev == c) {
+	    if (PIX_MAX_RUN == ++run) {
+		dst[len++] = PIX_OP_RUN | (run - 1);
+		run = 0;
+	    }
+	    continue;
+	}
+	if (0 != run) {
+	    dst[len++] = PIX_OP_RUN | (run - 1);
+	    run = 0;
+	}
+	if (table[PIX_HASH (c)] == c) {
+	    dst[len++] = PIX_OP_INDEX | PIX_HASH (c);
+	} else {
+	    table[PIX_HASH (c)] = c;
+	    dr = (c >> 11) - (prev >> 11);
+	    dg = ((c >> 5) & 0x3F) - ((prev >> 5) & 0x3F);
+	    db = (c & 0x1F) - (prev & 0x1F);
+	    if (-2 <= dr && 1 >= dr && -2 <= dg && 1 >= dg && 
+		-2 <= db && 1 >= db) {
+		dst[len++] = PIX_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) |
+			     (db + 2);
+	    } else if (-32 <= dg && 31 >= dg && -8 <= dr - dg && 
+		       7 >= dr - dg && -8 <= db - dg && 7 >= db - dg) {
+		dst[len++] = PIX_OP_LUMA | (dg + 32);
+		dst[len++] = ((dr - dg + 8) << 4) | (db - dg + 8);
+	    } else {
+		dst[len++] = PIX_OP_PIXEL;
+		dst[len++] = c & 0xFF;
+		dst[len++] = c >> 8;
+	    }
+	}
+	prev = c;
+    }
+    if (0 != run) {
+	dst[len++] = PIX_OP_RUN | (run - 1);
+    }
+    return len;
+}
+
+
+/*
+ * pix_decode
+ *   DESCRIPTION: Decode a block of pixels, checking every code against
+ *                the input and output sizes.
+ *   INPUTS: src -- coded block
+ *           len -- length of block
+ *           n -- expected number of pixels
+ *   OUTPUTS: px -- n decoded pixels
+ *   RETURN VALUE: 0 on success, or -1 if the block is damaged
+ *   SIDE EFFECTS: none
+ */
+int32_t
+pix_decode (const uint8_t* src, size_t len, uint16_t* px, size_t n)
+{
+    uint16_t       table[64];	    /* recent colors        */
+    const uint8_t* end = src + len; /* end of input         */
+    uint16_t       prev = 0;	    /* previous pixel       */
+    size_t         out = 0;	    /* pixels written to px */
+    int32_t        run;		    /* repeats of prev      */
+    int32_t        dg;		    /* change in green      */
+    uint8_t        op;		    /* current code byte    */
+
+    (void)memset (table, 0, sizeof (table));
+    while (end > src) {
+	op = *src++;
+	if (PIX_OP_DIFF > op) {
+	    if (n == out) {
+		return -1;
+	    }
+	    px[out++] = prev = table[op];
+	    continue;
+	}
+	if (PIX_OP_LUMA > op) {
+	    prev = ((((prev >> 11) + ((op >> 4) & 3) - 2) & 0x1F) << 11) |
+		   (((((prev >> 5) & 0x3F) + ((op >> 2) & 3) - 2) & 0x3F) << 5) |
+		   (((prev & 0x1F) + (op & 3) - 2) & 0x1F);
+	} else if (PIX_OP_RUN > op) {
+	    if (end == src) {
+		return -1;
+	    }
+	    dg = (op & 0x3F) - 32;
+	    prev = ((((prev >> 11) + dg + (*src >> 4) - 8) & 0x1F) << 11) |
+		   (((((prev >> 5) & 0x3F) + dg) & 0x3F) << 5) |
+		   (((prev & 0x1F) + dg + (*src & 0xF) - 8) & 0x1F);
+	    src++;
+	} else if (PIX_OP_PIXEL > op) {
+	    run = (op & 0x3F) + 1;
+	    if (n - out < (size_t)run) {
+		return -1;
+	    }
+	    for (; 0 < run; run--) {
+		px[out++] = prev;
+	    }
+	    continue;
+	} else if (PIX_OP_PIXEL == op && 2 <= end - src) {
+	    prev = src[0] | (src[1] << 8);
+	    src += 2;
+	} else {
+	    return -1;
+	}
+	if (n == out) {
+	    return -1;
+	}
+	table[PIX_HASH (prev)] = prev;
+	px[out++] = prev;
+    }
+    return (n == out ? 0 : -1);
+}
@@ -0,0 +1,56 @@
+/*									tab:8
+ *
+ * pixcodec.h - header file for the 5:6:5 pixel block codec used by
+ *              version 2 .photo files
+ *
+ * Filename:	    pixcodec.h
+ * History:
+ *	1	Added a delta/run/index codec for compressed .photo files.
+ */
+
+#ifndef PIXCODEC_H
+#define PIXCODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * Each pixel is coded against the one before it (0 at the start of a 
+ * block) in one of five ways, chosen by the first byte:
+ *
+ *     0x00-0x3F  the pixel last coded in slot n of a 64-entry table of
+ *                recent colors, hashed by PIX_HASH
+ *     0x40-0x7F  a change of -2 to 1 in each of red, green, and blue, 
+ *                two bits each (with 2 added)
+ *     0x80-0xBF  a change in green of -32 to 31 (low six bits, with 32 
+ *                added), followed by a byte holding the changes in red
+ *                and in blue less that in green, -8 to 7 each (four bits
+ *                each, with 8 added, red high)
+ *     0xC0-0xFD  the previous pixel repeated 1 to 62 times
+ *     0xFE       a literal pixel in the next two bytes, little-endian
+ *
+ * Every pixel coded in the last three ways enters the color table.  The
+ * table starts out zero in each block.  Photos change slowly from pixel
+ * to pixel, so most pixels take one or two bytes, and decoding is a 
+ * byte switch with no tables beyond the 64 colors.
+ */
+
+/* most bytes that coding n pixels can produce */
+#define PIX_BOUND(n) (3 * (n))
+
+/* slot of a color in the table of recent colors */
+#define PIX_HASH(c) ((((c) >> 11) * 3 + (((c) >> 5) & 0x3F) * 5 + \
+		      ((c) & 0x1F) * 7) & 0x3F)
+
+/* Code n pixels into dst (PIX_BOUND (n) bytes); returns the length. */
+extern size_t pix_encode (const uint16_t* px, size_t n, uint8_t* dst);
+
+/*
+ * Decode a block of len bytes into exactly n pixels at px.  Returns 0 on
+ * success, or -1 if the block is damaged (px is then undefined).
+ */
+extern int32_t pix_decode (const uint8_t* src, size_t len, uint16_t* px,
+			   size_t n);
+
+#endif /* PIXCODEC_H */
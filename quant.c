@@ -0,0 +1,479 @@
+/*									tab:8
+ *
+ * quant.c - palette quantizers for room photos (see quant.h)
+ *
+ * Filename:	    quant.c
+ * History:
+ *	1	Added a choice of palette quantizers, from a fixed color
+ *		table to median cut.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "quant.h"
+
+
+/* levels of red, green, and blue in the fixed color cube */
+#define FIXED_RED   6
+#define FIXED_GREEN 8
+#define FIXED_BLUE  4
+
+
+/* type of a quantizer (see quant_palette) */
+typedef int32_t (*quant_fn_t) (const uint32_t hist[OCTREE_COLORS],
+			       uint8_t palette[QUANT_ENTRIES][3],
+			       uint8_t map[OCTREE_COLORS]);
+
+/* a distinct color of a photo, for median cut */
+typedef struct mc_color_t mc_color_t;
+struct mc_color_t {
+    uint16_t value;	/* 5:6:5 pixel value      */
+    uint16_t pad;
+    uint32_t count;	/* pixels of that value   */
+};
+
+/* a box of colors for median cut: colors first to last - 1 */
+typedef struct mc_box_t mc_box_t;
+struct mc_box_t {
+    int32_t  first;	/* first color in box              */
+    int32_t  last;	/* one past last color in box      */
+    uint64_t pixels;	/* pixels of those colors          */
+    int32_t  axis;	/* component with the widest range */
+    int32_t  extent;	/* that range (6-bit units)        */
+};
+
+
+/* local functions--see function headers for details */
+static int32_t quant_octree (const uint32_t hist[OCTREE_COLORS],
+			     uint8_t palette[QUANT_ENTRIES][3],
+			     uint8_t map[OCTREE_COLORS]);
+static int32_t quant_levels (const uint32_t hist[OCTREE_COLORS],
+			     uint8_t palette[QUANT_ENTRIES][3],
+			     uint8_t map[OCTREE_COLORS]);
+static int32_t quant_median (const uint32_t hist[OCTREE_COLORS],
+			     uint8_t palette[QUANT_ENTRIES][3],
+			     uint8_t map[OCTREE_COLORS]);
+static int32_t quant_fixed (const uint32_t hist[OCTREE_COLORS],
+			    uint8_t palette[QUANT_ENTRIES][3],
+			    uint8_t map[OCTREE_COLORS]);
+static int32_t component (uint16_t value, int32_t axis);
+static void measure_box (const mc_color_t* color, mc_box_t* box);
+static void sort_box (mc_color_t* color, mc_color_t* tmp,
+		      const mc_box_t* box);
+
+
+/* the quantizers, by number */
+typedef struct quant_strategy_t quant_strategy_t;
+struct quant_strategy_t {
+    const char* name;		/* name for quant_force and reports */
+    quant_fn_t  fn;		/* quantizer                        */
+    int32_t     uses_hist;	/* 0 if it ignores the histogram    */
+};
+static const quant_strategy_t strategy[] = {
+    {"octree", quant_octree, 1},
+    {"levels", quant_levels, 1},
+    {"median", quant_median, 1},
+    {"fixed", quant_fixed, 0}
+};
+#define NUM_STRATEGIES ((int32_t)(sizeof (strategy) / sizeof (strategy[0])))
+
+
+/*
+ * file-scope variables
+ */
+static int32_t  chosen;			 /* selected quantizer          */
+static size_t   scratch;		 /* memory used by last call    */
+static octree_t tree;			 /* octree (arena on first use) */
+static uint8_t  fixed_map[OCTREE_COLORS]; /* cube entry of each value  */
+static int32_t  fixed_ready;		 /* 1 once fixed_map is filled  */
+
+
+/*
+ * quant_force
+ *   DESCRIPTION: Select the quantizer used by quant_palette.
+ *   INPUTS: name -- a quantizer name (see quant.h)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the name is unknown
+ *   SIDE EFFECTS: changes the selected quantizer
+ */
+int32_t
+quant_force (const char* name)
+{
+    int32_t q; /* index over quantizers */
+
+    for (q = 0; NUM_STRATEGIES > q; q++) {
+	if (0 == strcmp (name, strategy[q].name)) {
+	    chosen = q;
+	    return 0;
+	}
+    }
+    return -1;
+}
+
+
+/*
+ * quant_name
+ *   DESCRIPTION: Get the name of a quantizer.
+ *   INPUTS: q -- number of quantizer
+ *   OUTPUTS: none
+ *   RETURN VALUE: the name, or NULL if there is no such quantizer
+ *   SIDE EFFECTS: none
+ */
+const char*
+quant_name (int32_t q)
+{
+    return (0 <= q && NUM_STRATEGIES > q ? strategy[q].name : NULL);
+}
+
+
+/*
+ * quant_current
+ *   DESCRIPTION: Get the number of the selected quantizer.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number
+ *   SIDE EFFECTS: none
+ */
+int32_t
+quant_current (void)
+{
+    return chosen;
+}
+
+
+/*
+ * quant_uses_histogram
+ *   DESCRIPTION: Check whether the selected quantizer needs a histogram
+ *                of the photo's pixels.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if so, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+int32_t
+quant_uses_histogram (void)
+{
+    return strategy[chosen].uses_hist;
+}
+
+
+/*
+ * quant_palette
+ *   DESCRIPTION: Choose a palette with the selected quantizer.
+ *   INPUTS: hist -- pixel count for each 5:6:5 value
+ *   OUTPUTS: palette -- the entries (unused ones zero)
+ *            map -- entry for each value in hist (or for every value)
+ *   RETURN VALUE: 0 on success, or -1 if memory runs out
+ *   SIDE EFFECTS: records the memory used (see quant_scratch)
+ */
+int32_t
+quant_palette (const uint32_t hist[OCTREE_COLORS],
+	       uint8_t palette[QUANT_ENTRIES][3], uint8_t map[OCTREE_COLORS])
+{
+    (void)memset (palette, 0, QUANT_ENTRIES * sizeof (palette[0]));
+    scratch = 0;
+    return strategy[chosen].fn (hist, palette, map);
+}
+
+
+/*
+ * quant_scratch
+ *   DESCRIPTION: Get the memory used by the last quant_palette, beyond
+ *                its arguments: memory allocated during the call, or
+ *                held between calls for the quantizer's use.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: size in bytes
+ *   SIDE EFFECTS: none
+ */
+size_t
+quant_scratch (void)
+{
+    return scratch;
+}
+
+
+/*
+ * quant_octree
+ *   DESCRIPTION: Quantize with the arena octree (see octree.h).
+ *   INPUTS: hist -- pixel count for each 5:6:5 value
+ *   OUTPUTS: palette -- the entries
+ *            map -- entry for each value in hist
+ *   RETURN VALUE: 0 on success, or -1 if memory runs out
+ *   SIDE EFFECTS: allocates the arena on first use
+ */
+static int32_t
+quant_octree (const uint32_t hist[OCTREE_COLORS],
+	      uint8_t palette[QUANT_ENTRIES][3], uint8_t map[OCTREE_COLORS])
+{
+    uint32_t c; /* 5:6:5 pixel value */
+
+    if (NULL == tree.node &&
+	0 != octree_init (&tree, OCTREE_DEPTH, OCTREE_LEAVES)) {
+	return -1;
+    }
+    scratch = octree_arena_bytes (OCTREE_DEPTH);
+    octree_build (&tree, hist);
+    (void)octree_reduce (&tree, palette);
+    for (c = 0; OCTREE_COLORS > c; c++) {
+	if (0 != hist[c]) {
+	    map[c] = octree_map (&tree, c);
+	}
+    }
+    return 0;
+}
+
+
+/*
+ * quant_levels
+ *   DESCRIPTION: Quantize with the original scheme (see octree_levels).
+ *   INPUTS: hist -- pixel count for each 5:6:5 value
+ *   OUTPUTS: palette -- the entries
+ *            map -- entry for each value in hist
+ *   RETURN VALUE: 0 on success, or -1 if memory runs out
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+quant_levels (const uint32_t hist[OCTREE_COLORS],
+	      uint8_t palette[QUANT_ENTRIES][3], uint8_t map[OCTREE_COLORS])
+{
+    scratch = OCTREE_LEVELS_BYTES;
+    return octree_levels (hist, palette, map);
+}
+
+
+/*
+ * quant_median
+ *   DESCRIPTION: Quantize by median cut.  The distinct colors start in
+ *                one box.  The box with the largest product of pixels
+ *                and extent (the widest range of a component) is sorted
+ *                along that component and split where half its pixels
+ *                fall on each side, until there are QUANT_ENTRIES boxes
+ *                or no box holds two colors.  Each entry is the average
+ *                of its box's pixels.
+ *   INPUTS: hist -- pixel count for each 5:6:5 value
+ *   OUTPUTS: palette -- the entries
+ *            map -- entry for each value in hist
+ *   RETURN VALUE: 0 on success, or -1 if memory runs out
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+quant_median (const uint32_t hist[OCTREE_COLORS],
+	      uint8_t palette[QUANT_ENTRIES][3], uint8_t map[OCTREE_COLORS])
+{
+    mc_color_t* color;		      /* distinct colors             */
+    mc_color_t* tmp;		      /* space for sorting           */
+    mc_box_t    box[QUANT_ENTRIES];   /* the boxes                   */
+    mc_box_t*   b;		      /* box being split             */
+    uint64_t    best;		      /* score of box to split       */
+    uint64_t    half;		      /* pixels before the split     */
+    uint64_t    sum[3];		      /* component sums over a box   */
+    int32_t     n_colors;	      /* number of distinct colors   */
+    int32_t     n_boxes;	      /* number of boxes             */
+    int32_t     i;		      /* index over colors or boxes  */
+    int32_t     k;		      /* index over components       */
+    int32_t     split;		      /* first color of the new box  */
+    uint32_t    c;		      /* 5:6:5 pixel value           */
+
+    for (n_colors = 0, c = 0; OCTREE_COLORS > c; c++) {
+	n_colors += (0 != hist[c]);
+    }
+    if (0 == n_colors) {
+	return 0;
+    }
+    scratch = 2 * n_colors * sizeof (*color);
+    if (NULL == (color = malloc (scratch))) {
+	return -1;
+    }
+    tmp = color + n_colors;
+    for (i = 0, c = 0; OCTREE_COLORS > c; c++) {
+	if (0 != hist[c]) {
+	    color[i].value = c;
+	    color[i].count = hist[c];
+	    i++;
+	}
+    }
+
+    box[0].first = 0;
+    box[0].last = n_colors;
+    measure_box (color, &box[0]);
+    for (n_boxes = 1; QUANT_ENTRIES > n_boxes; n_boxes++) {
+
+	/* Pick the box to split. */
+	b = NULL;
+	best = 0;
+	for (i = 0; n_boxes > i; i++) {
+	    if (2 <= box[i].last - box[i].first &&
+		best < box[i].pixels * box[i].extent) {
+		best = box[i].pixels * box[i].extent;
+		b = &box[i];
+	    }
+	}
+	if (NULL == b) {
+	    break;
+	}
+
+	/* Split it at its weighted median, leaving a color on each side. */
+	sort_box (color, tmp, b);
+	half = 0;
+	for (split = b->first + 1; b->last - 1 > split; split++) {
+	    if (2 * (half += color[split - 1].count) >= b->pixels) {
+		break;
+	    }
+	}
+	box[n_boxes].first = split;
+	box[n_boxes].last = b->last;
+	b->last = split;
+	measure_box (color, b);
+	measure_box (color, &box[n_boxes]);
+    }
+
+    /* Each entry is the rounded average of its box. */
+    for (i = 0; n_boxes > i; i++) {
+	sum[0] = sum[1] = sum[2] = 0;
+	for (split = box[i].first; box[i].last > split; split++) {
+	    for (k = 0; 3 > k; k++) {
+		sum[k] += (uint64_t)component (color[split].value, k) *
+			  color[split].count;
+	    }
+	    map[color[split].value] = i;
+	}
+	for (k = 0; 3 > k; k++) {
+	    palette[i][k] = (sum[k] + box[i].pixels / 2) / box[i].pixels;
+	}
+    }
+    free (color);
+    return 0;
+}
+
+
+/*
+ * quant_fixed
+ *   DESCRIPTION: Quantize to a fixed color cube with FIXED_RED,
+ *                FIXED_GREEN, and FIXED_BLUE evenly spaced levels,
+ *                mapping each value to the nearest level of each
+ *                component.  The histogram is not used.
+ *   INPUTS: hist -- ignored
+ *   OUTPUTS: palette -- the entries
+ *            map -- entry for every pixel value
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: fills fixed_map on first use
+ */
+static int32_t
+quant_fixed (const uint32_t hist[OCTREE_COLORS],
+	     uint8_t palette[QUANT_ENTRIES][3], uint8_t map[OCTREE_COLORS])
+{
+    uint32_t c; /* 5:6:5 pixel value, or entry */
+
+    (void)hist;
+    if (!fixed_ready) {
+	for (c = 0; OCTREE_COLORS > c; c++) {
+	    fixed_map[c] =
+		    (((c >> 11) * (FIXED_RED - 1) + 15) / 31 * FIXED_GREEN +
+		     (((c >> 5) & 0x3F) * (FIXED_GREEN - 1) + 31) / 63) *
+		    FIXED_BLUE + ((c & 0x1F) * (FIXED_BLUE - 1) + 15) / 31;
+	}
+	fixed_ready = 1;
+    }
+    scratch = sizeof (fixed_map);
+    for (c = 0; FIXED_RED * FIXED_GREEN * FIXED_BLUE > c; c++) {
+	palette[c][0] = (63 * (c / (FIXED_GREEN * FIXED_BLUE)) +
+			 (FIXED_RED - 1) / 2) / (FIXED_RED - 1);
+	palette[c][1] = (63 * (c / FIXED_BLUE % FIXED_GREEN) +
+			 (FIXED_GREEN - 1) / 2) / (FIXED_GREEN - 1);
+	palette[c][2] = (63 * (c % FIXED_BLUE) + (FIXED_BLUE - 1) / 2) /
+			(FIXED_BLUE - 1);
+    }
+    (void)memcpy (map, fixed_map, sizeof (fixed_map));
+    return 0;
+}
+
+
+/*
+ * component
+ *   DESCRIPTION: Get one component of a pixel value in 6-bit units.
+ *   INPUTS: value -- 5:6:5 pixel value
+ *           axis -- 0 for red, 1 for green, 2 for blue
+ *   OUTPUTS: none
+ *   RETURN VALUE: the component (0 to 63)
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+component (uint16_t value, int32_t axis)
+{
+    switch (axis) {
+	case 0:  return (value >> 11) << 1;
+	case 1:  return (value >> 5) & 0x3F;
+	default: return (value & 0x1F) << 1;
+    }
+}
+
+
+/*
+ * measure_box
+ *   DESCRIPTION: Count a box's pixels and find its widest component.
+ *   INPUTS: color -- the colors
+ *           box -- the box (first and last set)
+ *   OUTPUTS: box -- pixels, axis, and extent set
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+measure_box (const mc_color_t* color, mc_box_t* box)
+{
+    int32_t lo[3] = {63, 63, 63}; /* least of each component    */
+    int32_t hi[3] = {0, 0, 0};	  /* greatest of each component */
+    int32_t i;			  /* index over colors          */
+    int32_t k;			  /* index over components      */
+    int32_t v;			  /* one component              */
+
+    box->pixels = 0;
+    for (i = box->first; box->last > i; i++) {
+	box->pixels += color[i].count;
+	for (k = 0; 3 > k; k++) {
+	    v = component (color[i].value, k);
+	    lo[k] = (v < lo[k] ? v : lo[k]);
+	    hi[k] = (v > hi[k] ? v : hi[k]);
+	}
+    }
+    box->axis = 1;
+    for (k = 0; 3 > k; k++) {
+	if (hi[k] - lo[k] > hi[box->axis] - lo[box->axis]) {
+	    box->axis = k;
+	}
+    }
+    box->extent = hi[box->axis] - lo[box->axis];
+}
+
+
+/*
+ * sort_box
+ *   DESCRIPTION: Sort a box's colors by its widest component, keeping
+ *                the existing order among equal components.
+ *   INPUTS: color -- the colors
+ *           tmp -- space for the box's colors
+ *           box -- the box
+ *   OUTPUTS: color -- the box's colors sorted
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+sort_box (mc_color_t* color, mc_color_t* tmp, const mc_box_t* box)
+{
+    int32_t start[65]; /* first position of each component value */
+    int32_t i;	       /* index over colors or values            */
+
+    (void)memset (start, 0, sizeof (start));
+    for (i = box->first; box->last > i; i++) {
+	start[component (color[i].value, box->axis) + 1]++;
+    }
+    for (i = 1; 64 >= i; i++) {
+	start[i] += start[i - 1];
+    }
+    for (i = box->first; box->last > i; i++) {
+	tmp[start[component (color[i].value, box->axis)]++] = color[i];
+    }
+    (void)memcpy (color + box->first, tmp,
+		  (box->last - box->first) * sizeof (*color));
+}
@@ -0,0 +1,72 @@
+/*									tab:8
+ *
+ * quant.h - header file for the palette quantizers used by read_photo
+ *
+ * Filename:	    quant.h
+ * History:
+ *	1	Added a choice of palette quantizers, from a fixed color
+ *		table to median cut.
+ */
+
+#ifndef QUANT_H
+#define QUANT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "octree.h"
+
+
+/*
+ * A quantizer chooses up to QUANT_ENTRIES palette entries for a room
+ * photo from the histogram of its 5:6:5 pixel values, and the entry for
+ * each value.  read_photo calls the selected one (quant_force), so a
+ * deployment can trade palette quality for load time.
+ *
+ * Quantizers:
+ *     octree -- arena octree folded by pixel count (see octree.h)
+ *     levels -- the original 128 level 4 + 64 level 2 octree nodes
+ *     median -- median cut: split the box of colors with the most
+ *               pixels times extent at its weighted median, until
+ *               there are QUANT_ENTRIES boxes
+ *     fixed  -- a fixed 6 x 8 x 4 red/green/blue color cube; needs no
+ *               histogram, so read_photo skips the counting pass
+ *
+ * "mp2photo -quant" compares them over a set of photos.
+ */
+
+/* palette entries of a room photo (VGA colors 64 to 255) */
+#define QUANT_ENTRIES 192
+
+/* the quantizer used unless another is forced */
+#define QUANT_DEFAULT "octree"
+
+/*
+ * Use the named quantizer from now on.  Returns 0 on success, or -1 if
+ * the name is unknown.
+ */
+extern int32_t quant_force (const char* name);
+
+/* Get the name of quantizer q (0, 1, ...), or NULL past the last. */
+extern const char* quant_name (int32_t q);
+
+/* Get the number of the selected quantizer. */
+extern int32_t quant_current (void);
+
+/* Check whether the selected quantizer uses the histogram. */
+extern int32_t quant_uses_histogram (void);
+
+/*
+ * Choose a palette with the selected quantizer, and set map[c] to the
+ * entry for each pixel value c in hist (for every value if the
+ * quantizer does not use the histogram).  Unused entries are zero.
+ * Returns 0 on success, or -1 if memory runs out.
+ */
+extern int32_t quant_palette (const uint32_t hist[OCTREE_COLORS],
+			      uint8_t palette[QUANT_ENTRIES][3],
+			      uint8_t map[OCTREE_COLORS]);
+
+/* Get the most scratch memory (bytes) used by the last quant_palette. */
+extern size_t quant_scratch (void);
+
+#endif /* QUANT_H */
@@ -0,0 +1,266 @@
+/*									tab:8
+ *
+ * replay.c - scripted command replay and session recording for the
+ *            adventure game
+ *
+ * Filename:	    replay.c
+ * History:
+ *	1	Added replay scripts for headless benchmark runs and a
+ *		recorder that writes real sessions in the same format.
+ */
+
+/*
+ * A script is a text file with one command per line:
+ *
+ *     seed 1318546123
+ *     0 enter
+ *     12 right
+ *     40 typed get board
+ *     95 quit
+ *
+ * The optional seed line gives the value passed to srand, so that random
+ * object placement matches the recorded session.  Every other line starts
+ * with the game loop tick at which the command was issued, followed by
+ * the command name (see cmd_name below).  A typed command is followed by
+ * the text that was typed.  Several lines may share a tick (a session
+ * can issue a Tux command and a keyboard command in the same tick); a
+ * replay issues all of them on that tick, in order.  Blank lines and
+ * lines starting with '#' are ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay.h"
+
+
+/* one scripted command */
+typedef struct event_t event_t;
+struct event_t {
+    uint32_t tick;			/* game loop tick of the command */
+    cmd_t    cmd;			/* the command                   */
+    char     text[MAX_TYPED_LEN + 1];	/* typed text for CMD_TYPED      */
+};
+
+/* script names of the commands, indexed by cmd_t */
+static const char* const cmd_name[NUM_COMMANDS] = {
+    "none", "right", "left", "up", "down",
+    "moveleft", "enter", "moveright", "typed", "quit"
+};
+
+/* file-scope variables */
+static event_t* events = NULL;	/* loaded script                  */
+static int32_t  n_events = 0;	/* number of commands in script   */
+static int32_t  next_event = 0;	/* index of next command to issue */
+static FILE*    record = NULL;	/* script being recorded, if any  */
+
+
+/*
+ * replay_open
+ *   DESCRIPTION: Read a replay script into memory.
+ *   INPUTS: fname -- script file name
+ *   OUTPUTS: seed -- random seed named by the script (0 if none)
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: prints an error message to stderr on failure
+ */
+int32_t
+replay_open (const char* fname, unsigned int* seed)
+{
+    FILE*    in;		/* script file                      */
+    char     line[100];		/* one line of the script           */
+    int32_t  line_no;		/* line number for error messages   */
+    int32_t  max_events;	/* space allocated in events        */
+    uint32_t tick;		/* tick read from current line      */
+    char     name[20];		/* command name from current line   */
+    int      used;		/* characters consumed by sscanf    */
+    int32_t  idx;		/* index over command names         */
+    event_t* ev;		/* event being filled in            */
+    char*    text;		/* typed text on current line       */
+
+    if (NULL == (in = fopen (fname, "r"))) {
+	perror (fname);
+	return -1;
+    }
+
+    *seed = 0;
+    max_events = 0;
+    for (line_no = 1; NULL != fgets (line, sizeof (line), in); line_no++) {
+
+	/* Strip the line ending; skip blank lines and comments. */
+	line[strcspn (line, "\r\n")] = '\0';
+	if ('\0' == line[0] || '#' == line[0]) {
+	    continue;
+	}
+	if (1 == sscanf (line, "seed %u", seed)) {
+	    continue;
+	}
+
+	if (2 != sscanf (line, "%u %19s%n", &tick, name, &used)) {
+	    fprintf (stderr, "%s:%d: bad script line\n", fname, line_no);
+	    break;
+	}
+	for (idx = 0; NUM_COMMANDS > idx; idx++) {
+	    if (0 == strcmp (name, cmd_name[idx])) {
+		break;
+	    }
+	}
+	if (NUM_COMMANDS == idx || CMD_NONE == idx) {
+	    fprintf (stderr, "%s:%d: unknown command %s\n", fname, line_no,
+		     name);
+	    break;
+	}
+
+	/* Make room for the new command. */
+	if (n_events == max_events) {
+	    max_events = (0 == max_events ? 256 : 2 * max_events);
+	    if (NULL == (ev = realloc (events, max_events * sizeof (*ev)))) {
+		fputs ("out of memory reading replay script\n", stderr);
+		break;
+	    }
+	    events = ev;
+	}
+
+	ev = &events[n_events++];
+	ev->tick = tick;
+	ev->cmd = idx;
+	text = line + used;
+	if (' ' == *text) {
+	    text++;
+	}
+	strncpy (ev->text, text, MAX_TYPED_LEN);
+	ev->text[MAX_TYPED_LEN] = '\0';
+    }
+
+    /* Any line we stopped on early is an error. */
+    if (!feof (in)) {
+	(void)fclose (in);
+	replay_close ();
+	return -1;
+    }
+    (void)fclose (in);
+    next_event = 0;
+    return 0;
+}
+
+
+/*
+ * replay_command
+ *   DESCRIPTION: Get the next scripted command due at or before a tick.
+ *                Call repeatedly until CMD_NONE to issue every command
+ *                due at that tick.
+ *   INPUTS: tick -- current game loop tick
+ *   OUTPUTS: none
+ *   RETURN VALUE: next command due, or CMD_NONE
+ *   SIDE EFFECTS: replaces the typed command for CMD_TYPED
+ */
+cmd_t
+replay_command (uint32_t tick)
+{
+    event_t* ev;	/* next command in the script */
+
+    if (next_event >= n_events || events[next_event].tick > tick) {
+	return CMD_NONE;
+    }
+    ev = &events[next_event++];
+    if (CMD_TYPED == ev->cmd) {
+	set_typed_command (ev->text);
+    }
+    return ev->cmd;
+}
+
+
+/*
+ * replay_done
+ *   DESCRIPTION: Check whether the whole script has been issued.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if no commands remain, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t
+replay_done ()
+{
+    return (next_event >= n_events);
+}
+
+
+/*
+ * replay_close
+ *   DESCRIPTION: Release the loaded script.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees script memory
+ */
+void
+replay_close ()
+{
+    free (events);
+    events = NULL;
+    n_events = next_event = 0;
+}
+
+
+/*
+ * record_open
+ *   DESCRIPTION: Start recording commands to a script file.
+ *   INPUTS: fname -- script file name
+ *           seed -- random seed used for this session
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: creates or truncates the file; prints an error message
+ *                 to stderr on failure
+ */
+int32_t
+record_open (const char* fname, unsigned int seed)
+{
+    if (NULL == (record = fopen (fname, "w"))) {
+	perror (fname);
+	return -1;
+    }
+    fprintf (record, "# adventure session\nseed %u\n", seed);
+    return 0;
+}
+
+
+/*
+ * record_command
+ *   DESCRIPTION: Append a command to the script being recorded, if any.
+ *   INPUTS: tick -- game loop tick at which the command was issued
+ *           cmd -- the command
+ *           typed -- typed text (used only for CMD_TYPED)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to the script file
+ */
+void
+record_command (uint32_t tick, cmd_t cmd, const char* typed)
+{
+    if (NULL == record || CMD_NONE == cmd || NUM_COMMANDS <= cmd) {
+	return;
+    }
+    if (CMD_TYPED == cmd) {
+	fprintf (record, "%u %s %s\n", tick, cmd_name[cmd], typed);
+    } else {
+	fprintf (record, "%u %s\n", tick, cmd_name[cmd]);
+    }
+}
+
+
+/*
+ * record_close
+ *   DESCRIPTION: Finish recording and close the script file.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: closes the script file
+ */
+void
+record_close ()
+{
+    if (NULL != record) {
+	(void)fclose (record);
+	record = NULL;
+    }
+}
@@ -0,0 +1,45 @@
+/*									tab:8
+ *
+ * replay.h - header file for scripted command replay and session
+ *            recording in the adventure game
+ *
+ * Filename:	    replay.h
+ * History:
+ *	1	Added replay scripts for headless benchmark runs and a
+ *		recorder that writes real sessions in the same format.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+
+#include "input.h"
+
+
+/* Load a replay script.  Returns 0 on success, -1 on failure. */
+extern int32_t replay_open (const char* fname, unsigned int* seed);
+
+/*
+ * Get the next scripted command due at or before the given tick, or
+ * CMD_NONE if there is none.  For CMD_TYPED, the typed command is
+ * replaced with the scripted text first.
+ */
+extern cmd_t replay_command (uint32_t tick);
+
+/* Check whether every scripted command has been returned. */
+extern int32_t replay_done ();
+
+/* Release the loaded script. */
+extern void replay_close ();
+
+/* Start recording commands to a script.  Returns 0 on success, -1 on failure. */
+extern int32_t record_open (const char* fname, unsigned int seed);
+
+/* Record a command issued at the given tick (typed is used for CMD_TYPED). */
+extern void record_command (uint32_t tick, cmd_t cmd, const char* typed);
+
+/* Finish recording. */
+extern void record_close ();
+
+#endif /* REPLAY_H */
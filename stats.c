@@ -0,0 +1,402 @@
+/*									tab:8
+ *
+ * stats.c - per-frame hot-path counters for the adventure game
+ *
+ * Filename:	    stats.c
+ * History:
+ *	1	Added call counts and cycle timers for the drawing and
+ *		input paths, dumped on exit and on SIGUSR1.
+ */
+
+#include <signal.h>
+#include <string.h>
+
+#include "copy.h"
+#include "stats.h"
+
+
+/*
+ * Counters for one timed function.  The tick_cycles field collects the
+ * cycles spent during the current game loop tick; stats_tick folds it
+ * into max_tick.  Counters are updated without locks: the drawing
+ * functions run either in the main loop or under the game's command
+ * lock, so updates do not overlap in practice, and a lost update would
+ * only make a statistic slightly low.
+ */
+typedef struct stat_t stat_t;
+struct stat_t {
+    uint64_t calls;		/* number of calls             */
+    uint64_t cycles;		/* total cycles over all calls */
+    uint64_t max_call;		/* most cycles in one call     */
+    uint64_t tick_cycles;	/* cycles in the current tick  */
+    uint64_t max_tick;		/* most cycles in one tick     */
+};
+
+/* names of the timed functions, indexed by stat_id_t */
+static const char* const stat_name[NUM_STATS] = {
+    "fill_horiz_buffer", "fill_vert_buffer", "draw_horiz_line",
+    "draw_vert_line", "fill_horiz_strip", "fill_vert_strip",
+    "set_view_window", "show_screen", "show_status_bar",
+    "copypalletetoVGA", "handle_typing", "capture_view", "enter_room",
+    "load_tile"
+};
+
+/* file-scope variables */
+static stat_t   stat[NUM_STATS];	/* per-function counters          */
+static uint64_t vram_bytes;		/* bytes show_screen wrote to VGA */
+static uint64_t vram_tick_bytes;	/* ...during the current tick     */
+static uint64_t vram_max_tick_bytes;	/* ...most in one tick            */
+static uint64_t latch_bytes;		/* bytes copied within the VGA    */
+static uint64_t n_presents;		/* pages flipped on retrace       */
+static uint64_t present_usec;		/* total queue-to-retrace time    */
+static uint64_t max_present_usec;	/* longest queue-to-retrace time  */
+static uint64_t dropped_frames;		/* queued pages never shown       */
+static uint64_t rooms_prerendered;	/* entries shown from a spare     */
+static uint64_t rooms_redrawn;		/* entries drawn line by line     */
+static uint64_t photo_raw_bytes;	/* room photo pixels read         */
+static uint64_t photo_packed_bytes;	/* ...as held in compressed tiles */
+static int32_t  asset_files;		/* asset files read in a batch    */
+static uint64_t asset_bytes;		/* ...bytes in them               */
+static int32_t  asset_uring;		/* ...1 if read with io_uring     */
+static int32_t  asset_by_pread;		/* ...files finished by pread     */
+static int32_t  asset_depth;		/* ...most reads in flight        */
+static int64_t  asset_first_usec;	/* ...time to first decode        */
+static int64_t  asset_total_usec;	/* ...time to read and decode all */
+static uint64_t n_ticks;		/* game loop ticks completed      */
+static uint64_t missed_ticks;		/* ticks skipped by game_loop     */
+static uint64_t max_missed;		/* most ticks skipped at once     */
+static volatile sig_atomic_t dump_requested = 0; /* set by SIGUSR1    */
+
+
+/* local functions--see function headers for details */
+static void request_dump (int sig);
+
+
+/*
+ * stat_add
+ *   DESCRIPTION: Count one call of a timed function.
+ *   INPUTS: id -- the function
+ *           cycles -- cycles taken by the call
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates counters
+ */
+void
+stat_add (stat_id_t id, uint64_t cycles)
+{
+    stat_t* s = &stat[id];
+
+    s->calls++;
+    s->cycles += cycles;
+    s->tick_cycles += cycles;
+    if (cycles > s->max_call) {
+	s->max_call = cycles;
+    }
+}
+
+
+/*
+ * stat_add_vram_bytes
+ *   DESCRIPTION: Count bytes written to video memory by show_screen.
+ *   INPUTS: bytes -- number of bytes written
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates counters
+ */
+void
+stat_add_vram_bytes (int32_t bytes)
+{
+    vram_bytes += bytes;
+    vram_tick_bytes += bytes;
+}
+
+
+/*
+ * stat_add_latch_bytes
+ *   DESCRIPTION: Count bytes (per plane) copied from one part of video
+ *                memory to another by show_screen.
+ *   INPUTS: bytes -- number of bytes copied
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates counters
+ */
+void
+stat_add_latch_bytes (int32_t bytes)
+{
+    latch_bytes += bytes;
+}
+
+
+/*
+ * stat_present
+ *   DESCRIPTION: Count one page shown by triple buffering.
+ *   INPUTS: usec -- microseconds from queueing the page to the retrace
+ *                   at which it was shown
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates counters
+ */
+void
+stat_present (uint32_t usec)
+{
+    n_presents++;
+    present_usec += usec;
+    if (usec > max_present_usec) {
+	max_present_usec = usec;
+    }
+}
+
+
+/*
+ * stat_drop_frame
+ *   DESCRIPTION: Count one page queued by triple buffering but replaced
+ *                before it could be shown.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates counters
+ */
+void
+stat_drop_frame ()
+{
+    dropped_frames++;
+}
+
+
+/*
+ * stat_room_entry
+ *   DESCRIPTION: Count one room entry.
+ *   INPUTS: prerendered -- 1 if the room was shown from a spare build
+ *                          buffer, 0 if it was redrawn
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates counters
+ */
+void
+stat_room_entry (int32_t prerendered)
+{
+    if (prerendered) {
+	rooms_prerendered++;
+    } else {
+	rooms_redrawn++;
+    }
+}
+
+
+/*
+ * stat_photo_bytes
+ *   DESCRIPTION: Count the memory held by one room photo's pixels.
+ *   INPUTS: raw -- bytes of pixel data in the photo
+ *           packed -- bytes used to hold them as compressed tiles
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates counters
+ */
+void
+stat_photo_bytes (uint32_t raw, uint32_t packed)
+{
+    photo_raw_bytes += raw;
+    photo_packed_bytes += packed;
+}
+
+
+/*
+ * stat_asset_reads
+ *   DESCRIPTION: Record a batch of asset file reads (see ioq.h).
+ *   INPUTS: uring -- 1 if read with io_uring, 0 if with pread
+ *           by_pread -- files finished with pread after io_uring failed
+ *                       or refused to read them
+ *           depth -- most reads in flight
+ *           files -- number of files
+ *           bytes -- bytes read
+ *           first_usec -- time from the first open to the first decode
+ *           total_usec -- time to read and decode all of the files
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates counters
+ */
+void
+stat_asset_reads (int32_t uring, int32_t by_pread, int32_t depth, 
+		  int32_t files, uint64_t bytes, int64_t first_usec, 
+		  int64_t total_usec)
+{
+    asset_uring = uring;
+    asset_by_pread = by_pread;
+    asset_depth = depth;
+    asset_files = files;
+    asset_bytes = bytes;
+    asset_first_usec = first_usec;
+    asset_total_usec = total_usec;
+}
+
+
+/*
+ * stats_tick
+ *   DESCRIPTION: Finish the counters for one game loop tick, and dump
+ *                them if SIGUSR1 has arrived since the last tick.
+ *   INPUTS: missed -- number of ticks game_loop skipped to catch up
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates counters; may write to stderr
+ */
+void
+stats_tick (int32_t missed)
+{
+    int32_t i;	/* index over timed functions */
+
+    n_ticks++;
+    missed_ticks += missed;
+    if (missed > max_missed) {
+	max_missed = missed;
+    }
+    for (i = 0; NUM_STATS > i; i++) {
+	if (stat[i].tick_cycles > stat[i].max_tick) {
+	    stat[i].max_tick = stat[i].tick_cycles;
+	}
+	stat[i].tick_cycles = 0;
+    }
+    if (vram_tick_bytes > vram_max_tick_bytes) {
+	vram_max_tick_bytes = vram_tick_bytes;
+    }
+    vram_tick_bytes = 0;
+
+    /* The signal handler only sets a flag; the dump happens here. */
+    if (dump_requested) {
+	dump_requested = 0;
+	stats_dump (stderr);
+    }
+}
+
+
+/*
+ * stats_init
+ *   DESCRIPTION: Install a SIGUSR1 handler that requests a counter dump
+ *                at the end of the next tick.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes SIGUSR1 behavior; prints an error message
+ *                 on failure
+ */
+void
+stats_init ()
+{
+    struct sigaction sa;   /* signal behavior definition structure  */
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = request_dump;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset (&sa.sa_mask);
+    if (-1 == sigaction (SIGUSR1, &sa, NULL))
+	perror ("sigaction for SIGUSR1");
+}
+
+
+/*
+ * stats_dump
+ *   DESCRIPTION: Write all counters, with per-call and per-tick averages
+ *                and maxima.
+ *   INPUTS: out -- stream to write to
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to out
+ */
+void
+stats_dump (FILE* out)
+{
+    int32_t  i;		/* index over timed functions       */
+    uint64_t ticks;	/* tick count (at least 1)          */
+    stat_t*  s;		/* counters for current function    */
+
+    ticks = (0 == n_ticks ? 1 : n_ticks);
+    fprintf (out, "--- hot-path counters: %llu ticks, %llu missed "
+	     "(at most %llu at once) ---\n", (unsigned long long)n_ticks,
+	     (unsigned long long)missed_ticks, (unsigned long long)max_missed);
+    fprintf (out, "%-18s %10s %9s %10s %10s %11s %11s\n", "function",
+	     "calls", "calls/tk", "cyc/call", "max/call", "cyc/tick",
+	     "max/tick");
+    for (i = 0; NUM_STATS > i; i++) {
+	s = &stat[i];
+	fprintf (out, "%-18s %10llu %9.1f %10llu %10llu %11llu %11llu\n",
+		 stat_name[i], (unsigned long long)s->calls,
+		 (double)s->calls / ticks,
+		 (unsigned long long)(0 == s->calls ? 0 : s->cycles / s->calls),
+		 (unsigned long long)s->max_call,
+		 (unsigned long long)(s->cycles / ticks),
+		 (unsigned long long)s->max_tick);
+    }
+    fprintf (out, "show_screen wrote %llu bytes to video memory (%.1f/tick, "
+	     "at most %llu in one tick)\n", (unsigned long long)vram_bytes,
+	     (double)vram_bytes / ticks,
+	     (unsigned long long)vram_max_tick_bytes);
+    if (0 != latch_bytes) {
+	fprintf (out, "show_screen latch-copied %llu bytes within video "
+		 "memory (%.1f/tick)\n", (unsigned long long)latch_bytes,
+		 (double)latch_bytes / ticks);
+    }
+    if (0 != n_presents || 0 != dropped_frames) {
+	fprintf (out, "presented %llu frames on retrace, latency %.0f us "
+		 "average, %llu us max; %llu frames dropped\n",
+		 (unsigned long long)n_presents,
+		 (0 == n_presents ? 0.0 : (double)present_usec / n_presents),
+		 (unsigned long long)max_present_usec,
+		 (unsigned long long)dropped_frames);
+    }
+    if (0 != rooms_prerendered || 0 != rooms_redrawn) {
+	fprintf (out, "entered %llu rooms: %llu pre-rendered, %llu redrawn\n",
+		 (unsigned long long)(rooms_prerendered + rooms_redrawn),
+		 (unsigned long long)rooms_prerendered,
+		 (unsigned long long)rooms_redrawn);
+    }
+    if (0 != photo_raw_bytes) {
+	fprintf (out, "room photos hold %llu pixel bytes in %llu compressed "
+		 "bytes (%.2f)\n", (unsigned long long)photo_raw_bytes,
+		 (unsigned long long)photo_packed_bytes,
+		 (double)photo_packed_bytes / photo_raw_bytes);
+    }
+    if (0 != asset_files) {
+	fprintf (out, "read %d asset files (%llu bytes) with %s, depth %d: "
+		 "first decode after %lld us, all in %lld us\n", asset_files,
+		 (unsigned long long)asset_bytes, 
+		 (asset_uring ? "io_uring" : "pread"), asset_depth,
+		 (long long)asset_first_usec, (long long)asset_total_usec);
+	if (asset_uring && 0 != asset_by_pread) {
+	    fprintf (out, "  %d of them fell back to pread\n", 
+		     asset_by_pread);
+	}
+    }
+    copy_report (out);
+    fflush (out);
+}
+
+
+/*
+ * stats_dump_cleanup
+ *   DESCRIPTION: Cleanup function that dumps the counters to stderr, so
+ *                that they appear on normal exit and on fatal signals.
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to stderr
+ */
+void
+stats_dump_cleanup (void* ignore)
+{
+    stats_dump (stderr);
+}
+
+
+/*
+ * request_dump
+ *   DESCRIPTION: SIGUSR1 handler; asks stats_tick to dump the counters
+ *                (stdio is not safe to use inside a signal handler).
+ *   INPUTS: sig -- signal number (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets dump_requested
+ */
+static void
+request_dump (int sig)
+{
+    dump_requested = 1;
+}
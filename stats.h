@@ -0,0 +1,98 @@
+/*									tab:8
+ *
+ * stats.h - header file for per-frame hot-path counters in the
+ *           adventure game
+ *
+ * Filename:	    stats.h
+ * History:
+ *	1	Added call counts and cycle timers for the drawing and
+ *		input paths, dumped on exit and on SIGUSR1.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+
+/* the timed functions (times include any functions they call) */
+typedef enum {
+    STAT_FILL_HORIZ,	/* fill_horiz_buffer */
+    STAT_FILL_VERT,	/* fill_vert_buffer  */
+    STAT_DRAW_HORIZ,	/* draw_horiz_line   */
+    STAT_DRAW_VERT,	/* draw_vert_line    */
+    STAT_FILL_HSTRIP,	/* fill_horiz_strip  */
+    STAT_FILL_VSTRIP,	/* fill_vert_strip   */
+    STAT_SET_VIEW,	/* set_view_window   */
+    STAT_SHOW_SCREEN,	/* show_screen       */
+    STAT_STATUS_BAR,	/* show_status_bar   */
+    STAT_PALETTE,	/* copypalletetoVGA  */
+    STAT_TYPING,	/* handle_typing     */
+    STAT_CAPTURE,	/* capture_view      */
+    STAT_ENTER_ROOM,	/* entering a room  */
+    STAT_LOAD_TILE,	/* load_tile         */
+    NUM_STATS
+} stat_id_t;
+
+/*
+ * Read the processor cycle counter.  Use as
+ *
+ *     uint64_t start = stat_cycles ();
+ *     ... timed work ...
+ *     stat_add (STAT_FOO, stat_cycles () - start);
+ */
+static inline uint64_t
+stat_cycles (void)
+{
+    uint32_t lo, hi;
+
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Count one call of a timed function that took the given cycles. */
+extern void stat_add (stat_id_t id, uint64_t cycles);
+
+/* Count bytes written to video memory by show_screen. */
+extern void stat_add_vram_bytes (int32_t bytes);
+
+/* Count bytes (per plane) copied within video memory by show_screen. */
+extern void stat_add_latch_bytes (int32_t bytes);
+
+/* Count a page flipped on retrace, usec after it was queued. */
+extern void stat_present (uint32_t usec);
+
+/* Count a queued page replaced before it was shown. */
+extern void stat_drop_frame ();
+
+/* Count a room entry, shown from a pre-rendered screen or redrawn. */
+extern void stat_room_entry (int32_t prerendered);
+
+/* Count a room photo of raw pixel bytes kept as packed compressed bytes. */
+extern void stat_photo_bytes (uint32_t raw, uint32_t packed);
+
+/* 
+ * Record a batch of asset file reads: the method (1 for io_uring), files
+ * that io_uring left to pread, most reads in flight, files and bytes 
+ * read, and the times from the first open to the first decode and to 
+ * the end of the batch.
+ */
+extern void stat_asset_reads (int32_t uring, int32_t by_pread, 
+			      int32_t depth, int32_t files,
+			      uint64_t bytes, int64_t first_usec, 
+			      int64_t total_usec);
+
+/* End a game loop tick; missed is the number of ticks skipped. */
+extern void stats_tick (int32_t missed);
+
+/* Install the SIGUSR1 handler that requests a dump. */
+extern void stats_init ();
+
+/* Write all counters with per-tick averages and maxima. */
+extern void stats_dump (FILE* out);
+
+/* Cleanup function (see assert.h) that dumps counters to stderr. */
+extern void stats_dump_cleanup (void* ignore);
+
+#endif /* STATS_H */
@@ -0,0 +1,326 @@
+/*									tab:8
+ *
+ * store.c - shared decoded-asset store (see store.h)
+ *
+ * Filename:	    store.c
+ * History:
+ *	1	Added a named shared memory segment that lets adventure
+ *		processes on one host share decoded photos and images.
+ */
+
+/*
+ * Segment layout: a store_hdr_t, then n_items store_ent_t index entries,
+ * then the exported assets (see photo_export and image_export), each
+ * starting on a STORE_ALIGN boundary.  The publisher sets the ready
+ * field last; a reader that finds it clear (publication in progress, or
+ * a publisher that died) ignores the segment and decodes for itself.
+ *
+ * Replacing a store unlinks the old segment first, so processes that
+ * already mapped it keep valid data until they exit.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "photo.h"
+#include "quant.h"
+#include "store.h"
+
+
+/* parameters defined for this file */
+#define STORE_MAGIC    "ADVASSET"	/* first bytes of the segment   */
+#define STORE_VERSION  3		/* bump when decoding changes   */
+#define STORE_FNAME_LEN 64		/* longest file name + 1        */
+#define STORE_ALIGN    64		/* alignment of asset data      */
+
+/* kinds of asset */
+enum {
+    STORE_PHOTO,
+    STORE_IMAGE
+};
+
+/* segment header */
+typedef struct store_hdr_t store_hdr_t;
+struct store_hdr_t {
+    char              magic[8];	/* STORE_MAGIC (not NUL-terminated) */
+    uint32_t          version;	/* STORE_VERSION                    */
+    uint32_t          n_items;	/* number of index entries          */
+    uint64_t          size;	/* segment size in bytes            */
+    volatile uint32_t ready;	/* set once segment is complete     */
+    uint32_t          quant;	/* quantizer of photos (quant.h)    */
+};
+
+/* one index entry */
+typedef struct store_ent_t store_ent_t;
+struct store_ent_t {
+    char     fname[STORE_FNAME_LEN];	/* asset file name              */
+    uint64_t offset;			/* start of data in segment     */
+    uint64_t len;			/* length of data in bytes      */
+    int64_t  mtime;			/* modification time of file    */
+    int64_t  fsize;			/* size of file in bytes        */
+    uint32_t kind;			/* STORE_PHOTO or STORE_IMAGE   */
+    uint32_t pad;
+};
+
+/* an opened store */
+struct store_t {
+    const uint8_t*     base;	/* read-only mapping of segment */
+    const store_hdr_t* hdr;	/* segment header               */
+    const store_ent_t* ent;	/* index table                  */
+};
+
+
+/* local functions--see function headers for details */
+static const void* find_item (store_t* st, const char* fname,
+			      uint32_t kind, size_t* len);
+
+
+/*
+ * store_attach
+ *   DESCRIPTION: Map a published store read-only.
+ *   INPUTS: name -- segment name (for shm_open)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the store, or NULL if no complete store of the current
+ *                 version (and quantizer) exists
+ *   SIDE EFFECTS: maps the segment for the rest of the process's life
+ */
+store_t*
+store_attach (const char* name)
+{
+    int                fd;	/* segment file descriptor */
+    struct stat        sb;	/* segment size            */
+    void*              map;	/* segment mapping         */
+    const store_hdr_t* hdr;	/* segment header          */
+    store_t*           st;	/* the store               */
+
+    if (-1 == (fd = shm_open (name, O_RDONLY, 0))) {
+	return NULL;
+    }
+    if (0 != fstat (fd, &sb) || sizeof (*hdr) > (size_t)sb.st_size ||
+	MAP_FAILED == (map = mmap (NULL, sb.st_size, PROT_READ, MAP_SHARED,
+				   fd, 0))) {
+	(void)close (fd);
+	return NULL;
+    }
+    (void)close (fd);
+
+    /* Check that the segment is complete and matches this build. */
+    hdr = map;
+    if (0 != memcmp (hdr->magic, STORE_MAGIC, sizeof (hdr->magic)) ||
+	STORE_VERSION != hdr->version || !hdr->ready ||
+	(uint32_t)quant_current () != hdr->quant ||
+	(uint64_t)sb.st_size != hdr->size ||
+	sizeof (*hdr) + hdr->n_items * sizeof (store_ent_t) > hdr->size ||
+	NULL == (st = malloc (sizeof (*st)))) {
+	(void)munmap (map, sb.st_size);
+	return NULL;
+    }
+    __sync_synchronize ();
+    st->base = map;
+    st->hdr = hdr;
+    st->ent = (const store_ent_t*)(hdr + 1);
+    return st;
+}
+
+
+/*
+ * find_item
+ *   DESCRIPTION: Find an asset in the store and check that the file it
+ *                was decoded from has not changed.
+ *   INPUTS: st -- the store
+ *           fname -- asset file name
+ *           kind -- STORE_PHOTO or STORE_IMAGE
+ *   OUTPUTS: len -- length of the asset's data
+ *   RETURN VALUE: pointer to the asset's data, or NULL if not found or
+ *                 out of date
+ *   SIDE EFFECTS: none
+ */
+static const void*
+find_item (store_t* st, const char* fname, uint32_t kind, size_t* len)
+{
+    const store_ent_t* e;	/* index entry */
+    struct stat        sb;	/* asset file  */
+    uint32_t           i;	/* entry index */
+
+    for (i = 0; st->hdr->n_items > i; i++) {
+	e = &st->ent[i];
+	if (kind != e->kind || 0 != strcmp (fname, e->fname)) {
+	    continue;
+	}
+	if (0 != stat (fname, &sb) || (int64_t)sb.st_mtime != e->mtime ||
+	    (int64_t)sb.st_size != e->fsize ||
+	    e->offset > st->hdr->size || e->len > st->hdr->size - e->offset) {
+	    return NULL;
+	}
+	*len = e->len;
+	return st->base + e->offset;
+    }
+    return NULL;
+}
+
+
+/*
+ * store_find_photo
+ *   DESCRIPTION: Get a room photo from the store.  The pixel data stay
+ *                in the shared segment.
+ *   INPUTS: st -- the store
+ *           fname -- photo file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the photo, or NULL if not available
+ *   SIDE EFFECTS: allocates memory for the photo structure
+ */
+photo_t*
+store_find_photo (store_t* st, const char* fname)
+{
+    const void* data;	/* exported photo */
+    size_t      len;	/* its length     */
+
+    if (NULL == (data = find_item (st, fname, STORE_PHOTO, &len))) {
+	return NULL;
+    }
+    return photo_import (data, len);
+}
+
+
+/*
+ * store_find_image
+ *   DESCRIPTION: Get an object image from the store.  The pixel data
+ *                stay in the shared segment.
+ *   INPUTS: st -- the store
+ *           fname -- image file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the image, or NULL if not available
+ *   SIDE EFFECTS: allocates memory for the image structure
+ */
+image_t*
+store_find_image (store_t* st, const char* fname)
+{
+    const void* data;	/* exported image */
+    size_t      len;	/* its length     */
+
+    if (NULL == (data = find_item (st, fname, STORE_IMAGE, &len))) {
+	return NULL;
+    }
+    return image_import (data, len);
+}
+
+
+/*
+ * store_publish
+ *   DESCRIPTION: Write decoded assets into a new shared memory segment
+ *                for other processes.  Items whose file names are too
+ *                long, whose files cannot be examined, or which repeat
+ *                an earlier file name are left out.
+ *   INPUTS: name -- segment name (for shm_open)
+ *           n_items -- number of assets
+ *           items -- the assets
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: replaces any segment with the same name; prints an
+ *                 error message to stderr on failure
+ */
+int32_t
+store_publish (const char* name, int32_t n_items, const store_item_t* items)
+{
+    store_ent_t* ent;	/* index table being built        */
+    struct stat  sb;	/* asset file                     */
+    uint64_t     size;	/* segment size                   */
+    uint32_t     n;	/* index entries used             */
+    int32_t      i;	/* index over items               */
+    uint32_t     j;	/* index over earlier entries     */
+    int          fd;	/* segment file descriptor        */
+    uint8_t*     map;	/* writable mapping of segment    */
+    store_hdr_t* hdr;	/* segment header                 */
+
+    /* Build the index table and lay out the segment. */
+    if (NULL == (ent = calloc (n_items, sizeof (*ent)))) {
+	fputs ("Out of memory for asset store index.\n", stderr);
+	return -1;
+    }
+    n = 0;
+    for (i = 0; n_items > i; i++) {
+	if (STORE_FNAME_LEN <= strlen (items[i].fname) ||
+	    0 != stat (items[i].fname, &sb)) {
+	    continue;
+	}
+	for (j = 0; n > j && 0 != strcmp (items[i].fname, ent[j].fname); j++);
+	if (n > j) {
+	    continue;
+	}
+	strcpy (ent[n].fname, items[i].fname);
+	ent[n].mtime = sb.st_mtime;
+	ent[n].fsize = sb.st_size;
+	if (NULL != items[i].photo) {
+	    ent[n].kind = STORE_PHOTO;
+	    ent[n].len = photo_export_size (items[i].photo);
+	} else {
+	    ent[n].kind = STORE_IMAGE;
+	    ent[n].len = image_export_size (items[i].img);
+	}
+	ent[n].pad = i;		/* remember the item until data are copied */
+	n++;
+    }
+    size = sizeof (*hdr) + n * sizeof (*ent);
+    for (j = 0; n > j; j++) {
+	size = (size + STORE_ALIGN - 1) & ~(uint64_t)(STORE_ALIGN - 1);
+	ent[j].offset = size;
+	size += ent[j].len;
+    }
+
+    /*
+     * Replace any old segment.  Readers that mapped it keep their copy;
+     * readers that open the new one before it is ready ignore it.
+     */
+    (void)shm_unlink (name);
+    if (-1 == (fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0644))) {
+	free (ent);
+	if (EEXIST == errno) {
+	    /* Another process is publishing at the same moment. */
+	    return 0;
+	}
+	perror ("asset store");
+	return -1;
+    }
+    if (0 != ftruncate (fd, size) ||
+	MAP_FAILED == (map = mmap (NULL, size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED, fd, 0))) {
+	perror ("asset store");
+	(void)shm_unlink (name);
+	(void)close (fd);
+	free (ent);
+	return -1;
+    }
+
+    /* Copy in the assets, then the index, then mark the segment ready. */
+    for (j = 0; n > j; j++) {
+	i = ent[j].pad;
+	ent[j].pad = 0;
+	if (STORE_PHOTO == ent[j].kind) {
+	    photo_export (items[i].photo, map + ent[j].offset);
+	} else {
+	    image_export (items[i].img, map + ent[j].offset);
+	}
+    }
+    hdr = (store_hdr_t*)map;
+    (void)memcpy (hdr + 1, ent, n * sizeof (*ent));
+    (void)memcpy (hdr->magic, STORE_MAGIC, sizeof (hdr->magic));
+    hdr->version = STORE_VERSION;
+    hdr->quant = quant_current ();
+    hdr->n_items = n;
+    hdr->size = size;
+    __sync_synchronize ();
+    hdr->ready = 1;
+
+    /* Later opens are read-only. */
+    (void)munmap (map, size);
+    (void)fchmod (fd, 0444);
+    (void)close (fd);
+    free (ent);
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*									tab:8
+ *
+ * store.h - header file for the shared decoded-asset store
+ *
+ * Filename:	    store.h
+ * History:
+ *	1	Added a named shared memory segment that lets adventure
+ *		processes on one host share decoded photos and images.
+ */
+
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+
+/*
+ * Decoding every room photo takes most of the game's startup time, and
+ * each process would otherwise hold its own copy of all of the pixel
+ * data.  With the store, the first process to load the world publishes
+ * the decoded photos and object images into a POSIX shared memory
+ * segment (shm_open), and later processes map that segment read-only
+ * and use the pixel data in place.  The segment holds an index table of
+ * asset file names, each with the size and modification time of the
+ * file it was decoded from; an asset whose file has changed is decoded
+ * again and the segment is replaced.  Remove the segment with
+ * "rm /dev/shm/adventure-assets" (on Linux) to force a fresh decode.
+ */
+
+/* default segment name (for shm_open) */
+#define STORE_NAME "/adventure-assets"
+
+/* an opened store */
+typedef struct store_t store_t;
+
+/* one asset to publish (exactly one of photo and img is non-NULL) */
+typedef struct store_item_t store_item_t;
+struct store_item_t {
+    const char*    fname;	/* file from which asset was decoded */
+    const photo_t* photo;	/* room photo, or NULL               */
+    const image_t* img;		/* object image, or NULL             */
+};
+
+/* Map a published store read-only.  Returns NULL if there is none. */
+extern store_t* store_attach (const char* name);
+
+/*
+ * Look up a room photo or object image by file name.  Returns NULL if
+ * the asset is not in the store or its file has changed since it was
+ * published.
+ */
+extern photo_t* store_find_photo (store_t* st, const char* fname);
+extern image_t* store_find_image (store_t* st, const char* fname);
+
+/*
+ * Publish decoded assets for other processes, replacing any store with
+ * the same name.  Returns 0 on success (or if another process published
+ * first), or -1 on failure.
+ */
+extern int32_t store_publish (const char* name, int32_t n_items,
+			      const store_item_t* items);
+
+#endif /* STORE_H */
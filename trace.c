@@ -0,0 +1,217 @@
+/*									tab:8
+ *
+ * trace.c - optional timeline trace recorder (see trace.h)
+ *
+ * Filename:	    trace.c
+ * History:
+ *	1	Added Chrome trace-event export of game loop phases,
+ *		room changes, photo loading, and lock waits.
+ */
+
+#include "trace.h"
+
+#if defined(USE_TRACE)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+/*
+ * Events per thread.  Each event is 16-24 bytes, and the game records
+ * a few hundred events per second, so this covers a long session.  Once
+ * a buffer fills, later events from that thread are counted and dropped.
+ */
+#define TRACE_BUF_EVENTS (1 << 18)
+
+/* one recorded event */
+typedef struct trace_rec_t trace_rec_t;
+struct trace_rec_t {
+    uint64_t    ns;	/* CLOCK_MONOTONIC time in nanoseconds */
+    const char* name;	/* span name (a string constant)        */
+    char        phase;	/* 'B' or 'E'                           */
+};
+
+/*
+ * One thread's events.  Only the owning thread writes to a buffer; the
+ * buffers are linked into all_bufs with compare-and-swap when a thread
+ * records its first event, and are read only by trace_write at exit.
+ */
+typedef struct trace_buf_t trace_buf_t;
+struct trace_buf_t {
+    trace_buf_t*          next;		/* next buffer in all_bufs      */
+    int32_t               tid;		/* small thread number          */
+    const char*           thread_name;	/* name given by TRACE_THREAD   */
+    volatile int32_t      n_recs;	/* events recorded              */
+    int32_t               dropped;	/* events lost to a full buffer */
+    trace_rec_t           rec[TRACE_BUF_EVENTS];
+};
+
+
+/* local functions--see function headers for details */
+static trace_buf_t* get_buf ();
+static void trace_write ();
+
+
+/* file-scope variables */
+static trace_buf_t* volatile all_bufs = NULL;	/* every thread's buffer */
+static __thread trace_buf_t* my_buf = NULL;	/* this thread's buffer  */
+static int32_t next_tid = 0;			/* last tid handed out   */
+static const char* out_fname = NULL;		/* file written at exit  */
+
+
+/*
+ * get_buf
+ *   DESCRIPTION: Get the calling thread's event buffer, creating and
+ *                publishing it on first use.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the buffer, or NULL if out of memory
+ *   SIDE EFFECTS: may allocate memory and link it into all_bufs
+ */
+static trace_buf_t*
+get_buf ()
+{
+    trace_buf_t* b;	/* new buffer */
+
+    if (NULL != my_buf) {
+	return my_buf;
+    }
+    if (NULL == (b = malloc (sizeof (*b)))) {
+	return NULL;
+    }
+    b->tid = __sync_add_and_fetch (&next_tid, 1);
+    b->thread_name = NULL;
+    b->n_recs = 0;
+    b->dropped = 0;
+    do {
+	b->next = all_bufs;
+    } while (!__sync_bool_compare_and_swap (&all_bufs, b->next, b));
+    my_buf = b;
+    return b;
+}
+
+
+/*
+ * trace_event
+ *   DESCRIPTION: Record the start or end of a span in the calling thread.
+ *   INPUTS: phase -- 'B' for begin or 'E' for end
+ *           name -- span name (must be a string constant)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: appends to the thread's buffer
+ */
+void
+trace_event (char phase, const char* name)
+{
+    trace_buf_t*    b;	/* this thread's buffer */
+    trace_rec_t*    r;	/* new record           */
+    struct timespec ts;	/* current time         */
+
+    if (NULL == (b = get_buf ())) {
+	return;
+    }
+    if (TRACE_BUF_EVENTS == b->n_recs) {
+	b->dropped++;
+	return;
+    }
+    (void)clock_gettime (CLOCK_MONOTONIC, &ts);
+    r = &b->rec[b->n_recs];
+    r->ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    r->name = name;
+    r->phase = phase;
+    __sync_synchronize ();
+    b->n_recs++;
+}
+
+
+/*
+ * trace_thread_name
+ *   DESCRIPTION: Name the calling thread in the trace.
+ *   INPUTS: name -- thread name (must be a string constant)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may create the thread's buffer
+ */
+void
+trace_thread_name (const char* name)
+{
+    trace_buf_t* b;	/* this thread's buffer */
+
+    if (NULL != (b = get_buf ())) {
+	b->thread_name = name;
+    }
+}
+
+
+/*
+ * trace_start
+ *   DESCRIPTION: Arrange for the trace to be written when the program
+ *                exits (by returning from main or calling exit).
+ *   INPUTS: fname -- output file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: registers an exit handler
+ */
+void
+trace_start (const char* fname)
+{
+    out_fname = fname;
+    (void)atexit (trace_write);
+}
+
+
+/*
+ * trace_write
+ *   DESCRIPTION: Write every thread's events as Chrome trace-event JSON.
+ *                Threads still running may add events meanwhile; only
+ *                those recorded before each buffer is read are written.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the trace file; prints a summary to stderr
+ */
+static void
+trace_write ()
+{
+    FILE*        out;	/* trace file                    */
+    trace_buf_t* b;	/* index over thread buffers     */
+    int32_t      n;	/* events in current buffer      */
+    int32_t      i;	/* index over events             */
+    int32_t      total;	/* events written                */
+    int32_t      lost;	/* events dropped                */
+    const char*  sep;	/* separator before next element */
+
+    if (NULL == (out = fopen (out_fname, "w"))) {
+	perror (out_fname);
+	return;
+    }
+    fputs ("{\"traceEvents\":[\n", out);
+    sep = "";
+    total = lost = 0;
+    for (b = all_bufs; NULL != b; b = b->next) {
+	if (NULL != b->thread_name) {
+	    fprintf (out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+		     "\"tid\":%d,\"args\":{\"name\":\"%s\"}}", sep, b->tid,
+		     b->thread_name);
+	    sep = ",\n";
+	}
+	n = b->n_recs;
+	__sync_synchronize ();
+	for (i = 0; n > i; i++) {
+	    fprintf (out, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,"
+		     "\"tid\":%d,\"ts\":%.3f}", sep, b->rec[i].name,
+		     b->rec[i].phase, b->tid, b->rec[i].ns / 1000.0);
+	    sep = ",\n";
+	}
+	total += n;
+	lost += b->dropped;
+    }
+    fputs ("\n]}\n", out);
+    (void)fclose (out);
+    fprintf (stderr, "trace: %d events written to %s (%d dropped)\n",
+	     total, out_fname, lost);
+}
+
+#endif /* USE_TRACE */
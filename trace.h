@@ -0,0 +1,54 @@
+/*									tab:8
+ *
+ * trace.h - header file for the optional timeline trace recorder
+ *
+ * Filename:	    trace.h
+ * History:
+ *	1	Added Chrome trace-event export of game loop phases,
+ *		room changes, photo loading, and lock waits.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * The recorder is compiled in only when USE_TRACE is defined ("make
+ * TRACE=1").  Otherwise every macro below expands to nothing and
+ * trace.c is empty.
+ *
+ * Each thread records begin/end events into its own buffer without
+ * locking.  At exit, all buffers are written to the file named by
+ * TRACE_START in Chrome trace-event JSON, which can be loaded with
+ * chrome://tracing or Perfetto.  Names must be string constants (only
+ * the pointer is stored).
+ *
+ *     TRACE_BEGIN ("show_screen");
+ *     show_screen ();
+ *     TRACE_END ("show_screen");
+ */
+#if defined(USE_TRACE)
+
+/* Record the start ('B') or end ('E') of a span in the calling thread. */
+extern void trace_event (char phase, const char* name);
+
+/* Name the calling thread in the trace. */
+extern void trace_thread_name (const char* name);
+
+/* Write the trace to fname when the program exits. */
+extern void trace_start (const char* fname);
+
+#define TRACE_BEGIN(name)	trace_event ('B', (name))
+#define TRACE_END(name)		trace_event ('E', (name))
+#define TRACE_THREAD(name)	trace_thread_name (name)
+#define TRACE_START(fname)	trace_start (fname)
+
+#else /* !defined(USE_TRACE) */
+
+#define TRACE_BEGIN(name)	do { } while (0)
+#define TRACE_END(name)		do { } while (0)
+#define TRACE_THREAD(name)	do { } while (0)
+#define TRACE_START(fname)	do { } while (0)
+
+#endif /* USE_TRACE */
+
+#endif /* TRACE_H */
@@ -41,5 +41,7 @@ typedef struct image_t image_t;
 /* types defined in world.h */
 typedef struct room_t room_t;
 typedef struct object_t object_t;
+typedef struct world_t world_t;
+typedef struct session_t session_t;
 
 #endif /* TYPES_H */
@@ -34,11 +34,16 @@
  */
  
 
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/stat.h>
 
 #include "assert.h"
+#include "ioq.h"
+#include "pack.h"
 #include "photo.h"
+#include "store.h"
 #include "world.h"
 
 
@@ -184,6 +189,7 @@ struct room_t {
     room_t*     left;   	/* room to the "left"             */
     room_t*     enter;  	/* doors, etc.                    */
     room_t*     right;  	/* room to the "right"            */
+    uint32_t    version;	/* changes when room's look does  */
 };
 
 /*
@@ -199,6 +205,38 @@ struct object_t {
     image_t*     img;     	/* image for use in room          */
 };
 
+/*
+ * The decoded photos and object images shared by all sessions.  A world
+ * is filled in once by load_world and never written afterwards, so any
+ * number of sessions (on any threads) can draw from it without locking.
+ */
+struct world_t {
+    photo_t* view[N_ROOMS];	/* starting photo for each room  */
+    photo_t* swap[N_SWAPS];	/* alternate photos for swapping */
+    image_t* img[N_OBJECTS];	/* image for each object         */
+};
+
+/*
+ * The state of one game: the rooms and objects (with their positions
+ * and connections), the player's accomplishments, and the photos that
+ * are currently swapped out of rooms.  Rooms hold their own pointers to
+ * the shared photos, so do_photo_swap only exchanges pointers within
+ * the session; the photos themselves are never modified.
+ *
+ * Flags are coded as bit vectors using an array of 32-bit words.  It's 
+ * overkill for this game, but it's nice not to worry about the number of 
+ * flags...
+ */
+struct session_t {
+    const world_t* world;			     /* shared images        */
+    room_t         room[N_ROOMS];		     /* rooms                */
+    object_t       object[N_OBJECTS];		     /* objects              */
+    uint32_t       player_flags[(NUM_FLAGS + 31) / 32]; /* accomplishments */
+    photo_t*       swap_photo[N_SWAPS];		     /* swapping photos      */
+    unsigned int   seed;			     /* rand_r state         */
+    void           (*status) (const char* s);	     /* status bar output    */
+};
+
 /*
  * This local structure is used to specify room connectivity and data 
  * in a reasonably manageable way.  The array entries in the database
@@ -421,49 +459,61 @@ static const swap_data_t swap_data[N_SWAPS] = {
     {SWAP_CAR, "images/caropen.photo"}		/* open/closed car photos */
 };
 
+/*
+ * An asset still to be decoded when loading the world: its file name and
+ * where to put the result (exactly one of photo and img is not NULL).
+ */
+typedef struct asset_load_t asset_load_t;
+struct asset_load_t {
+    const char* fname;	/* file name of asset              */
+    photo_t**   photo;	/* destination for a room photo    */
+    image_t**   img;	/* destination for an object image */
+};
+#define N_ASSETS (N_ROOMS + N_OBJECTS + N_SWAPS)
+
 
 /* functions local to this file--see function headers for details */
-static void do_photo_swap (room_t* r, int32_t which);
+static void do_photo_swap (session_t* s, room_t* r, int32_t which);
 static object_t* find_in_room (const room_t* r, const char* arg);
 static void insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y);
-static void insert_object (object_t* o, room_t* r);
-static void move_object_to_inventory (object_t* obj);
-static object_t* obj_special_get (room_t* r, const char* arg);
-static int32_t player_flag_is_set (int32_t fnum);
-static void player_set_flag (int32_t fnum);
+static void insert_object (session_t* s, object_t* o, room_t* r);
+static void move_object_to_inventory (session_t* s, object_t* obj);
+static object_t* obj_special_get (session_t* s, room_t* r, const char* arg);
+static int32_t player_flag_is_set (const session_t* s, int32_t fnum);
+static void player_set_flag (session_t* s, int32_t fnum);
 static void remove_object (object_t* o);
-
-
-/* file-scope variables */
-/* 
- * Flags are coded as bit vectors using an array of 32-bit words.  It's 
- * overkill for this game, but it's nice not to worry about the number of 
- * flags...
- */
-static room_t   room[N_ROOMS];			     /* rooms                */
-static object_t object[N_OBJECTS];		     /* objects              */
-static uint32_t player_flags[(NUM_FLAGS + 31) / 32]; /* accomplishment flags */
-static photo_t* swap_photo[N_SWAPS];                 /* swapping photos      */
+static void status_ignore (const char* s);
+static int32_t publish_world (const char* store_name, const world_t* w);
+static const void* find_packed (const pack_t* pk, const char* fname,
+				size_t* len, int64_t* mtime);
+static void queue_asset (asset_load_t* ld, const char* fname, 
+			 photo_t** photo, image_t** img);
+static int32_t decode_asset (const asset_load_t* ld, const void* data, 
+			     size_t len, int64_t mtime);
+static int32_t read_done (void* arg, int32_t idx, const void* data, 
+			  size_t len, int64_t mtime);
 
 
 /* 
  * do_photo_swap
  *   DESCRIPTION: Swap a room photo with another stored image.
- *   INPUTS: r -- the room into which the photo is swapped
+ *   INPUTS: s -- game session
+ *           r -- the room into which the photo is swapped
  *	     which -- index into array of stored photos
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
 static void
-do_photo_swap (room_t* r, int32_t which)
+do_photo_swap (session_t* s, room_t* r, int32_t which)
 {
     photo_t* tmp;	/* temporary variable to help with swap */
 
     /* Swap the photos. */
-    tmp               = r->view;
-    r->view           = swap_photo[which];
-    swap_photo[which] = tmp;
+    tmp                  = r->view;
+    r->view              = s->swap_photo[which];
+    s->swap_photo[which] = tmp;
+    r->version++;
 }
 
 
@@ -507,7 +557,8 @@ find_in_room (const room_t* r, const char* arg)
  *           y -- the y position for the object
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: takes the object out of its current location
+ *   SIDE EFFECTS: takes the object out of its current location; patches
+ *                 the background cache (see room_changed)
  */
 static void 
 insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y)
@@ -523,13 +574,16 @@ insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y)
     o->loc = r;
     o->next = r->contents;
     r->contents = o;
+    r->version++;
+    room_changed (r, x, y, image_width (o->img), image_height (o->img));
 }
 
 
 /* 
  * insert_object
  *   DESCRIPTION: Insert object at a random position within a room.
- *   INPUTS: o -- the object being placed
+ *   INPUTS: s -- game session (supplies the random number state)
+ *           o -- the object being placed
  *           r -- the room
  *   OUTPUTS: none
  *   RETURN VALUE: none
@@ -538,7 +592,7 @@ insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y)
  *                 randomly
  */
 static void 
-insert_object (object_t* o, room_t* r)
+insert_object (session_t* s, object_t* o, room_t* r)
 {
     int32_t space;	/* room photo height in pixels            */
     int32_t range;	/* number of pixels in placement interval */
@@ -549,7 +603,7 @@ insert_object (object_t* o, room_t* r)
 
     /* Choose a random x location. */
     range = photo_width (r->view) - image_width (o->img);
-    xpos = (0 >= range ? 0 : (rand () % range));
+    xpos = (0 >= range ? 0 : (rand_r (&s->seed) % range));
 
     /* Place in the lowest quarter of the roo photo if the object fits... */
     space = photo_height (r->view);
@@ -558,9 +612,9 @@ insert_object (object_t* o, room_t* r)
     if (0 >= range) {
 	/* Doesn't fit: try not to let the object fall off the bottom. */
         range = space - img_ht;
-	ypos = (0 >= range ? 0 : (rand () % range));
+	ypos = (0 >= range ? 0 : (rand_r (&s->seed) % range));
     } else {
-	ypos = (0 >= range ? 0 : (rand () % range) + (3 * space) / 4);
+	ypos = (0 >= range ? 0 : (rand_r (&s->seed) % range) + (3 * space) / 4);
     }
 
     /* Now put the object into the room at the chosen location. */
@@ -573,13 +627,14 @@ insert_object (object_t* o, room_t* r)
  *   DESCRIPTION: Move an object into the player's inventory.  Try to 
  *                place objects on a 3x3 grid for clarity, but place
  *                randomly if necessary.
- *   INPUTS: obj -- the object
+ *   INPUTS: s -- game session
+ *           obj -- the object
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: takes the object out of its current location
  */
 static void
-move_object_to_inventory (object_t* obj)
+move_object_to_inventory (session_t* s, object_t* obj)
 {
     object_t* conf;	/* loop index over possible conflicts for a space */
     int32_t   x;	/* loop index for 3x3 grid x positions            */
@@ -591,21 +646,21 @@ move_object_to_inventory (object_t* obj)
      */
     for (y = 10; 160 >= y; y += 50) {
         for (x = 10; 210 >= x; x += 100) {
-	    for (conf = room[R_INVENTORY].contents; NULL != conf; 
+	    for (conf = s->room[R_INVENTORY].contents; NULL != conf; 
 	    	 conf = conf->next) {
 	        if (x == conf->x && y == conf->y) {
 		    break;
 		}
 	    }
 	    if (NULL == conf) {
-		insert_object_at (obj, &room[R_INVENTORY], x, y);
+		insert_object_at (obj, &s->room[R_INVENTORY], x, y);
 		return;
 	    }
 	}
     }
 
     /* Give up: place randomly in bottom quarter like a room. */
-    insert_object (obj, &room[R_INVENTORY]);
+    insert_object (s, obj, &s->room[R_INVENTORY]);
 }
 
 
@@ -614,35 +669,36 @@ move_object_to_inventory (object_t* obj)
  *   DESCRIPTION: Handle special effects "get" commands, in which a player
  *                gets an object that is not represented as an object_t in
  *                the room's contents.
- *   INPUTS: r -- the room in which the "get" is performed
+ *   INPUTS: s -- game session
+ *           r -- the room in which the "get" is performed
  *           arg -- the name of the object sought
  *   OUTPUTS: none
  *   RETURN VALUE: an object to be gotten by the player, or NULL for nothing
  *   SIDE EFFECTS: may move objects or show status messages
  */
 static object_t*
-obj_special_get (room_t* r, const char* arg)
+obj_special_get (session_t* s, room_t* r, const char* arg)
 {
     /* Get a book from the Grainger reference desk... */
-    if (&room[R_RESERVE] == r && 0 == strcasecmp ("book", arg)) {
+    if (&s->room[R_RESERVE] == r && 0 == strcasecmp ("book", arg)) {
 	/* can only get it once... */
-	if (player_flag_is_set (FLAG_HAS_EATEN)) {
-	    if (NULL == object[O_BOOK_C].loc) {
-		show_status ("You check out the C book.");
-		return &object[O_BOOK_C];
+	if (player_flag_is_set (s, FLAG_HAS_EATEN)) {
+	    if (NULL == s->object[O_BOOK_C].loc) {
+		s->status ("You check out the C book.");
+		return &s->object[O_BOOK_C];
 	    }
 	} else {
-	    if (NULL == object[O_BOOK_WODE].loc) {
-		show_status ("Here's a nice Wodehouse collection.");
-		return &object[O_BOOK_WODE];
+	    if (NULL == s->object[O_BOOK_WODE].loc) {
+		s->status ("Here's a nice Wodehouse collection.");
+		return &s->object[O_BOOK_WODE];
 	    }
 	}
     }
 
     /* Pick up the car battery... */
-    if (&room[R_CAR_SITE] == r && object[O_BATT_CAR].loc == r) {
-        remove_object (&object[O_BATT_CAR]);
-	return &object[O_BATT_EMPTY];
+    if (&s->room[R_CAR_SITE] == r && s->object[O_BATT_CAR].loc == r) {
+        remove_object (&s->object[O_BATT_CAR]);
+	return &s->object[O_BATT_EMPTY];
     }
 
     /* That's all, folks! */
@@ -653,15 +709,16 @@ obj_special_get (room_t* r, const char* arg)
 /* 
  * player_flag_is_set
  *   DESCRIPTION: Checks whether the player has accomplished a specified task.
- *   INPUTS: fnum -- the accomplishment identifier (a FLAG_*)
+ *   INPUTS: s -- game session
+ *           fnum -- the accomplishment identifier (a FLAG_*)
  *   OUTPUTS: none
  *   RETURN VALUE: 1 if the player has accomplished the task, 0 if not
  *   SIDE EFFECTS: none
  */
 static int32_t
-player_flag_is_set (int32_t fnum)
+player_flag_is_set (const session_t* s, int32_t fnum)
 {
-    return (0 != (player_flags[fnum / 32] & (1UL << (fnum % 32))));
+    return (0 != (s->player_flags[fnum / 32] & (1UL << (fnum % 32))));
 }
 
 
@@ -669,15 +726,16 @@ player_flag_is_set (int32_t fnum)
  * player_set_flag
  *   DESCRIPTION: Sets the flag indicating that the player has accomplished 
  *                a specified task.
- *   INPUTS: fnum -- the accomplishment identifier (a FLAG_*)
+ *   INPUTS: s -- game session
+ *           fnum -- the accomplishment identifier (a FLAG_*)
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
 static void
-player_set_flag (int32_t fnum)
+player_set_flag (session_t* s, int32_t fnum)
 {
-    player_flags[fnum / 32] |= (1UL << (fnum % 32));
+    s->player_flags[fnum / 32] |= (1UL << (fnum % 32));
 }
 
 
@@ -688,7 +746,7 @@ player_set_flag (int32_t fnum)
  *   INPUTS: o -- the object
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: patches the background cache (see room_changed)
  */
 static void
 remove_object (object_t* o)
@@ -708,6 +766,9 @@ remove_object (object_t* o)
 	}
 
 	/* Mark the object's location as NULL. */
+	o->loc->version++;
+	room_changed (o->loc, o->x, o->y, image_width (o->img), 
+		      image_height (o->img));
 	o->loc = NULL;
     }
 }
@@ -821,6 +882,45 @@ room_photo (const room_t* r)
 }
 
 
+/* 
+ * room_exit
+ *   DESCRIPTION: Get the room reached through one of a room's exits
+ *                (without any special conditions for entering).
+ *   INPUTS: r -- pointer to the room
+ *           which -- EXIT_LEFT, EXIT_ENTER, or EXIT_RIGHT
+ *   OUTPUTS: none
+ *   RETURN VALUE: the room through that exit, or NULL if none
+ *   SIDE EFFECTS: none
+ */
+room_t*
+room_exit (const room_t* r, int32_t which)
+{
+    switch (which) {
+        case EXIT_LEFT:  return r->left;
+        case EXIT_ENTER: return r->enter;
+        case EXIT_RIGHT: return r->right;
+    }
+    return NULL;
+}
+
+
+/* 
+ * room_version
+ *   DESCRIPTION: Get a room's version number, which changes whenever the
+ *                room's photo or contents change, so that a copy of the
+ *                drawn room can be checked for staleness.
+ *   INPUTS: r -- pointer to the room
+ *   OUTPUTS: none
+ *   RETURN VALUE: room r's version number
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+room_version (const room_t* r)
+{
+    return r->version;
+}
+
+
 /* 
  * room_photo_height
  *   DESCRIPTION: Get height of room photo in pixels for a room.
@@ -852,26 +952,227 @@ room_photo_width (const room_t* r)
 
 
 /* 
- * build_world
- *   DESCRIPTION: Builds and connects the rooms, creates objects, and 
- *                reads in all image data (could be done lazily with 
- *                caching instead).
- *   INPUTS: none
+ * status_ignore
+ *   DESCRIPTION: Status output for sessions created without a status
+ *                bar; discards the message.
+ *   INPUTS: s -- the message (ignored)
  *   OUTPUTS: none
- *   RETURN VALUE: 1 on success, or 0 on failure
- *   SIDE EFFECTS: prints error messages to stderr on failure
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
  */
-int32_t
-build_world ()
+static void
+status_ignore (const char* s)
+{
+}
+
+
+/* 
+ * publish_world
+ *   DESCRIPTION: Publish a world's photos and images in the shared asset
+ *                store.
+ *   INPUTS: store_name -- name of the store
+ *           w -- the world
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: replaces the shared memory segment for the store
+ */
+static int32_t
+publish_world (const char* store_name, const world_t* w)
+{
+    store_item_t item[N_ROOMS + N_OBJECTS + N_SWAPS]; /* assets to publish */
+    int32_t      n;				      /* items filled in   */
+    int32_t      idx;				      /* index over data   */
+
+    n = 0;
+    for (idx = 0; N_ROOMS > idx; idx++, n++) {
+	item[n].fname = room_data[idx].filename;
+	item[n].photo = w->view[room_data[idx].id];
+	item[n].img = NULL;
+    }
+    for (idx = 0; N_OBJECTS > idx; idx++, n++) {
+	item[n].fname = obj_data[idx].filename;
+	item[n].photo = NULL;
+	item[n].img = w->img[obj_data[idx].id];
+    }
+    for (idx = 0; N_SWAPS > idx; idx++, n++) {
+	item[n].fname = swap_data[idx].filename;
+	item[n].photo = w->swap[swap_data[idx].id];
+	item[n].img = NULL;
+    }
+    return store_publish (store_name, n, item);
+}
+
+
+/* 
+ * find_packed
+ *   DESCRIPTION: Find a file in the asset pack, unless its loose copy 
+ *                was modified after the pack was built, in which case 
+ *                the loose file should be read instead of the stale 
+ *                packed copy.
+ *   INPUTS: pk -- asset pack, or NULL for none
+ *           fname -- file name
+ *   OUTPUTS: len -- size of the packed file
+ *            mtime -- modification time of the packed file
+ *   RETURN VALUE: contents of the packed file, or NULL if the file 
+ *                 should be read from disk
+ *   SIDE EFFECTS: warns about a loose file newer than the pack
+ */
+static const void*
+find_packed (const pack_t* pk, const char* fname, size_t* len, 
+	     int64_t* mtime)
+{
+    const void* data;	 /* contents of packed file */
+    struct stat file_st; /* status of loose file    */
+
+    if (NULL == pk || NULL == (data = pack_find (pk, fname, len, mtime))) {
+	return NULL;
+    }
+    if (0 == stat (fname, &file_st) && *mtime < file_st.st_mtime) {
+	fprintf (stderr, "%s is newer than the asset pack; reading it "
+		 "instead (rebuild the pack).\n", fname);
+	return NULL;
+    }
+    return data;
+}
+
+
+/* 
+ * queue_asset
+ *   DESCRIPTION: Fill in an asset to be decoded when loading the world.
+ *   INPUTS: fname -- file name of asset
+ *           photo -- destination for a room photo, or NULL
+ *           img -- destination for an object image, or NULL
+ *   OUTPUTS: ld -- the asset
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+queue_asset (asset_load_t* ld, const char* fname, photo_t** photo, 
+	     image_t** img)
+{
+    ld->fname = fname;
+    ld->photo = photo;
+    ld->img = img;
+}
+
+
+/* 
+ * decode_asset
+ *   DESCRIPTION: Decode a room photo or object image from the contents
+ *                of its file, or read the file itself if no contents 
+ *                are given.
+ *   INPUTS: ld -- the asset
+ *           data -- contents of the asset's file, or NULL to read it
+ *           len -- bytes at data
+ *           mtime -- modification time of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the asset; prints an
+ *                 error message to stderr on failure
+ */
+static int32_t
+decode_asset (const asset_load_t* ld, const void* data, size_t len, 
+	      int64_t mtime)
 {
-    int32_t idx;	/* index over data arrays   */
-    int32_t which;	/* id for current data item */
+    if (NULL != ld->photo) {
+	*ld->photo = (NULL == data ? read_photo (ld->fname) :
+		      read_photo_view (ld->fname, data, len, mtime));
+	if (NULL == *ld->photo) {
+	    fprintf (stderr, "Can't read room photo %s.\n", ld->fname);
+	    return -1;
+	}
+    } else {
+	*ld->img = (NULL == data ? read_obj_image (ld->fname) :
+		    read_obj_image_view (data, len));
+	if (NULL == *ld->img) {
+	    fprintf (stderr, "Can't read object photo %s.\n", ld->fname);
+	    return -1;
+	}
+    }
+    return 0;
+}
+
 
-    /* Clear all accomplishment flags. */
-    (void)memset (player_flags, 0, sizeof (player_flags));
+/* 
+ * read_done
+ *   DESCRIPTION: Decode an asset whose file has been read (callback for
+ *                ioq_read_files).
+ *   INPUTS: arg -- array of assets being read
+ *           idx -- index of the asset
+ *           data -- contents of the asset's file, or NULL if not read
+ *           len -- bytes at data
+ *           mtime -- modification time of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: see decode_asset
+ */
+static int32_t
+read_done (void* arg, int32_t idx, const void* data, size_t len, 
+	   int64_t mtime)
+{
+    return decode_asset ((const asset_load_t*)arg + idx, data, len, mtime);
+}
 
-    /* Clear room data to enable sanity check for duplication. */
-    (void)memset (room, 0, sizeof (room));
+
+/* 
+ * load_world
+ *   DESCRIPTION: Checks the room, object, and swap data, and reads in all 
+ *                room photos and object images (could be done lazily with 
+ *                caching instead).  The result is shared by every session
+ *                built from it and must not be modified.  Reading photos
+ *                is not thread-safe, so call this before starting sessions
+ *                on other threads.
+ *
+ *                Given a store name, assets are taken from the shared 
+ *                asset store (see store.h) when possible.  If any asset 
+ *                had to be decoded, the store is then (re)published so 
+ *                that later processes can skip decoding.
+ *
+ *                Given a pack name, assets to be decoded are read from
+ *                the asset pack (see pack.h), which is unmapped again 
+ *                before returning.  Any not in the pack are read from
+ *                their own files in one batch (see ioq.h), each decoded
+ *                as soon as it arrives while later reads are in flight.
+ *   INPUTS: store_name -- shared asset store to use, or NULL for none
+ *           pack_name -- asset pack to use, or NULL for none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the loaded world, or NULL on failure
+ *   SIDE EFFECTS: prints error messages to stderr on failure
+ */
+const world_t*
+load_world (const char* store_name, const char* pack_name)
+{
+    world_t*     w;                   /* the new world                 */
+    store_t*     st;                  /* shared asset store, if any    */
+    pack_t*      pk;                  /* asset pack, if any            */
+    asset_load_t ld[N_ASSETS];        /* assets to decode              */
+    const char*  fname[N_ASSETS];     /* files of assets to read       */
+    uint8_t      room_seen[N_ROOMS];  /* 1 once a room id is used      */
+    uint8_t      obj_seen[N_OBJECTS]; /* ...an object id               */
+    uint8_t      swap_seen[N_SWAPS];  /* ...a swap photo id            */
+    const void*  data;                /* contents of packed file       */
+    size_t       len;                 /* size of packed file           */
+    int64_t      mtime;               /* time of packed file           */
+    int32_t      misses;              /* assets not found in the store */
+    int32_t      n_files;             /* assets to read from files     */
+    int32_t      idx;                 /* index over data arrays        */
+    int32_t      which;               /* id for current data item      */
+
+    /* Clear the world. */
+    if (NULL == (w = calloc (1, sizeof (*w)))) {
+	fputs ("Out of memory for world.\n", stderr);
+	return NULL;
+    }
+    st = (NULL == store_name ? NULL : store_attach (store_name));
+    pk = NULL;
+    if (NULL != pack_name && NULL == (pk = pack_open (pack_name))) {
+	fprintf (stderr, "Can't open asset pack %s; reading loose files.\n",
+		 pack_name);
+    }
+    misses = 0;
+    memset (room_seen, 0, sizeof (room_seen));
+    memset (obj_seen, 0, sizeof (obj_seen));
+    memset (swap_seen, 0, sizeof (swap_seen));
 
     /* Loop over room data. */
     for (idx = 0; N_ROOMS > idx; idx++) {
@@ -882,33 +1183,23 @@ build_world ()
 	/* Check for bad and duplicate ids. */
 	if (0 > which || N_ROOMS <= which) {
 	    fputs ("Bad index in room data.\n", stderr);
-	    return 0;
+	    goto fail;
 	}
-	if (NULL != room[which].name) {
+	if (room_seen[which]) {
 	    fprintf (stderr, "Duplicate index %d in room data.\n", which);
-	    return 0;
+	    goto fail;
 	}
-
-	/* Set up the room. */
-        room[which].name = room_data[idx].name;
-	room[which].view = read_photo (room_data[idx].filename);
-	if (NULL == room[which].view) {
-	    fprintf (stderr, "Can't read room photo %s.\n", 
-	    	     room_data[idx].filename);
-	    return 0;
+	room_seen[which] = 1;
+
+	/* Get the room photo from the store or queue it to be decoded. */
+	if (NULL == st ||
+	    NULL == (w->view[which] = 
+		     store_find_photo (st, room_data[idx].filename))) {
+	    queue_asset (&ld[misses++], room_data[idx].filename, 
+	    		 &w->view[which], NULL);
 	}
-	room[which].contents = NULL;
-	room[which].left  = (R_NONE == room_data[idx].left ? NULL : 
-			     &room[room_data[idx].left]);
-	room[which].enter = (R_NONE == room_data[idx].enter ? NULL : 
-			     &room[room_data[idx].enter]);
-	room[which].right = (R_NONE == room_data[idx].right ? NULL : 
-			     &room[room_data[idx].right]);
     }
 
-    /* Clear object data to enable sanity check for duplication. */
-    (void)memset (object, 0, sizeof (object));
-
     /* Loop over object data. */
     for (idx = 0; N_OBJECTS > idx; idx++) {
 
@@ -918,40 +1209,23 @@ build_world ()
 	/* Check for bad and duplicate ids. */
 	if (0 > which || N_OBJECTS <= which) {
 	    fputs ("Bad index in object data.\n", stderr);
-	    return 0;
+	    goto fail;
 	}
-	if (NULL != object[which].name) {
+	if (obj_seen[which]) {
 	    fprintf (stderr, "Duplicate index %d in object data.\n", which);
-	    return 0;
-	}
-
-	/* Set up the object. */
-        object[which].name = obj_data[idx].name;
-	object[which].img = read_obj_image (obj_data[idx].filename);
-	if (NULL == object[which].img) {
-	    fprintf (stderr, "Can't read object photo %s.\n", 
-	    	     obj_data[idx].filename);
-	    return 0;
+	    goto fail;
 	}
-        object[which].next = NULL;
-        object[which].loc = NULL;
-        object[which].x = 0;
-        object[which].y = 0;
-
-	/* Insert it into a room if necessary. */
-	if (R_NONE != obj_data[idx].room) {
-	    if (-1 != obj_data[idx].x) {
-	        insert_object_at (&object[which], &room[obj_data[idx].room],
-				  obj_data[idx].x, obj_data[idx].y);
-	    } else {
-	        insert_object (&object[which], &room[obj_data[idx].room]);
-	    }
+	obj_seen[which] = 1;
+
+	/* Get the object image from the store or queue it to be decoded. */
+	if (NULL == st ||
+	    NULL == (w->img[which] = 
+		     store_find_image (st, obj_data[idx].filename))) {
+	    queue_asset (&ld[misses++], obj_data[idx].filename, NULL,
+	    		 &w->img[which]);
 	}
     }
 
-    /* Clear swap photo data to enable sanity check for duplication. */
-    (void)memset (swap_photo, 0, sizeof (swap_photo));
-
     /* Loop over swap photo data. */
     for (idx = 0; N_SWAPS > idx; idx++) {
 
@@ -961,24 +1235,157 @@ build_world ()
 	/* Check for bad and duplicate ids. */
 	if (0 > which || N_SWAPS <= which) {
 	    fputs ("Bad index in swap data.\n", stderr);
-	    return 0;
+	    goto fail;
 	}
-	if (NULL != swap_photo[which]) {
+	if (swap_seen[which]) {
 	    fprintf (stderr, "Duplicate index %d in swap data.\n", which);
-	    return 0;
+	    goto fail;
+	}
+	swap_seen[which] = 1;
+
+	/* Get the swap photo from the store or queue it to be decoded. */
+	if (NULL == st ||
+	    NULL == (w->swap[which] = 
+		     store_find_photo (st, swap_data[idx].filename))) {
+	    queue_asset (&ld[misses++], swap_data[idx].filename, 
+	    		 &w->swap[which], NULL);
 	}
+    }
+
+    /* 
+     * Decode the queued assets found in the pack, and move the rest to 
+     * the front of the queue to be read from their own files.
+     */
+    n_files = 0;
+    for (idx = 0; misses > idx; idx++) {
+	if (NULL != (data = find_packed (pk, ld[idx].fname, &len, &mtime))) {
+	    if (0 != decode_asset (&ld[idx], data, len, mtime)) {
+		goto fail;
+	    }
+	} else {
+	    ld[n_files] = ld[idx];
+	    fname[n_files++] = ld[idx].fname;
+	}
+    }
 
-	/* Read in the swap photo. */
-	swap_photo[which] = read_photo (swap_data[idx].filename);
-	if (NULL == swap_photo[which]) {
-	    fprintf (stderr, "Can't read room photo %s.\n", 
-	    	     swap_data[idx].filename);
-	    return 0;
+    /* Read the loose files, decoding each as it arrives. */
+    if (0 != ioq_read_files (n_files, fname, IOQ_DEPTH, read_done, ld)) {
+	goto fail;
+    }
+
+    /* Decoded assets do not refer to the pack. */
+    pack_close (pk);
+
+    /* Share the decoded assets with later processes (failure is harmless). */
+    if (NULL != store_name && 0 != misses) {
+	(void)publish_world (store_name, w);
+    }
+
+    /* Everything worked! */
+    return w;
+
+fail:
+    /* Photos already read are not reclaimed (there is no way to free one). */
+    pack_close (pk);
+    free (w);
+    return NULL;
+}
+
+
+/* 
+ * build_world
+ *   DESCRIPTION: Builds and connects the rooms and creates objects for a 
+ *                new game session, using the photos and images in a loaded
+ *                world.  Sessions are independent of one another: each has 
+ *                its own rooms, objects, flags, swapped photos, and random 
+ *                number state (seeded from rand), and may run on its own 
+ *                thread.
+ *   INPUTS: w -- world returned by load_world
+ *           status_fn -- function used to show status messages for the
+ *                        session, or NULL to discard them
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the new session, or NULL on failure
+ *   SIDE EFFECTS: allocates memory; prints an error message on failure
+ */
+session_t*
+build_world (const world_t* w, void (*status_fn) (const char* s))
+{
+    session_t* s;	/* the new session          */
+    int32_t    idx;	/* index over data arrays   */
+    int32_t    which;	/* id for current data item */
+
+    /* Clear all accomplishment flags and room and object data. */
+    if (NULL == (s = calloc (1, sizeof (*s)))) {
+	fputs ("Out of memory for game session.\n", stderr);
+	return NULL;
+    }
+    s->world = w;
+    s->seed = rand ();
+    s->status = (NULL == status_fn ? status_ignore : status_fn);
+
+    /* Loop over room data (ids were checked by load_world). */
+    for (idx = 0; N_ROOMS > idx; idx++) {
+	which = room_data[idx].id;
+
+	/* Set up the room. */
+        s->room[which].name = room_data[idx].name;
+	s->room[which].view = w->view[which];
+	s->room[which].contents = NULL;
+	s->room[which].left  = (R_NONE == room_data[idx].left ? NULL : 
+			        &s->room[room_data[idx].left]);
+	s->room[which].enter = (R_NONE == room_data[idx].enter ? NULL : 
+			        &s->room[room_data[idx].enter]);
+	s->room[which].right = (R_NONE == room_data[idx].right ? NULL : 
+			        &s->room[room_data[idx].right]);
+    }
+
+    /* Loop over object data. */
+    for (idx = 0; N_OBJECTS > idx; idx++) {
+	which = obj_data[idx].id;
+
+	/* Set up the object. */
+        s->object[which].name = obj_data[idx].name;
+	s->object[which].img = w->img[which];
+        s->object[which].next = NULL;
+        s->object[which].loc = NULL;
+        s->object[which].x = 0;
+        s->object[which].y = 0;
+
+	/* Insert it into a room if necessary. */
+	if (R_NONE != obj_data[idx].room) {
+	    if (-1 != obj_data[idx].x) {
+	        insert_object_at (&s->object[which], 
+				  &s->room[obj_data[idx].room],
+				  obj_data[idx].x, obj_data[idx].y);
+	    } else {
+	        insert_object (s, &s->object[which], 
+			       &s->room[obj_data[idx].room]);
+	    }
 	}
     }
 
+    /* All swap photos start out swapped out. */
+    (void)memcpy (s->swap_photo, w->swap, sizeof (s->swap_photo));
+
     /* Everything worked! */
-    return 1;
+    return s;
+}
+
+
+/* 
+ * free_session
+ *   DESCRIPTION: Discard a game session.  The world it was built from is
+ *                not affected.
+ *   INPUTS: s -- the session (may be NULL)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees memory; room pointers from the session become
+ *                 invalid
+ */
+void
+free_session (session_t* s)
+{
+    free (s);
 }
 
 
@@ -986,58 +1393,59 @@ build_world ()
  * start_in_room
  *   DESCRIPTION: Get a pointer to the room in which the player begins 
  *                the game.
- *   INPUTS: none
+ *   INPUTS: s -- game session
  *   OUTPUTS: none
  *   RETURN VALUE: pointer to the starting room
  *   SIDE EFFECTS: none
  */
 room_t*
-start_in_room ()
+start_in_room (session_t* s)
 {
-    return &room[R_EAST_EVRT];
+    return &s->room[R_EAST_EVRT];
 }
 
 
 /* 
  * player_has_board
  *   DESCRIPTION: Check whether the player has the board in inventory.
- *   INPUTS: none
+ *   INPUTS: s -- game session
  *   OUTPUTS: none
  *   RETURN VALUE: 1 if the board is in inventory, 0 if not
  *   SIDE EFFECTS: none
  */
 int32_t
-player_has_board ()
+player_has_board (const session_t* s)
 {
-    return (&room[R_INVENTORY] == object[0].loc);
+    return (&s->room[R_INVENTORY] == s->object[0].loc);
 }
 
 
 /* 
  * player_has_jetpack
  *   DESCRIPTION: Check whether the player has the jetpack in inventory.
- *   INPUTS: none
+ *   INPUTS: s -- game session
  *   OUTPUTS: none
  *   RETURN VALUE: 1 if the jetpack is in inventory, 0 if not
  *   SIDE EFFECTS: none
  */
 int32_t
-player_has_jetpack ()
+player_has_jetpack (const session_t* s)
 {
-    return (&room[R_INVENTORY] == object[1].loc);
+    return (&s->room[R_INVENTORY] == s->object[1].loc);
 }
 
 
 /* 
  * try_to_move_left
  *   DESCRIPTION: Try to move to the room to the 'left'.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-try_to_move_left (room_t** rptr)
+try_to_move_left (session_t* s, room_t** rptr)
 {
     room_t* r;	/* current room */
 
@@ -1049,18 +1457,18 @@ try_to_move_left (room_t** rptr)
         *rptr = r->left;
 
 	/* When entering the Boneyard Circle, choose picture randomly. */
-	if (&room[R_CIRCLE_N] == *rptr && 0 == (rand () % 2)) {
-	    do_photo_swap (*rptr, SWAP_CIRCLE);
+	if (&s->room[R_CIRCLE_N] == *rptr && 0 == (rand_r (&s->seed) % 2)) {
+	    do_photo_swap (s, *rptr, SWAP_CIRCLE);
 	}
 	return TC_CHANGE_ROOM;
     }
 
-    if (&room[0] == r) {
+    if (&s->room[0] == r) {
 	/* Give a hint as to how to get out of inventory. */
-        show_status ("Push 'home' or type 'inventory'.");
+        s->status ("Push 'home' or type 'inventory'.");
     } else {
 	/* Let the player know that the move failed. */
-	show_status ("You can't go that way.");
+	s->status ("You can't go that way.");
     }
     return TC_ALLOW_EDIT;
 }
@@ -1069,13 +1477,14 @@ try_to_move_left (room_t** rptr)
 /* 
  * try_to_enter
  *   DESCRIPTION: Try to 'enter' a room from the current room.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-try_to_enter (room_t** rptr)
+try_to_enter (session_t* s, room_t** rptr)
 {
     room_t* r;	/* current room */
 
@@ -1087,8 +1496,8 @@ try_to_enter (room_t** rptr)
         *rptr = r->enter;
 
 	/* When entering the Boneyard Circle, choose picture randomly. */
-	if (&room[R_CIRCLE_N] == *rptr && 0 == (rand () % 2)) {
-	    do_photo_swap (*rptr, SWAP_CIRCLE);
+	if (&s->room[R_CIRCLE_N] == *rptr && 0 == (rand_r (&s->seed) % 2)) {
+	    do_photo_swap (s, *rptr, SWAP_CIRCLE);
 	}
 	return TC_CHANGE_ROOM;
     }
@@ -1098,46 +1507,46 @@ try_to_enter (room_t** rptr)
      * conditions are met, and give hints when the conditions are 
      * not met. 
      */
-    if (&room[R_BY_CLEANR] == r) {
-	if (player_flag_is_set (FLAG_WEARING_SUIT)) {
-	    *rptr = &room[R_IN_CLEANR];
+    if (&s->room[R_BY_CLEANR] == r) {
+	if (player_flag_is_set (s, FLAG_WEARING_SUIT)) {
+	    *rptr = &s->room[R_IN_CLEANR];
 	    return TC_CHANGE_ROOM;
 	}
-	show_status ("You're not wearing a bunnysuit!");
+	s->status ("You're not wearing a bunnysuit!");
 	return TC_ALLOW_EDIT;
     }
-    if (&room[R_BY_395LAB] == r) {
-	if (object[O_ICARD].loc == &room[R_INVENTORY]) {
-	    show_status ("You swiped your Icard.");
-	    *rptr = &room[R_IN_395LAB];
+    if (&s->room[R_BY_395LAB] == r) {
+	if (s->object[O_ICARD].loc == &s->room[R_INVENTORY]) {
+	    s->status ("You swiped your Icard.");
+	    *rptr = &s->room[R_IN_395LAB];
 	    return TC_CHANGE_ROOM;
 	}
-	show_status ("You need a valid Icard.");
+	s->status ("You need a valid Icard.");
 	return TC_ALLOW_EDIT;
     }
-    if (&room[R_CSL_DOOR] == r) {
-	if (object[O_ICARD].loc == &room[R_INVENTORY]) {
-	    show_status ("You swiped your Icard.");
-	    *rptr = &room[R_CSL_LOBBY];
+    if (&s->room[R_CSL_DOOR] == r) {
+	if (s->object[O_ICARD].loc == &s->room[R_INVENTORY]) {
+	    s->status ("You swiped your Icard.");
+	    *rptr = &s->room[R_CSL_LOBBY];
 	    return TC_CHANGE_ROOM;
 	}
-	show_status ("You need a valid Icard.");
+	s->status ("You need a valid Icard.");
 	return TC_ALLOW_EDIT;
     }
-    if (&room[R_BECK_DOOR] == r) {
-	if (object[O_ROBOT_LIVE].loc == &room[R_INVENTORY]) {
-	    show_status ("The robot hand picked the lock!");
-	    *rptr = &room[R_BECKLOBBY];
+    if (&s->room[R_BECK_DOOR] == r) {
+	if (s->object[O_ROBOT_LIVE].loc == &s->room[R_INVENTORY]) {
+	    s->status ("The robot hand picked the lock!");
+	    *rptr = &s->room[R_BECKLOBBY];
 	    return TC_CHANGE_ROOM;
 	}
-	if (object[O_ROBOT_DEAD].loc == &room[R_INVENTORY]) {
-	    show_status ("Flash the robot's code again.");
+	if (s->object[O_ROBOT_DEAD].loc == &s->room[R_INVENTORY]) {
+	    s->status ("Flash the robot's code again.");
 	    return TC_ALLOW_EDIT;
 	}
-	show_status ("Complex lock!  Find a nanotech robot.");
+	s->status ("Complex lock!  Find a nanotech robot.");
 	return TC_ALLOW_EDIT;
     }
-    if (&room[R_MNTL_LAB1] == r) {
+    if (&s->room[R_MNTL_LAB1] == r) {
         /* Get advice from Kevin. */
 	static const char* const advice[8] = {
 	    "Kevin says, \"Andres' board is FAST!\"",
@@ -1149,16 +1558,16 @@ try_to_enter (room_t** rptr)
 	    "Kevin asks, \"Maybe you need a Dew?\"",
 	    "Kevin: \"A magnet can charge a battery.\""
 	};
-	show_status (advice[(rand () % 8)]);
+	s->status (advice[(rand_r (&s->seed) % 8)]);
 	return TC_ALLOW_EDIT;
     }
-    if (&room[R_COCKPIT] == r) {
-        show_status ("A MIMO transmitter card is missing!");
+    if (&s->room[R_COCKPIT] == r) {
+        s->status ("A MIMO transmitter card is missing!");
 	return TC_ALLOW_EDIT;
     }
 
     /* Let the player know that the move failed. */
-    show_status ("You can't go that way.");
+    s->status ("You can't go that way.");
     return TC_ALLOW_EDIT;
 }
 
@@ -1166,13 +1575,14 @@ try_to_enter (room_t** rptr)
 /* 
  * try_to_move_right
  *   DESCRIPTION: Try to move to the room to the 'right'.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-try_to_move_right (room_t** rptr)
+try_to_move_right (session_t* s, room_t** rptr)
 {
     room_t* r;	/* current room */
 
@@ -1184,18 +1594,18 @@ try_to_move_right (room_t** rptr)
         *rptr = r->right;
 
 	/* When entering the Boneyard Circle, choose picture randomly. */
-	if (&room[R_CIRCLE_N] == *rptr && 0 == (rand () % 2)) {
-	    do_photo_swap (*rptr, SWAP_CIRCLE);
+	if (&s->room[R_CIRCLE_N] == *rptr && 0 == (rand_r (&s->seed) % 2)) {
+	    do_photo_swap (s, *rptr, SWAP_CIRCLE);
 	}
 	return TC_CHANGE_ROOM;
     }
 
-    if (&room[0] == r) {
+    if (&s->room[0] == r) {
 	/* Give a hint as to how to get out of inventory. */
-        show_status ("Push 'home' or type 'inventory'.");
+        s->status ("Push 'home' or type 'inventory'.");
     } else {
 	/* Let the player know that the move failed. */
-	show_status ("You can't go that way.");
+	s->status ("You can't go that way.");
     }
     return TC_ALLOW_EDIT;
 }
@@ -1206,14 +1616,15 @@ try_to_move_right (room_t** rptr)
  *   DESCRIPTION: Execute the typed command "buy," which allows the player
  *                to simulate purchase of objects (sometimes obtaining an
  *                a real object, sometimes an accomplishment flag).
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- name of object to buy
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_buy (room_t** rptr, const char* arg)
+typed_cmd_buy (session_t* s, room_t** rptr, const char* arg)
 {
     room_t* r;	/* current room */
 
@@ -1222,39 +1633,39 @@ typed_cmd_buy (room_t** rptr, const char* arg)
 
     /* Buy a Dew! */
     if (0 == strcasecmp ("dew", arg)) {
-        if (&room[R_EVRT_VEND] != r) {
-	    show_status ("Great idea!  But ... where?");
+        if (&s->room[R_EVRT_VEND] != r) {
+	    s->status ("Great idea!  But ... where?");
 	    return TC_DISCARD_TEXT;
 	} 
-	if (object[O_MTN_DEW].loc == &room[R_INVENTORY] ||
-	    object[O_MTN_DEW].loc == r) {
-	    show_status ("Slow down!  One at a time...");
+	if (s->object[O_MTN_DEW].loc == &s->room[R_INVENTORY] ||
+	    s->object[O_MTN_DEW].loc == r) {
+	    s->status ("Slow down!  One at a time...");
 	    return TC_DISCARD_TEXT;
 	} 
-	if (NULL != object[O_MTN_DEW].loc) {
-	    show_status ("Last one get stolen?  Ok...here we go...");
+	if (NULL != s->object[O_MTN_DEW].loc) {
+	    s->status ("Last one get stolen?  Ok...here we go...");
 	} else {
-	    show_status ("You buy a Dew.");
+	    s->status ("You buy a Dew.");
 	}
-	move_object_to_inventory (&object[O_MTN_DEW]);
+	move_object_to_inventory (s, &s->object[O_MTN_DEW]);
 	return TC_REDRAW_ROOM;
     }
 
     /* Buy some yogurt. */
     if (0 == strcasecmp ("yogurt", arg)) {
-        if (&room[R_IN_COCOMR] != r) {
-	    show_status ("Cocomero doesn't deliver here.");
-	} else if (player_flag_is_set (FLAG_HAS_EATEN)) {
-	    show_status ("You're not hungry.");
+        if (&s->room[R_IN_COCOMR] != r) {
+	    s->status ("Cocomero doesn't deliver here.");
+	} else if (player_flag_is_set (s, FLAG_HAS_EATEN)) {
+	    s->status ("You're not hungry.");
 	} else {
-	    player_set_flag (FLAG_HAS_EATEN);
-	    show_status ("So tasty and delicious!");
+	    player_set_flag (s, FLAG_HAS_EATEN);
+	    s->status ("So tasty and delicious!");
 	}
 	return TC_DISCARD_TEXT;
     }
 
     /* The player got too imaginative. */
-    show_status ("Sorry, purchasing options are limited.");
+    s->status ("Sorry, purchasing options are limited.");
     return TC_ALLOW_EDIT;
 }
 
@@ -1262,14 +1673,15 @@ typed_cmd_buy (room_t** rptr, const char* arg)
 /* 
  * typed_cmd_charge
  *   DESCRIPTION: Execute the typed command "charge".
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- name of object to charge
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_charge (room_t** rptr, const char* arg)
+typed_cmd_charge (session_t* s, room_t** rptr, const char* arg)
 {
     room_t* r;	/* current room */
 
@@ -1278,28 +1690,28 @@ typed_cmd_charge (room_t** rptr, const char* arg)
 
     /* Only the battery can be charged. */
     if (0 != strcasecmp ("battery", arg)) {
-        show_status ("Electronic devices aren't (always) toys!");
+        s->status ("Electronic devices aren't (always) toys!");
 	return TC_ALLOW_EDIT;
     }
-    if (object[O_BATT_EMPTY].loc != &room[R_INVENTORY] &&
-	object[O_BATT_EMPTY].loc != r &&
-	object[O_BATT_FULL].loc != &room[R_INVENTORY] &&
-	object[O_BATT_FULL].loc != r) {
-	show_status ("What battery?");
+    if (s->object[O_BATT_EMPTY].loc != &s->room[R_INVENTORY] &&
+	s->object[O_BATT_EMPTY].loc != r &&
+	s->object[O_BATT_FULL].loc != &s->room[R_INVENTORY] &&
+	s->object[O_BATT_FULL].loc != r) {
+	s->status ("What battery?");
 	return TC_DISCARD_TEXT;
     }
-    if (&room[R_BECK_MRI] != r) {
-	show_status ("Find a bigger magnet.");
+    if (&s->room[R_BECK_MRI] != r) {
+	s->status ("Find a bigger magnet.");
 	return TC_DISCARD_TEXT;
     }
-    if (object[O_BATT_FULL].loc == &room[R_INVENTORY] ||
-	object[O_BATT_FULL].loc == r) {
-	show_status ("Don't overdo it.");
+    if (s->object[O_BATT_FULL].loc == &s->room[R_INVENTORY] ||
+	s->object[O_BATT_FULL].loc == r) {
+	s->status ("Don't overdo it.");
 	return TC_DISCARD_TEXT;
     }
-    remove_object (&object[O_BATT_EMPTY]);
-    move_object_to_inventory (&object[O_BATT_FULL]);
-    show_status ("Wow!  That's a strong magnet!");
+    remove_object (&s->object[O_BATT_EMPTY]);
+    move_object_to_inventory (s, &s->object[O_BATT_FULL]);
+    s->status ("Wow!  That's a strong magnet!");
     return TC_REDRAW_ROOM;
 }
 
@@ -1307,39 +1719,40 @@ typed_cmd_charge (room_t** rptr, const char* arg)
  * typed_cmd_do
  *   DESCRIPTION: Execute the typed command "do," which allows the player
  *                to do certain things...like their 391 MP2!
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- name of object to do
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_do (room_t** rptr, const char* arg)
+typed_cmd_do (session_t* s, room_t** rptr, const char* arg)
 {
     room_t* r;	/* current room */
 
     /* Set current room. */
     r = *rptr;
 
-    if (&room[R_IN_391LAB] != r) {
-        show_status ("You can't 'do' anything here.");
+    if (&s->room[R_IN_391LAB] != r) {
+        s->status ("You can't 'do' anything here.");
 	return TC_ALLOW_EDIT;
     }
     if (0 != strcasecmp ("391", arg) &&
 	0 != strcasecmp ("mp2", arg)) {
-        show_status ("Doing the 391 MP2 is more important!");
+        s->status ("Doing the 391 MP2 is more important!");
 	return TC_ALLOW_EDIT;
     }
-    if (object[O_BOOK_C].loc != &room[R_INVENTORY]) {
-        show_status ("You'd better get a book from Grainger.");
+    if (s->object[O_BOOK_C].loc != &s->room[R_INVENTORY]) {
+        s->status ("You'd better get a book from Grainger.");
 	return TC_DISCARD_TEXT;
     }
-    if (object[O_MP2].loc != &room[R_INVENTORY]) {
-        show_status ("Web's down.  Bring your own MP2.");
+    if (s->object[O_MP2].loc != &s->room[R_INVENTORY]) {
+        s->status ("Web's down.  Bring your own MP2.");
 	return TC_DISCARD_TEXT;
     }
-    if (object[O_TUX].loc != &room[R_IN_391LAB]) {
-        show_status ("You'd have better luck if Tux were here.");
+    if (s->object[O_TUX].loc != &s->room[R_IN_391LAB]) {
+        s->status ("You'd have better luck if Tux were here.");
 	return TC_DISCARD_TEXT;
     }
 
@@ -1353,14 +1766,15 @@ typed_cmd_do (room_t** rptr, const char* arg)
  * typed_cmd_drink
  *   DESCRIPTION: Execute the typed command "drink," which allows the player
  *                to drink objects.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- name of object to drink
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_drink (room_t** rptr, const char* arg)
+typed_cmd_drink (session_t* s, room_t** rptr, const char* arg)
 {
     room_t* r;	/* current room */
 
@@ -1369,16 +1783,16 @@ typed_cmd_drink (room_t** rptr, const char* arg)
 
     /* All you can drink is Dew... */
     if (0 != strcasecmp ("dew", arg)) {
-        show_status ("That sounds less refreshing than Dew.");
+        s->status ("That sounds less refreshing than Dew.");
 	return TC_ALLOW_EDIT;
     }
-    if (object[O_MTN_DEW].loc != &room[R_INVENTORY] &&
-        object[O_MTN_DEW].loc != r) {
-        show_status ("Uh-oh.  Hadewcinations.  Buy one soon!");
+    if (s->object[O_MTN_DEW].loc != &s->room[R_INVENTORY] &&
+        s->object[O_MTN_DEW].loc != r) {
+        s->status ("Uh-oh.  Hadewcinations.  Buy one soon!");
 	return TC_DISCARD_TEXT;
     }
-    remove_object (&object[O_MTN_DEW]);
-    show_status ("Ahhhhhhhhhhhhhhhh...........nother?");
+    remove_object (&s->object[O_MTN_DEW]);
+    s->status ("Ahhhhhhhhhhhhhhhh...........nother?");
     /* NOT a bug.  Sorry, Dew doesn't count as a food. */
     return TC_REDRAW_ROOM;
 }
@@ -1389,14 +1803,15 @@ typed_cmd_drink (room_t** rptr, const char* arg)
  *   DESCRIPTION: Execute the typed command "drop," which allows the player
  *                to drop objects from their inventory into the room in
  *                which they're standing.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- name of object to drop
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_drop (room_t** rptr, const char* arg)
+typed_cmd_drop (session_t* s, room_t** rptr, const char* arg)
 {
     room_t*   r;	/* current room                        */
     object_t* obj;      /* object being dropped                */
@@ -1406,11 +1821,11 @@ typed_cmd_drop (room_t** rptr, const char* arg)
     r = *rptr;
 
     /* Search for object to drop--it must be in the player's inventory. */
-    obj = find_in_room (&room[R_INVENTORY], arg);
+    obj = find_in_room (&s->room[R_INVENTORY], arg);
 
     /* No luck--say so. */
     if (NULL == obj) {
-	show_status ("You have no such thing.");
+	s->status ("You have no such thing.");
         return TC_ALLOW_EDIT;
     }
     
@@ -1418,17 +1833,17 @@ typed_cmd_drop (room_t** rptr, const char* arg)
      * Issue a warning to player if they seem to be trying to make use
      * of certain objects (as a hint).
      */
-    if ((&object[O_BATT_FULL] == obj && &room[R_CAR_SITE] == r) ||
-	(&object[O_MIMO_CARD] == obj && &room[R_REM_PLANE] == r)) {
-        show_status ("You may want to install it instead.");
+    if ((&s->object[O_BATT_FULL] == obj && &s->room[R_CAR_SITE] == r) ||
+	(&s->object[O_MIMO_CARD] == obj && &s->room[R_REM_PLANE] == r)) {
+        s->status ("You may want to install it instead.");
     }
 
     /* 
      * If player is looking at inventory, object goes into the room in 
      * which they're standing.
      */
-    dest = (&room[R_INVENTORY] == r ? room[R_INVENTORY].enter : r);
-    insert_object (obj, dest);
+    dest = (&s->room[R_INVENTORY] == r ? s->room[R_INVENTORY].enter : r);
+    insert_object (s, obj, dest);
     return TC_REDRAW_ROOM;
 }
 
@@ -1437,14 +1852,15 @@ typed_cmd_drop (room_t** rptr, const char* arg)
  * typed_cmd_fix
  *   DESCRIPTION: Execute the typed command "fix," which allows the player
  *                to fix objects.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- name of object to fix
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_fix (room_t** rptr, const char* arg)
+typed_cmd_fix (session_t* s, room_t** rptr, const char* arg)
 {
     room_t* r;	/* current room */
 
@@ -1453,32 +1869,32 @@ typed_cmd_fix (room_t** rptr, const char* arg)
 
     /* Only the GPS can be fixed. */
     if (0 != strcasecmp ("gps", arg)) {
-        show_status ("In the game, you're not as capable.");
+        s->status ("In the game, you're not as capable.");
 	return TC_ALLOW_EDIT;
     }
-    if (object[O_GPS_GOOD].loc == &room[R_INVENTORY] ||
-        object[O_GPS_GOOD].loc == r) {
-        show_status ("It's working fine.");
+    if (s->object[O_GPS_GOOD].loc == &s->room[R_INVENTORY] ||
+        s->object[O_GPS_GOOD].loc == r) {
+        s->status ("It's working fine.");
 	return TC_DISCARD_TEXT;
     }
-    if (object[O_GPS_BAD].loc != &room[R_INVENTORY] &&
-        object[O_GPS_BAD].loc != r) {
-        show_status ("Do you have a GPS?");
+    if (s->object[O_GPS_BAD].loc != &s->room[R_INVENTORY] &&
+        s->object[O_GPS_BAD].loc != r) {
+        s->status ("Do you have a GPS?");
 	return TC_DISCARD_TEXT;
     }
-    if (&room[R_IN_CLEANR] != r) {
-        show_status ("You'd better go to the cleanroom.");
+    if (&s->room[R_IN_CLEANR] != r) {
+        s->status ("You'd better go to the cleanroom.");
 	return TC_DISCARD_TEXT;
     }
-    if (object[O_GPS_SPEC].loc != &room[R_INVENTORY] &&
-        object[O_GPS_SPEC].loc != r) {
-        show_status ("Maybe you'd better get a spec?");
+    if (s->object[O_GPS_SPEC].loc != &s->room[R_INVENTORY] &&
+        s->object[O_GPS_SPEC].loc != r) {
+        s->status ("Maybe you'd better get a spec?");
 	return TC_DISCARD_TEXT;
     }
-    remove_object (&object[O_GPS_BAD]);
-    remove_object (&object[O_GPS_SPEC]);
-    move_object_to_inventory (&object[O_GPS_GOOD]);
-    show_status ("All done--wow, you're good!");
+    remove_object (&s->object[O_GPS_BAD]);
+    remove_object (&s->object[O_GPS_SPEC]);
+    move_object_to_inventory (s, &s->object[O_GPS_GOOD]);
+    s->status ("All done--wow, you're good!");
     return TC_CHANGE_ROOM;
 }
 
@@ -1487,14 +1903,15 @@ typed_cmd_fix (room_t** rptr, const char* arg)
  * typed_cmd_flash
  *   DESCRIPTION: Execute the typed command "flash," which allows the player
  *                to flash objects with code and so forth.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- name of object to flash
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_flash (room_t** rptr, const char* arg)
+typed_cmd_flash (session_t* s, room_t** rptr, const char* arg)
 {
     room_t* r;	/* current room */
 
@@ -1503,28 +1920,28 @@ typed_cmd_flash (room_t** rptr, const char* arg)
 
     /* Only the robot can be flashed. */
     if (0 != strcasecmp ("robot", arg)) {
-        show_status ("Don't waste your time.");
+        s->status ("Don't waste your time.");
 	return TC_ALLOW_EDIT;
     }
-    if (object[O_ROBOT_DEAD].loc != &room[R_INVENTORY] &&
-        object[O_ROBOT_DEAD].loc != r &&
-	object[O_ROBOT_LIVE].loc != &room[R_INVENTORY] &&
-        object[O_ROBOT_LIVE].loc != r) {
-        show_status ("Maybe get the robot first?");
+    if (s->object[O_ROBOT_DEAD].loc != &s->room[R_INVENTORY] &&
+        s->object[O_ROBOT_DEAD].loc != r &&
+	s->object[O_ROBOT_LIVE].loc != &s->room[R_INVENTORY] &&
+        s->object[O_ROBOT_LIVE].loc != r) {
+        s->status ("Maybe get the robot first?");
 	return TC_DISCARD_TEXT;
     }
-    if (&room[R_IN_395LAB] != r) {
-        show_status ("With spit and a lemon?  Try the lab.");
+    if (&s->room[R_IN_395LAB] != r) {
+        s->status ("With spit and a lemon?  Try the lab.");
 	return TC_DISCARD_TEXT;
     }
-    if (object[O_ROBOT_LIVE].loc == &room[R_INVENTORY] ||
-        object[O_ROBOT_LIVE].loc == r) {
-        show_status ("You flash the robot's ROM again.");
+    if (s->object[O_ROBOT_LIVE].loc == &s->room[R_INVENTORY] ||
+        s->object[O_ROBOT_LIVE].loc == r) {
+        s->status ("You flash the robot's ROM again.");
 	return TC_DISCARD_TEXT;
     }
-    remove_object (&object[O_ROBOT_DEAD]);
-    move_object_to_inventory (&object[O_ROBOT_LIVE]);
-    show_status ("You flash it with a lockpicking code.");
+    remove_object (&s->object[O_ROBOT_DEAD]);
+    move_object_to_inventory (s, &s->object[O_ROBOT_LIVE]);
+    s->status ("You flash it with a lockpicking code.");
     return TC_REDRAW_ROOM;
 }
 
@@ -1533,14 +1950,15 @@ typed_cmd_flash (room_t** rptr, const char* arg)
  * typed_cmd_get
  *   DESCRIPTION: Execute the typed command "get," which allows the player
  *                to move objects in a room into their inventory.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- name of object to get
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_get (room_t** rptr, const char* arg)
+typed_cmd_get (session_t* s, room_t** rptr, const char* arg)
 {
     room_t*   r;	/* current room                  */
     room_t*   src;	/* source room for object search */
@@ -1553,25 +1971,25 @@ typed_cmd_get (room_t** rptr, const char* arg)
      * If player is looking at inventory, source room for object search 
      * is the room in which they're standing.
      */
-    src = (&room[R_INVENTORY] == r ? room[R_INVENTORY].enter : r);
+    src = (&s->room[R_INVENTORY] == r ? s->room[R_INVENTORY].enter : r);
 
     /* Try a special effect search followed by a normal search. */
-    if (NULL == (obj = obj_special_get (src, arg))) {
+    if (NULL == (obj = obj_special_get (s, src, arg))) {
 	obj = find_in_room (src, arg);
     } 
     if (NULL == obj) {
-	show_status ("You see no such thing here.");
+	s->status ("You see no such thing here.");
         return TC_ALLOW_EDIT;
     }
 
     /* The player can't grab Tux! */
-    if (&object[O_TUX] == obj && !player_flag_is_set (FLAG_LURED_TUX)) {
-        show_status ("Tux must choose you!  Try using a fish.");
+    if (&s->object[O_TUX] == obj && !player_flag_is_set (s, FLAG_LURED_TUX)) {
+        s->status ("Tux must choose you!  Try using a fish.");
 	return TC_DISCARD_TEXT;
     }
 
     /* Move the object into the player's inventory. */
-    move_object_to_inventory (obj);
+    move_object_to_inventory (s, obj);
     return TC_REDRAW_ROOM;
 }
 
@@ -1580,14 +1998,15 @@ typed_cmd_get (room_t** rptr, const char* arg)
  * typed_cmd_go
  *   DESCRIPTION: Execute the typed command "go," which allows the player
  *                to go from one place to another using room features.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- name of location to which to go
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_go (room_t** rptr, const char* arg)
+typed_cmd_go (session_t* s, room_t** rptr, const char* arg)
 {
     room_t* r;	/* current room */
 
@@ -1596,76 +2015,76 @@ typed_cmd_go (room_t** rptr, const char* arg)
 
     /* Try to go to Allerton Mansion. */
     if (0 == strcasecmp ("allerton", arg)) {
-        if (&room[R_ALLERTON] == r) {
-	    show_status ("Kazam!  You're at Allerton!");
+        if (&s->room[R_ALLERTON] == r) {
+	    s->status ("Kazam!  You're at Allerton!");
 	    return TC_DISCARD_TEXT;
 	}
-        if (&room[R_WILLARD] != r && &room[R_CAR_SITE] != r) {
-	    show_status ("That's quite a hike.");
+        if (&s->room[R_WILLARD] != r && &s->room[R_CAR_SITE] != r) {
+	    s->status ("That's quite a hike.");
 	    return TC_DISCARD_TEXT;
 	}
-	if (!player_flag_is_set (FLAG_CAR_FIXED)) {
-	    if (player_flag_is_set (FLAG_CAR_OPEN)) {
-		show_status ("The car isn't working.");
+	if (!player_flag_is_set (s, FLAG_CAR_FIXED)) {
+	    if (player_flag_is_set (s, FLAG_CAR_OPEN)) {
+		s->status ("The car isn't working.");
 	    } else {
-		show_status ("Do you want to use that car?");
+		s->status ("Do you want to use that car?");
 	    }
 	    return TC_DISCARD_TEXT;
 	}
-	if (object[O_GPS_GOOD].loc != &room[R_INVENTORY]) {
-	    if (object[O_GPS_BAD].loc == &room[R_INVENTORY]) {
-	        show_status ("That's a long road with a broken GPS.");
+	if (s->object[O_GPS_GOOD].loc != &s->room[R_INVENTORY]) {
+	    if (s->object[O_GPS_BAD].loc == &s->room[R_INVENTORY]) {
+	        s->status ("That's a long road with a broken GPS.");
 	    } else {
-	        show_status ("You'll need a GPS to find that place.");
+	        s->status ("You'll need a GPS to find that place.");
 	    }
 	    return TC_DISCARD_TEXT;
 	}
-	show_status ("You drive to Allerton Park.");
-	*rptr = &room[R_ALLERTON];
+	s->status ("You drive to Allerton Park.");
+	*rptr = &s->room[R_ALLERTON];
 	return TC_CHANGE_ROOM;
     }
 
     /* Try to go to Willard Airport. */
     if (0 == strcasecmp ("willard", arg) ||
 	0 == strcasecmp ("airport", arg)) {
-        if (&room[R_WILLARD] == r) {
-	    show_status ("Kazap!  You're at Willard!");
+        if (&s->room[R_WILLARD] == r) {
+	    s->status ("Kazap!  You're at Willard!");
 	    return TC_DISCARD_TEXT;
 	}
-        if (&room[R_ALLERTON] != r && &room[R_CAR_SITE] != r) {
-	    show_status ("That's quite a hike.");
+        if (&s->room[R_ALLERTON] != r && &s->room[R_CAR_SITE] != r) {
+	    s->status ("That's quite a hike.");
 	    return TC_DISCARD_TEXT;
 	}
-	if (!player_flag_is_set (FLAG_CAR_FIXED)) {
-	    if (player_flag_is_set (FLAG_CAR_OPEN)) {
-		show_status ("The car isn't working.");
+	if (!player_flag_is_set (s, FLAG_CAR_FIXED)) {
+	    if (player_flag_is_set (s, FLAG_CAR_OPEN)) {
+		s->status ("The car isn't working.");
 	    } else {
-		show_status ("Do you want to use that car?");
+		s->status ("Do you want to use that car?");
 	    }
 	    return TC_DISCARD_TEXT;
 	}
-	show_status ("You drive to Willard Airport.");
-	*rptr = &room[R_WILLARD];
+	s->status ("You drive to Willard Airport.");
+	*rptr = &s->room[R_WILLARD];
 	return TC_CHANGE_ROOM;
     }
 
     /* Try to go to campus. */
     if (0 == strcasecmp ("campus", arg)) {
-        if (&room[R_CAR_SITE] == r) {
-	    show_status ("Kazar!  You're on campus!");
+        if (&s->room[R_CAR_SITE] == r) {
+	    s->status ("Kazar!  You're on campus!");
 	    return TC_DISCARD_TEXT;
 	}
-        if (&room[R_ALLERTON] != r && &room[R_WILLARD] != r) {
-	    show_status ("That's quite a hike.");
+        if (&s->room[R_ALLERTON] != r && &s->room[R_WILLARD] != r) {
+	    s->status ("That's quite a hike.");
 	    return TC_DISCARD_TEXT;
 	}
-	show_status ("You drive back to campus.");
-	*rptr = &room[R_CAR_SITE];
+	s->status ("You drive back to campus.");
+	*rptr = &s->room[R_CAR_SITE];
 	return TC_CHANGE_ROOM;
     }
 
     /* Location unrecognized.  Say so. */
-    show_status ("The game map lacks certain places.");
+    s->status ("The game map lacks certain places.");
     return TC_ALLOW_EDIT;
 }
 
@@ -1674,14 +2093,15 @@ typed_cmd_go (room_t** rptr, const char* arg)
  * typed_cmd_install
  *   DESCRIPTION: Execute the typed command "install," which allows the player
  *                to install objects.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- name of object to install
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_install (room_t** rptr, const char* arg)
+typed_cmd_install (session_t* s, room_t** rptr, const char* arg)
 {
     room_t* r;	/* current room */
 
@@ -1690,49 +2110,49 @@ typed_cmd_install (room_t** rptr, const char* arg)
 
     /* Try to install a battery. */
     if (0 == strcasecmp ("battery", arg)) {
-	if (object[O_BATT_EMPTY].loc != &room[R_INVENTORY] &&
-	    object[O_BATT_EMPTY].loc != r &&
-	    object[O_BATT_FULL].loc != &room[R_INVENTORY] &&
-	    object[O_BATT_FULL].loc != r) {
-	    show_status ("What battery?");
+	if (s->object[O_BATT_EMPTY].loc != &s->room[R_INVENTORY] &&
+	    s->object[O_BATT_EMPTY].loc != r &&
+	    s->object[O_BATT_FULL].loc != &s->room[R_INVENTORY] &&
+	    s->object[O_BATT_FULL].loc != r) {
+	    s->status ("What battery?");
 	    return TC_DISCARD_TEXT;
 	}
-	if (&room[R_CAR_SITE] != r) {
-	    show_status ("Do you see the car?");
+	if (&s->room[R_CAR_SITE] != r) {
+	    s->status ("Do you see the car?");
 	    return TC_DISCARD_TEXT;
 	}
-	if (object[O_BATT_EMPTY].loc == &room[R_INVENTORY] ||
-	    object[O_BATT_EMPTY].loc == r) {
-	    show_status ("You want to install a dead battery?");
+	if (s->object[O_BATT_EMPTY].loc == &s->room[R_INVENTORY] ||
+	    s->object[O_BATT_EMPTY].loc == r) {
+	    s->status ("You want to install a dead battery?");
 	    return TC_DISCARD_TEXT;
         }
-	remove_object (&object[O_BATT_FULL]);
-	player_set_flag (FLAG_CAR_FIXED);
-	do_photo_swap (r, SWAP_CAR);
-	show_status ("Nice work!  Now you can use it!");
+	remove_object (&s->object[O_BATT_FULL]);
+	player_set_flag (s, FLAG_CAR_FIXED);
+	do_photo_swap (s, r, SWAP_CAR);
+	s->status ("Nice work!  Now you can use it!");
 	return TC_CHANGE_ROOM;
     }
 
     /* Try to install a MIMO transmitter card. */
     if (0 == strcasecmp ("mimo", arg) || 0 == strcasecmp ("card", arg) ||
 	0 == strcasecmp ("transmitter", arg)) {
-	if (object[O_MIMO_CARD].loc != &room[R_INVENTORY] &&
-	    object[O_MIMO_CARD].loc != r) {
-	    show_status ("Do you have one of those?");
+	if (s->object[O_MIMO_CARD].loc != &s->room[R_INVENTORY] &&
+	    s->object[O_MIMO_CARD].loc != r) {
+	    s->status ("Do you have one of those?");
 	    return TC_DISCARD_TEXT;
 	}
-	if (&room[R_COCKPIT] != r) {
-	    show_status ("Nothing here needs that.");
+	if (&s->room[R_COCKPIT] != r) {
+	    s->status ("Nothing here needs that.");
 	    return TC_DISCARD_TEXT;
 	}
-	remove_object (&object[O_MIMO_CARD]);
-	room[R_COCKPIT].enter = &room[R_OVER_WILL];
-	show_status ("Ready for takeoff, captain!");
+	remove_object (&s->object[O_MIMO_CARD]);
+	s->room[R_COCKPIT].enter = &s->room[R_OVER_WILL];
+	s->status ("Ready for takeoff, captain!");
 	return TC_REDRAW_ROOM;
     }
 
     /* There's nothing else that can be installed. */
-    show_status ("What are you playing at?");
+    s->status ("What are you playing at?");
     return TC_ALLOW_EDIT;
 }
 
@@ -1747,7 +2167,8 @@ typed_cmd_install (room_t** rptr, const char* arg)
  *                Typing 'inventory' from the inventory view returns the
  *                player to the room in which they're standing.
  *
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- takes no argument, so this parameter should be an 
  *                  empty string (we don't check)
  *   OUTPUTS: *rptr -- new room for player
@@ -1755,20 +2176,20 @@ typed_cmd_install (room_t** rptr, const char* arg)
  *   SIDE EFFECTS: changes player's room
  */
 tc_action_t
-typed_cmd_inventory (room_t** rptr, const char* arg)
+typed_cmd_inventory (session_t* s, room_t** rptr, const char* arg)
 {
     room_t* r;	/* current room */
 
     /* Set current room. */
     r = *rptr;
 
-    if (&room[R_INVENTORY] == r) {
+    if (&s->room[R_INVENTORY] == r) {
 	/* Return from inventory to previous room. */
 	*rptr = r->enter;
     } else {
 	/* Record current room and enter inventory view. */
-	room[R_INVENTORY].enter = r;
-	*rptr = &room[R_INVENTORY];
+	s->room[R_INVENTORY].enter = r;
+	*rptr = &s->room[R_INVENTORY];
     }
     return TC_CHANGE_ROOM;
 }
@@ -1779,7 +2200,8 @@ typed_cmd_inventory (room_t** rptr, const char* arg)
  *   DESCRIPTION: Execute the typed command "sigh," which allows the player
  *                to show their respects for many a vanished site.  Ouch,
  *                sorry WS.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- takes no argument, so this parameter should be an 
  *                  empty string (we don't check)
  *   OUTPUTS: *rptr -- possibly new room for player
@@ -1787,17 +2209,17 @@ typed_cmd_inventory (room_t** rptr, const char* arg)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_sigh (room_t** rptr, const char* arg)
+typed_cmd_sigh (session_t* s, room_t** rptr, const char* arg)
 {
     room_t* r;	/* current room */
 
     /* Set current room. */
     r = *rptr;
-    if (&room[R_BY_ZAS] != r) {
-        show_status ("MP2 got you down?  Take a break!");
+    if (&s->room[R_BY_ZAS] != r) {
+        s->status ("MP2 got you down?  Take a break!");
     } else {
-	show_status ("So sad... you lose your appetite.");
-	player_set_flag (FLAG_HAS_EATEN);
+	s->status ("So sad... you lose your appetite.");
+	player_set_flag (s, FLAG_HAS_EATEN);
     }
     return TC_DISCARD_TEXT;
 }
@@ -1807,14 +2229,15 @@ typed_cmd_sigh (room_t** rptr, const char* arg)
  * typed_cmd_use
  *   DESCRIPTION: Execute the typed command "use," which allows the player
  *                to use objects in a room or in their inventory.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- name of object to use
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_use (room_t** rptr, const char* arg)
+typed_cmd_use (session_t* s, room_t** rptr, const char* arg)
 {
     room_t* r;	/* current room */
 
@@ -1823,58 +2246,58 @@ typed_cmd_use (room_t** rptr, const char* arg)
 
     /* Try to use a car. */
     if (0 == strcasecmp ("car", arg)) {
-    	if (&room[R_ALLERTON] == r) {
-	    show_status ("Go to campus or Willard Airport?");
+    	if (&s->room[R_ALLERTON] == r) {
+	    s->status ("Go to campus or Willard Airport?");
 	    return TC_DISCARD_TEXT;
 	}
-    	if (&room[R_WILLARD] == r) {
-	    show_status ("Go to Allerton or campus?");
+    	if (&s->room[R_WILLARD] == r) {
+	    s->status ("Go to Allerton or campus?");
 	    return TC_DISCARD_TEXT;
 	}
-	if (&room[R_CAR_SITE] != r) {
-	    show_status ("You have a car?");
+	if (&s->room[R_CAR_SITE] != r) {
+	    s->status ("You have a car?");
 	    return TC_DISCARD_TEXT;
 	}
-	if (player_flag_is_set (FLAG_CAR_FIXED)) {
-	    show_status ("Go to Allerton or Willard Airport?");
+	if (player_flag_is_set (s, FLAG_CAR_FIXED)) {
+	    s->status ("Go to Allerton or Willard Airport?");
 	    return TC_DISCARD_TEXT;
 	}
-	if (player_flag_is_set (FLAG_CAR_OPEN)) {
-	    show_status ("You'll have to charge the battery.");
+	if (player_flag_is_set (s, FLAG_CAR_OPEN)) {
+	    s->status ("You'll have to charge the battery.");
 	    return TC_DISCARD_TEXT;
 	}
-	if (object[O_CAR_KEY].loc != &room[R_INVENTORY]) {
-	    show_status ("Perhaps you can find a key?");
+	if (s->object[O_CAR_KEY].loc != &s->room[R_INVENTORY]) {
+	    s->status ("Perhaps you can find a key?");
 	    return TC_DISCARD_TEXT;
 	}
-	do_photo_swap (r, SWAP_CAR);
-	remove_object (&object[O_CAR_KEY]);
-	insert_object_at (&object[O_BATT_CAR], r, 265, 122);
-	player_set_flag (FLAG_CAR_OPEN);
-	show_status ("The key works, but the battery's dead.");
+	do_photo_swap (s, r, SWAP_CAR);
+	remove_object (&s->object[O_CAR_KEY]);
+	insert_object_at (&s->object[O_BATT_CAR], r, 265, 122);
+	player_set_flag (s, FLAG_CAR_OPEN);
+	s->status ("The key works, but the battery's dead.");
 	return TC_CHANGE_ROOM;
     }
 
     /* Try to use a fish. */
     if (0 == strcasecmp ("fish", arg)) {
-	if (object[O_FISH].loc != &room[R_INVENTORY] &&
-	    object[O_FISH].loc != r) {
-	    show_status ("Using the invisible fish...no effect!");
+	if (s->object[O_FISH].loc != &s->room[R_INVENTORY] &&
+	    s->object[O_FISH].loc != r) {
+	    s->status ("Using the invisible fish...no effect!");
 	    return TC_DISCARD_TEXT;
 	}
-	if (&room[R_REM_LAB] != r) {
-	    show_status ("I don't think that's sanitary.");
+	if (&s->room[R_REM_LAB] != r) {
+	    s->status ("I don't think that's sanitary.");
 	    return TC_DISCARD_TEXT;
 	}
-	remove_object (&object[O_FISH]);
-	move_object_to_inventory (&object[O_TUX]);
-	player_set_flag (FLAG_LURED_TUX);
-        show_status ("Tux likes you!");
+	remove_object (&s->object[O_FISH]);
+	move_object_to_inventory (s, &s->object[O_TUX]);
+	player_set_flag (s, FLAG_LURED_TUX);
+        s->status ("Tux likes you!");
 	return TC_REDRAW_ROOM;
     }
 
     /* Don't ask.  Oh, was that YOU who tried to use that?  Uh. */
-    show_status ("You want to use what!?");
+    s->status ("You want to use what!?");
     return TC_ALLOW_EDIT;
 }
 
@@ -1883,14 +2306,15 @@ typed_cmd_use (room_t** rptr, const char* arg)
  * typed_cmd_wear
  *   DESCRIPTION: Execute the typed command "wear," which allows the player
  *                to wear objects.
- *   INPUTS: *rptr -- player's current room
+ *   INPUTS: s -- game session
+ *           *rptr -- player's current room
  *           arg -- name of object to wear
  *   OUTPUTS: *rptr -- possibly new room for player
  *   RETURN VALUE: indicates types of action taken (see header file)
  *   SIDE EFFECTS: may move objects, show status messages, change player's room
  */
 tc_action_t
-typed_cmd_wear (room_t** rptr, const char* arg)
+typed_cmd_wear (session_t* s, room_t** rptr, const char* arg)
 {
     room_t* r;	/* current room */
 
@@ -1899,17 +2323,17 @@ typed_cmd_wear (room_t** rptr, const char* arg)
 
     /* Only the bunnysuit can be worn. */
     if (0 != strcasecmp ("bunnysuit", arg)) {
-        show_status ("Big Brother forbids fashion statements.");
+        s->status ("Big Brother forbids fashion statements.");
 	return TC_ALLOW_EDIT;
     }
-    if (object[O_BUNNYSUIT].loc != &room[R_INVENTORY] &&
-        object[O_BUNNYSUIT].loc != r) {
-        show_status ("Do you have a bunnysuit?");
+    if (s->object[O_BUNNYSUIT].loc != &s->room[R_INVENTORY] &&
+        s->object[O_BUNNYSUIT].loc != r) {
+        s->status ("Do you have a bunnysuit?");
 	return TC_DISCARD_TEXT;
     }
-    remove_object (&object[O_BUNNYSUIT]);
-    player_set_flag (FLAG_WEARING_SUIT);
-    show_status ("You look good in pink!");
+    remove_object (&s->object[O_BUNNYSUIT]);
+    player_set_flag (s, FLAG_WEARING_SUIT);
+    s->status ("You look good in pink!");
     return TC_REDRAW_ROOM;
 }
 
@@ -49,19 +49,46 @@ extern const char* room_name (const room_t* r);
 extern photo_t* room_photo (const room_t* r);
 extern uint32_t room_photo_height (const room_t* r);
 extern uint32_t room_photo_width (const room_t* r);
+extern room_t* room_exit (const room_t* r, int32_t which);
+extern uint32_t room_version (const room_t* r);
 
-/* Build the game world.  Returns 0 on failure, or 1 on success. */
-extern int32_t build_world (void);
+/* exits from a room (see room_exit); the 'enter' exit may be guarded */
+enum {
+    EXIT_LEFT,
+    EXIT_ENTER,
+    EXIT_RIGHT,
+    NUM_EXITS
+};
+
+/* 
+ * Load the photos and object images shared by all game sessions, using 
+ * the named shared asset store (see store.h) if store_name is not NULL,
+ * and reading assets from the named asset pack (see pack.h) if 
+ * pack_name is not NULL.  Returns NULL on failure.
+ */
+extern const world_t* load_world (const char* store_name, 
+				  const char* pack_name);
+
+/* 
+ * Build a new game session from a loaded world.  Status messages for the 
+ * session go to status_fn (or nowhere if it is NULL).  Returns NULL on 
+ * failure.
+ */
+extern session_t* build_world (const world_t* w, 
+			       void (*status_fn) (const char* s));
+
+/* Discard a game session. */
+extern void free_session (session_t* s);
 
 /* Get pointer to starting room for player. */
-extern room_t* start_in_room (void);
+extern room_t* start_in_room (session_t* s);
 
 /*
  * checks for accelerator object ownership; these make horizontal (board)
  * and vertical (jetpack) pixel panning faster
  */
-extern int32_t player_has_board ();
-extern int32_t player_has_jetpack ();
+extern int32_t player_has_board (const session_t* s);
+extern int32_t player_has_jetpack (const session_t* s);
 
 /* responses possible for command actions */
 typedef enum {
@@ -72,25 +99,37 @@ typedef enum {
 } tc_action_t;
 
 /* actions caused by button presses (room movement) */
-extern tc_action_t try_to_move_left (room_t** rptr);
-extern tc_action_t try_to_enter (room_t** rptr);
-extern tc_action_t try_to_move_right (room_t** rptr);
+extern tc_action_t try_to_move_left (session_t* s, room_t** rptr);
+extern tc_action_t try_to_enter (session_t* s, room_t** rptr);
+extern tc_action_t try_to_move_right (session_t* s, room_t** rptr);
 
 /* typed command actions */
-extern tc_action_t typed_cmd_buy (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_charge (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_do (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_drink (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_drop (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_fix (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_flash (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_get (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_go (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_install (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_inventory (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_sigh (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_use (room_t** rptr, const char* arg);
-extern tc_action_t typed_cmd_wear (room_t** rptr, const char* arg);
+extern tc_action_t typed_cmd_buy (session_t* s, room_t** rptr,
+                                  const char* arg);
+extern tc_action_t typed_cmd_charge (session_t* s, room_t** rptr,
+                                     const char* arg);
+extern tc_action_t typed_cmd_do (session_t* s, room_t** rptr, const char* arg);
+extern tc_action_t typed_cmd_drink (session_t* s, room_t** rptr,
+                                    const char* arg);
+extern tc_action_t typed_cmd_drop (session_t* s, room_t** rptr,
+                                   const char* arg);
+extern tc_action_t typed_cmd_fix (session_t* s, room_t** rptr,
+                                  const char* arg);
+extern tc_action_t typed_cmd_flash (session_t* s, room_t** rptr,
+                                    const char* arg);
+extern tc_action_t typed_cmd_get (session_t* s, room_t** rptr,
+                                  const char* arg);
+extern tc_action_t typed_cmd_go (session_t* s, room_t** rptr, const char* arg);
+extern tc_action_t typed_cmd_install (session_t* s, room_t** rptr,
+                                      const char* arg);
+extern tc_action_t typed_cmd_inventory (session_t* s, room_t** rptr,
+                                        const char* arg);
+extern tc_action_t typed_cmd_sigh (session_t* s, room_t** rptr,
+                                   const char* arg);
+extern tc_action_t typed_cmd_use (session_t* s, room_t** rptr,
+                                  const char* arg);
+extern tc_action_t typed_cmd_wear (session_t* s, room_t** rptr,
+                                   const char* arg);
 
 /* in adventure.c */
 extern void show_status (const char* s);